@@ -4,6 +4,7 @@
 #include <math.h>
 
 #include "aifffile.h"
+#include "pcmsamples.h"
 
 typedef struct
 { 
@@ -15,15 +16,17 @@ typedef struct
 } HEADER;
 
 static int loadcommon(FILE *fp, HEADER *header, int extended);
+static int findsounddata(FILE *fp, HEADER *header);
 static short *loadsounddata(FILE *fp, HEADER *header);
+static int getsampleformat(HEADER *header, int *format, int *bytes, int *bigendian);
 static int loadchunkheader(FILE *fp, char *chunkid, long *size);
 
 static int skipchunk(FILE *fp, long size);
+static int skipbytes(FILE *fp, long N);
 static int readpstring(FILE *fp, char *out);
 static long double freadieee754_80bit(FILE *fp, int bigendian);
 static int fget16be(FILE *fp);
 static long fget32be(FILE *fp);
-static int fget16le(FILE *fp);
 
 short *loadaiff(const char *fname, long *samplerate, int *Nchannels, long 
 *Nsamples)
@@ -59,86 +62,136 @@ short *floadaiff(FILE *fp, long *samplerate, int *Nchannels, long
 {
    short *answer = 0;
    HEADER header;
+   
+   if (findsounddata(fp, &header))
+      goto error_exit;
+   answer = loadsounddata(fp, &header);
+   if (!answer)
+      goto error_exit;
+
+   if (samplerate)
+     *samplerate = header.sampleRate;
+   if (Nchannels)
+     *Nchannels = header.numChannels;
+   if (Nsamples)
+     *Nsamples = (long) header.numSampleFrames;
+   return answer;
+
+error_exit:
+    if (samplerate)
+       *samplerate = 0;
+   if (Nchannels)
+     *Nchannels = 0;
+   if (Nsamples)
+     *Nsamples = 0;
+   free(answer);
+   return 0;
+
+}
+
+/*
+  Load an aiff file, passing the samples to a callback a block at a time.
+  Params: fname - the file name
+          callback - called with each block of interleaved pcm, return
+                     non-zero to abandon loading
+          ptr - context pointer passed to the callback
+  Returns: 0 on success, -1 on error.
+  Notes: only a block of the file is held in memory at once.
+ */
+int loadaiffstream(const char *fname, int (*callback)(void *ptr, const short *pcm, long samplerate, int Nchannels, long Nsamples), void *ptr)
+{
+   FILE *fp;
+   HEADER header;
+   int format;
+   int bytes;
+   int bigendian;
+   int answer = -1;
+
+   fp = fopen(fname, "rb");
+   if (!fp)
+     return -1;
+   if (findsounddata(fp, &header) == 0 &&
+       getsampleformat(&header, &format, &bytes, &bigendian) == 0)
+   {
+     answer = streampcmsamples(fp, (long) header.numSampleFrames, header.numChannels,
+        format, bytes, bigendian, header.sampleRate, callback, ptr);
+   }
+   fclose(fp);
+
+   return answer;
+}
+
+/*
+  Walk the chunks to the common chunk and then the sound data.
+  Params: fp - the file, at the start
+          header - return for the common chunk
+  Returns: 0 on success, -1 on error
+  Notes: on success fp is at the first sample.
+ */
+static int findsounddata(FILE *fp, HEADER *header)
+{
    char id[5];
    long size;
+   long offset;
    int err;
    int extended = 0;
    int hascommon = 0;
-   int hassounddata = 0;
    
    err = loadchunkheader(fp, id, &size);
    if (err)
-      goto error_exit;
+      return -1;
    if (strcmp(id, "FORM") != 0)
-     goto error_exit;
+     return -1;
 
    if (fread(id, 1, 4, fp) != 4)
-     goto error_exit;
+     return -1;
    if (strncmp(id, "AIFF", 4) == 0)
      extended = 0;
    else if(strncmp(id, "AIFC", 4) == 0)
      extended = 1;
    else
-     goto error_exit;
+     return -1;
    
    while (!hascommon)
    {
       err = loadchunkheader(fp, id, &size);
       if (err)
-         goto error_exit;
+         return -1;
 
       if (strcmp(id, "COMM") == 0)
       {
-         loadcommon(fp, &header, extended);
+         loadcommon(fp, header, extended);
          hascommon = 1;
       }
       else
       {
         err = skipchunk(fp, size);
         if (err)
-           goto error_exit;
+           return -1;
       }
    }
 
-   while (!hassounddata)
+   while (1)
    {
       err = loadchunkheader(fp, id, &size);
       if (err)
-        goto error_exit;
+        return -1;
 
       if (!strcmp(id, "SSND"))
-      {
-         answer = loadsounddata(fp, &header);
-         if (!answer)
-           goto error_exit;
-         hassounddata = 1;
-      }
-      else
-      {
-        err = skipchunk(fp, size);
-        if (err)
-           goto error_exit;
-      }
+         break;
+      err = skipchunk(fp, size);
+      if (err)
+         return -1;
    }
 
-   if (samplerate)
-     *samplerate = header.sampleRate;
-   if (Nchannels)
-     *Nchannels = header.numChannels;
-   if (Nsamples)
-     *Nsamples = (long) header.numSampleFrames;
-   return answer;
+   offset = fget32be(fp);
+   fget32be(fp);
+   if (feof(fp) || offset < 0)
+     return -1;
+   if (skipbytes(fp, offset))
+     return -1;
 
-error_exit:
-    if (samplerate)
-       *samplerate = 0;
-   if (Nchannels)
-     *Nchannels = 0;
-   if (Nsamples)
-     *Nsamples = 0;
-   free(answer);
    return 0;
-
 }
 
 static int loadcommon(FILE *fp, HEADER *header, int extended)
@@ -171,60 +224,78 @@ static int loadcommon(FILE *fp, HEADER *header, int extended)
 static short *loadsounddata(FILE *fp, HEADER *header)
 {
    short *answer = 0;
-   long offset;
-   long blocksize;
-   long i;
-   int bigendian = 1;
+   long N;
+   int format;
+   int bytes;
+   int bigendian;
+   int err;
 
-   answer = malloc(header->numSampleFrames * header->numChannels * 
-sizeof(short));
+   if (getsampleformat(header, &format, &bytes, &bigendian))
+     goto error_exit;
+   N = (long) header->numSampleFrames * header->numChannels;
+   answer = malloc((N ? N : 1) * sizeof(short));
    if (!answer)
      goto error_exit;
 
-   offset = fget32be(fp);
-   blocksize = fget32be(fp);
+   err = freadpcmsamples(fp, answer, N, format, bytes, bigendian);
+   if (err)
+     goto error_exit;
 
-   for (i =0; i <offset; i++)
-   {
-     if (fgetc(fp) == EOF)
-        goto error_exit;
-   }
+   return answer;
 
-   if (strncmp(header->compression, "NONE", 4) == 0)
+   error_exit:
+     free(answer);
+   return 0;
+}
+
+/*
+  Get the sample layout from the compression type.
+  Returns: 0 on success, -1 if the compression is not supported
+ */
+static int getsampleformat(HEADER *header, int *format, int *bytes, int *bigendian)
+{
+   *format = PCM_SIGNED;
+   *bigendian = 1;
+   *bytes = (header->sampleSize + 7) / 8;
+   if (strncmp(header->compression, "NONE", 4) == 0 ||
+       strncmp(header->compression, "twos", 4) == 0)
    {
-      bigendian = 1;
+      *bigendian = 1;
    }
    else if(strncmp(header->compression, "sowt", 4) == 0)
    {
-     bigendian = 0;
+     *bigendian = 0;
    }
-   else
+   else if (strncmp(header->compression, "in24", 4) == 0)
    {
-     goto error_exit;
+     *bytes = 3;
    }
-
-   if (header->sampleSize != 16)
-      goto error_exit;
- 
-
-   for (i = 0; i < header->numSampleFrames * header->numChannels; i++)
+   else if (strncmp(header->compression, "in32", 4) == 0)
    {
-      if (bigendian)
-      	answer[i] = fget16be(fp);
-      else
-        answer[i] = fget16le(fp);
+     *bytes = 4;
    }
-   if (feof(fp))
-     goto error_exit;
-
-   return answer;
+   else if (strncmp(header->compression, "fl32", 4) == 0 ||
+            strncmp(header->compression, "FL32", 4) == 0)
+   {
+     *format = PCM_FLOAT;
+     *bytes = 4;
+   }
+   else if (strncmp(header->compression, "fl64", 4) == 0 ||
+            strncmp(header->compression, "FL64", 4) == 0)
+   {
+     *format = PCM_FLOAT;
+     *bytes = 8;
+   }
+   else
+   {
+     return -1;
+   }
+   if (header->numChannels <= 0)
+     return -1;
 
-   error_exit:
-     free(answer);
    return 0;
 }
 
-
 static int loadchunkheader(FILE *fp, char *chunkid, long *size)
 {
   size_t Nread;
@@ -240,15 +311,23 @@ static int loadchunkheader(FILE *fp, char *chunkid, long *size)
 }
 
 static int skipchunk(FILE *fp, long size)
+{
+   if (size < 0)
+      return -1;
+   return skipbytes(fp, size + (size % 2));
+}
+
+static int skipbytes(FILE *fp, long N)
 {
    long i;
-   for (i = 0; i < size; i++)
+
+   if (N == 0 || fseek(fp, N, SEEK_CUR) == 0)
+      return 0;
+   for (i = 0; i < N; i++)
    {
      if (fgetc(fp) == EOF)
        return -1;
-   };
-   if (size % 2)
-      fgetc(fp);
+   }
    return 0;
 }
 
@@ -389,13 +468,3 @@ static long fget32be(FILE *fp)
 * 256 + c1;
 }
 
-static int fget16le(FILE *fp)
-{
-        int c1, c2;
-        
-        c1 = fgetc(fp);
-        c2 = fgetc(fp); 
-        
-        return ((c2 ^ 128) - 128) * 256 + c1;
-}
-
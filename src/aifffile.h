@@ -7,5 +7,6 @@ short *loadaiff(const char *fname, long *samplerate, int *Nchannels, long
 *Nsamples);
 short *floadaiff(FILE *fp, long *samplerate, int *Nchannels, long 
 *Nsamples);
+int loadaiffstream(const char *fname, int (*callback)(void *ptr, const short *pcm, long samplerate, int Nchannels, long Nsamples), void *ptr);
 
 #endif
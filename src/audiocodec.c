@@ -0,0 +1,424 @@
+/*
+  audiocodec.c - compressed sample formats for embedded audio.
+
+  IMA ADPCM stores each sample as a 4 bit step from a prediction, so
+  it is a quarter of the size of 16 bit pcm. The samples are in blocks
+  of 505 frames, and each channel of a block starts with its predictor
+  and step index, so playback can start at any block. mu-law and A-law
+  are the G.711 telephone companding curves, 8 bits a sample with about
+  14 bits of dynamic range, and every sample stands alone.
+
+  The encoders run here, at build time. The decoders are small enough
+  to be written into the output as C source, with no tables beyond
+  the ADPCM step sizes and no memory allocation.
+
+  by Malcolm McLean
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "audiocodec.h"
+
+static const short imasteps[89] =
+{
+  7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+  19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+  50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+  130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+  337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+  876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+  2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+  5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+  15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+static const signed char imaindex[16] =
+{
+  -1, -1, -1, -1, 2, 4, 6, 8,
+  -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+/*
+  The decoders as they are written into the output. Each is guarded,
+  so a file with several sounds gets one copy.
+ */
+static const char *imadecoder[] =
+{
+  "#ifndef BBX_IMA_ADPCM_DEFINED",
+  "#define BBX_IMA_ADPCM_DEFINED",
+  "/* IMA ADPCM, in blocks of 505 frames with 256 bytes a channel */",
+  "static const short bbx_ima_step[89] = {",
+  "  7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37,",
+  "  41, 45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173,",
+  "  190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658,",
+  "  724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,",
+  "  2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484,",
+  "  7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818,",
+  "  18500, 20350, 22385, 24623, 27086, 29794, 32767",
+  "};",
+  "",
+  "static const signed char bbx_ima_index[16] = {",
+  "  -1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8",
+  "};",
+  "",
+  "/* decode Nframes frames from frame offset, returns frames decoded */",
+  "static long bbx_ima_decode(const unsigned char *data, int Nchannels, long Nsamples,",
+  "  short *pcm, long offset, long Nframes)",
+  "{",
+  "  const unsigned char *in;",
+  "  long block, i, j, end;",
+  "  int ch, pos, predictor, index, step, nibble, diff;",
+  "",
+  "  if (offset < 0 || offset >= Nsamples || Nframes <= 0)",
+  "    return 0;",
+  "  if (Nframes > Nsamples - offset)",
+  "    Nframes = Nsamples - offset;",
+  "  end = offset + Nframes;",
+  "  for (ch = 0; ch < Nchannels; ch++)",
+  "  {",
+  "    for (i = offset; i < end; i = (block + 1) * 505)",
+  "    {",
+  "      block = i / 505;",
+  "      in = data + (block * Nchannels + ch) * 256;",
+  "      predictor = in[0] | (in[1] << 8);",
+  "      if (predictor > 32767)",
+  "        predictor -= 65536;",
+  "      index = in[2];",
+  "      for (pos = 0, j = block * 505; pos < 505 && j < end; pos++, j++)",
+  "      {",
+  "        if (pos > 0)",
+  "        {",
+  "          nibble = (in[4 + (pos - 1) / 2] >> (((pos - 1) & 1) * 4)) & 15;",
+  "          step = bbx_ima_step[index];",
+  "          diff = step >> 3;",
+  "          if (nibble & 4)",
+  "            diff += step;",
+  "          if (nibble & 2)",
+  "            diff += step >> 1;",
+  "          if (nibble & 1)",
+  "            diff += step >> 2;",
+  "          predictor += (nibble & 8) ? -diff : diff;",
+  "          if (predictor > 32767)",
+  "            predictor = 32767;",
+  "          if (predictor < -32768)",
+  "            predictor = -32768;",
+  "          index += bbx_ima_index[nibble];",
+  "          if (index < 0)",
+  "            index = 0;",
+  "          if (index > 88)",
+  "            index = 88;",
+  "        }",
+  "        if (j >= i)",
+  "          pcm[(j - offset) * Nchannels + ch] = (short) predictor;",
+  "      }",
+  "    }",
+  "  }",
+  "",
+  "  return Nframes;",
+  "}",
+  "#endif",
+  "",
+  0
+};
+
+static const char *ulawdecoder[] =
+{
+  "#ifndef BBX_ULAW_DEFINED",
+  "#define BBX_ULAW_DEFINED",
+  "/* G.711 mu-law sample to 16 bit pcm */",
+  "static short bbx_ulaw_decode(unsigned char u)",
+  "{",
+  "  int t;",
+  "",
+  "  u = ~u;",
+  "  t = (((u & 0x0F) << 3) + 0x84) << ((u & 0x70) >> 4);",
+  "",
+  "  return (short) ((u & 0x80) ? 0x84 - t : t - 0x84);",
+  "}",
+  "#endif",
+  "",
+  0
+};
+
+static const char *alawdecoder[] =
+{
+  "#ifndef BBX_ALAW_DEFINED",
+  "#define BBX_ALAW_DEFINED",
+  "/* G.711 A-law sample to 16 bit pcm */",
+  "static short bbx_alaw_decode(unsigned char a)",
+  "{",
+  "  int t;",
+  "  int seg;",
+  "",
+  "  a ^= 0x55;",
+  "  t = (a & 0x0F) << 4;",
+  "  seg = (a & 0x70) >> 4;",
+  "  if (seg == 0)",
+  "    t += 8;",
+  "  else",
+  "    t = (t + 0x108) << (seg - 1);",
+  "",
+  "  return (short) ((a & 0x80) ? t : -t);",
+  "}",
+  "#endif",
+  "",
+  0
+};
+
+/*
+  Get the encoding for an audio encoding attribute.
+  Returns: the AUDIO_ code, -1 if not recognised.
+ */
+int getaudioencoding(const char *str)
+{
+  if (!str || !strcmp(str, "pcm"))
+    return AUDIO_PCM;
+  if (!strcmp(str, "ima_adpcm") || !strcmp(str, "adpcm"))
+    return AUDIO_IMA_ADPCM;
+  if (!strcmp(str, "ulaw") || !strcmp(str, "mulaw") || !strcmp(str, "mu-law"))
+    return AUDIO_ULAW;
+  if (!strcmp(str, "alaw") || !strcmp(str, "a-law"))
+    return AUDIO_ALAW;
+
+  return -1;
+}
+
+/*
+  16 bit pcm to G.711 mu-law.
+ */
+unsigned char ulaw_encode(short x)
+{
+  int val = x >> 2;
+  int mask;
+  int seg;
+
+  if (val < 0)
+  {
+    val = -val;
+    mask = 0x7F;
+  }
+  else
+    mask = 0xFF;
+  if (val > 8159)
+    val = 8159;
+  val += 0x21;
+  for (seg = 0; seg < 8; seg++)
+    if (val < (0x40 << seg))
+      break;
+  if (seg >= 8)
+    return (unsigned char) (0x7F ^ mask);
+
+  return (unsigned char) (((seg << 4) | ((val >> (seg + 1)) & 0x0F)) ^ mask);
+}
+
+/*
+  G.711 mu-law to 16 bit pcm.
+ */
+short ulaw_decode(unsigned char u)
+{
+  int t;
+
+  u = ~u;
+  t = (((u & 0x0F) << 3) + 0x84) << ((u & 0x70) >> 4);
+
+  return (short) ((u & 0x80) ? 0x84 - t : t - 0x84);
+}
+
+/*
+  16 bit pcm to G.711 A-law.
+ */
+unsigned char alaw_encode(short x)
+{
+  int val = x >> 3;
+  int mask;
+  int seg;
+  int aval;
+
+  if (val >= 0)
+    mask = 0xD5;
+  else
+  {
+    mask = 0x55;
+    val = -val - 1;
+  }
+  for (seg = 0; seg < 8; seg++)
+    if (val < (0x20 << seg))
+      break;
+  if (seg >= 8)
+    return (unsigned char) (0x7F ^ mask);
+  aval = seg << 4;
+  if (seg < 2)
+    aval |= (val >> 1) & 0x0F;
+  else
+    aval |= (val >> seg) & 0x0F;
+
+  return (unsigned char) (aval ^ mask);
+}
+
+/*
+  G.711 A-law to 16 bit pcm.
+ */
+short alaw_decode(unsigned char a)
+{
+  int t;
+  int seg;
+
+  a ^= 0x55;
+  t = (a & 0x0F) << 4;
+  seg = (a & 0x70) >> 4;
+  if (seg == 0)
+    t += 8;
+  else
+    t = (t + 0x108) << (seg - 1);
+
+  return (short) ((a & 0x80) ? t : -t);
+}
+
+/*
+  Step an ADPCM channel on by one nibble, as the decoder does.
+ */
+static void imastep(int nibble, int *predictor, int *index)
+{
+  int step = imasteps[*index];
+  int diff = step >> 3;
+
+  if (nibble & 4)
+    diff += step;
+  if (nibble & 2)
+    diff += step >> 1;
+  if (nibble & 1)
+    diff += step >> 2;
+  *predictor += (nibble & 8) ? -diff : diff;
+  if (*predictor > 32767)
+    *predictor = 32767;
+  if (*predictor < -32768)
+    *predictor = -32768;
+  *index += imaindex[nibble];
+  if (*index < 0)
+    *index = 0;
+  if (*index > 88)
+    *index = 88;
+}
+
+/*
+  Encode one channel of a block of IMA ADPCM.
+  Params: pcm - interleaved samples
+          Nchannels - number of channels
+          ch - the channel to encode
+          Nframes - frames in pcm, 1 to IMA_BLOCKFRAMES
+          stepindex - step index for the channel, carried from block to block
+          out - return for IMA_BLOCKBYTES bytes
+  Notes: a short last block is padded by holding the last sample.
+ */
+void ima_encodechannel(const short *pcm, int Nchannels, int ch, int Nframes, int *stepindex, unsigned char *out)
+{
+  int i;
+  int predictor, sample, diff, step, nibble;
+
+  memset(out, 0, IMA_BLOCKBYTES);
+  predictor = pcm[ch];
+  out[0] = predictor & 0xFF;
+  out[1] = (predictor >> 8) & 0xFF;
+  out[2] = (unsigned char) *stepindex;
+  out[3] = 0;
+  for (i = 1; i < IMA_BLOCKFRAMES; i++)
+  {
+    sample = i < Nframes ? pcm[i * Nchannels + ch] : pcm[(Nframes - 1) * Nchannels + ch];
+    step = imasteps[*stepindex];
+    diff = sample - predictor;
+    nibble = 0;
+    if (diff < 0)
+    {
+      nibble = 8;
+      diff = -diff;
+    }
+    if (diff >= step)
+    {
+      nibble |= 4;
+      diff -= step;
+    }
+    step >>= 1;
+    if (diff >= step)
+    {
+      nibble |= 2;
+      diff -= step;
+    }
+    step >>= 1;
+    if (diff >= step)
+      nibble |= 1;
+    imastep(nibble, &predictor, stepindex);
+    out[4 + (i - 1) / 2] |= nibble << (((i - 1) & 1) * 4);
+  }
+}
+
+/*
+  Decode IMA ADPCM blocks, as the decoder in the output does.
+  Params: data - the blocks
+          Nchannels - number of channels
+          Nsamples - frames in the whole sound
+          pcm - return for interleaved samples
+          offset - first frame to decode
+          Nframes - number of frames to decode
+  Returns: number of frames decoded.
+ */
+long ima_decode(const unsigned char *data, int Nchannels, long Nsamples, short *pcm, long offset, long Nframes)
+{
+  const unsigned char *in;
+  long block, i, j, end;
+  int ch, pos, predictor, index, nibble;
+
+  if (offset < 0 || offset >= Nsamples || Nframes <= 0)
+    return 0;
+  if (Nframes > Nsamples - offset)
+    Nframes = Nsamples - offset;
+  end = offset + Nframes;
+  for (ch = 0; ch < Nchannels; ch++)
+  {
+    for (i = offset; i < end; i = (block + 1) * IMA_BLOCKFRAMES)
+    {
+      block = i / IMA_BLOCKFRAMES;
+      in = data + (block * Nchannels + ch) * IMA_BLOCKBYTES;
+      predictor = in[0] | (in[1] << 8);
+      if (predictor > 32767)
+        predictor -= 65536;
+      index = in[2];
+      for (pos = 0, j = block * IMA_BLOCKFRAMES; pos < IMA_BLOCKFRAMES && j < end; pos++, j++)
+      {
+        if (pos > 0)
+        {
+          nibble = (in[4 + (pos - 1) / 2] >> (((pos - 1) & 1) * 4)) & 15;
+          imastep(nibble, &predictor, &index);
+        }
+        if (j >= i)
+          pcm[(j - offset) * Nchannels + ch] = (short) predictor;
+      }
+    }
+  }
+
+  return Nframes;
+}
+
+/*
+  Write the decoder for an encoding into the output.
+  Params: fp - the output file
+          encoding - AUDIO_ code
+  Returns: 0 on success, -1 if the encoding has no decoder.
+ */
+int dumpaudiodecoder(FILE *fp, int encoding)
+{
+  const char **lines;
+  int i;
+
+  if (encoding == AUDIO_IMA_ADPCM)
+    lines = imadecoder;
+  else if (encoding == AUDIO_ULAW)
+    lines = ulawdecoder;
+  else if (encoding == AUDIO_ALAW)
+    lines = alawdecoder;
+  else
+    return -1;
+  for (i = 0; lines[i]; i++)
+    fprintf(fp, "%s\n", lines[i]);
+
+  return 0;
+}
@@ -0,0 +1,27 @@
+#ifndef audiocodec_h
+#define audiocodec_h
+
+#include <stdio.h>
+
+#define AUDIO_PCM 0
+#define AUDIO_IMA_ADPCM 1
+#define AUDIO_ULAW 2
+#define AUDIO_ALAW 3
+
+/* frames in an IMA ADPCM block, and bytes a channel */
+#define IMA_BLOCKFRAMES 505
+#define IMA_BLOCKBYTES 256
+
+int getaudioencoding(const char *str);
+
+unsigned char ulaw_encode(short x);
+short ulaw_decode(unsigned char u);
+unsigned char alaw_encode(short x);
+short alaw_decode(unsigned char a);
+
+void ima_encodechannel(const short *pcm, int Nchannels, int ch, int Nframes, int *stepindex, unsigned char *out);
+long ima_decode(const unsigned char *data, int Nchannels, long Nsamples, short *pcm, long offset, long Nframes);
+
+int dumpaudiodecoder(FILE *fp, int encoding);
+
+#endif
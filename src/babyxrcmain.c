@@ -10,6 +10,7 @@
 #include "loadasutf8.h"
 #include "loadcursor.h"
 #include "loadimage.h"
+#include "gif.h"
 #include "wavfile.h"
 #include "aifffile.h"
 #include "loadmp3.h"
@@ -19,7 +20,14 @@
 #include "bdf2c.h"
 #include "ttf2c.h"
 #include "bbx_utf8.h"
+#include "utftranscode.h"
+#include "threadpool.h"
 #include "samplerate/samplerate.h"
+#include "audiocodec.h"
+#include "stringpool.h"
+
+#define STRINGPOOLNAME "babyxrc_stringpool"
+#define UTF16POOLNAME "babyxrc_utf16pool"
 
 char *getextension(char *fname);
 
@@ -153,37 +161,332 @@ int putcursordefinition(FILE *fp)
 	return 0;
 }
 
-int dumpaudio(FILE *fp, int header, const short *pcm, long samplerate, int Nchannels, long Nsamples, char *name)
+/*
+  dump an animation as a first frame plus dirty-rectangle deltas.
+  Each frame entry gives the rectangle to copy from rgba + offset onto the
+  previous frame, so only the pixels that actually change are stored.
+ */
+int dumpanimation(FILE *fp, int header, const char *name, const unsigned char *rgba, unsigned long Nbytes, int width, int height, const GIFFRAME *frames, int Nframes)
 {
-    size_t count;
-    long i;
-    
-    count = Nsamples * Nchannels;
+    unsigned long j;
+    int i;
     
     if (header)
     {
-        fprintf(fp, "exern long %s_samplerate;\n", name);
-        fprintf(fp, "extern int %s_Nchannels;\n", name);
-        fprintf(fp, "extern long %s_Nsamples;\n", name);
-        fprintf(fp, "extern short %s[%ld];\n", name, (long) count);
+        fprintf(fp, "extern struct bbx_animation %s;\n", name);
         return 0;
     }
     
+    fprintf(fp, "unsigned char %s_rgba[%lu] = \n", name, Nbytes);
+    fprintf(fp, "{\n");
+    for (j = 0; j < Nbytes; j++)
+    {
+        fprintf(fp, "0x%02x, ", rgba[j]);
+        if ((j % 10) == 9)
+            fprintf(fp, "\n");
+    }
+    if (Nbytes % 10)
+        fprintf(fp, "\n");
+    fprintf(fp, "};\n\n");
+    
+    fprintf(fp, "struct bbx_animationframe %s_frames[%d] = \n", name, Nframes);
+    fprintf(fp, "{\n");
+    for (i = 0; i < Nframes; i++)
+    {
+        fprintf(fp, "  {%d, %d, %d, %d, %d, %lu},\n", frames[i].x, frames[i].y,
+                frames[i].width, frames[i].height, frames[i].delay, frames[i].offset);
+    }
+    fprintf(fp, "};\n\n");
+    
+    fprintf(fp, "struct bbx_animation %s = \n", name);
+    fprintf(fp, "{\n");
+    fprintf(fp, "  %d,\n", width);
+    fprintf(fp, "  %d,\n", height);
+    fprintf(fp, "  %d,\n", Nframes);
+    fprintf(fp, "  %s_frames,\n", name);
+    fprintf(fp, "  %s_rgba\n", name);
+    fprintf(fp, "};\n");
+    fprintf(fp, "\n\n");
+    
+    return 0;
+}
+
+int putanimationdefinition(FILE *fp)
+{
+    fprintf(fp, "/* animation structures */\n");
+    fprintf(fp, "struct bbx_animationframe {\n");
+    fprintf(fp, "  int x;              /* left of changed rectangle */\n");
+    fprintf(fp, "  int y;              /* top of changed rectangle */\n");
+    fprintf(fp, "  int width;          /* width of changed rectangle (0 if no change) */\n");
+    fprintf(fp, "  int height;         /* height of changed rectangle */\n");
+    fprintf(fp, "  int delay;          /* display time in hundredths of a second */\n");
+    fprintf(fp, "  unsigned long offset; /* offset of rectangle pixels in rgba */\n");
+    fprintf(fp, "};\n\n");
+    fprintf(fp, "struct bbx_animation {\n");
+    fprintf(fp, "  int width;          /* animation width in pixels */\n");
+    fprintf(fp, "  int height;         /* animation height in pixels */\n");
+    fprintf(fp, "  int Nframes;        /* number of frames */\n");
+    fprintf(fp, "  struct bbx_animationframe *frames; /* frame table */\n");
+    fprintf(fp, "  unsigned char *rgba; /* first frame, then changed rectangles */\n");
+    fprintf(fp, "};\n\n");
+    
+    return 0;
+}
+
+/*
+  Audio is written out as it is produced, so the sample count
+  follows the array. Compressed audio is written as bytes, with IMA
+  ADPCM held back until there is a whole block to encode.
+  With a null fp nothing is printed and the writer only counts, which
+  is how the header gets the array length.
+*/
+typedef struct
+{
+    FILE *fp;
+    const char *name;
+    long Nwritten;   /* individual samples, all channels */
+    int Nchannels;
+    int encoding;    /* AUDIO_ code */
+    long Nbytes;     /* bytes of compressed data written */
+    short *block;    /* ADPCM frames waiting for a full block */
+    int Nblock;
+    int *stepindex;  /* ADPCM step index for each channel */
+} AUDIOWRITER;
+
+static void freeaudiowriter(AUDIOWRITER *aw);
+
+int startaudio(AUDIOWRITER *aw, FILE *fp, const char *name, long samplerate, int Nchannels, int encoding)
+{
+    int i;
+    
+    aw->fp = fp;
+    aw->name = name;
+    aw->Nwritten = 0;
+    aw->Nchannels = Nchannels;
+    aw->encoding = encoding;
+    aw->Nbytes = 0;
+    aw->block = 0;
+    aw->Nblock = 0;
+    aw->stepindex = 0;
+    if (encoding == AUDIO_IMA_ADPCM)
+    {
+        aw->block = malloc(IMA_BLOCKFRAMES * Nchannels * sizeof(short));
+        aw->stepindex = malloc(Nchannels * sizeof(int));
+        if (!aw->block || !aw->stepindex)
+        {
+            free(aw->block);
+            free(aw->stepindex);
+            aw->block = 0;
+            aw->stepindex = 0;
+            return -1;
+        }
+        for (i = 0; i < Nchannels; i++)
+            aw->stepindex[i] = 0;
+    }
+    
+    if (!fp)
+        return 0;
     fprintf(fp, "long %s_samplerate = %ld;\n", name, samplerate);
     fprintf(fp, "int %s_Nchannels = %d;\n", name, Nchannels);
-    fprintf(fp, "long %s_Nsamples = %ld;\n", name, (long) Nsamples);
+    if (encoding == AUDIO_PCM)
+        fprintf(fp, "short %s[] = {\n", name);
+    else
+    {
+        if (encoding == AUDIO_IMA_ADPCM)
+            fprintf(fp, "/* IMA ADPCM, blocks of %d frames, %d bytes a channel */\n", IMA_BLOCKFRAMES, IMA_BLOCKBYTES);
+        else if (encoding == AUDIO_ULAW)
+            fprintf(fp, "/* G.711 mu-law */\n");
+        else
+            fprintf(fp, "/* G.711 A-law */\n");
+        fprintf(fp, "unsigned char %s[] = {\n", name);
+    }
+    
+    return 0;
+}
+
+static void writeaudiobytes(AUDIOWRITER *aw, const unsigned char *bytes, long N)
+{
+    long i;
     
-    fprintf(fp, "short %s[%ld] = {\n", name, (long) count);
-    for (i=0; i <count; i++)
+    if (!aw->fp)
     {
-      fprintf(fp, "%d, ", pcm[i]);
-      if( (i % 10) == 9)
-        fprintf(fp, "\n");
+        aw->Nbytes += N;
+        return;
     }
-    if (i % 10)
-      fprintf(fp, "\n");
+    for (i = 0; i < N; i++)
+    {
+        fprintf(aw->fp, "0x%02x, ", bytes[i]);
+        if ((aw->Nbytes % 10) == 9)
+            fprintf(aw->fp, "\n");
+        aw->Nbytes++;
+    }
+}
 
-    fprintf(fp, "};\n\n");
+static void writeimablock(AUDIOWRITER *aw)
+{
+    unsigned char bytes[IMA_BLOCKBYTES];
+    int ch;
+    
+    /* the encoder writes every channel of the block, so go a channel at a time */
+    for (ch = 0; ch < aw->Nchannels; ch++)
+    {
+        if (!aw->fp)
+        {
+            aw->Nbytes += IMA_BLOCKBYTES;
+            continue;
+        }
+        ima_encodechannel(aw->block, aw->Nchannels, ch, aw->Nblock, &aw->stepindex[ch], bytes);
+        writeaudiobytes(aw, bytes, IMA_BLOCKBYTES);
+    }
+    aw->Nblock = 0;
+}
+
+int writeaudio(void *ptr, const short *pcm, long Nsamples)
+{
+    AUDIOWRITER *aw = ptr;
+    unsigned char byte;
+    long count;
+    long i;
+    int ch;
+    
+    count = Nsamples * aw->Nchannels;
+    if (!aw->fp && aw->encoding != AUDIO_IMA_ADPCM)
+    {
+        aw->Nbytes += aw->encoding == AUDIO_PCM ? 0 : count;
+        aw->Nwritten += count;
+        return 0;
+    }
+    if (aw->encoding == AUDIO_IMA_ADPCM)
+    {
+        for (i = 0; i < Nsamples; i++)
+        {
+            for (ch = 0; ch < aw->Nchannels; ch++)
+                aw->block[aw->Nblock * aw->Nchannels + ch] = pcm[i * aw->Nchannels + ch];
+            if (++aw->Nblock == IMA_BLOCKFRAMES)
+                writeimablock(aw);
+        }
+        aw->Nwritten += count;
+        return 0;
+    }
+    
+    for (i = 0; i < count; i++)
+    {
+        if (aw->encoding == AUDIO_ULAW || aw->encoding == AUDIO_ALAW)
+        {
+            byte = aw->encoding == AUDIO_ULAW ? ulaw_encode(pcm[i]) : alaw_encode(pcm[i]);
+            writeaudiobytes(aw, &byte, 1);
+        }
+        else
+        {
+            fprintf(aw->fp, "%d, ", pcm[i]);
+            if ((aw->Nwritten % 10) == 9)
+                fprintf(aw->fp, "\n");
+        }
+        aw->Nwritten++;
+    }
+    
+    return 0;
+}
+
+void endaudio(AUDIOWRITER *aw)
+{
+    const char *name = aw->name;
+    
+    if (!aw->fp)
+    {
+        if (aw->Nblock > 0)
+            writeimablock(aw);
+        freeaudiowriter(aw);
+        return;
+    }
+    if (aw->encoding == AUDIO_PCM)
+    {
+        if (aw->Nwritten % 10)
+            fprintf(aw->fp, "\n");
+        fprintf(aw->fp, "};\n");
+        fprintf(aw->fp, "long %s_Nsamples = %ld;\n\n", name,
+                aw->Nchannels ? aw->Nwritten / aw->Nchannels : 0);
+        return;
+    }
+    
+    if (aw->Nblock > 0)
+        writeimablock(aw);
+    if (aw->Nbytes % 10)
+        fprintf(aw->fp, "\n");
+    fprintf(aw->fp, "};\n");
+    fprintf(aw->fp, "long %s_Nsamples = %ld;\n\n", name,
+            aw->Nchannels ? aw->Nwritten / aw->Nchannels : 0);
+    
+    dumpaudiodecoder(aw->fp, aw->encoding);
+    fprintf(aw->fp, "/* decode Nframes frames from frame offset into pcm, returns frames decoded */\n");
+    fprintf(aw->fp, "long %s_decode(short *pcm, long offset, long Nframes)\n", name);
+    fprintf(aw->fp, "{\n");
+    if (aw->encoding == AUDIO_IMA_ADPCM)
+    {
+        fprintf(aw->fp, "  return bbx_ima_decode(%s, %s_Nchannels, %s_Nsamples, pcm, offset, Nframes);\n", name, name, name);
+    }
+    else
+    {
+        fprintf(aw->fp, "  long i;\n\n");
+        fprintf(aw->fp, "  if (offset < 0 || offset >= %s_Nsamples || Nframes <= 0)\n", name);
+        fprintf(aw->fp, "    return 0;\n");
+        fprintf(aw->fp, "  if (Nframes > %s_Nsamples - offset)\n", name);
+        fprintf(aw->fp, "    Nframes = %s_Nsamples - offset;\n", name);
+        fprintf(aw->fp, "  for (i = 0; i < Nframes * %s_Nchannels; i++)\n", name);
+        fprintf(aw->fp, "    pcm[i] = bbx_%s_decode(%s[offset * %s_Nchannels + i]);\n\n",
+                aw->encoding == AUDIO_ULAW ? "ulaw" : "alaw", name, name);
+        fprintf(aw->fp, "  return Nframes;\n");
+    }
+    fprintf(aw->fp, "}\n\n");
+    
+    freeaudiowriter(aw);
+}
+
+/*
+  Abandon audio part way through. The array is closed and followed
+  by an #error, so a truncated clip can't be compiled in by mistake.
+ */
+void failaudio(AUDIOWRITER *aw)
+{
+    if (aw->fp)
+    {
+        fprintf(aw->fp, "\n};\n");
+        fprintf(aw->fp, "#error \"audio %s is incomplete, babyxrc failed to convert it\"\n\n", aw->name);
+    }
+    freeaudiowriter(aw);
+}
+
+/*
+  Release the writer's encoder memory.
+ */
+static void freeaudiowriter(AUDIOWRITER *aw)
+{
+    free(aw->block);
+    free(aw->stepindex);
+    aw->block = 0;
+    aw->stepindex = 0;
+}
+
+/*
+  Params: fp - the output
+          aw - a counting writer (null fp) that has seen all the audio
+  Notes: the array length is the count of shorts, or of bytes for
+    compressed audio, so sizeof() works on the declaration.
+ */
+int dumpaudioheader(FILE *fp, const AUDIOWRITER *aw)
+{
+    const char *name = aw->name;
+    
+    fprintf(fp, "extern long %s_samplerate;\n", name);
+    fprintf(fp, "extern int %s_Nchannels;\n", name);
+    fprintf(fp, "extern long %s_Nsamples;\n", name);
+    if (aw->encoding == AUDIO_PCM)
+        fprintf(fp, "extern short %s[%ld];\n", name, aw->Nwritten);
+    else
+    {
+        fprintf(fp, "extern unsigned char %s[%ld];\n", name, aw->Nbytes);
+        fprintf(fp, "long %s_decode(short *pcm, long offset, long Nframes);\n", name);
+    }
     
     return 0;
 }
@@ -498,6 +801,173 @@ int putfontdefinition(FILE *fp)
 	return 0;
 }
 
+int putpackedfontdefinition(FILE *fp)
+{
+	fprintf(fp, "/* box of set pixels in a character cell */\n");
+	fprintf(fp, "struct bitmap_glyph {\n");
+	fprintf(fp, "  short x;                     /* left of box (left side bearing) */\n");
+	fprintf(fp, "  short y;                     /* top of box, down from top of cell */\n");
+	fprintf(fp, "  unsigned short width;        /* box width */\n");
+	fprintf(fp, "  unsigned short height;       /* box height */\n");
+	fprintf(fp, "  unsigned long offset;        /* offset of box into bitmap */\n");
+	fprintf(fp, "};\n\n");
+	fprintf(fp, "/* bitmap font with each character stored as its box */\n");
+	fprintf(fp, "struct bitmap_font_packed {\n");
+	fprintf(fp, "  unsigned short width;        /* max. character width */\n");
+	fprintf(fp, "  unsigned short height;       /* character height */\n");
+	fprintf(fp, "  int ascent;                  /* font ascent */\n");
+	fprintf(fp, "  int descent;                 /* font descent */\n");
+	fprintf(fp, "  unsigned short Nchars;       /* number of characters in font */\n");
+	fprintf(fp, "  unsigned char *widths;       /* width of each character */\n");
+	fprintf(fp, "  unsigned long *index;        /* encoding to character index */\n");
+	fprintf(fp, "  struct bitmap_glyph *glyphs; /* box of each character */\n");
+	fprintf(fp, "  unsigned char *bitmap;       /* boxes of all characters */\n");
+	fprintf(fp, "};\n\n");
+
+	return 0;
+}
+
+int putsdffontdefinition(FILE *fp)
+{
+	fprintf(fp, "/* signed distance field font, glyphs stored as boxes */\n");
+	fprintf(fp, "struct sdf_font {\n");
+	fprintf(fp, "  unsigned short width;        /* max. character width, with margins */\n");
+	fprintf(fp, "  unsigned short height;       /* character height, with margins */\n");
+	fprintf(fp, "  int ascent;                  /* font ascent, with margin */\n");
+	fprintf(fp, "  int descent;                 /* font descent, with margin */\n");
+	fprintf(fp, "  int points;                  /* size the fields are for */\n");
+	fprintf(fp, "  int spread;                  /* pixels from the edge to 0 or 255 */\n");
+	fprintf(fp, "  unsigned short Nchars;       /* number of characters in font */\n");
+	fprintf(fp, "  unsigned char *widths;       /* width of each character */\n");
+	fprintf(fp, "  unsigned long *index;        /* encoding to character index */\n");
+	fprintf(fp, "  struct bitmap_glyph *glyphs; /* box of each character */\n");
+	fprintf(fp, "  unsigned char *bitmap;       /* distance fields, edge = 128 */\n");
+	fprintf(fp, "};\n\n");
+
+	return 0;
+}
+
+int putbitsfontdefinition(FILE *fp)
+{
+	fprintf(fp, "/* bitmap font with each character stored as its box, at 1, 2 or 4 bits a pixel */\n");
+	fprintf(fp, "struct bitmap_font_bits {\n");
+	fprintf(fp, "  unsigned short width;        /* max. character width */\n");
+	fprintf(fp, "  unsigned short height;       /* character height */\n");
+	fprintf(fp, "  int ascent;                  /* font ascent */\n");
+	fprintf(fp, "  int descent;                 /* font descent */\n");
+	fprintf(fp, "  int bpp;                     /* bits per pixel */\n");
+	fprintf(fp, "  unsigned short Nchars;       /* number of characters in font */\n");
+	fprintf(fp, "  unsigned char *widths;       /* width of each character */\n");
+	fprintf(fp, "  unsigned long *index;        /* encoding to character index */\n");
+	fprintf(fp, "  struct bitmap_glyph *glyphs; /* box of each character, offset in bits */\n");
+	fprintf(fp, "  unsigned char *bitmap;       /* boxes as one stream of bits */\n");
+	fprintf(fp, "};\n\n");
+	fprintf(fp, "/* bit position of pixel x, y in the box of glyph i */\n");
+	fprintf(fp, "#define bitmap_font_bits_bit(font, i, x, y) \\\n");
+	fprintf(fp, "  ((font)->glyphs[i].offset + \\\n");
+	fprintf(fp, "   ((unsigned long) (y) * (font)->glyphs[i].width + (x)) * (font)->bpp)\n\n");
+	fprintf(fp, "/* grey level (0-255) of pixel x, y in the box of glyph i */\n");
+	fprintf(fp, "#define bitmap_font_bits_pixel(font, i, x, y) \\\n");
+	fprintf(fp, "  ((((font)->bitmap[bitmap_font_bits_bit(font, i, x, y) / 8] >> \\\n");
+	fprintf(fp, "     (8 - (font)->bpp - bitmap_font_bits_bit(font, i, x, y) %% 8)) & \\\n");
+	fprintf(fp, "    ((1 << (font)->bpp) - 1)) * 255 / ((1 << (font)->bpp) - 1))\n\n");
+
+	return 0;
+}
+
+int putfontlookupdefinition(FILE *fp)
+{
+	fprintf(fp, "/* two level table from code point to character index */\n");
+	fprintf(fp, "struct bitmap_font_lookup {\n");
+	fprintf(fp, "  unsigned short Npages;       /* number of pages of 256 code points */\n");
+	fprintf(fp, "  unsigned short *pages;       /* block of glyphs for each page */\n");
+	fprintf(fp, "  unsigned short *glyphs;      /* blocks of 256 character indices */\n");
+	fprintf(fp, "};\n\n");
+	fprintf(fp, "/* character index of code point ch, 0xFFFF if not in the font */\n");
+	fprintf(fp, "#define bitmap_font_lookup_glyph(lookup, ch) \\\n");
+	fprintf(fp, "  ((unsigned long) (ch) >> 8 < (lookup)->Npages ? \\\n");
+	fprintf(fp, "   (lookup)->glyphs[(lookup)->pages[(unsigned long) (ch) >> 8] * 256 + ((ch) & 0xFF)] : \\\n");
+	fprintf(fp, "   0xFFFF)\n\n");
+
+	return 0;
+}
+
+int putfontkerningdefinition(FILE *fp)
+{
+	fprintf(fp, "/* advances and kerning for laying out text, in 1/64 pixels */\n");
+	fprintf(fp, "struct bitmap_font_kerning {\n");
+	fprintf(fp, "  unsigned short Nchars;       /* number of characters in font */\n");
+	fprintf(fp, "  unsigned short *advances;    /* unhinted advance of each character */\n");
+	fprintf(fp, "  int Npairs;                  /* number of kerning pairs */\n");
+	fprintf(fp, "  unsigned long *pairs;        /* first << 16 | second index, ascending */\n");
+	fprintf(fp, "  short *kerns;                /* adjustment to the advance of the first */\n");
+	fprintf(fp, "};\n\n");
+
+	return 0;
+}
+
+/*
+  get the bits per pixel for a font.
+  Returns: 1, 2, 4 or 8, -1 if bppstr isn't one of those.
+ */
+static int getfontbpp(const char *bppstr)
+{
+  char *end;
+  long bpp;
+
+  bpp = strtol(bppstr, &end, 10);
+  if (*end || (bpp != 1 && bpp != 2 && bpp != 4 && bpp != 8))
+    return -1;
+
+  return (int) bpp;
+}
+
+/*
+  how many fonts in the script are stored at less than a byte a pixel?
+ */
+static int Nbitsfonts(XMLNODE *script)
+{
+    XMLNODE *node;
+    const char *bppstr;
+    int bpp;
+    int answer = 0;
+    
+    for (node = script->child; node != NULL; node = node->next)
+    {
+        if (strcmp(xml_gettag(node), "font"))
+            continue;
+        bppstr = xml_getattribute(node, "bpp");
+        if (!bppstr)
+            continue;
+        bpp = getfontbpp(bppstr);
+        if (bpp > 0 && bpp < 8)
+            answer++;
+    }
+    
+    return answer;
+}
+
+/*
+  how many fonts in the script have a boolean attribute set?
+ */
+static int Nfontswithflag(XMLNODE *script, const char *attribute)
+{
+    XMLNODE *node;
+    const char *flagstr;
+    int answer = 0;
+    
+    for (node = script->child; node != NULL; node = node->next)
+    {
+        if (strcmp(xml_gettag(node), "font"))
+            continue;
+        flagstr = xml_getattribute(node, attribute);
+        if (flagstr && parseboolean(flagstr, 0))
+            answer++;
+    }
+    
+    return answer;
+}
+
 
 
 int processimagetag(FILE *fp, int header, const char *fname, const char *name, const char *widthstr, const char *heightstr)
@@ -546,68 +1016,417 @@ int processimagetag(FILE *fp, int header, const char *fname, const char *name, c
   return 0;
 }
 
-int processfonttag(FILE *fp, int header,  const char *fname, const char *name, const char *pointsstr)
-{
-  int points;
-  char *end;
-  char *path;
-  char *fontname;
-  char *ext;
-  int answer = 0;
+#define MAXCODEPOINT 0x10FFFF
 
-  if(!fname)
-  {
-    fprintf(stderr, "No font source file\n");
-    return -1;
-  }
-  path = mystrdup(fname);
-  if(name)
-    fontname = mystrdup(name);
-  else
-    fontname = getbasename(path);
-  
-  if(pointsstr)
-  {
-    points = (int) strtol(pointsstr, &end, 10);
-    if(*end || points <= 0)
-    {
-      fprintf(stderr, "Bad points ***%s*** Using default\n", pointsstr);
-      points = 12;
-    } 
-  }
-  else
-  {
-      points = 12;
-  }
-  ext = getextension(path);
-  makelower(ext);
-  if(!strcmp(ext, ".ttf"))
-  {
-    dumpttf(path, header, fontname, points, fp);
-  }
-  else if(!strcmp(ext, ".bdf"))
-  {
-    FILE *fpbdf;
-    fpbdf = fopen(path, "r");
-    if(!fpbdf)
+/*
+  mark the characters in a string in a set of code points.
+  If the string isn't valid UTF-8 we take it to be Latin-1.
+ */
+static void markcodepoints(unsigned char *set, const char *str)
+{
+    int ch;
+    
+    if (bbx_isutf8z(str))
     {
-      fprintf(stderr, "Can't open %s\n", path);
-      answer = -1;
+        while (*str)
+        {
+            ch = bbx_utf8_getch(str);
+            if (ch > 0 && ch <= MAXCODEPOINT)
+                set[ch >> 3] |= 1 << (ch & 7);
+            str += bbx_utf8_skip(str);
+        }
     }
-    else   
+    else
+    {
+        for (; *str; str++)
+        {
+            ch = (unsigned char) *str;
+            set[ch >> 3] |= 1 << (ch & 7);
+        }
+    }
+}
+
+/*
+  mark the characters in a text resource, either embedded or from a file
+ */
+static void marktextnode(unsigned char *set, XMLNODE *node)
+{
+    const char *path;
+    const char *str;
+    char *string;
+    int error;
+    
+    path = xml_getattribute(node, "src");
+    str = xml_getdata(node);
+    if (path)
+    {
+        string = loadasutf8(path, &error);
+        if (string)
+            markcodepoints(set, string);
+        free(string);
+    }
+    else if (str)
+        markcodepoints(set, str);
+}
+
+/*
+  mark all the characters used by text resources in a script
+ */
+static void markscriptcodepoints(unsigned char *set, XMLNODE *script)
+{
+    XMLNODE *node;
+    XMLNODE *child;
+    const char *tag;
+    
+    for (node = script->child; node != NULL; node = node->next)
+    {
+        tag = xml_gettag(node);
+        if (!strcmp(tag, "string") || !strcmp(tag, "utf8") || !strcmp(tag, "utf16"))
+            marktextnode(set, node);
+        else if (!strcmp(tag, "international"))
+        {
+            for (child = node->child; child != NULL; child = child->next)
+            {
+                tag = xml_gettag(child);
+                if (!strcmp(tag, "string") || !strcmp(tag, "utf8"))
+                    marktextnode(set, child);
+            }
+        }
+    }
+}
+
+static int parsecodepoint(const char *str, char **end)
+{
+    long answer;
+    
+    if (!strncmp(str, "U+", 2) || !strncmp(str, "u+", 2))
+        answer = strtol(str + 2, end, 16);
+    else
+        answer = strtol(str, end, 0);
+    if (*end == str || answer < 0 || answer > MAXCODEPOINT)
+        return -1;
+    
+    return (int) answer;
+}
+
+/*
+  get the characters to include in a font.
+  Params: charsstr - comma-separated list of code points and ranges,
+                      eg "0x20-0x7E, 0xA9, U+2014". "auto" includes every
+                      character used by text resources in the script.
+          script - the script the font is in
+          Nchars - return for number of code points
+  Returns: ascending list of code points, 0 on error.
+ */
+static int *getfontchars(const char *charsstr, XMLNODE *script, int *Nchars)
+{
+    unsigned char *set;
+    int *answer = 0;
+    const char *ptr = charsstr;
+    char *end;
+    int first, last;
+    int ch;
+    int N = 0;
+    
+    set = calloc(MAXCODEPOINT / 8 + 1, 1);
+    if (!set)
+        goto out_of_memory;
+    while (*ptr)
     {
-      ReadBdf(fpbdf, fp, header, fontname);
+        while (isspace((unsigned char) *ptr) || *ptr == ',')
+            ptr++;
+        if (!*ptr)
+            break;
+        if (!strncmp(ptr, "auto", 4))
+        {
+            markscriptcodepoints(set, script);
+            ptr += 4;
+            continue;
+        }
+        first = parsecodepoint(ptr, &end);
+        if (first < 0)
+            goto parse_error;
+        ptr = end;
+        while (isspace((unsigned char) *ptr))
+            ptr++;
+        last = first;
+        if (*ptr == '-')
+        {
+            ptr++;
+            while (isspace((unsigned char) *ptr))
+                ptr++;
+            last = parsecodepoint(ptr, &end);
+            if (last < first)
+                goto parse_error;
+            ptr = end;
+        }
+        for (ch = first; ch <= last; ch++)
+            set[ch >> 3] |= 1 << (ch & 7);
+    }
+    
+    for (ch = 0; ch <= MAXCODEPOINT; ch++)
+        if (set[ch >> 3] & (1 << (ch & 7)))
+            N++;
+    answer = malloc((N ? N : 1) * sizeof(int));
+    if (!answer)
+        goto out_of_memory;
+    N = 0;
+    for (ch = 0; ch <= MAXCODEPOINT; ch++)
+        if (set[ch >> 3] & (1 << (ch & 7)))
+            answer[N++] = ch;
+    free(set);
+    *Nchars = N;
+    return answer;
+    
+parse_error:
+    fprintf(stderr, "Bad chars ***%s***\n", charsstr);
+    free(set);
+    return 0;
+out_of_memory:
+    fprintf(stderr, "Out of memory\n");
+    free(set);
+    return 0;
+}
+
+/*
+  get the point sizes for a font.
+  Params: sizesstr - comma-separated list of point sizes, eg "10, 12, 14"
+          Nsizes - return for number of sizes
+  Returns: the sizes, 0 on error.
+ */
+static int *getfontsizes(const char *sizesstr, int *Nsizes)
+{
+  int *answer;
+  const char *ptr;
+  char *end;
+  long points;
+  int N = 1;
+
+  for (ptr = sizesstr; *ptr; ptr++)
+    if (*ptr == ',')
+      N++;
+  answer = malloc(N * sizeof(int));
+  if (!answer)
+  {
+    fprintf(stderr, "Out of memory\n");
+    return 0;
+  }
+  N = 0;
+  ptr = sizesstr;
+  while (1)
+  {
+    points = strtol(ptr, &end, 10);
+    if (end == ptr || points <= 0 || points > 1000)
+      goto parse_error;
+    answer[N++] = (int) points;
+    ptr = end;
+    while (isspace((unsigned char) *ptr))
+      ptr++;
+    if (*ptr == 0)
+      break;
+    if (*ptr != ',')
+      goto parse_error;
+    ptr++;
+  }
+  *Nsizes = N;
+  return answer;
+
+parse_error:
+  fprintf(stderr, "Bad sizes ***%s***\n", sizesstr);
+  free(answer);
+  return 0;
+}
+
+/*
+  Params: fp - the output
+          header - set to write declarations only
+          node - the <font> tag, giving the source and options
+          script - the whole script, for chars given by <string> names
+  Returns: 0 on success, -1 on fail
+ */
+int processfonttag(FILE *fp, int header, XMLNODE *node, XMLNODE *script)
+{
+  const char *fname = xml_getattribute(node, "src");
+  const char *name = xml_getattribute(node, "name");
+  const char *pointsstr = xml_getattribute(node, "points");
+  const char *sizesstr = xml_getattribute(node, "sizes");
+  const char *packedstr = xml_getattribute(node, "packed");
+  const char *charsstr = xml_getattribute(node, "chars");
+  const char *sdfstr = xml_getattribute(node, "sdf");
+  const char *spreadstr = xml_getattribute(node, "spread");
+  const char *bppstr = xml_getattribute(node, "bpp");
+  const char *lookupstr = xml_getattribute(node, "lookup");
+  const char *kerningstr = xml_getattribute(node, "kerning");
+  const char *coveragestr = xml_getattribute(node, "coverage");
+  int points;
+  int bpp = 8;
+  int *sizes = 0;
+  int Nsizes = 0;
+  int packed = 0;
+  int sdf = 0;
+  int spread = 4;
+  int lookup = 0;
+  int kerning = 0;
+  int coverage = 0;
+  int err;
+  FONTOPTIONS options;
+  int *chars = 0;
+  int Nchars = 0;
+  char *end;
+  char *path;
+  char *fontname;
+  char *ext;
+  int answer = 0;
+
+  if(!fname)
+  {
+    fprintf(stderr, "No font source file\n");
+    return -1;
+  }
+  path = mystrdup(fname);
+  if(name)
+    fontname = mystrdup(name);
+  else
+    fontname = getbasename(path);
+  
+  if(pointsstr)
+  {
+    points = (int) strtol(pointsstr, &end, 10);
+    if(*end || points <= 0)
+    {
+      fprintf(stderr, "Bad points ***%s*** Using default\n", pointsstr);
+      points = 12;
+    } 
+  }
+  else
+  {
+      points = 12;
+  }
+  if (sizesstr)
+  {
+    if (pointsstr)
+      fprintf(stderr, "Both points and sizes given, using sizes\n");
+    sizes = getfontsizes(sizesstr, &Nsizes);
+    if (!sizes)
+    {
+      free(path);
+      free(fontname);
+      return -1;
+    }
+  }
+  if (packedstr)
+  {
+    packed = parseboolean(packedstr, &err);
+    if (err)
+      fprintf(stderr, "Bad packed ***%s*** Using default\n", packedstr);
+  }
+  if (sdfstr)
+  {
+    sdf = parseboolean(sdfstr, &err);
+    if (err)
+      fprintf(stderr, "Bad sdf ***%s*** Using default\n", sdfstr);
+  }
+  if (spreadstr)
+  {
+    spread = (int) strtol(spreadstr, &end, 10);
+    if (*end || spread <= 0 || spread > 64)
+    {
+      fprintf(stderr, "Bad spread ***%s*** Using default\n", spreadstr);
+      spread = 4;
+    }
+  }
+  if (bppstr)
+  {
+    bpp = getfontbpp(bppstr);
+    if (bpp < 0)
+    {
+      fprintf(stderr, "Bad bpp ***%s*** Using default\n", bppstr);
+      bpp = 8;
+    }
+    if (bpp < 8 && sdf)
+      fprintf(stderr, "bpp is ignored for sdf fonts\n");
+  }
+  if (lookupstr)
+  {
+    lookup = parseboolean(lookupstr, &err);
+    if (err)
+      fprintf(stderr, "Bad lookup ***%s*** Using default\n", lookupstr);
+  }
+  if (kerningstr)
+  {
+    kerning = parseboolean(kerningstr, &err);
+    if (err)
+      fprintf(stderr, "Bad kerning ***%s*** Using default\n", kerningstr);
+  }
+  if (coveragestr)
+  {
+    coverage = parseboolean(coveragestr, &err);
+    if (err)
+      fprintf(stderr, "Bad coverage ***%s*** Using default\n", coveragestr);
+  }
+  if (charsstr && !header)
+  {
+    chars = getfontchars(charsstr, script, &Nchars);
+    if (!chars)
+    {
+      free(path);
+      free(fontname);
+      free(sizes);
+      return -1;
+    }
+  }
+  options.packed = packed;
+  options.chars = chars;
+  options.Nchars = Nchars;
+  options.spread = sdf ? spread : 0;
+  options.bpp = bpp;
+  options.lookup = lookup;
+  options.kerning = kerning;
+  options.coverage = coverage;
+  ext = getextension(path);
+  makelower(ext);
+  if(!strcmp(ext, ".ttf"))
+  {
+    if (sizes)
+      dumpttfsizes(path, header, fontname, sizes, Nsizes, &options, fp);
+    else
+      dumpttf(path, header, fontname, points, &options, fp);
+  }
+  else if(!strcmp(ext, ".bdf"))
+  {
+    FILE *fpbdf;
+    fpbdf = fopen(path, "r");
+    if(!fpbdf)
+    {
+      fprintf(stderr, "Can't open %s\n", path);
+      answer = -1;
+    }
+    else   
+    {
+      if (chars)
+        fprintf(stderr, "chars is ignored for bdf fonts, using all\n");
+      if (sizes)
+        fprintf(stderr, "sizes is ignored for bdf fonts\n");
+      if (sdf)
+        fprintf(stderr, "sdf is ignored for bdf fonts\n");
+      if (kerning)
+        fprintf(stderr, "kerning is ignored for bdf fonts\n");
+      if (coverage)
+        fprintf(stderr, "coverage is ignored for bdf fonts\n");
+      ReadBdf(fpbdf, fp, header, fontname, &options);
       fclose(fpbdf);
     }
   }
   else
   {
     fprintf(stderr, "Unsupported font file type %s\n", ext);
-    return -1;
+    answer = -1;
   }
   free(path);
   free(fontname);
   free(ext);
+  free(chars);
+  free(sizes);
 
   return answer;
 }
@@ -779,70 +1598,6 @@ int processutf8tag(FILE *fp, int header, const char *fname, const char *name, co
   return answer;
 }
 
-unsigned short *utf8toutf16(const char *utf8, int allowsurrogatepairs, int *error)
-{
-    unsigned short *answer;
-    int N = 0;
-    int Nout = 0;
-    int i, j;
-    const char *ptr;
-    int ch;
-    
-    if (error)
-        *error = 0;
-    N = bbx_utf8_Nchars(utf8);
-    ptr = utf8;
-    for (i =0; i < N; i++)
-    {
-        ch = bbx_utf8_getch(ptr);
-        if (ch > 0xFFFF)
-            Nout += 2;
-        else
-            Nout += 1;
-        ptr += bbx_utf8_skip(ptr);
-    }
-    answer = malloc( (Nout +1) * sizeof(short));
-    if (!answer)
-    {
-        if (error)
-            *error = 1;
-        return 0;
-    }
-    
-    ptr = utf8;
-    j = 0;
-    for (i = 0; i < N; i++)
-    {
-        ch = bbx_utf8_getch(ptr);
-        if (ch < 0 || ch > 0xFFFF)
-        {
-            if (allowsurrogatepairs && ch > 0)
-            {
-                unsigned short highsurrogate = 0xD800 | ((ch >> 10) & 0x03FF);
-                unsigned short lowsurrogate = 0xDC00 | (ch & 0x03FF);
-                answer[j++] = highsurrogate;
-                answer[j++] = lowsurrogate;
-            }
-            else
-            {
-                if (error)
-                    *error = -2;
-                ch = 0xFFFE;
-                answer[j++] = (unsigned short) ch;
-            }
-        }
-        else
-        {
-            answer[j++] = (unsigned short) ch;
-        }
-        
-        ptr += bbx_utf8_skip(ptr);
-    }
-    answer[j] = 0;
-    
-    return answer;
-}
-
 int processutf16tag(FILE *fp, int header, const char *fname, const char *name, const char *allowsurrogatepairs, const char *str)
 {
   char *path = 0;
@@ -936,6 +1691,223 @@ int processutf16tag(FILE *fp, int header, const char *fname, const char *name, c
   return answer;
 }
 
+/*
+  test if a text node can go in the string pool. Quoted <string> data
+  is a C string literal, and is written out as it is.
+ */
+static int ispoolable(XMLNODE *node)
+{
+    const char *str = xml_getdata(node);
+    
+    if (!strcmp(xml_gettag(node), "string") && !xml_getattribute(node, "src") && str && quotedstring(str))
+        return 0;
+    return 1;
+}
+
+/*
+  get the raw text of a text node, as UTF-8 except for <string> files,
+  which are read as they are
+ */
+static char *loadpooltext(XMLNODE *node)
+{
+    const char *path = xml_getattribute(node, "src");
+    const char *str = xml_getdata(node);
+    FILE *fp;
+    char *answer = 0;
+    int error;
+    
+    if (!strcmp(xml_gettag(node), "string") && path)
+    {
+        fp = fopen(path, "r");
+        if (fp)
+        {
+            answer = fslurp(fp);
+            fclose(fp);
+        }
+    }
+    else if (path)
+        answer = loadasutf8(path, &error);
+    else if (str)
+        answer = mystrdup(str);
+    
+    return answer;
+}
+
+static char *getstringname(XMLNODE *node)
+{
+    const char *name = xml_getattribute(node, "name");
+    const char *path = xml_getattribute(node, "src");
+    
+    if (name)
+        return mystrdup(name);
+    else if (path)
+        return getbasename((char *) path);
+    return 0;
+}
+
+/*
+  put the text of all the string resources in the pools
+  Params: pool - pool for <string>, <utf8> and <international> strings
+          utf16pool - pool for <utf16> strings
+          scripts - the BabyXRC nodes
+          Nscripts - the number of scripts
+  Returns: 0 on success, -1 on out of memory
+  Notes: strings which can't be loaded are left out, and written out 
+     in the normal way, which reports the error.
+ */
+static int fillstringpools(STRINGPOOL *pool, STRINGPOOL *utf16pool, XMLNODE **scripts, int Nscripts)
+{
+    XMLNODE *node;
+    XMLNODE *child;
+    const char *tag;
+    const char *language;
+    const char *allowsurrogatepairs;
+    char *name;
+    char *text;
+    unsigned short *utf16;
+    char stringname[256];
+    int allowsurrogatesflag;
+    int error;
+    int i;
+    int answer = 0;
+    
+    for (i = 0; i < Nscripts; i++)
+    {
+        for (node = scripts[i]->child; node != NULL; node = node->next)
+        {
+            tag = xml_gettag(node);
+            if (!strcmp(tag, "string") || !strcmp(tag, "utf8") || !strcmp(tag, "utf16"))
+            {
+                if (!ispoolable(node))
+                    continue;
+                name = getstringname(node);
+                text = loadpooltext(node);
+                if (name && text && !strcmp(tag, "utf16"))
+                {
+                    allowsurrogatesflag = 0;
+                    allowsurrogatepairs = xml_getattribute(node, "allowsurrogatepairs");
+                    if (allowsurrogatepairs)
+                        allowsurrogatesflag = parseboolean(allowsurrogatepairs, &error);
+                    utf16 = utf8toutf16(text, allowsurrogatesflag, &error);
+                    if (error == -2)
+                        fprintf(stderr, "Not all values in %s can be represented in UTF-16\n", name);
+                    if (utf16 && stringpool_add(utf16pool, name, utf16) < 0)
+                        answer = -1;
+                    free(utf16);
+                }
+                else if (name && text)
+                {
+                    if (stringpool_add(pool, name, text) < 0)
+                        answer = -1;
+                }
+                free(name);
+                free(text);
+            }
+            else if (!strcmp(tag, "international"))
+            {
+                for (child = node->child; child != NULL; child = child->next)
+                {
+                    tag = xml_gettag(child);
+                    if (strcmp(tag, "string") && strcmp(tag, "utf8"))
+                        continue;
+                    language = xml_getattribute(child, "language");
+                    if (!language || !xml_getattribute(node, "name") || !ispoolable(child))
+                        continue;
+                    snprintf(stringname, 256, "%s_%s", xml_getattribute(node, "name"), language);
+                    text = loadpooltext(child);
+                    if (text && stringpool_add(pool, stringname, text) < 0)
+                        answer = -1;
+                    free(text);
+                }
+            }
+        }
+    }
+    
+    return answer;
+}
+
+/*
+  write out a string pool as a static array
+ */
+static void putstringpool(FILE *fp, STRINGPOOL *pool, const char *type, const char *name, int width)
+{
+    long N;
+    long i;
+    int column = 0;
+    unsigned long ch;
+    
+    N = stringpool_length(pool);
+    if (N == 0)
+        return;
+    fprintf(fp, "static const %s %s[%ld] = {\n", type, name, N);
+    for (i = 0; i < N; i++)
+    {
+        ch = stringpool_get(pool, i);
+        fprintf(fp, width == 2 ? "0x%04lx, " : "0x%02lx, ", ch);
+        column++;
+        /* each string on a new line */
+        if (ch == 0 || column == 10)
+        {
+            fprintf(fp, "\n");
+            column = 0;
+        }
+    }
+    fprintf(fp, "};\n\n");
+}
+
+/*
+  write a string resource as a pointer into a string pool
+  Params: fp - the output file
+          header - set to write the header
+          node - the <string>, <utf8> or <utf16> node
+          pool - the pool with the string
+          type - "char" or "unsigned short"
+          poolname - name of the pool array
+  Returns: 0 on success, -1 if the string isn't in the pool
+  Notes: the pool is filled for the header too, so the header and the
+    source agree on which strings are pooled.
+ */
+static int processpooledstringtag(FILE *fp, int header, XMLNODE *node, STRINGPOOL *pool, const char *type, const char *poolname)
+{
+    char *stringname;
+    long offset;
+    
+    stringname = getstringname(node);
+    if (!stringname)
+        return -1;
+    offset = stringpool_offset(pool, stringname);
+    if (offset < 0)
+    {
+        free(stringname);
+        return -1;
+    }
+    if (header)
+        fprintf(fp, "extern const %s *const %s;\n", type, stringname);
+    else
+        fprintf(fp, "const %s *const %s = %s + %ld;\n", type, stringname, poolname, offset);
+    free(stringname);
+    
+    return 0;
+}
+
+/*
+  get the C expression for the string of an <international> child,
+  either its own array or a pointer into the pool
+ */
+static void getinternationalstring(char *buff, int size, STRINGPOOL *pool, const char *name, const char *language)
+{
+    char stringname[256];
+    long offset = -1;
+    
+    snprintf(stringname, 256, "%s_%s", name, language);
+    if (pool)
+        offset = stringpool_offset(pool, stringname);
+    if (offset >= 0)
+        snprintf(buff, size, "%s + %ld", STRINGPOOLNAME, offset);
+    else
+        snprintf(buff, size, "%s", stringname);
+}
+
 int processcommenttag(FILE *fp, const char *fname, const char *str)
 {
     char *comment  = 0;
@@ -1045,10 +2017,12 @@ int processcursortag(FILE *fp, int header, const char *fname, const char *name)
 	return answer;
 }
 
-int processdataframetag(FILE *fp, int header, const char *fname, const char *name)
+int processdataframetag(FILE *fp, int header, const char *fname, const char *name, const char *compactstr)
 {
     char *csvname;
     int answer = 0;
+    int compact = 0;
+    int err;
     CSV *csv;
 
     if (!fname)
@@ -1056,6 +2030,12 @@ int processdataframetag(FILE *fp, int header, const char *fname, const char *nam
         fprintf(stderr, "Error, dataframe without src attribute\n");
         return -1;
     }
+    if (compactstr)
+    {
+        compact = parseboolean(compactstr, &err);
+        if (err)
+            fprintf(stderr, "Bad compact ***%s*** Using default\n", compactstr);
+    }
 
     if (name)
         csvname = mystrdup(name);
@@ -1067,7 +2047,7 @@ int processdataframetag(FILE *fp, int header, const char *fname, const char *nam
         fprintf(stderr, "can't load csv %s\n", fname);
         return -1;
     }
-    if (dumpcsv(fp, header, csvname, csv) < 0)
+    if (dumpcsv(fp, header, csvname, csv, compact) < 0)
     {
       fprintf(stderr, "Error processing %s\n", fname);
       answer = -1;
@@ -1078,77 +2058,248 @@ int processdataframetag(FILE *fp, int header, const char *fname, const char *nam
     return answer;
 }
 
-short *resampleaudio(const short *pcm, long samplerate, int Nchannels, long Nsamples, long resamplerate, long *Nsamplesout)
+int processanimationtag(FILE *fp, int header, const char *fname, const char *name)
 {
-    float *fpcmin = 0;
-    float *fpcmout = 0;
-    short *answer = 0;
-    long Nout;
-    SRC_DATA src_data;
+    char *animationname;
+    char *ext;
+    unsigned char *rgba = 0;
+    GIFFRAME *frames = 0;
+    unsigned long Nbytes;
+    int width, height;
+    int Nframes;
+    int answer = 0;
     
-    fpcmin = malloc(Nsamples * Nchannels * sizeof(float));
-    if (!fpcmin)
-        goto error_exit;
-    Nout = (long) ((Nchannels * Nsamples * (double) resamplerate + 1204.0)/samplerate);
-    fpcmout = malloc(Nout * sizeof(float));
-    if (!fpcmout)
-        goto error_exit;
+    if (!fname)
+    {
+        fprintf(stderr, "Error, animation without src attribute\n");
+        return -1;
+    }
     
-    src_short_to_float_array(pcm, fpcmin, (int) (Nsamples * Nchannels) );
+    if (name)
+        animationname = mystrdup(name);
+    else
+        animationname = getbasename((char*)fname);
+    ext = getextension((char *)fname);
+    makelower(ext);
+    if (!strcmp(ext, ".gif"))
+        rgba = loadgifanimation((char *) fname, &width, &height, &frames, &Nframes, &Nbytes);
+    else
+        fprintf(stderr, "Unsupported animation file type %s\n", ext);
+    if (!rgba)
+    {
+        fprintf(stderr, "can't load animation %s\n", fname);
+        free(animationname);
+        free(ext);
+        return -1;
+    }
+    if (dumpanimation(fp, header, animationname, rgba, Nbytes, width, height, frames, Nframes) < 0)
+    {
+        fprintf(stderr, "Error processing %s\n", fname);
+        answer = -1;
+    }
+    free(animationname);
+    free(ext);
+    free(rgba);
+    free(frames);
     
-    src_data.data_in = fpcmin;
-    src_data.data_out = fpcmout;
-    src_data.input_frames = Nsamples;
-    src_data.output_frames = Nout / Nchannels;
-    src_data.input_frames_used = 0;
-    src_data.output_frames_gen = 0;
-    src_data.end_of_input = 0;
-    src_data.src_ratio = ((double)resamplerate)/(double)(samplerate);
+    return answer;
+}
+
+/*
+  Resampling runs through src_process a block at a time, so memory use
+  doesn't depend on the length of the clip.
+*/
+#define RESAMPLE_BLOCK 4096
+
+typedef struct
+{
+    SRC_STATE *src;
+    int Nchannels;
+    double ratio;
+    float *in;
+    float *out;
+    short *pcm;
+    long Nin;
+    int (*emit)(void *ptr, const short *pcm, long Nsamples);
+    void *ptr;
+} RESAMPLER;
+
+static void killresampler(RESAMPLER *rs);
+
+/*
+  Get the libsamplerate converter for a quality attribute.
+  Returns: the converter type, -1 if not recognised.
+  Notes: best quality is the polyphase converter, which is the same
+    filter but far faster when the rates are in a simple ratio.
+*/
+int getresamplequality(const char *str)
+{
+    if (!str || !strcmp(str, "best") || !strcmp(str, "sinc_best"))
+        return SRC_SINC_POLYPHASE;
+    if (!strcmp(str, "medium") || !strcmp(str, "sinc_medium"))
+        return SRC_SINC_MEDIUM_QUALITY;
+    if (!strcmp(str, "fastest") || !strcmp(str, "sinc_fastest"))
+        return SRC_SINC_FASTEST;
+    if (!strcmp(str, "linear"))
+        return SRC_LINEAR;
+    if (!strcmp(str, "zoh") || !strcmp(str, "zero_order_hold"))
+        return SRC_ZERO_ORDER_HOLD;
     
-    if (!src_is_valid_ratio(src_data.src_ratio))
-        goto error_exit;
+    return -1;
+}
+
+/*
+  Create a streaming resampler.
+  Params: samplerate - input rate
+          resamplerate - output rate
+          Nchannels - number of interleaved channels
+          quality - libsamplerate converter type
+          emit - called with each block of resampled audio
+          ptr - context pointer for emit
+  Returns: the resampler, 0 on failure.
+*/
+static RESAMPLER *resampler(long samplerate, long resamplerate, int Nchannels, int quality,
+                            int (*emit)(void *ptr, const short *pcm, long Nsamples), void *ptr)
+{
+    RESAMPLER *rs;
+    int err;
     
-    src_simple(&src_data, SRC_SINC_BEST_QUALITY, Nchannels);
-    answer = malloc(src_data.output_frames_gen * Nchannels * sizeof(short));
-    if (!answer)
+    rs = malloc(sizeof(RESAMPLER));
+    if (!rs)
+        return 0;
+    rs->Nchannels = Nchannels;
+    rs->ratio = ((double)resamplerate)/(double)(samplerate);
+    rs->Nin = 0;
+    rs->emit = emit;
+    rs->ptr = ptr;
+    rs->in = malloc(RESAMPLE_BLOCK * Nchannels * sizeof(float));
+    rs->out = malloc(RESAMPLE_BLOCK * Nchannels * sizeof(float));
+    rs->pcm = malloc(RESAMPLE_BLOCK * Nchannels * sizeof(short));
+    rs->src = 0;
+    if (!rs->in || !rs->out || !rs->pcm)
+        goto error_exit;
+    if (!src_is_valid_ratio(rs->ratio))
+        goto error_exit;
+    rs->src = src_new(quality, Nchannels, &err);
+    if (!rs->src)
         goto error_exit;
+    
+    return rs;
+error_exit:
+    killresampler(rs);
+    return 0;
+}
+
+static void killresampler(RESAMPLER *rs)
+{
+    if (rs)
+    {
+        if (rs->src)
+            src_delete(rs->src);
+        free(rs->in);
+        free(rs->out);
+        free(rs->pcm);
+        free(rs);
+    }
+}
 
-    src_float_to_short_array(src_data.data_out, answer, src_data.output_frames_gen * Nchannels);
+/*
+  Run the buffered input through the converter.
+  If end_of_input is set, drain the converter completely.
+*/
+static int resampleblock(RESAMPLER *rs, int end_of_input)
+{
+    SRC_DATA src_data;
+    long Nleft;
+    
+    do
+    {
+        src_data.data_in = rs->in;
+        src_data.data_out = rs->out;
+        src_data.input_frames = rs->Nin;
+        src_data.output_frames = RESAMPLE_BLOCK;
+        src_data.input_frames_used = 0;
+        src_data.output_frames_gen = 0;
+        src_data.end_of_input = end_of_input;
+        src_data.src_ratio = rs->ratio;
+        if (src_process(rs->src, &src_data))
+            return -1;
+        
+        Nleft = rs->Nin - src_data.input_frames_used;
+        if (Nleft > 0 && src_data.input_frames_used > 0)
+            memmove(rs->in, rs->in + src_data.input_frames_used * rs->Nchannels,
+                    Nleft * rs->Nchannels * sizeof(float));
+        rs->Nin = Nleft;
+        
+        if (src_data.output_frames_gen > 0)
+        {
+            src_float_to_short_array(rs->out, rs->pcm, (int) (src_data.output_frames_gen * rs->Nchannels));
+            if ((*rs->emit)(rs->ptr, rs->pcm, src_data.output_frames_gen))
+                return -1;
+        }
+    } while (end_of_input ? src_data.output_frames_gen > 0 :
+             rs->Nin > 0 && (src_data.input_frames_used > 0 || src_data.output_frames_gen > 0));
     
-    if (Nsamplesout)
-        *Nsamplesout = src_data.output_frames_gen;
-    free(fpcmin);
-    free(fpcmout);
+    return 0;
+}
+
+/*
+  Pass audio to the resampler. Output is produced through the emit callback
+  whenever a block of input has been gathered.
+*/
+static int resample(RESAMPLER *rs, const short *pcm, long Nsamples)
+{
+    long chunk;
+    long i;
+    float *in;
     
-    return answer;
+    while (Nsamples > 0)
+    {
+        chunk = RESAMPLE_BLOCK - rs->Nin;
+        if (chunk > Nsamples)
+            chunk = Nsamples;
+        in = rs->in + rs->Nin * rs->Nchannels;
+        for (i = 0; i < chunk * rs->Nchannels; i++)
+            in[i] = (float) (pcm[i] / (1.0 * 0x8000));
+        rs->Nin += chunk;
+        pcm += chunk * rs->Nchannels;
+        Nsamples -= chunk;
+        if (rs->Nin == RESAMPLE_BLOCK)
+        {
+            if (resampleblock(rs, 0) < 0)
+                return -1;
+        }
+    }
     
-error_exit:
-    free(fpcmin);
-    free(fpcmout);
-    free(answer);
     return 0;
 }
 
-short *loadaudiofile(const char *fname, long *samplerate, int *Nchannels, long *Nsamples)
+/*
+  Decode an audio file, passing it to the callback a block at a time.
+  Returns: 0 on success, -1 on fail
+ */
+static int loadaudiostream(const char *fname, int (*callback)(void *ptr, const short *pcm, long samplerate, int Nchannels, long Nsamples), void *ptr)
 {
     char *ext;
-    short *answer = 0;
+    int answer = -1;
 
     ext = getextension((char *)fname);
     if (ext)
         makelower(ext);
     
-    if (!strcmp(ext, ".wav"))
+    if (!ext)
+        answer = -1;
+    else if (!strcmp(ext, ".wav"))
     {
-        answer = loadwav(fname, samplerate, Nchannels, Nsamples);
+        answer = loadwavstream(fname, callback, ptr);
     }
     else if (!strcmp(ext, ".aif") || !strcmp(ext, ".aiff"))
     {
-        answer = loadaiff(fname, samplerate, Nchannels, Nsamples);
+        answer = loadaiffstream(fname, callback, ptr);
     }
     else if(!strcmp(ext, ".mp3"))
     {
-        answer = loadmp3(fname, samplerate, Nchannels, Nsamples);
+        answer = loadmp3stream(fname, callback, ptr) > 0 ? 0 : -1;
     }
 
     free(ext);
@@ -1156,16 +2307,78 @@ short *loadaudiofile(const char *fname, long *samplerate, int *Nchannels, long *
     return answer;
 }
 
-int processaudiotag(FILE *fp, int header, const char *fname, const char *name, const char *sampleratestr)
+/*
+  State for passing audio from the decoder through the resampler
+  (if needed) to the output.
+*/
+typedef struct
 {
-    char *audioname;
-    int answer = 0;
-    int err;
+    FILE *fp;
+    const char *name;
+    long resamplerate;
+    int quality;
+    int encoding;
     long samplerate;
     int Nchannels;
-    long Nsamples;
-    short *pcm;
+    int started;
+    RESAMPLER *rs;
+    AUDIOWRITER writer;
+} AUDIOSTREAM;
+
+static int audiostreamframe(void *ptr, const short *pcm, long samplerate, int Nchannels, long Nsamples)
+{
+    AUDIOSTREAM *as = ptr;
+    long outrate = samplerate;
+    
+    if (!as->started)
+    {
+        as->samplerate = samplerate;
+        as->Nchannels = Nchannels;
+        if (as->resamplerate > 0 && as->resamplerate != samplerate)
+        {
+            as->rs = resampler(samplerate, as->resamplerate, Nchannels, as->quality, writeaudio, &as->writer);
+            if (!as->rs)
+            {
+                fprintf(stderr, "failed to resample %s\n", as->name);
+                return -1;
+            }
+            outrate = as->resamplerate;
+        }
+        if (startaudio(&as->writer, as->fp, as->name, outrate, Nchannels, as->encoding) < 0)
+        {
+            fprintf(stderr, "out of memory encoding %s\n", as->name);
+            return -1;
+        }
+        as->started = 1;
+    }
+    else if (samplerate != as->samplerate || Nchannels != as->Nchannels)
+    {
+        fprintf(stderr, "%s changes format part way through\n", as->name);
+        return -1;
+    }
+    
+    if (as->rs)
+    {
+        if (resample(as->rs, pcm, Nsamples) < 0)
+        {
+            fprintf(stderr, "failed to resample %s\n", as->name);
+            return -1;
+        }
+        return 0;
+    }
+    
+    return writeaudio(&as->writer, pcm, Nsamples);
+}
+
+/*
+  Returns: 0 on success, -1 if nothing was written, -2 if the audio
+    failed part way through the output.
+ */
+int processaudiotag(FILE *fp, int header, const char *fname, const char *name, const char *sampleratestr, const char *qualitystr, const char *encodingstr)
+{
+    char *audioname;
     char *end;
+    AUDIOSTREAM as;
     
     if (!fname)
     {
@@ -1177,61 +2390,151 @@ int processaudiotag(FILE *fp, int header, const char *fname, const char *name, c
         audioname = mystrdup(name);
     else
         audioname = getbasename((char*)fname);
-    pcm = loadaudiofile(fname, &samplerate, &Nchannels, &Nsamples);
-    if (!pcm)
+
+    /* the header needs the array length, so count without writing */
+    as.fp = header ? 0 : fp;
+    as.name = audioname;
+    as.resamplerate = 0;
+    as.quality = getresamplequality(qualitystr);
+    as.started = 0;
+    as.rs = 0;
+    as.encoding = getaudioencoding(encodingstr);
+    if (as.quality < 0)
     {
-        fprintf(stderr, "can't load audio %s\n", fname);
-        return -1;
+        fprintf(stderr, "unknown resampling quality %s\n", qualitystr);
+        goto error_exit;
+    }
+    if (as.encoding < 0)
+    {
+        fprintf(stderr, "unknown audio encoding %s\n", encodingstr);
+        goto error_exit;
     }
     if (sampleratestr)
     {
-        long resamplerate = strtol(sampleratestr, &end, 10);
-        short *resampledpcm;
-        long Nresamples;
-        if (resamplerate <= 0)
+        as.resamplerate = strtol(sampleratestr, &end, 10);
+        if (as.resamplerate <= 0)
         {
             fprintf(stderr, "audio samplerate must be positive\n");
-            return -1;
-        }
-        if (samplerate != resamplerate)
-        {
-            resampledpcm = resampleaudio(pcm, samplerate, Nchannels, Nsamples,
-                                         resamplerate, &Nresamples);
-            if (resampledpcm)
-            {
-                free(pcm);
-                pcm = resampledpcm;
-                resampledpcm = 0;
-                Nsamples = Nresamples;
-                samplerate = resamplerate;
-            }
-            else
-            {
-                fprintf(stderr, "failed to resample %s\n", audioname);
-                return -1;
-            }
+            goto error_exit;
         }
     }
-    if (dumpaudio(fp, header, pcm, samplerate, Nchannels, Nsamples, audioname) < 0)
+    
+    if (loadaudiostream(fname, audiostreamframe, &as) < 0)
+    {
+        fprintf(stderr, "can't load audio %s\n", fname);
+        goto error_exit;
+    }
+    if (as.rs)
     {
-        fprintf(stderr, "Error processing %s\n", fname);
-        answer = -1;
+        if (resampleblock(as.rs, 1) < 0)
+        {
+            fprintf(stderr, "failed to resample %s\n", audioname);
+            goto error_exit;
+        }
     }
+    endaudio(&as.writer);
+    if (header)
+        dumpaudioheader(fp, &as.writer);
+    
+    killresampler(as.rs);
+    free(audioname);
+
+    return 0;
+    
+error_exit:
+    if (as.started)
+        failaudio(&as.writer);
+    killresampler(as.rs);
     free(audioname);
-    free(pcm);
+    return as.started && !header ? -2 : -1;
+}
+
+static int compareinternationallanguages(const void *a, const void *b)
+{
+    return strcmp(*(const char **) a, *(const char **) b);
+}
 
+/*
+  get the languages of an international node's strings, sorted
+  Params: node - the <international> node
+          N - return for number of languages
+  Returns: the languages, pointers into the node (free the array only)
+ */
+static const char **getinternationallanguages(XMLNODE *node, int *N)
+{
+    XMLNODE *child;
+    const char *tag;
+    const char *language;
+    const char **answer;
+    int Nlanguages = 0;
+    
+    answer = malloc((xml_Nchildren(node) + 1) * sizeof(const char *));
+    if (!answer)
+        return 0;
+    for (child = node->child; child != NULL; child = child->next)
+    {
+        tag = xml_gettag(child);
+        if (strcmp(tag, "string") && strcmp(tag, "utf8"))
+            continue;
+        language = xml_getattribute(child, "language");
+        if (language)
+            answer[Nlanguages++] = language;
+    }
+    qsort(answer, Nlanguages, sizeof(const char *), compareinternationallanguages);
+    *N = Nlanguages;
+    
     return answer;
 }
 
-int processinternationalnode(FILE *fp, XMLNODE *node, int header)
+/*
+  write a table of languages, sorted so the generated code can
+  find a language by binary search.
+ */
+static void putlanguagetable(FILE *fp, const char *type, const char *table, const char **languages, char **values, int N)
+{
+    int i;
+    
+    fprintf(fp, "static const struct {const char *language; %s;} %s[%d] =\n", type, table, N);
+    fprintf(fp, "{\n");
+    for (i = 0; i < N; i++)
+        fprintf(fp, "    {\"%s\", %s},\n", languages[i], values[i]);
+    fprintf(fp, "};\n");
+    fprintf(fp, "\n");
+}
+
+static void putlanguagesearch(FILE *fp, const char *table, const char *field, int N)
+{
+    fprintf(fp, "    int low = 0;\n");
+    fprintf(fp, "    int high = %d;\n", N - 1);
+    fprintf(fp, "    int mid;\n");
+    fprintf(fp, "    int cmp;\n");
+    fprintf(fp, "\n");
+    fprintf(fp, "    while (low <= high)\n");
+    fprintf(fp, "    {\n");
+    fprintf(fp, "        mid = (low + high) / 2;\n");
+    fprintf(fp, "        cmp = strcmp(language, %s[mid].language);\n", table);
+    fprintf(fp, "        if (cmp == 0)\n");
+    fprintf(fp, "            return %s[mid].%s;\n", table, field);
+    fprintf(fp, "        if (cmp < 0)\n");
+    fprintf(fp, "            high = mid - 1;\n");
+    fprintf(fp, "        else\n");
+    fprintf(fp, "            low = mid + 1;\n");
+    fprintf(fp, "    }\n");
+}
+
+int processinternationalnode(FILE *fp, XMLNODE *node, int header, STRINGPOOL *pool)
 {
     XMLNODE *child;
+    const char *tag;
     const char *name;
     const char *language;
     const char *str;
     const char *path;
+    const char **languages;
+    char **values = 0;
+    const char *returntype;
     char *string;
-    int Nchildren;
+    int Nlanguages;
     FILE *fpstr;
     char *buff;
     int i, ii;
@@ -1240,16 +2543,19 @@ int processinternationalnode(FILE *fp, XMLNODE *node, int header)
     char stringname[256];
     
     name = xml_getattribute(node, "name");
-    Nchildren = xml_Nchildrenwithtag(node, "string");
+    /* pooled strings are shared, so they are const */
+    returntype = pool ? "const char *" : "char *";
    
     if (header)
     {
-        fprintf(fp, "char *get_%s(const char *language);\n", name);
+        fprintf(fp, "%sget_%s(const char *language);\n", returntype, name);
         return 0;
     }
-    for(i=0;i<Nchildren;i++)
+    for (child = node->child; child != NULL; child = child->next)
     {
-        child = xml_getchild(node, "string", i);
+        tag = xml_gettag(child);
+        if (strcmp(tag, "string") && strcmp(tag, "utf8"))
+            continue;
         path = xml_getattribute(child, "src");
         language = xml_getattribute(child, "language");
         if (!language)
@@ -1260,100 +2566,329 @@ int processinternationalnode(FILE *fp, XMLNODE *node, int header)
         str = xml_getdata(child);
         string = 0;
         snprintf(stringname, 256, "%s_%s", name, language);
-        if(path)
-        {
-          fpstr = fopen(path, "r");
-          if(!fpstr)
-          {
-            fprintf(stderr, "Can't open %s\n", path);
-            answer = -1;
-          }
-          else
-          {
-             buff = fslurp(fpstr);
-             if(buff)
-               string = texttostring(buff);
-             free(buff);
-             fclose(fpstr);
-          }
-        }
-        else if(str)
-        {
-          string = addquotes(str);
-        }
-        if(!string)
+        if (pool && stringpool_offset(pool, stringname) >= 0)
+            continue;
+        if (!strcmp(tag, "string"))
         {
-          fprintf(stderr, "Out of memory with string\n");
-          answer = -1;
+            if(path)
+            {
+              fpstr = fopen(path, "r");
+              if(!fpstr)
+              {
+                fprintf(stderr, "Can't open %s\n", path);
+                answer = -1;
+              }
+              else
+              {
+                 buff = fslurp(fpstr);
+                 if(buff)
+                   string = texttostring(buff);
+                 free(buff);
+                 fclose(fpstr);
+              }
+            }
+            else if(str)
+            {
+              string = addquotes(str);
+            }
+            if(!string)
+            {
+              fprintf(stderr, "Out of memory with string\n");
+              answer = -1;
+            }
+            else
+            {
+              /* an array, not a pointer, so the language table can hold its address */
+              fprintf(fp, "char %s[] = ", stringname);
+              fputs(string, fp);
+              fprintf(fp, ";\n");
+            }
         }
         else
         {
-          fprintf(fp, "char *%s = ", stringname);
-          fputs(string, fp);
-          fprintf(fp, ";\n");
+            if(path)
+            {
+                string = loadasutf8(path, &error);
+            }
+            else if(str)
+            {
+              string = mystrdup(str);
+            }
+            if (string)
+            {
+                fprintf(fp, "char %s[] = {\n", stringname);
+                for (ii = 0; string[ii]; ii++)
+                {
+                    fprintf(fp, "0x%02x, ", (unsigned char) string[ii]);
+                    if ((ii % 10) == 9)
+                        fprintf(fp, "\n");
+                }
+                if ((ii % 10) == 9)
+                    fprintf(fp, "\n");
+                fprintf(fp, "0x00\n");
+                fprintf(fp, "};\n");
+            }
         }
         free(string);
     }
-    Nchildren = xml_Nchildrenwithtag(node, "utf8");
-    for(i=0;i<Nchildren;i++)
+    
+    languages = getinternationallanguages(node, &Nlanguages);
+    if (!languages)
     {
-        child = xml_getchild(node, "utf8", i);
-        path = xml_getattribute(child, "src");
-        language = xml_getattribute(child, "language");
-        if (!language)
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+    for (i = 1; i < Nlanguages; i++)
+    {
+        if (!strcmp(languages[i-1], languages[i]))
         {
-            fprintf(stderr, "Children of international nodes must have\"language\" attribute set.\n");
-            return -1;
+            fprintf(stderr, "%s has two %s strings\n", name, languages[i]);
+            answer = -1;
         }
-        str = xml_getdata(child);
-        snprintf(stringname, 256, "%s_%s", name, language);
-        if(path)
+    }
+    
+    values = malloc((Nlanguages + 1) * sizeof(char *));
+    if (!values)
+    {
+        fprintf(stderr, "Out of memory\n");
+        free(languages);
+        return -1;
+    }
+    for (i = 0; i < Nlanguages; i++)
+    {
+        values[i] = malloc(256);
+        if (values[i])
+            getinternationalstring(values[i], 256, pool, name, languages[i]);
+        else
+            answer = -1;
+    }
+    /* the search reads the table, so if there is no table there is no search */
+    snprintf(stringname, 256, "%s_languagetable", name);
+    if (Nlanguages > 0 && answer == 0)
+        putlanguagetable(fp, pool ? "const char *string" : "char *string", stringname, languages, values, Nlanguages);
+    fprintf(fp, "%sget_%s(const char *language)\n", returntype, name);
+    fprintf(fp, "{\n");
+    if (Nlanguages > 0 && answer == 0)
+        putlanguagesearch(fp, stringname, "string", Nlanguages);
+    fprintf(fp, "    return 0;\n");
+    fprintf(fp, "}\n");
+    
+    for (i = 0; i < Nlanguages; i++)
+        free(values[i]);
+    free(values);
+    free(languages);
+    
+    return answer;
+}
+
+/*
+  write the strings of the <international> nodes of a group as one 
+  struct per language, so a program can switch language with a 
+  single lookup.
+  Params: fp - the output file
+          scripts - the BabyXRC nodes
+          Nscripts - number of scripts
+          group - the group name
+          header - set to write the header
+  Returns: 0 on success, -1 on fail
+  Notes: a string missing in a language is a null pointer.
+ */
+int processinternationalgroup(FILE *fp, XMLNODE **scripts, int Nscripts, const char *group, int header, STRINGPOOL *pool)
+{
+    XMLNODE *node;
+    const char *str;
+    XMLNODE **members = 0;
+    const char ***memberlanguages = 0;
+    int *Nmemberlanguages = 0;
+    const char **languages = 0;
+    char **values = 0;
+    char *structname = 0;
+    char table[256];
+    char type[256];
+    char value[256];
+    int Nmembers = 0;
+    int Nlanguages = 0;
+    int i, ii, j;
+    int answer = 0;
+    
+    for (i = 0; i < Nscripts; i++)
+    {
+        for (node = scripts[i]->child; node != NULL; node = node->next)
         {
-            string = loadasutf8(path, &error);
+            str = xml_getattribute(node, "group");
+            if (!strcmp(xml_gettag(node), "international") && str && !strcmp(str, group))
+                Nmembers++;
         }
-        else if(str)
+    }
+    members = malloc(Nmembers * sizeof(XMLNODE *));
+    memberlanguages = malloc(Nmembers * sizeof(const char **));
+    Nmemberlanguages = malloc(Nmembers * sizeof(int));
+    structname = malloc(strlen(group) + 32);
+    if (!members || !memberlanguages || !Nmemberlanguages || !structname)
+        goto out_of_memory;
+    
+    /* the union of the languages of the group's strings */
+    Nmembers = 0;
+    for (i = 0; i < Nscripts; i++)
+    {
+        for (node = scripts[i]->child; node != NULL; node = node->next)
         {
-          string = mystrdup(str);
+            str = xml_getattribute(node, "group");
+            if (strcmp(xml_gettag(node), "international") || !str || strcmp(str, group))
+                continue;
+            members[Nmembers] = node;
+            memberlanguages[Nmembers] = getinternationallanguages(node, &Nmemberlanguages[Nmembers]);
+            if (!memberlanguages[Nmembers])
+                goto out_of_memory;
+            Nlanguages += Nmemberlanguages[Nmembers];
+            Nmembers++;
         }
-        if (string)
+    }
+    languages = malloc((Nlanguages + 1) * sizeof(const char *));
+    if (!languages)
+        goto out_of_memory;
+    Nlanguages = 0;
+    for (i = 0; i < Nmembers; i++)
+        for (ii = 0; ii < Nmemberlanguages[i]; ii++)
+            languages[Nlanguages++] = memberlanguages[i][ii];
+    qsort(languages, Nlanguages, sizeof(const char *), compareinternationallanguages);
+    j = 0;
+    for (i = 0; i < Nlanguages; i++)
+    {
+        if (j == 0 || strcmp(languages[j-1], languages[i]))
+            languages[j++] = languages[i];
+    }
+    Nlanguages = j;
+    
+    for (i = 0; group[i]; i++)
+        structname[i] = toupper((unsigned char) group[i]);
+    strcpy(structname + i, "_STRINGS");
+    
+    /* in both the header and the source, so guarded */
+    fprintf(fp, "#ifndef BBX_%sDEFINED\n", structname);
+    fprintf(fp, "#define BBX_%sDEFINED\n", structname);
+    fprintf(fp, "typedef struct\n");
+    fprintf(fp, "{\n");
+    for (i = 0; i < Nmembers; i++)
+        fprintf(fp, "    %schar *%s;\n", pool ? "const " : "", xml_getattribute(members[i], "name"));
+    fprintf(fp, "} %s;\n", structname);
+    fprintf(fp, "#endif\n");
+    fprintf(fp, "\n");
+    
+    if (header)
+    {
+        fprintf(fp, "const %s *get_%s_strings(const char *language);\n", structname, group);
+        goto done;
+    }
+    
+    for (i = 0; i < Nlanguages; i++)
+    {
+        fprintf(fp, "static const %s %s_strings_%s =\n", structname, group, languages[i]);
+        fprintf(fp, "{\n");
+        for (ii = 0; ii < Nmembers; ii++)
         {
-            fprintf(fp, "char %s[] = {\n", stringname);
-            for (ii = 0; string[ii]; ii++)
+            if (bsearch(&languages[i], memberlanguages[ii], Nmemberlanguages[ii], sizeof(const char *), compareinternationallanguages))
             {
-                fprintf(fp, "0x%02x, ", (unsigned char) string[ii]);
-                if ((ii % 10) == 9)
-                    fprintf(fp, "\n");
+                getinternationalstring(value, 256, pool, xml_getattribute(members[ii], "name"), languages[i]);
+                fprintf(fp, "    %s,\n", value);
             }
-            if ((ii % 10) == 9)
-                fprintf(fp, "\n");
-            fprintf(fp, "0x00\n");
-            fprintf(fp, "};\n");
+            else
+                fprintf(fp, "    0,\n");
         }
-        free(string);
+        fprintf(fp, "};\n");
     }
+    fprintf(fp, "\n");
     
-    fprintf(fp, "char *get_%s(const char *language)\n", name);
+    values = malloc((Nlanguages + 1) * sizeof(char *));
+    if (!values)
+        goto out_of_memory;
+    for (i = 0; i < Nlanguages; i++)
+        values[i] = 0;
+    for (i = 0; i < Nlanguages; i++)
+    {
+        values[i] = malloc(strlen(group) + strlen(languages[i]) + 32);
+        if (!values[i])
+            goto out_of_memory;
+        sprintf(values[i], "&%s_strings_%s", group, languages[i]);
+    }
+    snprintf(table, 256, "%s_languagetable", group);
+    snprintf(type, 256, "const %s *strings", structname);
+    if (Nlanguages > 0)
+        putlanguagetable(fp, type, table, languages, values, Nlanguages);
+    fprintf(fp, "const %s *get_%s_strings(const char *language)\n", structname, group);
     fprintf(fp, "{\n");
-    Nchildren = xml_Nchildrenwithtag(node, "string");
-    for(i=0;i<Nchildren;i++)
+    if (Nlanguages > 0)
+        putlanguagesearch(fp, table, "strings", Nlanguages);
+    fprintf(fp, "    return 0;\n");
+    fprintf(fp, "}\n");
+    fprintf(fp, "\n");
+    
+done:
+    if (values)
     {
-        child = xml_getchild(node, "string", i);
-        language = xml_getattribute(child, "language");
-        fprintf(fp, "    if (!strcmp(\"%s\", language))\n", language);
-        fprintf(fp, "        return %s_%s;\n", name, language);
+        for (i = 0; i < Nlanguages; i++)
+            free(values[i]);
+        free(values);
     }
-    Nchildren = xml_Nchildrenwithtag(node, "utf8");
-    for(i=0;i<Nchildren;i++)
+    for (i = 0; i < Nmembers; i++)
+        free(memberlanguages[i]);
+    free(members);
+    free(memberlanguages);
+    free(Nmemberlanguages);
+    free(languages);
+    free(structname);
+    return answer;
+    
+out_of_memory:
+    fprintf(stderr, "Out of memory\n");
+    answer = -1;
+    goto done;
+}
+
+/*
+  write a struct for each group of <international> nodes 
+ */
+int processinternationalgroups(FILE *fp, XMLNODE **scripts, int Nscripts, int header, STRINGPOOL *pool)
+{
+    XMLNODE *node;
+    const char *group;
+    const char **groups = 0;
+    const char **temp;
+    int Ngroups = 0;
+    int i, ii;
+    int answer = 0;
+    
+    for (i = 0; i < Nscripts; i++)
     {
-        child = xml_getchild(node, "utf8", i);
-        language = xml_getattribute(child, "language");
-        fprintf(fp, "    if (!strcmp(\"%s\", language))\n", language);
-        fprintf(fp, "        return %s_%s;\n", name, language);
+        for (node = scripts[i]->child; node != NULL; node = node->next)
+        {
+            if (strcmp(xml_gettag(node), "international"))
+                continue;
+            group = xml_getattribute(node, "group");
+            if (!group)
+                continue;
+            for (ii = 0; ii < Ngroups; ii++)
+                if (!strcmp(groups[ii], group))
+                    break;
+            if (ii < Ngroups)
+                continue;
+            temp = realloc(groups, (Ngroups + 1) * sizeof(const char *));
+            if (!temp)
+            {
+                fprintf(stderr, "Out of memory\n");
+                free(groups);
+                return -1;
+            }
+            groups = temp;
+            groups[Ngroups++] = group;
+        }
     }
-    fprintf(fp, "    return 0;\n");
-    fprintf(fp, "}\n");
+    for (i = 0; i < Ngroups; i++)
+        if (processinternationalgroup(fp, scripts, Nscripts, groups[i], header, pool) < 0)
+            answer = -1;
+    free(groups);
     
-    return 0;
+    return answer;
 }
 
 void usage(void)
@@ -1361,9 +2896,13 @@ void usage(void)
   printf("The Baby X resource compiler v1.1\n");
   printf("by Malcolm Mclean\n");
   printf("\n");
-  printf("Usage: babyxrc [-header] <script.xml>\n");
+  printf("Usage: babyxrc [-header] [-threads N] [-stringpool] <script.xml>\n");
   printf("\n");
   printf("-header write a .h header file instead of a .c source file.\n");
+  printf("-threads N use N worker threads to decode large resources.\n");
+  printf("-stringpool store the text of all the string resources in one array,\n");
+  printf("  sharing repeated strings, with a const pointer for each resource.\n");
+  printf("  Pass it for both the .c and the .h.\n");
   printf("Example script file:\n");
   printf("<BabyXRC>\n");
   printf("<image src = \"smiley.png\", name = \"fred\", width = \"10\", height = \"10\"> </image>\n");
@@ -1381,14 +2920,42 @@ void usage(void)
     printf("using averaging for shrinking and bilinear interpolation for expanding.\n");
   printf("width and height defaults to image size.\n");
   printf("Output is always as a C-parseable 32 bit rgba array.\n");
+  printf("<animation>\n");
+  printf("Animated gif. Output is the first frame followed by the changed\n");
+  printf("rectangle of each later frame, plus a frame table with delays.\n");
   printf("<font>\n");
   printf("Handles ttf or bdf font. Truetype must always have points set.\n");
   printf("Output glyphs in 8-bit grayscale.\n");
+  printf("packed = \"true\" stores each glyph as just its box of set pixels.\n");
+  printf("chars = \"0x20-0x7E, 0xA9\" or \"auto\" (characters used by the script's\n");
+  printf("text) restricts a ttf font to just those characters.\n");
+  printf("sizes = \"10, 12, 14\" rips a ttf font at several sizes at once,\n");
+  printf("as name10, name12 and name14 sharing one index.\n");
+  printf("sdf = \"true\" writes a struct sdf_font of signed distance fields, which\n");
+  printf("scale to any size. spread = \"4\" sets the field's reach in pixels.\n");
+  printf("bpp = \"1\", \"2\" or \"4\" writes a struct bitmap_font_bits with the glyph\n");
+  printf("boxes packed into bytes, read with bitmap_font_bits_pixel().\n");
+  printf("lookup = \"true\" adds a struct bitmap_font_lookup, a page table from\n");
+  printf("code point to character index, read with bitmap_font_lookup_glyph().\n");
+  printf("kerning = \"true\" adds a struct bitmap_font_kerning of fractional advances\n");
+  printf("and the kerning pairs of a ttf font.\n");
+  printf("coverage = \"true\" anti-aliases a ttf font by the exact area of each pixel\n");
+  printf("covered, at 256 grey levels, instead of 5 levels from 2x2 oversampling.\n");
   printf("<string>\n");
   printf("Ascii strings, external or embedded. Quoted strings assumed to be C \n");
   printf("string literals.\n");
   printf("<audio>\n");
   printf("Audio in .wav, .aiff or .mp3 format. Resamples to the rate passed.\n");
+  printf("quality = zoh, linear, fastest, medium or best (default) resampling.\n");
+  printf("encoding = pcm (default), ima_adpcm (4:1), ulaw or alaw (2:1). Compressed\n");
+  printf("audio is written as bytes with a NAME_decode() function to get pcm back.\n");
+  printf("<dataframe>\n");
+  printf("CSV data as an array of structs. compact = \"true\" stores numerical\n");
+  printf("columns as int or float when every value fits exactly.\n");
+  printf("<international>\n");
+  printf("Child <string> and <utf8> tags with a language attribute. Gives\n");
+  printf("get_NAME(language). group = \"ui\" also gathers the strings of\n");
+  printf("several tags into a UI_STRINGS struct per language.\n");
   printf("<binary>\n");
   printf("Dump raw binary data.\n");   
   exit(EXIT_FAILURE);
@@ -1406,6 +2973,9 @@ int main(int argc, char **argv)
   XMLNODE *node;
   int Nscripts;
   int header = 0;
+  int badoutput = 0;
+  int poolerr, utf16poolerr;
+  int Nthreads = 1;
   int i;
   const char *path;
   const char *name;
@@ -1413,13 +2983,20 @@ int main(int argc, char **argv)
   const char *xconst;
   const char *widthstr;
   const char *heightstr;
-  const char *pointsstr;
+  const char *compactstr;
   const char *sampleratestr;
+  const char *qualitystr;
+  const char *encodingstr;
   const char *allowsurrogatepairsstr;
+  int stringpoolflag;
+  STRINGPOOL *pool = 0;
+  STRINGPOOL *utf16pool = 0;
     
   
   opt = options(argc, argv, 0);
   header = opt_get(opt, "-header", 0);
+  stringpoolflag = opt_get(opt, "-stringpool", 0);
+  opt_get(opt, "-threads", "%d", &Nthreads);
   if(opt_Nargs(opt) != 1)
     usage();
   scriptfile = opt_arg(opt, 0);
@@ -1427,6 +3004,7 @@ int main(int argc, char **argv)
         exit(EXIT_FAILURE);
   killoptions(opt);
   opt = 0;
+  threadpool_setNthreads(Nthreads);
 
   doc = loadxmldoc(scriptfile, error, 1024);
   if(!doc)
@@ -1451,6 +3029,28 @@ int main(int argc, char **argv)
       fprintf(stdout, "\n");
       free(basename);
   }
+  if (stringpoolflag)
+  {
+      pool = stringpool(1);
+      utf16pool = stringpool(2);
+      if (!pool || !utf16pool)
+      {
+          fprintf(stderr, "Out of memory\n");
+          exit(EXIT_FAILURE);
+      }
+      /* the header is built from the same pools, so it declares the same strings */
+      if (fillstringpools(pool, utf16pool, scripts, Nscripts) < 0)
+          fprintf(stderr, "Out of memory building the string pool\n");
+      poolerr = stringpool_build(pool);
+      utf16poolerr = stringpool_build(utf16pool);
+      if (poolerr == -2 || utf16poolerr == -2)
+          fprintf(stderr, "Two strings have the same name, not pooling them\n");
+      if (!header)
+      {
+          putstringpool(stdout, pool, "char", STRINGPOOLNAME, 1);
+          putstringpool(stdout, utf16pool, "unsigned short", UTF16POOLNAME, 2);
+      }
+  }
   for(i=0;i<Nscripts;i++)
   {
     if (i == 0 && xml_Nchildrenwithtag(scripts[i], "international") > 0)
@@ -1461,6 +3061,42 @@ int main(int argc, char **argv)
         fprintf(stdout, "#define BBX_BITMAPFONTDEFINED\n");
         putfontdefinition(stdout);
         fprintf(stdout, "#endif\n");
+    }
+    /* distance field and bits fonts use the glyph boxes of the packed layout */
+    if (i == 0 && Nfontswithflag(scripts[i], "packed") + Nfontswithflag(scripts[i], "sdf") + Nbitsfonts(scripts[i]) > 0)
+    {
+        fprintf(stdout, "#ifndef BBX_PACKEDFONTDEFINED\n");
+        fprintf(stdout, "#define BBX_PACKEDFONTDEFINED\n");
+        putpackedfontdefinition(stdout);
+        fprintf(stdout, "#endif\n");
+    }
+    if (i == 0 && Nbitsfonts(scripts[i]) > 0)
+    {
+        fprintf(stdout, "#ifndef BBX_BITSFONTDEFINED\n");
+        fprintf(stdout, "#define BBX_BITSFONTDEFINED\n");
+        putbitsfontdefinition(stdout);
+        fprintf(stdout, "#endif\n");
+    }
+    if (i == 0 && Nfontswithflag(scripts[i], "lookup") > 0)
+    {
+        fprintf(stdout, "#ifndef BBX_FONTLOOKUPDEFINED\n");
+        fprintf(stdout, "#define BBX_FONTLOOKUPDEFINED\n");
+        putfontlookupdefinition(stdout);
+        fprintf(stdout, "#endif\n");
+    }
+    if (i == 0 && Nfontswithflag(scripts[i], "kerning") > 0)
+    {
+        fprintf(stdout, "#ifndef BBX_FONTKERNINGDEFINED\n");
+        fprintf(stdout, "#define BBX_FONTKERNINGDEFINED\n");
+        putfontkerningdefinition(stdout);
+        fprintf(stdout, "#endif\n");
+    }
+    if (i == 0 && Nfontswithflag(scripts[i], "sdf") > 0)
+    {
+        fprintf(stdout, "#ifndef BBX_SDFFONTDEFINED\n");
+        fprintf(stdout, "#define BBX_SDFFONTDEFINED\n");
+        putsdffontdefinition(stdout);
+        fprintf(stdout, "#endif\n");
     }
 	if (i == 0 && xml_Nchildrenwithtag(scripts[i], "cursor") > 0)
     {
@@ -1469,6 +3105,13 @@ int main(int argc, char **argv)
         putcursordefinition(stdout);
         fprintf(stdout, "#endif\n");
     }
+    if (i == 0 && xml_Nchildrenwithtag(scripts[i], "animation") > 0)
+    {
+        fprintf(stdout, "#ifndef BBX_ANIMATIONDEFINED\n");
+        fprintf(stdout, "#define BBX_ANIMATIONDEFINED\n");
+        putanimationdefinition(stdout);
+        fprintf(stdout, "#endif\n");
+    }
     for (node = scripts[i]->child; node != NULL; node = node->next)
     { 
         const char* tag = xml_gettag(node);
@@ -1488,10 +3131,7 @@ int main(int argc, char **argv)
          }
         else if (!strcmp(tag, "font"))
         {
-            path = xml_getattribute(node, "src");
-            name = xml_getattribute(node, "name");
-            pointsstr = xml_getattribute(node, "points");
-            processfonttag(stdout, header, path, name, pointsstr);
+            processfonttag(stdout, header, node, scripts[i]);
         }
         else if (!strcmp(tag, "string"))
         {
@@ -1499,14 +3139,16 @@ int main(int argc, char **argv)
             name = xml_getattribute(node, "name");
             xconst = xml_getattribute(node, "const");
             str = xml_getdata(node);
-            processstringtag(stdout, header, path, name, xconst, str);
+            if (!pool || !ispoolable(node) || processpooledstringtag(stdout, header, node, pool, "char", STRINGPOOLNAME) < 0)
+                processstringtag(stdout, header, path, name, xconst, str);
         }
         else if (!strcmp(tag, "utf8"))
         {
             path = xml_getattribute(node, "src");
             name = xml_getattribute(node, "name");
             str = xml_getdata(node);
-            processutf8tag(stdout, header, path, name, str);
+            if (!pool || processpooledstringtag(stdout, header, node, pool, "char", STRINGPOOLNAME) < 0)
+                processutf8tag(stdout, header, path, name, str);
         }
         else if (!strcmp(tag, "utf16"))
         {
@@ -1514,7 +3156,8 @@ int main(int argc, char **argv)
             name = xml_getattribute(node, "name");
             allowsurrogatepairsstr = xml_getattribute(node, "allowsurrogatepairs");
             str = xml_getdata(node);
-            processutf16tag(stdout, header, path, name, allowsurrogatepairsstr, str);
+            if (!utf16pool || processpooledstringtag(stdout, header, node, utf16pool, "unsigned short", UTF16POOLNAME) < 0)
+                processutf16tag(stdout, header, path, name, allowsurrogatepairsstr, str);
         }
         else if(!strcmp(tag, "binary"))
         { 
@@ -1528,33 +3171,49 @@ int main(int argc, char **argv)
             name = xml_getattribute(node, "name");
             processcursortag(stdout, header, path, name);
         }
+        else if (!strcmp(tag, "animation"))
+        {
+            path = xml_getattribute(node, "src");
+            name = xml_getattribute(node, "name");
+            processanimationtag(stdout, header, path, name);
+        }
         else if (!strcmp(tag, "dataframe"))
         {
             path = xml_getattribute(node, "src");
             name = xml_getattribute(node, "name");
-            processdataframetag(stdout, header, path, name);
+            compactstr = xml_getattribute(node, "compact");
+            processdataframetag(stdout, header, path, name, compactstr);
         }
         else if (!strcmp(tag, "audio"))
         {
             path = xml_getattribute(node, "src");
             name = xml_getattribute(node, "name");
             sampleratestr = xml_getattribute(node, "samplerate");
-            processaudiotag(stdout, header, path, name, sampleratestr);
+            qualitystr = xml_getattribute(node, "quality");
+            encodingstr = xml_getattribute(node, "encoding");
+            if (processaudiotag(stdout, header, path, name, sampleratestr, qualitystr, encodingstr) == -2)
+                badoutput = 1;
         }
         else if (!strcmp(tag, "international"))
         {
-            processinternationalnode(stdout, node, header);
+            if (processinternationalnode(stdout, node, header, pool) < 0)
+                badoutput = 1;
         }
     }
   }
+  processinternationalgroups(stdout, scripts, Nscripts, header, pool);
   if (header)
   {
       fprintf(stdout, "\n#endif\n");
   }
+  killstringpool(pool);
+  killstringpool(utf16pool);
   killxmldoc(doc);
     free(scriptfile);
     free(scripts);
 
+  if (badoutput)
+    exit(EXIT_FAILURE);
 
   return 0;
 }
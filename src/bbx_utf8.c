@@ -5,7 +5,10 @@
 //  Created by Malcolm McLean on 29/07/2023.
 //
 
+#include <string.h>
+
 #include "bbx_utf8.h"
+#include "utftranscode.h"
 
 static const unsigned int offsetsFromUTF8[6] =
 {
@@ -24,52 +27,12 @@ static const unsigned char trailingBytesForUTF8[256] = {
     2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2, 3,3,3,3,3,3,3,3,4,4,4,4,5,5,5,5
 };
 
+/*
+  test if a nul-terminated string is valid UTF-8
+ */
 int bbx_isutf8z(const char *str)
 {
-  int len = 0;
-  int pos = 0;
-  int nb;
-  int i;
-  int ch;
-
-  while(str[len])
-    len++;
-  while(pos < len && *str)
-  {
-    nb = bbx_utf8_skip(str);
-    if(nb < 1 || nb > 4)
-      return 0;
-    if(pos + nb > len)
-      return 0;
-    for(i=1;i<nb;i++)
-      if( (str[i] & 0xC0) != 0x80 )
-        return 0;
-    ch = bbx_utf8_getch(str);
-    if(ch < 0x80)
-    {
-      if(nb != 1)
-        return 0;
-    }
-    else if(ch < 0x8000)
-    {
-      if(nb != 2)
-        return 0;
-    }
-    else if(ch < 0x10000)
-    {
-      if(nb != 3)
-        return 0;
-    }
-    else if(ch < 0x110000)
-    {
-      if(nb != 4)
-        return 0;
-    }
-    pos += nb;
-    str += nb;
-  }
-
-  return 1;
+  return utf8_valid(str, (long) strlen(str));
 }
 
 int bbx_utf8_skip(const char *utf8)
@@ -151,13 +114,5 @@ int bbx_utf8_charwidth(int ch)
 
 int bbx_utf8_Nchars(const char *utf8)
 {
-  int answer = 0;
-
-  while(*utf8)
-  {
-    utf8 += bbx_utf8_skip(utf8);
-    answer++;
-  }
-
-  return answer;
+  return (int) utf8_Nchars(utf8, (long) strlen(utf8));
 }
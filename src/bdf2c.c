@@ -67,6 +67,8 @@
 #include <ctype.h>
 #include <errno.h>
 
+#include "bitmapfont.h"
+
 #define VERSION "5"			///< version of this application
 
 //////////////////////////////////////////////////////////////////////////////
@@ -163,6 +165,37 @@ static void EncodingTable(FILE * out, const char *name,
     fprintf(out, "};\n");
 }
 
+///
+///	Print code point to glyph page table for c file
+///
+///	@param out		file stream for output
+///	@param name		font variable name in C source file
+///	@param encoding_table	encoding table read from BDF file
+///	@param chars		number of characters in encoding table
+///
+///	@returns 0 on success, -1 on out of memory, -2 if there are too many
+///	glyphs
+///
+static int LookupTable(FILE * out, const char *name,
+    const unsigned *encoding_table, int chars)
+{
+    int *codes;
+    int i;
+    int err;
+
+    codes = malloc((chars ? chars : 1) * sizeof(*codes));
+    if (!codes) {
+	return -1;
+    }
+    for (i = 0; i < chars; ++i) {
+	// unencoded glyphs are ENCODING -1
+	codes[i] = encoding_table[i] > 0x10FFFF ? -1 : (int)encoding_table[i];
+    }
+    err = dumpfontlookup(out, 0, name, codes, chars);
+    free(codes);
+    return err;
+}
+
 ///
 ///	Print footer for c file.
 ///
@@ -219,6 +252,45 @@ static void DumpCharacter(FILE * out, unsigned char *bitmap, int width, int heig
     }
 }
 
+///
+///	Store character in packed font.
+///
+///	@param font	font to store glyph in
+///	@param n	glyph number
+///	@param encoding	character encoding
+///	@param advance	character width
+///	@param bitmap	input bitmap
+///	@param width	character width
+///	@param height	character height
+///
+static void StoreCharacter(BITMAPFONT * font, int n, int encoding, int advance,
+    unsigned char *bitmap, int width, int height)
+{
+    unsigned char *cell;
+    int x;
+    int y;
+
+    cell = malloc(width * height);
+    if (!cell) {
+	fprintf(stderr, "Out of memory\n");
+	exit(-1);
+    }
+    for (y = 0; y < height; ++y) {
+	for (x = 0; x < width; ++x) {
+	    if (bitmap[y * ((width + 7) / 8) + x / 8] & (0x80 >> x % 8)) {
+		cell[y * width + x] = 0xFF;
+	    } else {
+		cell[y * width + x] = 0x00;
+	    }
+	}
+    }
+    if (setglyph(font, n, encoding, advance, cell, width)) {
+	fprintf(stderr, "Out of memory\n");
+	exit(-1);
+    }
+    free(cell);
+}
+
 ///
 ///	Hex ascii to integer
 ///
@@ -332,11 +404,15 @@ static void OutlineCharacter(unsigned char *bitmap, int width, int height)
 ///
 ///	@param bdf	file stream for input (bdf file)
 ///	@param out	file stream for output (C source file)
+///	@param header	write declaration for header file
 ///	@param name	font variable name in C source file
+///	@param options	packed writes glyphs as boxes (struct bitmap_font_packed),
+///			bpp 1, 2 or 4 as boxes of bits (struct bitmap_font_bits),
+///			may be NULL
 ///
 ///	@todo bbx isn't used to correct character position in bitmap
 ///
-void ReadBdf(FILE * bdf, FILE * out, int header, const char *name)
+void ReadBdf(FILE * bdf, FILE * out, int header, const char *name, const FONTOPTIONS *options)
 {
     char linebuf[1024];
     char *s;
@@ -363,10 +439,21 @@ void ReadBdf(FILE * bdf, FILE * out, int header, const char *name)
     unsigned *width_table;
     unsigned *encoding_table;
     unsigned char *bitmap;
+    BITMAPFONT *font = 0;
+    int bpp = options && options->bpp ? options->bpp : 8;
+    int packed = (options && options->packed) || bpp < 8;
+    int lookup = options && options->lookup;
     
     if (header)
     {
-        fprintf(out, "extern struct bitmap_font %s_font;\n", name);
+        if (bpp < 8)
+            dumpbitsfont(out, 1, name, 0, 0, bpp);
+        else if (packed)
+            dumppackedfont(out, 1, name, 0, 0);
+        else
+            fprintf(out, "extern struct bitmap_font %s_font;\n", name);
+        if (lookup)
+            dumpfontlookup(out, 1, name, 0, 0);
         return;
     }
 
@@ -444,7 +531,16 @@ void ReadBdf(FILE * bdf, FILE * out, int header, const char *name)
 	exit(-1);
     }
 
-    Header(out, name);
+    if (packed) {
+	font = bitmapfont(chars, fontboundingbox_width, fontboundingbox_height,
+	    font_ascent, font_descent);
+	if (!font) {
+	    fprintf(stderr, "Out of memory\n");
+	    exit(-1);
+	}
+    } else {
+	Header(out, name);
+    }
 
     scanline = -1;
     n = 0;
@@ -482,9 +578,11 @@ void ReadBdf(FILE * bdf, FILE * out, int header, const char *name)
 	    p = strtok(NULL, " \t\n\r");
 	    bby = atoi(p);
 	} else if (!mystrcasecmp(s, "BITMAP")) {
-	    fprintf(out, "// %3d $%02x '%s'\n", encoding, encoding, charname);
-	    fprintf(out, "//\twidth %d, bbx %d, bby %d, bbw %d, bbh %d\n",
-		width, bbx, bby, bbw, bbh);
+	    if (!packed) {
+		fprintf(out, "// %3d $%02x '%s'\n", encoding, encoding, charname);
+		fprintf(out, "//\twidth %d, bbx %d, bby %d, bbw %d, bbh %d\n",
+		    width, bbx, bby, bbw, bbh);
+	    }
 
 	    if (n == chars) {
 		fprintf(stderr, "Too many bitmaps for characters\n");
@@ -533,8 +631,14 @@ void ReadBdf(FILE * bdf, FILE * out, int header, const char *name)
 		OutlineCharacter(bitmap, fontboundingbox_width,
 		    fontboundingbox_height);
 	    }
-	    DumpCharacter(out, bitmap, fontboundingbox_width,
-		fontboundingbox_height);
+	    if (packed) {
+		StoreCharacter(font, n - 1, encoding_table[n - 1],
+		    width_table[n - 1], bitmap, fontboundingbox_width,
+		    fontboundingbox_height);
+	    } else {
+		DumpCharacter(out, bitmap, fontboundingbox_width,
+		    fontboundingbox_height);
+	    }
 	    scanline = -1;
 	    width = INT_MIN;
 	} else {
@@ -562,6 +666,23 @@ void ReadBdf(FILE * bdf, FILE * out, int header, const char *name)
 	}
     }
 
+    if (packed) {
+	font->Nglyphs = n;
+	if (bpp < 8)
+	    dumpbitsfont(out, 0, name, 0, font, bpp);
+	else
+	    dumppackedfont(out, 0, name, 0, font);
+	if (lookup && LookupTable(out, name, encoding_table, n) == -1) {
+	    fprintf(stderr, "Out of memory\n");
+	    exit(-1);
+	}
+	killbitmapfont(font);
+	free(width_table);
+	free(encoding_table);
+	free(bitmap);
+	return;
+    }
+
     fprintf(out, "};\n\n\n");
 
     // Output width table for proportional font.
@@ -572,6 +693,10 @@ void ReadBdf(FILE * bdf, FILE * out, int header, const char *name)
     EncodingTable(out, name, encoding_table, chars);
 
     Footer(out, name, font_ascent, font_descent, fontboundingbox_width, fontboundingbox_height, chars);
+    if (lookup && LookupTable(out, name, encoding_table, chars) == -1) {
+	fprintf(stderr, "Out of memory\n");
+	exit(-1);
+    }
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -608,7 +733,7 @@ int bdf2cmain(int argc, char **argv)
     exit(EXIT_FAILURE);
   }
   printf("#include \"font.h\"\n\n");
-  ReadBdf(fpin, stdout, 0, argv[2]);
+  ReadBdf(fpin, stdout, 0, argv[2], 0);
   fclose(fpin);
   return 0;
 }
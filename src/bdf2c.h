@@ -1,6 +1,8 @@
 #ifndef bdf2c_h
 #define bdf2c_h
 
-void ReadBdf(FILE * bdf, FILE * out, int header, const char *name);
+#include "bitmapfont.h"
+
+void ReadBdf(FILE * bdf, FILE * out, int header, const char *name, const FONTOPTIONS *options);
 
 #endif
@@ -0,0 +1,711 @@
+/*
+  bitmapfont.c - raster fonts held in memory, and written out as C.
+
+  The font rippers (ttf2c and bdf2c) render each glyph into a character
+  cell and hand it over here. The glyph is trimmed to the box of pixels
+  that are set, so we can write the font either in the traditional
+  layout, every glyph a full cell, or in the packed layout, every glyph
+  just its box, stored one after another in a single bitmap.
+
+  by Malcolm McLean
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bitmapfont.h"
+
+/*
+  Create an empty bitmap font.
+  Params: Nglyphs - number of glyphs
+          width - cell width (max character width)
+          height - cell height
+          ascent - font ascent
+          descent - font descent
+  Returns: the font, 0 on out of memory.
+ */
+BITMAPFONT *bitmapfont(int Nglyphs, int width, int height, int ascent, int descent)
+{
+  BITMAPFONT *font;
+  int i;
+
+  font = malloc(sizeof(BITMAPFONT));
+  if (!font)
+    return 0;
+  font->width = width;
+  font->height = height;
+  font->ascent = ascent;
+  font->descent = descent;
+  font->Nglyphs = Nglyphs;
+  font->glyphs = malloc((Nglyphs ? Nglyphs : 1) * sizeof(BITMAPGLYPH));
+  if (!font->glyphs)
+  {
+    free(font);
+    return 0;
+  }
+  for (i = 0; i < Nglyphs; i++)
+  {
+    font->glyphs[i].code = -1;
+    font->glyphs[i].advance = 0;
+    font->glyphs[i].x = 0;
+    font->glyphs[i].y = 0;
+    font->glyphs[i].width = 0;
+    font->glyphs[i].height = 0;
+    font->glyphs[i].bitmap = 0;
+  }
+
+  return font;
+}
+
+void killbitmapfont(BITMAPFONT *font)
+{
+  int i;
+
+  if (font)
+  {
+    for (i = 0; i < font->Nglyphs; i++)
+      free(font->glyphs[i].bitmap);
+    free(font->glyphs);
+    free(font);
+  }
+}
+
+/*
+  Set a glyph from a rendered character cell.
+  Params: font - the font
+          index - glyph number
+          code - the code point
+          advance - advance width in pixels
+          cell - font->width x font->height grey levels
+          stride - bytes per row of cell
+  Returns: 0 on success, -1 on out of memory.
+  Notes: the cell is trimmed to the set pixels and copied.
+ */
+int setglyph(BITMAPFONT *font, int index, int code, int advance, const unsigned char *cell, int stride)
+{
+  return setglyphbox(font, index, code, advance, cell, font->width, font->height, stride, 0, 0);
+}
+
+/*
+  Set a glyph from a bitmap placed somewhere in the character cell.
+  Params: font - the font
+          index - glyph number
+          code - the code point
+          advance - advance width in pixels
+          box - width x height grey levels
+          width - box width
+          height - box height
+          stride - bytes per row of box
+          x, y - position of top left of box in the cell (may be negative)
+  Returns: 0 on success, -1 on out of memory.
+  Notes: pixels falling outside the cell are clipped, and the result is
+    trimmed to the set pixels.
+ */
+int setglyphbox(BITMAPFONT *font, int index, int code, int advance, const unsigned char *box, int width, int height, int stride, int x, int y)
+{
+  BITMAPGLYPH *glyph = &font->glyphs[index];
+  int minx = font->width;
+  int maxx = -1;
+  int miny = font->height;
+  int maxy = -1;
+  int bx, by;
+  int left, right, top, bottom;
+
+  /* the part of the box inside the cell */
+  left = x < 0 ? -x : 0;
+  top = y < 0 ? -y : 0;
+  right = width;
+  if (x + right > font->width)
+    right = font->width - x;
+  bottom = height;
+  if (y + bottom > font->height)
+    bottom = font->height - y;
+
+  for (by = top; by < bottom; by++)
+  {
+    for (bx = left; bx < right; bx++)
+    {
+      if (box[by * stride + bx])
+      {
+        if (bx < minx)
+          minx = bx;
+        if (bx > maxx)
+          maxx = bx;
+        if (by < miny)
+          miny = by;
+        maxy = by;
+      }
+    }
+  }
+
+  free(glyph->bitmap);
+  glyph->bitmap = 0;
+  glyph->code = code;
+  glyph->advance = advance;
+  if (maxx < 0)
+  {
+    glyph->x = 0;
+    glyph->y = 0;
+    glyph->width = 0;
+    glyph->height = 0;
+    return 0;
+  }
+  glyph->x = minx + x;
+  glyph->y = miny + y;
+  glyph->width = maxx - minx + 1;
+  glyph->height = maxy - miny + 1;
+  glyph->bitmap = malloc(glyph->width * glyph->height);
+  if (!glyph->bitmap)
+    return -1;
+  for (by = 0; by < glyph->height; by++)
+    memcpy(glyph->bitmap + by * glyph->width, box + (by + miny) * stride + minx, glyph->width);
+
+  return 0;
+}
+
+/*
+  Get the grey level at a position in a glyph's character cell.
+ */
+static int cellpixel(const BITMAPGLYPH *glyph, int x, int y)
+{
+  x -= glyph->x;
+  y -= glyph->y;
+  if (x < 0 || x >= glyph->width || y < 0 || y >= glyph->height)
+    return 0;
+  return glyph->bitmap[y * glyph->width + x];
+}
+
+/*
+  Write the table of code points. Fonts ripped from the same face at
+  different sizes have the same glyphs, so they can share one index.
+  The struct bitmap_font index is unsigned short, but the boxed layouts
+  take code points above 0xFFFF, so set boxed to write unsigned long.
+ */
+int dumpfontindex(FILE *fp, const char *name, const BITMAPFONT *font, int boxed)
+{
+  int i;
+
+  fprintf(fp, "static %s %s_index[%d] =\n", boxed ? "unsigned long" : "unsigned short", name,  font->Nglyphs);
+  fprintf(fp, "{\n");
+  for (i = 0; i < font->Nglyphs; i++)
+    fprintf(fp, "%d,\n", font->glyphs[i].code);
+  fprintf(fp, "};\n\n");
+
+  return 0;
+}
+
+/*
+  The widths table is unsigned char, and the boxed layouts give the cell
+  as unsigned short, so check the font fits rather than let them wrap.
+  Params: fp - the output, gets an #error so the build fails
+          name - the font name, for the messages
+          font - the font
+          cellmax - the largest cell width and height allowed
+  Returns: 0 if the font fits, -1 if not
+ */
+static int checkfontsize(FILE *fp, const char *name, const BITMAPFONT *font, int cellmax)
+{
+  int i;
+
+  if (font->width > cellmax || font->height > cellmax)
+  {
+    fprintf(stderr, "font %s is too big, cell %d x %d, maximum %d\n", name, font->width, font->height, cellmax);
+    fprintf(fp, "#error \"font %s is too big\"\n", name);
+    return -1;
+  }
+  for (i = 0; i < font->Nglyphs; i++)
+  {
+    if (font->glyphs[i].advance < 0 || font->glyphs[i].advance > 255)
+    {
+      fprintf(stderr, "font %s is too big, glyph %d is %d pixels wide, maximum 255\n", name, font->glyphs[i].code, font->glyphs[i].advance);
+      fprintf(fp, "#error \"font %s is too big\"\n", name);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+static void dumpwidthsandindex(FILE *fp, const char *name, const char *indexname, const BITMAPFONT *font, int boxed)
+{
+  int i;
+
+  fprintf(fp, "static unsigned char %s_widths[%d] =\n", name,  font->Nglyphs);
+  fprintf(fp, "{\n");
+  for (i = 0; i < font->Nglyphs; i++)
+    fprintf(fp, "%d,\n", font->glyphs[i].advance);
+  fprintf(fp, "};\n\n");
+
+  if (!indexname)
+    dumpfontindex(fp, name, font, boxed);
+}
+
+/*
+  Write the font as a struct bitmap_font, each glyph a full
+  width x height cell.
+  indexname is the name of an index written by dumpfontindex(), 0 to
+  write the font's own index.
+ */
+int dumpbitmapfont(FILE *fp, int header, const char *name, const char *indexname, const BITMAPFONT *font)
+{
+  int i;
+  int x, y;
+
+  if (header)
+  {
+    fprintf(fp, "extern struct bitmap_font %s_font;\n", name);
+    return 0;
+  }
+
+  fprintf(fp, "\nstatic unsigned char %s_bitmap[%d] =\n", name,  font->Nglyphs * font->width * font->height);
+  fprintf(fp, "{\n");
+  for (i = 0; i < font->Nglyphs; i++)
+  {
+    fprintf(fp, "/* glyph %d */\n", font->glyphs[i].code);
+    for (y = 0; y < font->height; y++)
+    {
+      for (x = 0; x < font->width; x++)
+        fprintf(fp, "0x%02x, ", cellpixel(&font->glyphs[i], x, y));
+      fprintf(fp, "\n");
+    }
+    fprintf(fp, "\n");
+  }
+  fprintf(fp, "};\n");
+
+  dumpwidthsandindex(fp, name, indexname, font, 0);
+
+  fprintf(fp, "struct bitmap_font %s_font = \n", name);
+  fprintf(fp, "{\n");
+  fprintf(fp, "%d, /* max width */\n", font->width);
+  fprintf(fp, "%d, /* height */\n", font->height);
+  fprintf(fp, "%d, /* ascent */\n", font->ascent);
+  fprintf(fp, "%d, /* descent */\n", font->descent);
+  fprintf(fp, "%d, /* Nchars */\n", font->Nglyphs);
+  fprintf(fp, "%s_widths, /* widths */\n", name);
+  fprintf(fp, "%s_index, /* index */\n", indexname ? indexname : name);
+  fprintf(fp, "%s_bitmap /* bitmap */\n", name);
+  fprintf(fp, "};\n");
+  fprintf(fp, "\n");
+
+  return 0;
+}
+
+/*
+  Write the boxes of the glyphs, one after another in a single bitmap,
+  and the table giving the position of each box.
+ */
+static void dumpboxes(FILE *fp, const char *name, const BITMAPFONT *font)
+{
+  const BITMAPGLYPH *glyph;
+  unsigned long total = 0;
+  unsigned long offset = 0;
+  int i;
+  int x, y;
+
+  for (i = 0; i < font->Nglyphs; i++)
+    total += font->glyphs[i].width * font->glyphs[i].height;
+
+  fprintf(fp, "\nstatic unsigned char %s_bitmap[%lu] =\n", name, total ? total : 1);
+  fprintf(fp, "{\n");
+  for (i = 0; i < font->Nglyphs; i++)
+  {
+    glyph = &font->glyphs[i];
+    if (glyph->width == 0)
+      continue;
+    fprintf(fp, "/* glyph %d */\n", glyph->code);
+    for (y = 0; y < glyph->height; y++)
+    {
+      for (x = 0; x < glyph->width; x++)
+        fprintf(fp, "0x%02x, ", glyph->bitmap[y * glyph->width + x]);
+      fprintf(fp, "\n");
+    }
+  }
+  if (total == 0)
+    fprintf(fp, "0\n");
+  fprintf(fp, "};\n\n");
+
+  fprintf(fp, "static struct bitmap_glyph %s_glyphs[%d] =\n", name, font->Nglyphs);
+  fprintf(fp, "{\n");
+  for (i = 0; i < font->Nglyphs; i++)
+  {
+    glyph = &font->glyphs[i];
+    fprintf(fp, "{%d, %d, %d, %d, %lu}, /* %d */\n", glyph->x, glyph->y,
+            glyph->width, glyph->height, offset, glyph->code);
+    offset += glyph->width * glyph->height;
+  }
+  fprintf(fp, "};\n\n");
+}
+
+/*
+  Write the font as a struct bitmap_font_packed. Each glyph is stored
+  as just its box, and the glyph table gives the position of the box
+  in the character cell and its offset into the bitmap.
+  indexname as for dumpbitmapfont().
+ */
+int dumppackedfont(FILE *fp, int header, const char *name, const char *indexname, const BITMAPFONT *font)
+{
+  if (header)
+  {
+    fprintf(fp, "extern struct bitmap_font_packed %s_font;\n", name);
+    return 0;
+  }
+  if (checkfontsize(fp, name, font, 65535))
+    return -1;
+
+  dumpboxes(fp, name, font);
+  dumpwidthsandindex(fp, name, indexname, font, 1);
+
+  fprintf(fp, "struct bitmap_font_packed %s_font = \n", name);
+  fprintf(fp, "{\n");
+  fprintf(fp, "%d, /* max width */\n", font->width);
+  fprintf(fp, "%d, /* height */\n", font->height);
+  fprintf(fp, "%d, /* ascent */\n", font->ascent);
+  fprintf(fp, "%d, /* descent */\n", font->descent);
+  fprintf(fp, "%d, /* Nchars */\n", font->Nglyphs);
+  fprintf(fp, "%s_widths, /* widths */\n", name);
+  fprintf(fp, "%s_index, /* index */\n", indexname ? indexname : name);
+  fprintf(fp, "%s_glyphs, /* glyph boxes */\n", name);
+  fprintf(fp, "%s_bitmap /* bitmap */\n", name);
+  fprintf(fp, "};\n");
+  fprintf(fp, "\n");
+
+  return 0;
+}
+
+/*
+  Write the font as a struct sdf_font. The glyphs are signed distance
+  fields, stored as boxes as in the packed layout. The cell includes
+  spread pixels of margin on every side, so the pen is spread pixels
+  in from the left of the cell.
+  indexname as for dumpbitmapfont().
+ */
+int dumpsdffont(FILE *fp, int header, const char *name, const char *indexname, const BITMAPFONT *font, int points, int spread)
+{
+  if (header)
+  {
+    fprintf(fp, "extern struct sdf_font %s_font;\n", name);
+    return 0;
+  }
+  if (checkfontsize(fp, name, font, 65535))
+    return -1;
+
+  dumpboxes(fp, name, font);
+  dumpwidthsandindex(fp, name, indexname, font, 1);
+
+  fprintf(fp, "struct sdf_font %s_font = \n", name);
+  fprintf(fp, "{\n");
+  fprintf(fp, "%d, /* max width */\n", font->width);
+  fprintf(fp, "%d, /* height */\n", font->height);
+  fprintf(fp, "%d, /* ascent */\n", font->ascent);
+  fprintf(fp, "%d, /* descent */\n", font->descent);
+  fprintf(fp, "%d, /* points */\n", points);
+  fprintf(fp, "%d, /* spread */\n", spread);
+  fprintf(fp, "%d, /* Nchars */\n", font->Nglyphs);
+  fprintf(fp, "%s_widths, /* widths */\n", name);
+  fprintf(fp, "%s_index, /* index */\n", indexname ? indexname : name);
+  fprintf(fp, "%s_glyphs, /* glyph boxes */\n", name);
+  fprintf(fp, "%s_bitmap /* distance fields */\n", name);
+  fprintf(fp, "};\n");
+  fprintf(fp, "\n");
+
+  return 0;
+}
+
+/*
+  Write the font as a struct bitmap_font_bits. The glyphs are stored as
+  boxes, as in the packed layout, but each pixel is cut down to bpp bits
+  (1, 2 or 4) and the boxes are written as one stream of bits, most
+  significant bits first, with no padding between rows or glyphs. The
+  glyph offsets are in bits. As bpp divides 8, a pixel never straddles
+  two bytes.
+  indexname as for dumpbitmapfont().
+ */
+int dumpbitsfont(FILE *fp, int header, const char *name, const char *indexname, const BITMAPFONT *font, int bpp)
+{
+  const BITMAPGLYPH *glyph;
+  unsigned long totalbits = 0;
+  unsigned long offset = 0;
+  unsigned long Nbytes = 0;
+  int maxlevel = (1 << bpp) - 1;
+  int byte = 0;
+  int bit = 0;
+  int i;
+  int x, y;
+
+  if (header)
+  {
+    fprintf(fp, "extern struct bitmap_font_bits %s_font;\n", name);
+    return 0;
+  }
+  if (checkfontsize(fp, name, font, 65535))
+    return -1;
+
+  for (i = 0; i < font->Nglyphs; i++)
+    totalbits += (unsigned long) font->glyphs[i].width * font->glyphs[i].height * bpp;
+
+  fprintf(fp, "\nstatic unsigned char %s_bitmap[%lu] =\n", name, totalbits ? (totalbits + 7) / 8 : 1);
+  fprintf(fp, "{\n");
+  for (i = 0; i < font->Nglyphs; i++)
+  {
+    glyph = &font->glyphs[i];
+    if (glyph->width == 0)
+      continue;
+    fprintf(fp, "/* glyph %d */\n", glyph->code);
+    for (y = 0; y < glyph->height; y++)
+    {
+      for (x = 0; x < glyph->width; x++)
+      {
+        byte = (byte << bpp) | ((glyph->bitmap[y * glyph->width + x] * maxlevel + 127) / 255);
+        bit += bpp;
+        if (bit == 8)
+        {
+          fprintf(fp, "0x%02x, ", byte);
+          if ((++Nbytes % 16) == 0)
+            fprintf(fp, "\n");
+          byte = 0;
+          bit = 0;
+        }
+      }
+    }
+    if (Nbytes % 16)
+      fprintf(fp, "\n");
+    Nbytes = 0;
+  }
+  if (bit)
+    fprintf(fp, "0x%02x\n", (byte << (8 - bit)) & 0xFF);
+  if (totalbits == 0)
+    fprintf(fp, "0\n");
+  fprintf(fp, "};\n\n");
+
+  fprintf(fp, "static struct bitmap_glyph %s_glyphs[%d] =\n", name, font->Nglyphs);
+  fprintf(fp, "{\n");
+  for (i = 0; i < font->Nglyphs; i++)
+  {
+    glyph = &font->glyphs[i];
+    fprintf(fp, "{%d, %d, %d, %d, %lu}, /* %d */\n", glyph->x, glyph->y,
+            glyph->width, glyph->height, offset, glyph->code);
+    offset += (unsigned long) glyph->width * glyph->height * bpp;
+  }
+  fprintf(fp, "};\n\n");
+
+  dumpwidthsandindex(fp, name, indexname, font, 1);
+
+  fprintf(fp, "struct bitmap_font_bits %s_font = \n", name);
+  fprintf(fp, "{\n");
+  fprintf(fp, "%d, /* max width */\n", font->width);
+  fprintf(fp, "%d, /* height */\n", font->height);
+  fprintf(fp, "%d, /* ascent */\n", font->ascent);
+  fprintf(fp, "%d, /* descent */\n", font->descent);
+  fprintf(fp, "%d, /* bpp */\n", bpp);
+  fprintf(fp, "%d, /* Nchars */\n", font->Nglyphs);
+  fprintf(fp, "%s_widths, /* widths */\n", name);
+  fprintf(fp, "%s_index, /* index */\n", indexname ? indexname : name);
+  fprintf(fp, "%s_glyphs, /* glyph boxes */\n", name);
+  fprintf(fp, "%s_bitmap /* bitmap */\n", name);
+  fprintf(fp, "};\n");
+  fprintf(fp, "\n");
+
+  return 0;
+}
+
+/*
+  Write a two level page table from code point to glyph number, as a
+  struct bitmap_font_lookup. The code point shifted right 8 bits selects
+  a page, which gives a block of 256 glyph numbers, so finding a glyph
+  takes two array reads whatever the size of the font. Pages without
+  glyphs share one empty block.
+  Params: fp - the output stream
+          header - write the declaration for a header
+          name - name of the table, written as name_lookup
+          codes - the code point of each glyph, -1 for none
+          Ncodes - number of glyphs
+  Returns: 0 on success, -1 on out of memory, -2 if the font has too
+    many glyphs.
+  Notes: where two glyphs have the same code, the first is used.
+    Glyph numbers are unsigned short with 0xFFFF for none, so a font
+    with more than 65535 glyphs is rejected, with an #error in the
+    output so the build fails.
+ */
+int dumpfontlookup(FILE *fp, int header, const char *name, const int *codes, int Ncodes)
+{
+  int *pages = 0;
+  unsigned short *blocks = 0;
+  int Npages = 0;
+  int Nblocks = 0;
+  int empty = -1;
+  int Nprinted = 0;
+  int page;
+  int i;
+
+  if (header)
+  {
+    fprintf(fp, "extern struct bitmap_font_lookup %s_lookup;\n", name);
+    return 0;
+  }
+  if (Ncodes > 0xFFFF)
+  {
+    fprintf(stderr, "font %s has %d glyphs, too many for a lookup table, maximum 65535\n", name, Ncodes);
+    fprintf(fp, "#error \"font %s has too many glyphs for a lookup table\"\n", name);
+    return -2;
+  }
+
+  for (i = 0; i < Ncodes; i++)
+    if (codes[i] >= 0 && codes[i] <= 0x10FFFF && (codes[i] >> 8) + 1 > Npages)
+      Npages = (codes[i] >> 8) + 1;
+  pages = malloc((Npages ? Npages : 1) * sizeof(int));
+  if (!pages)
+    goto out_of_memory;
+  for (page = 0; page < Npages; page++)
+    pages[page] = -1;
+  for (i = 0; i < Ncodes; i++)
+    if (codes[i] >= 0 && codes[i] <= 0x10FFFF)
+      pages[codes[i] >> 8] = 0;
+  for (page = 0; page < Npages; page++)
+  {
+    if (pages[page] == 0)
+      pages[page] = Nblocks++;
+    else
+    {
+      if (empty == -1)
+        empty = Nblocks++;
+      pages[page] = empty;
+    }
+  }
+
+  blocks = malloc((Nblocks ? Nblocks : 1) * 256 * sizeof(unsigned short));
+  if (!blocks)
+    goto out_of_memory;
+  for (i = 0; i < Nblocks * 256; i++)
+    blocks[i] = 0xFFFF;
+  for (i = 0; i < Ncodes; i++)
+  {
+    if (codes[i] >= 0 && codes[i] <= 0x10FFFF &&
+        blocks[pages[codes[i] >> 8] * 256 + (codes[i] & 0xFF)] == 0xFFFF)
+      blocks[pages[codes[i] >> 8] * 256 + (codes[i] & 0xFF)] = (unsigned short) i;
+  }
+
+  fprintf(fp, "static unsigned short %s_pages[%d] =\n", name, Npages ? Npages : 1);
+  fprintf(fp, "{\n");
+  for (page = 0; page < Npages; page++)
+    fprintf(fp, "%d,\n", pages[page]);
+  if (Npages == 0)
+    fprintf(fp, "0\n");
+  fprintf(fp, "};\n\n");
+
+  fprintf(fp, "static unsigned short %s_pageglyphs[%d] =\n", name, Nblocks ? Nblocks * 256 : 1);
+  fprintf(fp, "{\n");
+  for (page = 0; page < Npages; page++)
+  {
+    /* blocks are numbered in page order, and the empty one comes once */
+    if (pages[page] < Nprinted)
+      continue;
+    Nprinted++;
+    if (pages[page] == empty)
+      fprintf(fp, "/* empty */\n");
+    else
+      fprintf(fp, "/* U+%04X */\n", page << 8);
+    for (i = 0; i < 256; i++)
+    {
+      fprintf(fp, "0x%04x, ", blocks[pages[page] * 256 + i]);
+      if (i % 16 == 15)
+        fprintf(fp, "\n");
+    }
+  }
+  if (Nblocks == 0)
+    fprintf(fp, "0\n");
+  fprintf(fp, "};\n\n");
+
+  fprintf(fp, "struct bitmap_font_lookup %s_lookup = \n", name);
+  fprintf(fp, "{\n");
+  fprintf(fp, "%d, /* Npages */\n", Npages);
+  fprintf(fp, "%s_pages, /* pages */\n", name);
+  fprintf(fp, "%s_pageglyphs /* glyphs */\n", name);
+  fprintf(fp, "};\n");
+  fprintf(fp, "\n");
+
+  free(pages);
+  free(blocks);
+  return 0;
+out_of_memory:
+  free(pages);
+  free(blocks);
+  return -1;
+}
+
+/*
+  Write the kerning pairs, as character indices packed into one number,
+  first << 16 | second, in ascending order so they can be binary
+  searched. Fonts ripped from the same face at different sizes have
+  the same pairs, so they can share them.
+  Params: fp - the output stream
+          name - written as name_kernpairs
+          pairs - the pairs, sorted by left then right
+          Npairs - number of pairs
+  Returns: 0
+ */
+int dumpkernpairs(FILE *fp, const char *name, const KERNPAIR *pairs, int Npairs)
+{
+  int i;
+
+  fprintf(fp, "static unsigned long %s_kernpairs[%d] =\n", name, Npairs ? Npairs : 1);
+  fprintf(fp, "{\n");
+  for (i = 0; i < Npairs; i++)
+    fprintf(fp, "0x%04x%04xUL,\n", pairs[i].left, pairs[i].right);
+  if (Npairs == 0)
+    fprintf(fp, "0\n");
+  fprintf(fp, "};\n\n");
+
+  return 0;
+}
+
+/*
+  Write the fractional advances and kerning of a font as a struct
+  bitmap_font_kerning.
+  Params: fp - the output stream
+          header - write the declaration for a header
+          name - font name, written as name_kerning
+          pairsname - name the pairs were written under by dumpkernpairs()
+          advances - advance of each character, in 1/64 pixels
+          Nchars - number of characters
+          kerns - adjustment for each pair, in 1/64 pixels
+          Npairs - number of pairs
+  Returns: 0
+ */
+int dumpfontkerning(FILE *fp, int header, const char *name, const char *pairsname, const int *advances, int Nchars, const int *kerns, int Npairs)
+{
+  int i;
+
+  if (header)
+  {
+    fprintf(fp, "extern struct bitmap_font_kerning %s_kerning;\n", name);
+    return 0;
+  }
+
+  fprintf(fp, "static unsigned short %s_advances[%d] =\n", name, Nchars ? Nchars : 1);
+  fprintf(fp, "{\n");
+  for (i = 0; i < Nchars; i++)
+    fprintf(fp, "%d,\n", advances[i]);
+  if (Nchars == 0)
+    fprintf(fp, "0\n");
+  fprintf(fp, "};\n\n");
+
+  fprintf(fp, "static short %s_kerns[%d] =\n", name, Npairs ? Npairs : 1);
+  fprintf(fp, "{\n");
+  for (i = 0; i < Npairs; i++)
+    fprintf(fp, "%d,\n", kerns[i]);
+  if (Npairs == 0)
+    fprintf(fp, "0\n");
+  fprintf(fp, "};\n\n");
+
+  fprintf(fp, "struct bitmap_font_kerning %s_kerning = \n", name);
+  fprintf(fp, "{\n");
+  fprintf(fp, "%d, /* Nchars */\n", Nchars);
+  fprintf(fp, "%s_advances, /* advances */\n", name);
+  fprintf(fp, "%d, /* Npairs */\n", Npairs);
+  fprintf(fp, "%s_kernpairs, /* pairs */\n", pairsname);
+  fprintf(fp, "%s_kerns /* kerns */\n", name);
+  fprintf(fp, "};\n");
+  fprintf(fp, "\n");
+
+  return 0;
+}
@@ -0,0 +1,69 @@
+#ifndef bitmapfont_h
+#define bitmapfont_h
+
+#include <stdio.h>
+
+/*
+  A glyph, trimmed to the box of pixels that are actually set.
+  x and y give the position of the box in the character cell.
+ */
+typedef struct
+{
+  int code;               /* Unicode code point */
+  int advance;            /* advance width in pixels */
+  int x;                  /* left of box in cell (left side bearing) */
+  int y;                  /* top of box in cell, measured down from the top */
+  int width;              /* box width */
+  int height;             /* box height */
+  unsigned char *bitmap;  /* width * height grey levels, 0 = background */
+} BITMAPGLYPH;
+
+typedef struct
+{
+  int width;              /* max character width, width of the cell */
+  int height;             /* cell height, ascent + descent */
+  int ascent;
+  int descent;
+  int Nglyphs;
+  BITMAPGLYPH *glyphs;
+} BITMAPFONT;
+
+/*
+  A kerning pair. left and right are character indices, not codes.
+ */
+typedef struct
+{
+  int left;               /* index of the first character */
+  int right;              /* index of the second character */
+  int kern;               /* adjustment to the advance of the first, font units */
+} KERNPAIR;
+
+/*
+  how a font is to be ripped and written out
+ */
+typedef struct
+{
+  int packed;             /* write as struct bitmap_font_packed */
+  const int *chars;       /* code points wanted, ascending, 0 for all */
+  int Nchars;             /* number of code points in chars */
+  int spread;             /* signed distance field spread, 0 for grey levels */
+  int bpp;                /* bits per pixel, 1, 2 or 4, 8 (or 0) for bytes */
+  int lookup;             /* also write a page table from code point to glyph */
+  int kerning;            /* also write fractional advances and kerning pairs */
+  int coverage;           /* anti-alias by exact area, not 2x2 oversampling */
+} FONTOPTIONS;
+
+BITMAPFONT *bitmapfont(int Nglyphs, int width, int height, int ascent, int descent);
+void killbitmapfont(BITMAPFONT *font);
+int setglyph(BITMAPFONT *font, int index, int code, int advance, const unsigned char *cell, int stride);
+int setglyphbox(BITMAPFONT *font, int index, int code, int advance, const unsigned char *box, int width, int height, int stride, int x, int y);
+int dumpfontindex(FILE *fp, const char *name, const BITMAPFONT *font, int boxed);
+int dumpbitmapfont(FILE *fp, int header, const char *name, const char *indexname, const BITMAPFONT *font);
+int dumppackedfont(FILE *fp, int header, const char *name, const char *indexname, const BITMAPFONT *font);
+int dumpbitsfont(FILE *fp, int header, const char *name, const char *indexname, const BITMAPFONT *font, int bpp);
+int dumpfontlookup(FILE *fp, int header, const char *name, const int *codes, int Ncodes);
+int dumpkernpairs(FILE *fp, const char *name, const KERNPAIR *pairs, int Npairs);
+int dumpfontkerning(FILE *fp, int header, const char *name, const char *pairsname, const int *advances, int Nchars, const int *kerns, int Npairs);
+int dumpsdffont(FILE *fp, int header, const char *name, const char *indexname, const BITMAPFONT *font, int points, int spread);
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef ccitt_h
+#define ccitt_h
+
+/*
+  The CCITT fax decoders and code tables in loadtiff.c, which also uses
+  them. Exposed for the regression test in tests/ccitttest.c.
+*/
+
+#define CCITT_PASS 101
+#define CCITT_HORIZONTAL 102
+#define CCITT_VERTICAL_0 103
+#define CCITT_VERTICAL_R1 104
+#define CCITT_VERTICAL_R2 105
+#define CCITT_VERTICAL_R3 106
+#define CCITT_VERTICAL_L1 107
+#define CCITT_VERTICAL_L2 108
+#define CCITT_VERTICAL_L3 109
+#define CCITT_EXTENSION 110
+#define CCITT_ENDOFFAXBLOCK 110
+
+/* the run length of the end of line code */
+#define CCITT_EOL -2
+
+struct ccitt2dcode { int symbol; const char *code; };
+struct ccittcode { int whitelen; const char *whitecode; int blacklen; const char *blackcode; };
+
+extern const struct ccitt2dcode ccitt2dtable[11];
+extern const struct ccittcode ccitttable[105];
+
+unsigned char *ccittdecompress(unsigned char *in, unsigned long count, unsigned long *Nret, int width, int height, int eol);
+unsigned char *ccittgroup4decompress(unsigned char *in, unsigned long count, unsigned long *Nret, int width, int height, int eol);
+
+#endif
@@ -1,697 +1,1003 @@
-/*
-  csv.c
-  code to load a comma-separated value file
-  by Malcolm McLean
- */
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <ctype.h>
-#include <math.h>
-#include <float.h> 
-#include <assert.h>
-
-#include "csv.h"
-
-static int hasheader(char ***data, int width, int height);
-static int getcoltype(char ***data, int col, int width, int height);
-static int gettype(const char *str);
-static char **loadline(FILE *fp, int *N);
-static char *loadfield(FILE *fp);
-static char *loadraw(FILE *fp);
-static char *loadquote(FILE *fp);
-static void striptrail(char *str);
-static char *mystrdup(const char *str);
-static double makenan(void);
-static int myisnan(double x);
-
-/*
-  load a csv file.
-  Params: fname - the name of the csv file to load.
-  Returns: a CSV object, 0 on fail. 
- */
-CSV *loadcsv(const char *fname)
-{
-  CSV *answer;
-  int *len = 0;        /* number of records in each line */
-  char ***rec = 0;     /* square matrix of records */
-  FILE *fp;
-  int i = 0;
-  int ii;
-  int N;              /* number of lines */
-  int width = 0;
-  int height = 0;
-  void *temp;
-
-  answer = malloc(sizeof(CSV));
-  if(!answer)
-    return 0;
-  answer->data = 0;
-  answer->names = 0;
-  answer->types = 0;
-
-  fp = fopen(fname, "r");
-  if(!fp)
-    return 0;
-
-  /* load each row of the csv data */
-  do
-  {
-    temp = realloc(rec, (i+1) * sizeof(char **));
-    rec = temp;
-    temp = realloc(len, (i+1) * sizeof(int));
-    len = temp;
-    rec[i] = loadline(fp, &len[i]);
-    
-    if(len[i] == -2)
-      break;
-    i++;
-  } 
-  while(!ferror(fp));
-  
-  fclose(fp);
-  
-  /* csv file may contain lines of the wrong length.
-     Assume the first line contains the right number of columns.
-  */
- 
-  N = i;
-  
-  for(i=0;i<N;i++)
-  {
-    /* if the line is not the right length, take action against it */
-    if(len[i] != len[0])
-    {
-      /* does the line contain records ? */
-      for(ii=0;ii<len[i];ii++)
-        if(rec[i][ii])
-          break;
-      /* if it contains no records, just delete it */
-      if(ii == len[i])
-      {
-        for(ii=0;ii<len[i];ii++)
-          free(rec[i][ii]);
-        free(rec[i]);
-        memmove(&len[i], &len[i+1], (N - i - 1) * sizeof(int));
-        memmove(&rec[i], &rec[i+1], (N - i -1) * sizeof(char **));
-        N--;
-        i--;
-      }
-      /* if the bad lline contains records, just throw the file out */
-      else
-      { 
-        goto error_exit;
-      }
-    }
-  }
-
-  width = len[0];
-  free(len);
-  
-  /* if the CSV file contains a header, fill data */
-  if(hasheader(rec, width, N))
-  {
-    height = N - 1;
-    answer->types = malloc(width * sizeof(int));
-    answer->names = malloc(width * sizeof(char *));
-    answer->data = malloc(width * height * sizeof(CSV_VALUE));
-    if(!answer->data || !answer->names || !answer->types)
-      goto error_exit;
-    for(i=0;i<width;i++)
-    {
-      answer->names[i] = rec[0][i];
-      answer->types[i] = getcoltype(rec + 1, i, width, height);
-    }
-    for(i=0;i<height;i++)
-    {
-      for(ii=0;ii<width;ii++)
-      {
-        switch(answer->types[ii])
-        {
-          case CSV_REAL:
-            if(rec[i+1][ii])
-              answer->data[i * width + ii].x = strtod(rec[i+1][ii], 0);
-            else
-              answer->data[i * width + ii].x = makenan();
-            free(rec[i+1][ii]);
-            break;
-          case CSV_STRING:
-            answer->data[i * width + ii].str = rec[i+1][ii];
-            rec[i+1][ii] = 0;
-            break;
-        }
-      }
-    }
-  }
-  /* if no header, fill differently */
-  else
-  {
-    height = N;
-    answer->names = 0;
-    answer->types = malloc(width * sizeof(int));
-    answer->data = malloc(width * height * sizeof(CSV_VALUE));
-    if(!answer->data || !answer->types)
-      goto error_exit;
-
-    for(i=0;i<width;i++)
-      answer->types[i] = getcoltype(rec, i, width, height);
-
-    for(i=0;i<height;i++)
-      for(ii=0;ii<width;ii++)
-      {
-        switch(answer->types[ii])
-	{
-          case CSV_REAL:
-            if(rec[i][ii])
-              answer->data[i * width + ii].x = strtod(rec[i][ii], 0);
-            else
-              answer->data[i * width + ii].x = makenan();
-            free(rec[i][ii]);
-            break;
-          case CSV_STRING:
-            answer->data[i * width + ii].str = rec[i][ii];
-            rec[i][ii] = 0;
-            break;
-	}
-      }
-  }
-
-  /* clean up temporary records */
-  for(i=0;i<N;i++)
-    free(rec[i]);
-  free(rec); 
-
-  answer->width = width;
-  answer->height = height;
-  
-  return answer;
-  
-  /* clean up and return NULL */
- error_exit:
-  for(i=0;i<N;i++)
-  {
-    if(len)
-    {
-      for(ii=0;ii<len[i];ii++)
-        free(rec[i][ii]);
-    }
-    else
-    {
-      for(ii=0;ii<width;ii++)
-        free(rec[i][ii]);
-    }
-    free(rec[i]);
-  }
-  free(rec);
-  free(len);
-  
-  free(answer->data);
-  free(answer->names);
-  free(answer->types);
-  free(answer);
-
-  return 0;
-}
-
-/*
-  destructor for csv object
-  Params: csv - pointer to object to destroy
- */
-void killcsv(CSV *csv)
-{
-  int i;
-  int ii;
-
-  if(!csv)
-    return;
-
-  for(i=0;i<csv->width;i++)
-  {
-    if(csv->types[i] == CSV_STRING)
-      for(ii=0;ii<csv->height;ii++)
-        free(csv->data[ii * csv->width + i].str);
-  }
-  free(csv->data);
-  free(csv->types);
-  if(csv->names)
-  {
-    for(i=0;i<csv->width;i++)
-      free(csv->names[i]);
-  }
-  free(csv->names);
-
-  free(csv);
-}
-
-/*
-  get the dimensions of a CSV object
-  Params: CSV - the comma-separated data
-          width - return pointer for no columns
-          height - return pointer for no rows (excl header)
- */
-void csv_getsize(CSV *csv, int *width, int *height)
-{
-  *width = csv->width;
-  *height = csv->height;
-}
-
-/*
-  is a data element present
-  Params: csv - pointer tot he object
-          col - coumn to test
-          row - row to test
-  Returns: 1 if data present for that object, else 0
- */
-int csv_hasdata(CSV *csv, int col, int row)
-{
-  if(col < 0 || col >= csv->width)
-    return 0;
-  if(row < 0 || row >= csv->height)
-    return 0;
-  switch(csv->types[col])
-  {
-    case CSV_REAL:
-      if(myisnan(csv->data[row * csv->width + col].x))
-        return 0;
-      return 1;
-    case CSV_STRING:
-      if(csv->data[row * csv->width + col].str == 0)
-        return 0;
-      return 1;
-    default:
-      return 0;
-  }
-  return 0;
-}
-
-/*
-  get numerical data
-  Params: csv - pointer to the object
-          col - column of data item
-          row - row of data item
-  Returns: value of data item.          
- */
-double csv_get(CSV *csv, int col, int row)
-{
-  assert(col >= 0 && col < csv->width);
-  assert(row >= 0 && row < csv->height);
-  assert(csv->types[col] == CSV_REAL);
- 
-  return csv->data[row * csv->width + col].x;
-}
-
-/*
-  get string data
-  Params: csv - pointer to the object
-          col - column of data item
-          row - row of data item
-  Returns: pointer to string data item.
- */
-const char *csv_getstr(CSV *csv, int col, int row)
-{
-  assert(col >= 0 && col < csv->width);
-  assert(row >= 0 && row < csv->height);
-  assert(csv->types[col] == CSV_STRING);
-
-  return csv->data[row * csv->width + col].str;
-}
-
-/*
-  test if comma-separted values contains header row
-  Params: csv - pointer to the object
-  Returns: 1 if header present, 0 if absent
- */
-int csv_hasheader(CSV *csv)
-{
-  return csv->names ? 1 : 0;
-}
-
-/*
-  get information about a csv column
-  Parmas: csv - pointer to object
-          col - colmn to get infromation about
-          type - return pointer type of colum (CSV_REAL, CSV_STRING)
-  Returns: pointer to column name, NULL if not present
- */
-const char *csv_column(CSV *csv, int col, int *type)
-{
-  if(type)
-    *type = csv->types[col];
-  if(csv->names)
-    return csv->names[col];
-  else
-    return 0;
-}
-
-/*
-  tests if the csv file has a header.
-  Params: data - the read in data
-          width - number of columns
-          height - number of rows
-  Returns: 1 if the data has a header row, else 0
-  Notes: applies a heuristic. If the first has a different type from
-    the rest of the data, it is a header.
- */
-static int hasheader(char ***data, int width, int height)
-{
-  int t1;
-  int t2;
-  int i;
-  int ii;
-
-  if(height < 2)
-    return 0;
-  for(i=0;i<width;i++)
-  {
-    t1 = gettype(data[0][i]);
-    t2 = gettype(data[1][i]);
-    
-    for(ii=2;ii<height;ii++)
-    {
-      if(data[ii][i] && gettype(data[ii][i]) != t2)
-        break;
-    }
-    if(ii == height && t1 != t2)
-      return 1;
-  }
-
-  return 0;
-}
-
-/*
-  get the type of a column
-  Params: data - the array of read-in strings
-          col - column to test
-          width - data width
-          height - data height
-  Returns: type of that column (CSV_STRING if mixed)
- */
-static int getcoltype(char ***data, int col, int width, int height)
-{
-  int t = CSV_NULL;
-  int t2;
-  int i;
-
-  assert(col < width);
-
-  for(i=0;i<height;i++)
-  {
-    t2 = gettype(data[i][col]);
-    if(t2 != t)
-    {
-      if(t == CSV_NULL)
-        t = t2;
-      if(t == CSV_REAL && t2 == CSV_STRING)
-        t = CSV_STRING;
-    }
-  }
-
-  return t;
-}
-
-/*
-  get the type of a field
-  Params: str - string containg data
-  Returns: the type
-    CSV_NULL - no data
-    CSV_REAL - numerical data
-    CSV_STRING - string data
- */
-static int gettype(const char *str)
-{
-  char *ptr;
-  double x;
-
-  if(!str)
-    return CSV_NULL;
-
-  x = strtod(str, &ptr);
-  if(*ptr == 0)
-    return CSV_REAL;
-  else
-    return CSV_STRING;
-}
-
-/*
-  load a line (record) from a csv file.
-  Params: fp - pointer to an opne file
-          N - return pointer for number of fields read
-  Returns: malloced list of malloced strings
- */
-static char **loadline(FILE *fp, int *N)
-{
-  char **answer = 0;
-  int ch;
-  int i = 0;
-  char **temp;
-
-  ch = fgetc(fp);
-  if(ch == EOF)
-  {
-    *N = -2;
-    return 0;
-  }
-  ungetc(ch, fp);
-
-  do
-  {
-    temp = realloc(answer, (i + 1) * sizeof(char *));
-    if(!temp)
-    {
-      while(i >= 0)
-        free(answer[i--]);
-      free(answer);
-      *N = 0;
-      return 0;
-    }
-    answer = temp;
-    answer[i] = loadfield(fp);
-    i++;
-  }
-  while(fgetc(fp) == ',');
-
-  if(i==1 && answer[0] == 0)
-  {
-    free(answer);
-    *N = 0;
-    return 0;
-  }
-  *N = i;
-
-  return answer;
-}
-  
-/*
-  load a field from a csv file.
-  Params: fp - pointer to an open file.
-  Returns: a field read as a character string
-    empty fields are returned as 0
- */
-static char *loadfield(FILE *fp)
-{
-  int ch;
-  char *answer = 0;
-
-  while( (ch = fgetc(fp)) != EOF)
-  {
-    if(ch == ',' || ch == '\n')
-      break;
-    if(isspace(ch))
-      continue;
-    if(ch == '"')
-      answer = loadquote(fp);
-    else
-    {
-      ungetc(ch, fp);
-      answer = loadraw(fp);
-    }
-  }
-  ungetc(ch, fp);
-  
-  return answer;
-}
-
-/*
-  load a raw (comma-delimited) field from file.
-  Params: fp - pointer to open file
-  Returns: the field. fp points to delimiter
- */
-static char *loadraw(FILE *fp)
-{
-  char *answer;
-  char *temp;
-  int len = 64;
-  int N = 0;
-  int ch;
-
-  answer = malloc(64);
-  if(!answer)
-    return 0;
-
-  while( (ch = fgetc(fp)) != EOF)
-  {
-    if(ch == ',' || ch == '\n')
-      break;
-    answer[N++] = (char) ch;
-    if(N == len -1)
-    {
-      temp = realloc(answer, len + 128);
-      if(!temp)
-      {
-        free(answer);
-        return 0;
-      }
-      answer = temp;
-      len += 128;
-    }
-  }
-
-  ungetc(ch, fp);
-  answer[N] = 0;
-
-  striptrail(answer);
-  temp = mystrdup(answer);
-  free(answer);
-
-  return temp;
-}
-
-/*
-  load a quote-delimited field
-  Params: fp - pointer to an open file.
-  Returns: string loaded, 0 on fail. fp points to character after quote.
-  Notes: first quote assumed to be read. On entry fp points to first
-    character after the quote.
- */
-static char *loadquote(FILE *fp)
-{
-  char *answer;
-  char *temp;
-  int len = 64;
-  int N = 0;
-  int ch;
-  int ch2;
-
-  answer = malloc(64);
-  if(!answer)
-    return 0;
-
-  while( (ch = fgetc(fp)) != EOF)
-  {
-    if(ch != '"')
-      answer[N++] = (char) ch;
-    else
-    {
-      ch2 = fgetc(fp);
-      if(ch2 == '"')
-        answer[N++] = '"';
-      else
-      {
-        ungetc(ch2, fp);
-        break;
-      }
-      if(N == len -2)
-      {
-        temp = realloc(answer, len + 128);
-        if(!temp)
-        {
-          free(answer);
-          return 0;
-        }
-        len += 128;
-      }
-    }
-  }
-
-  answer[N] = 0;
-
-  temp = mystrdup(answer);
-  free(answer);
-  return temp;
-}
-
-/*
-  strip trailing whitespace from a string.
-  Params: str - the string.
-  Notes: trailing whitespace set to 0
- */
-static void striptrail(char *str)
-{
-  int len;
-  len = strlen(str);
-  while(len--)
-  {
-    if(isspace(str[len]))
-      str[len] = 0;
-    else
-      break; 
-  }
-}
-
-/*
-  duplicate a string.
-  Params; str - the string to duplicate
-  Returns: malloced pointer to duplicated string, 0 on fail.
- */
-static char *mystrdup(const char *str)
-{
-  char *answer = malloc(strlen(str) + 1);
-  if(answer)
-    strcpy(answer, str);
-  return answer;
-}
-
-/*
-  create a not-a-number (nan)
-  Returns: nan
-  Portability warning: no ANSI standard way of generating nan()
- */
-static double makenan(void)
-{
-  return sqrt(-1.0);
-}
-
-/*
-  check for not-a number
-  Params: x - number to check
-  returns: 1 if a NAN, else 0.
-  Portability warning: not all compliers provide an isnan().
-*/
-static int myisnan(double x)
-{
-  return isnan(x);
-}
-
-/*
-  test function
-  Loads a csv file and prints out header.
- */
-int csvmain(int argc, char **argv)
-{
-  CSV *csv = 0;
-  int width;
-  int height;
-  int i;
-  int type;
-  const char *name;
-
-  if(argc == 2)
-    csv = loadcsv(argv[1]);
-  if(!csv)
-  {
-    printf("Failed\n");
-    exit(EXIT_FAILURE);
-  }
-  csv_getsize(csv, &width, &height);
-  printf("width %d height %d\n", width, height);
-
-  for(i=0;i<width;i++)
-  {
-    name = csv_column(csv, i, &type);
-    printf("%s %s\n", name, type == CSV_STRING ? "string" : "real");
-  }
-
-  killcsv(csv);
-
-  return 0;
-}
+/*
+  csv.c
+  code to load a comma-separated value file
+  by Malcolm McLean
+
+  The whole file is read into memory in large blocks and split into
+  fields in place, so each field is a pointer into the text. Lines
+  without quotes, which is nearly all of them, are split with memchr().
+  The data is then stored by column, as an array of doubles for a
+  numerical column or an array of pointers into the text for a string
+  column, so every field is only converted once.
+
+  With more than one worker thread a big file is cut into chunks at
+  record boundaries, found by a quick scan which only looks closely at
+  lines with quotes, and the chunks are split in parallel and joined
+  in order. The fields are then converted in parallel by bands of rows.
+  The result is exactly the same as loading on one thread.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <float.h> 
+#include <limits.h>
+#include <assert.h>
+
+#include "csv.h"
+#include "threadpool.h"
+
+#define CSV_BLOCKSIZE (1024 * 1024)
+#define CSV_CHUNKSPERTHREAD 4
+
+/*
+  the fields of the file, before we know the column types
+ */
+typedef struct
+{
+  char **cells;     /* fields in row-major order, 0 if empty */
+  int width;        /* fields per row */
+  int N;            /* number of rows */
+  int capacity;     /* rows allocated */
+} RECORDS;
+
+/*
+  splitting the file on worker threads
+ */
+typedef struct
+{
+  char **starts;    /* start of each chunk, and the end of the text */
+  RECORDS *chunks;  /* the records of each chunk */
+  int *errors;      /* set if a chunk fails */
+} SPLITJOB;
+
+/*
+  converting the fields on worker threads
+ */
+typedef struct
+{
+  CSV *csv;
+  RECORDS *rec;
+  int Njobs;
+  const int *t1;    /* type of the second row of each column */
+  int *uniform;     /* Njobs by width, rows match the second row */
+  int *nreal;       /* Njobs by width, count of numbers */
+  int *nstring;     /* Njobs by width, count of strings */
+} TYPEJOB;
+
+static char *loadtext(const char *fname, size_t *len);
+static int splitparallel(char *text, char *end, RECORDS *rec, int Nthreads);
+static void splitjob(void *ptr, int index);
+static char *findrecord(char *ptr, char *target, char *end);
+static char *skiprecord(char *ptr, char *end);
+static int splitrecords(char *ptr, char *end, RECORDS *rec);
+static int addrecord(RECORDS *rec, char **fields, int N);
+static char *scanfield(char *ptr, char *end, char **field, int *last);
+static char *trimfield(char *start, char *stop);
+static int buildcolumns(CSV *csv, RECORDS *rec, int Nthreads);
+static void typejob(void *ptr, int index);
+static int gettype(const char *str, double *x);
+static int fastnumber(const char *str, double *x);
+static double makenan(void);
+static int myisnan(double x);
+
+/*
+  load a csv file.
+  Params: fname - the name of the csv file to load.
+  Returns: a CSV object, 0 on fail. 
+ */
+CSV *loadcsv(const char *fname)
+{
+  CSV *answer;
+  RECORDS rec;
+  size_t len;
+  int Nthreads;
+
+  rec.cells = 0;
+  rec.width = 0;
+  rec.N = 0;
+  rec.capacity = 0;
+
+  answer = malloc(sizeof(CSV));
+  if(!answer)
+    return 0;
+  answer->names = 0;
+  answer->columns = 0;
+  answer->width = 0;
+  answer->height = 0;
+
+  answer->text = loadtext(fname, &len);
+  if(!answer->text)
+    goto error_exit;
+  Nthreads = threadpool_Nthreads();
+  if(len < CSV_BLOCKSIZE)
+    Nthreads = 1;
+  if(splitparallel(answer->text, answer->text + len, &rec, Nthreads))
+    goto error_exit;
+  if(rec.N > 0 && buildcolumns(answer, &rec, Nthreads))
+    goto error_exit;
+  free(rec.cells);
+
+  return answer;
+
+  /* clean up and return NULL */
+ error_exit:
+  free(rec.cells);
+  killcsv(answer);
+
+  return 0;
+}
+
+/*
+  destructor for csv object
+  Params: csv - pointer to object to destroy
+ */
+void killcsv(CSV *csv)
+{
+  int i;
+
+  if(!csv)
+    return;
+
+  if(csv->columns)
+  {
+    for(i=0;i<csv->width;i++)
+    {
+      free(csv->columns[i].x);
+      free(csv->columns[i].str);
+    }
+  }
+  free(csv->columns);
+  free(csv->names);
+  free(csv->text);
+
+  free(csv);
+}
+
+/*
+  get the dimensions of a CSV object
+  Params: CSV - the comma-separated data
+          width - return pointer for no columns
+          height - return pointer for no rows (excl header)
+ */
+void csv_getsize(CSV *csv, int *width, int *height)
+{
+  *width = csv->width;
+  *height = csv->height;
+}
+
+/*
+  is a data element present
+  Params: csv - pointer tot he object
+          col - coumn to test
+          row - row to test
+  Returns: 1 if data present for that object, else 0
+ */
+int csv_hasdata(CSV *csv, int col, int row)
+{
+  if(col < 0 || col >= csv->width)
+    return 0;
+  if(row < 0 || row >= csv->height)
+    return 0;
+  switch(csv->columns[col].type)
+  {
+    case CSV_REAL:
+      if(myisnan(csv->columns[col].x[row]))
+        return 0;
+      return 1;
+    case CSV_STRING:
+      if(csv->columns[col].str[row] == 0)
+        return 0;
+      return 1;
+    default:
+      return 0;
+  }
+  return 0;
+}
+
+/*
+  get numerical data
+  Params: csv - pointer to the object
+          col - column of data item
+          row - row of data item
+  Returns: value of data item.          
+ */
+double csv_get(CSV *csv, int col, int row)
+{
+  assert(col >= 0 && col < csv->width);
+  assert(row >= 0 && row < csv->height);
+  assert(csv->columns[col].type == CSV_REAL);
+ 
+  return csv->columns[col].x[row];
+}
+
+/*
+  get string data
+  Params: csv - pointer to the object
+          col - column of data item
+          row - row of data item
+  Returns: pointer to string data item.
+ */
+const char *csv_getstr(CSV *csv, int col, int row)
+{
+  assert(col >= 0 && col < csv->width);
+  assert(row >= 0 && row < csv->height);
+  assert(csv->columns[col].type == CSV_STRING);
+
+  return csv->columns[col].str[row];
+}
+
+/*
+  test if comma-separted values contains header row
+  Params: csv - pointer to the object
+  Returns: 1 if header present, 0 if absent
+ */
+int csv_hasheader(CSV *csv)
+{
+  return csv->names ? 1 : 0;
+}
+
+/*
+  get information about a csv column
+  Parmas: csv - pointer to object
+          col - colmn to get infromation about
+          type - return pointer type of colum (CSV_REAL, CSV_STRING)
+  Returns: pointer to column name, NULL if not present
+ */
+const char *csv_column(CSV *csv, int col, int *type)
+{
+  if(type)
+    *type = csv->columns[col].type;
+  if(csv->names)
+    return csv->names[col];
+  else
+    return 0;
+}
+
+/*
+  read a whole file into memory.
+  Params: fname - the file to read
+          len - return for the length of the text
+  Returns: malloced text, with a nul appended, 0 on fail.
+ */
+static char *loadtext(const char *fname, size_t *len)
+{
+  FILE *fp;
+  char *answer = 0;
+  char *temp;
+  size_t capacity = CSV_BLOCKSIZE;
+  size_t N = 0;
+  size_t Nread;
+
+  fp = fopen(fname, "rb");
+  if(!fp)
+    return 0;
+  answer = malloc(capacity);
+  if(!answer)
+    goto error_exit;
+  while( (Nread = fread(answer + N, 1, capacity - N - 1, fp)) > 0)
+  {
+    N += Nread;
+    if(N == capacity - 1)
+    {
+      temp = realloc(answer, capacity * 2);
+      if(!temp)
+        goto error_exit;
+      answer = temp;
+      capacity *= 2;
+    }
+  }
+  if(ferror(fp))
+    goto error_exit;
+  fclose(fp);
+  answer[N] = 0;
+  *len = N;
+
+  return answer;
+
+ error_exit:
+  fclose(fp);
+  free(answer);
+  return 0;
+}
+
+/*
+  split the text into records, in parallel chunks.
+  Params: text - the text of the file, which is modified
+          end - end of the text
+          rec - return for the fields
+          Nthreads - number of worker threads
+  Returns: 0 on success, -1 on fail.
+  Notes: the first record, which sets the width, is split here, then
+    the rest is cut into chunks which each start on a record, so each
+    chunk splits exactly as it would as part of the whole file.
+ */
+static int splitparallel(char *text, char *end, RECORDS *rec, int Nthreads)
+{
+  SPLITJOB job;
+  char *ptr = text;
+  char *next;
+  int Nchunks;
+  int total;
+  int i;
+  int error = 0;
+
+  while(ptr < end && rec->N == 0)
+  {
+    next = skiprecord(ptr, end);
+    if(splitrecords(ptr, next, rec))
+      return -1;
+    ptr = next;
+  }
+  if(Nthreads < 2 || ptr == end)
+    return splitrecords(ptr, end, rec);
+
+  Nchunks = Nthreads * CSV_CHUNKSPERTHREAD;
+  job.starts = malloc((Nchunks + 1) * sizeof(char *));
+  job.chunks = malloc(Nchunks * sizeof(RECORDS));
+  job.errors = malloc(Nchunks * sizeof(int));
+  if(!job.starts || !job.chunks || !job.errors)
+    goto error_exit;
+  job.starts[0] = ptr;
+  for(i=1;i<Nchunks;i++)
+    job.starts[i] = findrecord(job.starts[i-1], ptr + (end - ptr) / Nchunks * i, end);
+  job.starts[Nchunks] = end;
+  for(i=0;i<Nchunks;i++)
+  {
+    job.chunks[i].cells = 0;
+    job.chunks[i].width = rec->width;
+    job.chunks[i].N = 0;
+    job.chunks[i].capacity = 0;
+    job.errors[i] = 0;
+  }
+
+  parallelfor(Nchunks, Nthreads, splitjob, &job);
+
+  total = rec->N;
+  for(i=0;i<Nchunks;i++)
+  {
+    if(job.errors[i] || job.chunks[i].N > INT_MAX - total)
+      error = 1;
+    else
+      total += job.chunks[i].N;
+  }
+  if(!error && total > rec->capacity)
+  {
+    char **temp = realloc(rec->cells, (size_t) total * rec->width * sizeof(char *));
+    if(!temp)
+      error = 1;
+    else
+    {
+      rec->cells = temp;
+      rec->capacity = total;
+    }
+  }
+  for(i=0;i<Nchunks;i++)
+  {
+    if(!error && job.chunks[i].N > 0)
+    {
+      memcpy(rec->cells + (size_t) rec->N * rec->width, job.chunks[i].cells,
+        (size_t) job.chunks[i].N * rec->width * sizeof(char *));
+      rec->N += job.chunks[i].N;
+    }
+    free(job.chunks[i].cells);
+  }
+  free(job.starts);
+  free(job.chunks);
+  free(job.errors);
+
+  return error ? -1 : 0;
+
+ error_exit:
+  free(job.starts);
+  free(job.chunks);
+  free(job.errors);
+  return -1;
+}
+
+static void splitjob(void *ptr, int index)
+{
+  SPLITJOB *job = ptr;
+
+  if(splitrecords(job->starts[index], job->starts[index+1], &job->chunks[index]))
+    job->errors[index] = 1;
+}
+
+/*
+  find the first record starting at or after a point in the text.
+  Params: ptr - the start of a record before target
+          target - where we would like to start
+          end - end of the text
+  Returns: start of the record.
+  Notes: lines without quotes are records, so we only have to go record
+    by record through lines with quotes.
+ */
+static char *findrecord(char *ptr, char *target, char *end)
+{
+  char *newline;
+  char *stop;
+  char *quote;
+  char *line;
+
+  while(ptr < target)
+  {
+    newline = memchr(target - 1, '\n', end - (target - 1));
+    stop = newline ? newline : end;
+    quote = memchr(ptr, '"', stop - ptr);
+    if(!quote)
+      return newline ? newline + 1 : end;
+    line = quote;
+    while(line > ptr && line[-1] != '\n')
+      line--;
+    ptr = skiprecord(line, end);
+  }
+
+  return ptr;
+}
+
+/*
+  find the start of the next record, without changing the text.
+  Params: ptr - start of a record
+          end - end of the text
+  Returns: the start of the next record, or end.
+  Notes: must agree exactly with splitrecords() and scanfield().
+ */
+static char *skiprecord(char *ptr, char *end)
+{
+  char *lineend;
+  char *quote;
+
+  lineend = memchr(ptr, '\n', end - ptr);
+  if(!lineend)
+    lineend = end;
+  if(!memchr(ptr, '"', lineend - ptr))
+    return lineend < end ? lineend + 1 : end;
+
+  while(1)
+  {
+    while(ptr < end && *ptr != '\n' && isspace((unsigned char) *ptr))
+      ptr++;
+    if(ptr < end && *ptr == '"')
+    {
+      ptr++;
+      while(1)
+      {
+        quote = memchr(ptr, '"', end - ptr);
+        if(!quote)
+          return end;
+        if(quote + 1 < end && quote[1] == '"')
+          ptr = quote + 2;
+        else
+        {
+          ptr = quote + 1;
+          break;
+        }
+      }
+    }
+    while(ptr < end && *ptr != ',' && *ptr != '\n')
+      ptr++;
+    if(ptr == end)
+      return end;
+    if(*ptr++ == '\n')
+      return ptr;
+  }
+}
+
+/*
+  split the text into records and fields.
+  Params: ptr - the text, which is modified
+          end - end of the text
+          rec - return for the fields
+  Returns: 0 on success, -1 on fail.
+  Notes: fields are nul-terminated in place. Empty fields are 0.
+ */
+static int splitrecords(char *ptr, char *end, RECORDS *rec)
+{
+  char **fields = 0;
+  char **temp;
+  int capacity = 0;
+  int N;
+  char *lineend;
+  char *comma;
+  int last;
+
+  while(ptr < end)
+  {
+    N = 0;
+    lineend = memchr(ptr, '\n', end - ptr);
+    if(!lineend)
+      lineend = end;
+    /* quotes can hide commas and newlines, otherwise scan quickly */
+    if(!memchr(ptr, '"', lineend - ptr))
+    {
+      while(1)
+      {
+        comma = memchr(ptr, ',', lineend - ptr);
+        if(!comma)
+          comma = lineend;
+        if(N == capacity)
+        {
+          temp = realloc(fields, (capacity * 2 + 16) * sizeof(char *));
+          if(!temp)
+            goto error_exit;
+          fields = temp;
+          capacity = capacity * 2 + 16;
+        }
+        fields[N++] = trimfield(ptr, comma);
+        ptr = comma + 1;
+        if(comma == lineend)
+          break;
+      }
+    }
+    else
+    {
+      while(1)
+      {
+        if(N == capacity)
+        {
+          temp = realloc(fields, (capacity * 2 + 16) * sizeof(char *));
+          if(!temp)
+            goto error_exit;
+          fields = temp;
+          capacity = capacity * 2 + 16;
+        }
+        ptr = scanfield(ptr, end, &fields[N++], &last);
+        if(last)
+          break;
+      }
+    }
+    if(addrecord(rec, fields, N))
+      goto error_exit;
+  }
+  free(fields);
+
+  return 0;
+
+ error_exit:
+  free(fields);
+  return -1;
+}
+
+/*
+  add a record to the list.
+  Params: rec - the records
+          fields - the fields of the record
+          N - number of fields
+  Returns: 0 on success, -1 on fail.
+  Notes: csv file may contain lines of the wrong length.
+    Assume the first line contains the right number of columns, and
+    set the width from it unless it is already known.
+    Lines without records are just dropped, but a line of the wrong
+    length with records throws the file out.
+ */
+static int addrecord(RECORDS *rec, char **fields, int N)
+{
+  char **temp;
+  int i;
+
+  for(i=0;i<N;i++)
+    if(fields[i])
+      break;
+  if(i == N && (N == 1 || (rec->width > 0 && N != rec->width)))
+    return 0;
+  if(rec->width == 0)
+    rec->width = N;
+  else if(N != rec->width)
+    return -1;
+
+  if(rec->N == rec->capacity)
+  {
+    if(rec->capacity > (INT_MAX - 16) / 2)
+      return -1;
+    temp = realloc(rec->cells, (size_t) (rec->capacity * 2 + 16) * rec->width * sizeof(char *));
+    if(!temp)
+      return -1;
+    rec->cells = temp;
+    rec->capacity = rec->capacity * 2 + 16;
+  }
+  memcpy(rec->cells + (size_t) rec->N * rec->width, fields, N * sizeof(char *));
+  rec->N++;
+
+  return 0;
+}
+
+/*
+  scan a field which may be quoted.
+  Params: ptr - start of the field
+          end - end of the text
+          field - return for the field, 0 if empty
+          last - return set if the field ends the line
+  Returns: pointer past the delimiter after the field.
+  Notes: in a quoted field two quotes stand for one, and commas and
+    newlines are part of the field. Anything after the closing quote
+    is ignored.
+ */
+static char *scanfield(char *ptr, char *end, char **field, int *last)
+{
+  char *out;
+  char *quote;
+  char *start;
+
+  while(ptr < end && *ptr != '\n' && isspace((unsigned char) *ptr))
+    ptr++;
+  if(ptr == end || *ptr != '"')
+  {
+    start = ptr;
+    while(ptr < end && *ptr != ',' && *ptr != '\n')
+      ptr++;
+    *last = (ptr == end || *ptr == '\n');
+    *field = trimfield(start, ptr);
+    return ptr + 1;
+  }
+
+  *field = out = ++ptr;
+  while(1)
+  {
+    quote = memchr(ptr, '"', end - ptr);
+    if(!quote)
+    {
+      memmove(out, ptr, end - ptr);
+      out += end - ptr;
+      ptr = end;
+      break;
+    }
+    memmove(out, ptr, quote - ptr);
+    out += quote - ptr;
+    if(quote + 1 < end && quote[1] == '"')
+    {
+      *out++ = '"';
+      ptr = quote + 2;
+    }
+    else
+    {
+      ptr = quote + 1;
+      break;
+    }
+  }
+  while(ptr < end && *ptr != ',' && *ptr != '\n')
+    ptr++;
+  *last = (ptr == end || *ptr == '\n');
+  *out = 0;
+
+  return ptr + 1;
+}
+
+/*
+  strip whitespace from both ends of a raw field and terminate it.
+  Params: start - start of the field
+          stop - the delimiter after it
+  Returns: the field, 0 if it is empty.
+ */
+static char *trimfield(char *start, char *stop)
+{
+  while(start < stop && isspace((unsigned char) *start))
+    start++;
+  while(stop > start && isspace((unsigned char) stop[-1]))
+    stop--;
+  if(start == stop)
+    return 0;
+  *stop = 0;
+  return start;
+}
+
+/*
+  decide on the header and the column types, and convert the data.
+  Params: csv - the object to fill
+          rec - the fields
+  Returns: 0 on success, -1 on fail.
+  Notes: applies a heuristic. If the first row has a different type
+    from the rest of a column, which is all of one type, it is a header.
+    A column is a string column if any field is not a number.
+    Every field is converted only once, as we work out its type.
+ */
+static int buildcolumns(CSV *csv, RECORDS *rec, int Nthreads)
+{
+  TYPEJOB job;
+  int width = rec->width;
+  int N = rec->N;
+  int *t0 = 0;       /* type of the first row */
+  int *t1 = 0;       /* type of the second row */
+  int *uniform = 0;  /* rows after the first all have the type of the second */
+  int *nreal = 0;    /* numbers after the first row */
+  int *nstring = 0;  /* strings after the first row */
+  int Njobs = 1;
+  int header = 0;
+  int start;
+  int i, ii;
+
+  if(Nthreads > 1 && N > 2)
+    Njobs = Nthreads * CSV_CHUNKSPERTHREAD;
+  if(Njobs > N - 2)
+    Njobs = N > 2 ? N - 2 : 1;
+
+  csv->columns = malloc(width * sizeof(CSV_COLUMN));
+  t0 = malloc(width * sizeof(int));
+  t1 = malloc(width * sizeof(int));
+  uniform = malloc((size_t) Njobs * width * sizeof(int));
+  nreal = malloc((size_t) Njobs * width * sizeof(int));
+  nstring = malloc((size_t) Njobs * width * sizeof(int));
+  if(!csv->columns || !t0 || !t1 || !uniform || !nreal || !nstring)
+    goto error_exit;
+  csv->width = width;
+  for(i=0;i<width;i++)
+  {
+    csv->columns[i].type = CSV_NULL;
+    csv->columns[i].str = 0;
+    csv->columns[i].x = 0;
+  }
+  for(i=0;i<width;i++)
+  {
+    csv->columns[i].x = malloc(N * sizeof(double));
+    if(!csv->columns[i].x)
+      goto error_exit;
+    t0[i] = gettype(rec->cells[i], &csv->columns[i].x[0]);
+    t1[i] = CSV_NULL;
+  }
+  for(i=0;i<Njobs*width;i++)
+  {
+    uniform[i] = 1;
+    nreal[i] = 0;
+    nstring[i] = 0;
+  }
+  if(N >= 2)
+  {
+    for(i=0;i<width;i++)
+    {
+      t1[i] = gettype(rec->cells[width + i], &csv->columns[i].x[1]);
+      if(t1[i] == CSV_REAL)
+        nreal[i]++;
+      else if(t1[i] == CSV_STRING)
+        nstring[i]++;
+    }
+  }
+
+  if(N > 2)
+  {
+    job.csv = csv;
+    job.rec = rec;
+    job.Njobs = Njobs;
+    job.t1 = t1;
+    job.uniform = uniform;
+    job.nreal = nreal;
+    job.nstring = nstring;
+    parallelfor(Njobs, Nthreads, typejob, &job);
+    for(ii=1;ii<Njobs;ii++)
+    {
+      for(i=0;i<width;i++)
+      {
+        uniform[i] &= uniform[ii * width + i];
+        nreal[i] += nreal[ii * width + i];
+        nstring[i] += nstring[ii * width + i];
+      }
+    }
+  }
+
+  if(N >= 2)
+  {
+    for(i=0;i<width;i++)
+      if(uniform[i] && t0[i] != t1[i])
+        header = 1;
+  }
+  start = header ? 1 : 0;
+  csv->height = N - start;
+
+  if(header)
+  {
+    csv->names = malloc(width * sizeof(char *));
+    if(!csv->names)
+      goto error_exit;
+    for(i=0;i<width;i++)
+      csv->names[i] = rec->cells[i];
+  }
+
+  for(i=0;i<width;i++)
+  {
+    if(!header)
+    {
+      if(t0[i] == CSV_REAL)
+        nreal[i]++;
+      else if(t0[i] == CSV_STRING)
+        nstring[i]++;
+    }
+    if(nstring[i])
+    {
+      csv->columns[i].type = CSV_STRING;
+      free(csv->columns[i].x);
+      csv->columns[i].x = 0;
+      csv->columns[i].str = malloc((csv->height ? csv->height : 1) * sizeof(char *));
+      if(!csv->columns[i].str)
+        goto error_exit;
+      for(ii=0;ii<csv->height;ii++)
+        csv->columns[i].str[ii] = rec->cells[(size_t) (ii + start) * width + i];
+    }
+    else if(nreal[i])
+    {
+      csv->columns[i].type = CSV_REAL;
+      if(start)
+        memmove(csv->columns[i].x, csv->columns[i].x + 1, csv->height * sizeof(double));
+    }
+    else
+    {
+      free(csv->columns[i].x);
+      csv->columns[i].x = 0;
+    }
+  }
+
+  free(t0);
+  free(t1);
+  free(uniform);
+  free(nreal);
+  free(nstring);
+  return 0;
+
+ error_exit:
+  free(t0);
+  free(t1);
+  free(uniform);
+  free(nreal);
+  free(nstring);
+  return -1;
+}
+
+/*
+  convert the fields of a band of rows, from the third row on.
+ */
+static void typejob(void *ptr, int index)
+{
+  TYPEJOB *job = ptr;
+  int width = job->rec->width;
+  int rowstart = 2 + (int) ((double) (job->rec->N - 2) * index / job->Njobs);
+  int rowend = 2 + (int) ((double) (job->rec->N - 2) * (index + 1) / job->Njobs);
+  int *uniform = job->uniform + (size_t) index * width;
+  int *nreal = job->nreal + (size_t) index * width;
+  int *nstring = job->nstring + (size_t) index * width;
+  char *field;
+  int i, ii;
+  int t;
+
+  for(ii=rowstart;ii<rowend;ii++)
+  {
+    for(i=0;i<width;i++)
+    {
+      field = job->rec->cells[(size_t) ii * width + i];
+      t = gettype(field, &job->csv->columns[i].x[ii]);
+      if(field && t != job->t1[i])
+        uniform[i] = 0;
+      if(t == CSV_REAL)
+        nreal[i]++;
+      else if(t == CSV_STRING)
+        nstring[i]++;
+    }
+  }
+}
+
+/*
+  get the type of a field
+  Params: str - string containg data
+          x - return for the value, NaN if not a number
+  Returns: the type
+    CSV_NULL - no data
+    CSV_REAL - numerical data
+    CSV_STRING - string data
+ */
+static int gettype(const char *str, double *x)
+{
+  char *ptr;
+
+  if(!str)
+  {
+    *x = makenan();
+    return CSV_NULL;
+  }
+
+  if(fastnumber(str, x))
+    return CSV_REAL;
+  *x = strtod(str, &ptr);
+  if(*ptr == 0)
+    return CSV_REAL;
+  else
+    return CSV_STRING;
+}
+
+/*
+  convert a short plain decimal number quickly.
+  Params: str - the field
+          x - return for the value
+  Returns: 1 if converted, 0 if the field must go to strtod().
+  Notes: with at most 15 digits the digits are an exact double, and so
+    is a power of ten up to 1e22, so one division gives exactly the
+    correctly rounded result that strtod() would.
+ */
+static int fastnumber(const char *str, double *x)
+{
+  static const double powersoften[23] = 
+  {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+  double mantissa = 0;
+  int Ndigits = 0;
+  int Nfraction = 0;
+  int negative = 0;
+
+  if(*str == '-' || *str == '+')
+    negative = (*str++ == '-');
+  while(*str >= '0' && *str <= '9')
+  {
+    mantissa = mantissa * 10 + (*str++ - '0');
+    Ndigits++;
+  }
+  if(*str == '.')
+  {
+    str++;
+    while(*str >= '0' && *str <= '9')
+    {
+      mantissa = mantissa * 10 + (*str++ - '0');
+      Ndigits++;
+      Nfraction++;
+    }
+  }
+  if(*str || Ndigits == 0 || Ndigits > 15 || Nfraction > 22)
+    return 0;
+  if(Nfraction)
+    mantissa /= powersoften[Nfraction];
+  *x = negative ? -mantissa : mantissa;
+
+  return 1;
+}
+
+/*
+  create a not-a-number (nan)
+  Returns: nan
+  Portability warning: no ANSI standard way of generating nan()
+ */
+static double makenan(void)
+{
+  return sqrt(-1.0);
+}
+
+/*
+  check for not-a number
+  Params: x - number to check
+  returns: 1 if a NAN, else 0.
+  Portability warning: not all compliers provide an isnan().
+*/
+static int myisnan(double x)
+{
+  return isnan(x);
+}
+
+/*
+  test function
+  Loads a csv file and prints out header.
+ */
+int csvmain(int argc, char **argv)
+{
+  CSV *csv = 0;
+  int width;
+  int height;
+  int i;
+  int type;
+  const char *name;
+
+  if(argc == 2)
+    csv = loadcsv(argv[1]);
+  if(!csv)
+  {
+    printf("Failed\n");
+    exit(EXIT_FAILURE);
+  }
+  csv_getsize(csv, &width, &height);
+  printf("width %d height %d\n", width, height);
+
+  for(i=0;i<width;i++)
+  {
+    name = csv_column(csv, i, &type);
+    printf("%s %s\n", name, type == CSV_STRING ? "string" : "real");
+  }
+
+  killcsv(csv);
+
+  return 0;
+}
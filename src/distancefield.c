@@ -0,0 +1,203 @@
+/*
+  distancefield.c - signed distance fields for scalable bitmap fonts.
+
+  A glyph is rendered at a high resolution, then each pixel of a much
+  smaller field is set to the distance from its centre to the outline,
+  positive inside and negative outside. Drawn with bilinear filtering
+  and a threshold at the edge value, one field gives clean text over a
+  wide range of sizes.
+
+  The distances are exact Euclidean distances, computed with the
+  separable squared distance transform of Felzenszwalb and Huttenlocher,
+  which is linear in the number of pixels.
+
+  by Malcolm McLean
+ */
+#include <stdlib.h>
+#include <math.h>
+
+#include "distancefield.h"
+
+#define INF 1e20f
+
+/*
+  one dimensional squared distance transform.
+  Params: f - the squared distances along the line (0 or INF to start)
+          n - number of samples
+          d - return for the transformed distances
+          v - workspace, n ints
+          z - workspace, n + 1 floats
+ */
+static void edt1d(const float *f, int n, float *d, int *v, float *z)
+{
+  int k = 0;
+  int q;
+  float s;
+
+  v[0] = 0;
+  z[0] = -INF;
+  z[1] = INF;
+  for (q = 1; q < n; q++)
+  {
+    while (1)
+    {
+      s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2.0f * q - 2.0f * v[k]);
+      if (s > z[k])
+        break;
+      k--;
+    }
+    k++;
+    v[k] = q;
+    z[k] = s;
+    z[k+1] = INF;
+  }
+  k = 0;
+  for (q = 0; q < n; q++)
+  {
+    while (z[k+1] < q)
+      k++;
+    d[q] = (q - v[k]) * (q - v[k]) + f[v[k]];
+  }
+}
+
+/*
+  two dimensional squared distance transform, in place.
+  Params: grid - width x height, 0 on the pixels we measure to, INF elsewhere
+          width - grid width
+          height - grid height
+  Returns: 0 on success, -1 on out of memory.
+ */
+static int edt2d(float *grid, int width, int height)
+{
+  int N = width > height ? width : height;
+  float *f, *d, *z;
+  int *v;
+  int x, y;
+
+  /* cleared, so edt1d() can never read an unset value */
+  f = calloc(N > 0 ? N : 1, sizeof(float));
+  d = malloc(N * sizeof(float));
+  z = malloc((N + 1) * sizeof(float));
+  v = malloc(N * sizeof(int));
+  if (!f || !d || !z || !v)
+    goto out_of_memory;
+
+  for (x = 0; x < width; x++)
+  {
+    for (y = 0; y < height; y++)
+      f[y] = grid[y * width + x];
+    edt1d(f, height, d, v, z);
+    for (y = 0; y < height; y++)
+      grid[y * width + x] = d[y];
+  }
+  for (y = 0; y < height; y++)
+  {
+    edt1d(grid + y * width, width, d, v, z);
+    for (x = 0; x < width; x++)
+      grid[y * width + x] = d[x];
+  }
+
+  free(f);
+  free(d);
+  free(z);
+  free(v);
+  return 0;
+out_of_memory:
+  free(f);
+  free(d);
+  free(z);
+  free(v);
+  return -1;
+}
+
+/*
+  Make a signed distance field from a high resolution glyph.
+  Params: bitmap - grey levels, 128 or more is inside the glyph
+          width - bitmap width
+          height - bitmap height
+          stride - bytes per bitmap row
+          ox, oy - position of the bitmap in the field, in bitmap pixels
+          fwidth - field width
+          fheight - field height
+          scale - bitmap pixels to a field pixel
+          spread - distance in field pixels which maps to 0 and 255
+  Returns: fwidth x fheight distances, 0 on out of memory.
+  Notes: the edge is 128, inside is above and outside below. The field
+    should extend spread pixels beyond the glyph on every side.
+ */
+unsigned char *distancefield(const unsigned char *bitmap, int width, int height, int stride, int ox, int oy, int fwidth, int fheight, int scale, int spread)
+{
+  float *inside = 0;
+  float *outside = 0;
+  unsigned char *answer = 0;
+  int gwidth = fwidth * scale;
+  int gheight = fheight * scale;
+  int x, y;
+  int bx, by;
+  int gx, gy;
+  float dist;
+  long value;
+  int Nfield;
+
+  inside = malloc(gwidth * gheight * sizeof(float));
+  outside = malloc(gwidth * gheight * sizeof(float));
+  Nfield = fwidth * fheight;
+  answer = malloc(Nfield > 0 ? Nfield : 1);
+  if (!inside || !outside || !answer)
+    goto out_of_memory;
+
+  /* inside measures the distance to the glyph, outside the distance out of it */
+  for (gy = 0; gy < gheight; gy++)
+  {
+    for (gx = 0; gx < gwidth; gx++)
+    {
+      bx = gx - ox;
+      by = gy - oy;
+      if (bx >= 0 && bx < width && by >= 0 && by < height && bitmap[by * stride + bx] >= 128)
+      {
+        inside[gy * gwidth + gx] = 0;
+        outside[gy * gwidth + gx] = INF;
+      }
+      else
+      {
+        inside[gy * gwidth + gx] = INF;
+        outside[gy * gwidth + gx] = 0;
+      }
+    }
+  }
+  if (edt2d(inside, gwidth, gheight) || edt2d(outside, gwidth, gheight))
+    goto out_of_memory;
+
+  /*
+    sample at the centre of each field pixel. The distance is from
+    pixel centre to pixel centre, so the edge lies half a bitmap pixel
+    nearer.
+   */
+  for (y = 0; y < fheight; y++)
+  {
+    for (x = 0; x < fwidth; x++)
+    {
+      gx = x * scale + scale / 2;
+      gy = y * scale + scale / 2;
+      if (outside[gy * gwidth + gx] > 0)
+        dist = (float) sqrt(outside[gy * gwidth + gx]) - 0.5f;
+      else
+        dist = 0.5f - (float) sqrt(inside[gy * gwidth + gx]);
+      value = 128 + (long) floor(dist / scale * 127.0f / spread + 0.5f);
+      if (value < 0)
+        value = 0;
+      if (value > 255)
+        value = 255;
+      answer[y * fwidth + x] = (unsigned char) value;
+    }
+  }
+
+  free(inside);
+  free(outside);
+  return answer;
+out_of_memory:
+  free(inside);
+  free(outside);
+  free(answer);
+  return 0;
+}
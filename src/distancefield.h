@@ -0,0 +1,6 @@
+#ifndef distancefield_h
+#define distancefield_h
+
+unsigned char *distancefield(const unsigned char *bitmap, int width, int height, int stride, int ox, int oy, int fwidth, int fheight, int scale, int spread);
+
+#endif
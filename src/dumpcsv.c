@@ -2,10 +2,57 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
+#include <math.h>
 
 #include "asciitostring.h"
+#include "formatreal.h"
 #include "dumpcsv.h"
 
+/* C types for numerical columns, narrowest last */
+#define NUM_DOUBLE 0
+#define NUM_FLOAT 1
+#define NUM_INT 2
+
+static const char *numtypenames[3] = {"double", "float", "int"};
+
+/*
+  the narrowest C type which holds every value of a numerical column
+  exactly. Missing values are NANs, so need a floating point type.
+ */
+static int getnumerictype(CSV *csv, int col)
+{
+    int width, height;
+    int answer = NUM_INT;
+    double x;
+    int i;
+
+    csv_getsize(csv, &width, &height);
+    for (i = 0; i < height; i++)
+    {
+        x = csv_get(csv, col, i);
+        if (answer == NUM_INT && (!csv_hasdata(csv, col, i) || 
+            x != floor(x) || x < INT_MIN || x > INT_MAX))
+            answer = NUM_FLOAT;
+        if (answer == NUM_FLOAT && !isfloatexact(x))
+            return NUM_DOUBLE;
+    }
+
+    return answer;
+}
+
+static void writenumber(FILE *fp, double x, int numtype)
+{
+    char buff[FORMATREAL_BUFFSIZE];
+
+    if (numtype == NUM_INT)
+        fprintf(fp, "%d, ", (int) x);
+    else if (numtype == NUM_FLOAT)
+        fprintf(fp, "%s, ", formatfloat(buff, (float) x));
+    else
+        fprintf(fp, "%s, ", formatdouble(buff, x));
+}
+
 
 
 static char *getfieldname(const char *columnheader)
@@ -98,37 +145,42 @@ static int isstringtable(CSV *csv)
 }
 
 
-static int dumpasmatrix(FILE *fp, int headerfile,  const char *name, CSV *csv)
+static int dumpasmatrix(FILE *fp, int headerfile,  const char *name, CSV *csv, int compact)
 {
     int width, height;
     int i, ii;
+    int numtype = NUM_DOUBLE;
+    int coltype;
     
     csv_getsize(csv, &width, &height);
     if (width <= 0 || height <= 0)
         return -2;
+
+    if (compact)
+    {
+        numtype = NUM_INT;
+        for (i = 0; i < width; i++)
+        {
+            coltype = getnumerictype(csv, i);
+            if (coltype < numtype)
+                numtype = coltype;
+        }
+    }
     
     if (headerfile)
     {
-        fprintf(fp, "extern double %s[%d][%d];\n", name, height, width);
+        fprintf(fp, "extern %s %s[%d][%d];\n", numtypenames[numtype], name, height, width);
         return 0;
     }
     
-    fprintf(fp, "double %s[%d][%d] =\n", name, height, width);
+    fprintf(fp, "%s %s[%d][%d] =\n", numtypenames[numtype], name, height, width);
     fprintf(fp, "{\n");
     for (i = 0; i < height; i++)
     {
         fprintf(fp, "\t{");
         for (ii =0; ii < width; ii++)
         {
-            if (csv_hasdata(csv, ii, i))
-            {
-                double x = csv_get(csv, ii, i);
-                fprintf(fp, "%g, ", x);
-            }
-            else
-            {
-                fprintf(fp, "NAN, ");
-            }
+            writenumber(fp, csv_get(csv, ii, i), numtype);
         }
         fprintf(fp, "},\n");
     }
@@ -181,7 +233,7 @@ static int dumpasstringmatrix(FILE *fp, int headerfile, const char *name, CSV *c
 }
 
 
-static int dumpwithheader(FILE *fp, int headerfile, const char *name, CSV *csv)
+static int dumpwithheader(FILE *fp, int headerfile, const char *name, CSV *csv, int compact)
 {
     int width, height;
     int i, ii;
@@ -190,11 +242,26 @@ static int dumpwithheader(FILE *fp, int headerfile, const char *name, CSV *csv)
     char *structname;
     const char *str;
     char *cstr;
+    int *numtypes;
     
     structname = makestructname(name);
     
     
     csv_getsize(csv, &width, &height);
+    numtypes = malloc((width ? width : 1) * sizeof(int));
+    if (!structname || !numtypes)
+    {
+        free(structname);
+        free(numtypes);
+        return -1;
+    }
+    for (i = 0; i < width; i++)
+    {
+        csv_column(csv, i, &fieldtype);
+        numtypes[i] = NUM_DOUBLE;
+        if (compact && fieldtype == CSV_REAL)
+            numtypes[i] = getnumerictype(csv, i);
+    }
             
     fprintf(fp, "typedef struct\n");
     fprintf(fp, "{\n");
@@ -208,7 +275,7 @@ static int dumpwithheader(FILE *fp, int headerfile, const char *name, CSV *csv)
                 fprintf(fp, "\tint %s_null;\n", fieldname);
                 break;
             case CSV_REAL:
-                fprintf(fp, "\tdouble %s;\n", fieldname);
+                fprintf(fp, "\t%s %s;\n", numtypenames[numtypes[i]], fieldname);
                 break;
             case CSV_STRING:
                 fprintf(fp, "\tconst char *%s;\n", fieldname);
@@ -225,6 +292,7 @@ static int dumpwithheader(FILE *fp, int headerfile, const char *name, CSV *csv)
     {
         fprintf(fp, "extern %s %s[%d];\n", structname, name, height);
         free(structname);
+        free(numtypes);
         return 0;
     }
     
@@ -242,7 +310,7 @@ static int dumpwithheader(FILE *fp, int headerfile, const char *name, CSV *csv)
                     fprintf(fp, "0, ");
                     break;
                 case CSV_REAL:
-                    fprintf(fp, "%g, ", csv_get(csv, ii, i));
+                    writenumber(fp, csv_get(csv, ii, i), numtypes[ii]);
                     break;
                 case CSV_STRING:
                     str = csv_getstr(csv, ii, i);
@@ -260,23 +328,35 @@ static int dumpwithheader(FILE *fp, int headerfile, const char *name, CSV *csv)
     fprintf(fp, "};\n\n");
 
     free(structname);
+    free(numtypes);
 
     return 0;
 
 }
 
-int dumpcsv(FILE *fp, int headerfile, const char *name, CSV *csv)
+/*
+  write a dataframe as C
+  Params: fp - the output file
+          headerfile - set to write declarations only
+          name - the name of the data
+          csv - the data
+          compact - set to store numerical columns as int or float
+            when every value fits exactly
+  Returns: 0 on success, -1 on fail
+ */
+int dumpcsv(FILE *fp, int headerfile, const char *name, CSV *csv, int compact)
 {
   int answer = 0;
     
   if (csv_hasheader(csv))
   {
-      dumpwithheader(fp, headerfile, name, csv);
+      if (dumpwithheader(fp, headerfile, name, csv, compact) == -1)
+          answer = -1;
   }
   else
   {
       if (isrealmatrix(csv))
-          dumpasmatrix(fp, headerfile, name, csv);
+          dumpasmatrix(fp, headerfile, name, csv, compact);
       else if (isstringtable(csv))
           dumpasstringmatrix(fp, headerfile, name, csv);
       else
@@ -0,0 +1,180 @@
+/*
+  formatreal.c - write floating point numbers as short C literals.
+
+  The number is written with the fewest significant digits which read
+  back as exactly the same value, so 0.1 is "0.1" and not 
+  "0.10000000000000001", and nothing is lost, as it is with "%g".
+
+  Most numbers in data have only a few decimal places, and those we can
+  do directly. If the digits and the power of ten are both exact
+  doubles, dividing one by the other gives the correctly rounded value
+  that strtod() or the C compiler would read, so we can find the fewest
+  decimal places which give the number back without any printf() or
+  strtod() calls. Anything else goes through printf() at 15, 16 and 17
+  digits, and 17 is always enough.
+
+  by Malcolm McLean
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+#include "formatreal.h"
+
+static const double powersoften[23] = 
+{
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static int formatspecial(char *buff, double x);
+static int formatdecimal(char *buff, double x);
+static void writedecimal(char *buff, double mantissa, int Nplaces);
+
+/*
+  write a double as the shortest literal which reads back exactly.
+  Params: buff - return for the text, FORMATREAL_BUFFSIZE bytes
+          x - the number
+  Returns: buff
+  Notes: nans and infinities are written as NAN and INFINITY, from
+    math.h.
+ */
+char *formatdouble(char *buff, double x)
+{
+  int precision;
+
+  if(formatspecial(buff, x))
+    return buff;
+  if(formatdecimal(buff, x))
+    return buff;
+  /* 15 digits always survive the round trip, except in subnormals */
+  for(precision=fabs(x) < DBL_MIN ? 1 : 15;precision<17;precision++)
+  {
+    sprintf(buff, "%.*g", precision, x);
+    if(strtod(buff, 0) == x)
+      return buff;
+  }
+  sprintf(buff, "%.17g", x);
+
+  return buff;
+}
+
+/*
+  write a float as the shortest literal which reads back exactly.
+  Params: buff - return for the text, FORMATREAL_BUFFSIZE bytes
+          x - the number
+  Returns: buff
+  Notes: the literal has no f suffix, and gives the same float whether
+    the compiler reads it as a float or as a double and converts it.
+ */
+char *formatfloat(char *buff, float x)
+{
+  double d;
+  int precision;
+
+  if(formatspecial(buff, x))
+    return buff;
+  for(precision=fabs(x) < FLT_MIN ? 1 : 6;precision<9;precision++)
+  {
+    sprintf(buff, "%.*g", precision, (double) x);
+    d = strtod(buff, 0);
+    if((float) d == x && strtof(buff, 0) == x)
+      return buff;
+  }
+  sprintf(buff, "%.9g", (double) x);
+
+  return buff;
+}
+
+/*
+  can a double be stored as a float with no loss
+  Params: x - the number
+  Returns: 1 if a float holds it exactly, else 0.
+ */
+int isfloatexact(double x)
+{
+  if(isnan(x))
+    return 1;
+  if(fabs(x) > FLT_MAX && !isinf(x))
+    return 0;
+  return (double) (float) x == x;
+}
+
+/*
+  nans and infinities
+ */
+static int formatspecial(char *buff, double x)
+{
+  if(isnan(x))
+    strcpy(buff, "NAN");
+  else if(isinf(x))
+    strcpy(buff, x < 0 ? "-INFINITY" : "INFINITY");
+  else
+    return 0;
+  return 1;
+}
+
+/*
+  the fast path, for numbers from 0.0001 to 1e15 with few digits.
+  Returns: 1 if written, 0 if the number needs printf().
+ */
+static int formatdecimal(char *buff, double x)
+{
+  double ax = fabs(x);
+  double scaled;
+  double mantissa;
+  int Nplaces;
+
+  if(x == 0)
+  {
+    strcpy(buff, signbit(x) ? "-0.0" : "0");
+    return 1;
+  }
+  if(ax < 1e-4 || ax >= 1e15)
+    return 0;
+  for(Nplaces=0;Nplaces<23;Nplaces++)
+  {
+    scaled = ax * powersoften[Nplaces];
+    if(scaled >= 9007199254740992.0)
+      return 0;
+    mantissa = floor(scaled + 0.5);
+    if(mantissa / powersoften[Nplaces] == ax)
+    {
+      if(x < 0)
+        *buff++ = '-';
+      writedecimal(buff, mantissa, Nplaces);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/*
+  write an integral mantissa with a decimal point Nplaces from the right.
+ */
+static void writedecimal(char *buff, double mantissa, int Nplaces)
+{
+  char digits[32];
+  int Ndigits = 0;
+  int i;
+  double tenth;
+
+  while(mantissa > 0)
+  {
+    tenth = floor(mantissa / 10);
+    digits[Ndigits++] = (char) ('0' + (int) (mantissa - tenth * 10));
+    mantissa = tenth;
+  }
+  while(Ndigits <= Nplaces)
+    digits[Ndigits++] = '0';
+  for(i=Ndigits-1;i>=0;i--)
+  {
+    *buff++ = digits[i];
+    if(i == Nplaces && i > 0)
+      *buff++ = '.';
+  }
+  *buff = 0;
+}
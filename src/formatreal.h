@@ -0,0 +1,11 @@
+#ifndef formatreal_h
+#define formatreal_h
+
+/* big enough for any number formatreal writes */
+#define FORMATREAL_BUFFSIZE 32
+
+char *formatdouble(char *buff, double x);
+char *formatfloat(char *buff, float x);
+int isfloatexact(double x);
+
+#endif
@@ -626,6 +626,14 @@ extern "C" {
 
 	EXPORT_DEF TT_Error TT_Set_Raster_Gray_Palette(TT_Engine engine, TT_Byte * palette);
 
+	/* Choose how pixmaps are anti-aliased.  By default each pixel is */
+	/* sampled 2x2 and given one of the 5 palette colours.  With      */
+	/* coverage set, each pixel is the exact area of it covered by    */
+	/* the outline, from 0 (background) to 255 (foreground), and the  */
+	/* palette isn't used.                                            */
+
+	EXPORT_DEF TT_Error TT_Set_Raster_Coverage(TT_Engine engine, TT_Bool coverage);
+
 	/* ----------------------- face management ----------------------- */
 
 	/* Open a new TrueType font file, and returns a handle for  */
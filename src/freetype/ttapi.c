@@ -55,6 +55,9 @@
 #define RENDER_Gray_Glyph( glyph, target, palette ) \
           Render_Gray_Glyph( RAS_OPS  glyph, target, palette )
 
+#define RENDER_Coverage_Glyph( glyph, target ) \
+          Render_Coverage_Glyph( RAS_OPS  glyph, target )
+
 /*******************************************************************
  *
  *  Function    :  TT_FreeType_Version
@@ -131,6 +134,7 @@ EXPORT_FUNC TT_Error TT_Init_FreeType(TT_Engine * engine)
 	/* set the gray palette defaults: 0 to 4 */
 	for (n = 0; n < 5; n++)
 		_engine->raster_palette[n] = (Byte) n;	/* Conversion ok, some warn */
+	_engine->raster_coverage = FALSE;
 
 	/* create the engine lock */
 	MUTEX_Create(_engine->lock);
@@ -217,6 +221,34 @@ EXPORT_FUNC TT_Error TT_Set_Raster_Gray_Palette(TT_Engine engine, Byte * palette
 	return TT_Err_Ok;
 }
 
+/*******************************************************************
+ *
+ *  Function    :  TT_Set_Raster_Coverage
+ *
+ *  Description :  Chooses the anti-aliasing of pixmaps, the 5 level
+ *                 palette or 256 levels of exact area coverage.
+ *
+ *  Input  :  engine        FreeType engine instance
+ *            coverage      true for exact area coverage
+ *
+ *  Output :  Error code.
+ *
+ *  MT-Note:  NO!  Unprotected modification of an engine's settings.
+ *
+ ******************************************************************/
+
+EXPORT_FUNC TT_Error TT_Set_Raster_Coverage(TT_Engine engine, TT_Bool coverage)
+{
+	PEngine_Instance _engine = HANDLE_Engine(engine);
+
+	if (!_engine)
+		return TT_Err_Invalid_Engine;
+
+	_engine->raster_coverage = coverage ? TRUE : FALSE;
+
+	return TT_Err_Ok;
+}
+
 #endif							/* TT_CONFIG_OPTION_GRAY_SCALING */
 
 /*******************************************************************
@@ -1437,7 +1469,10 @@ EXPORT_FUNC TT_Error TT_Get_Outline_Pixmap(TT_Engine engine, TT_Outline * outlin
 		return TT_Err_Invalid_Argument;
 
 	MUTEX_Lock(_engine->raster_lock);
-	error = RENDER_Gray_Glyph(outline, map, _engine->raster_palette);
+	if (_engine->raster_coverage)
+		error = RENDER_Coverage_Glyph(outline, map);
+	else
+		error = RENDER_Gray_Glyph(outline, map, _engine->raster_palette);
 	MUTEX_Release(_engine->raster_lock);
 	return error;
 }
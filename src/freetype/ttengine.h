@@ -66,6 +66,7 @@ extern "C" {
 		TMutex raster_lock;		/* mutex for this engine's render pool   */
 		void *raster_component;	/* ttraster implementation depedent      */
 		Byte raster_palette[5];	/* gray-levels palette for anti-aliasing */
+		Bool raster_coverage;	/* anti-alias by exact area coverage     */
 
 		void *extension_component;	/* extensions dependent */
 
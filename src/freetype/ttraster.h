@@ -100,6 +100,10 @@ extern "C" {
 	/* Palette points to an array of 5 colors used for the rendering. */
 	/* Use NULL to reuse the last palette. Default is VGA graylevels. */
 	LOCAL_DEF TT_Error Render_Gray_Glyph(RAS_ARGS TT_Outline * glyph, TT_Raster_Map * target, Byte * palette);
+
+	/* Render one glyph in the target pixmap at 256 gray levels, */
+	/* by the exact area of each pixel the outline covers.       */
+	LOCAL_DEF TT_Error Render_Coverage_Glyph(RAS_ARGS TT_Outline * glyph, TT_Raster_Map * target);
 #endif
 
 	/* Initialize rasterizer */
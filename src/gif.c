@@ -14,6 +14,7 @@
 #include <assert.h>
 
 #include "rbtree.h"
+#include "gif.h"
 
 typedef struct
 {
@@ -71,6 +72,11 @@ static int loadheader(SCREEN *scr, FILE *fp);
 static int loadimageheader(LOCAL *local, FILE *fp);
 static int loadtransparency(FILE *fp);
 static int loadpalette(FILE *fp, unsigned char *pal, int N);
+static int loadgraphiccontrol(FILE *fp, int *disposal, int *delay, int *transparent);
+static int skipextension(FILE *fp);
+static void pasteframe(unsigned char *canvas, int swidth, int sheight, const unsigned char *index, LOCAL *local, const unsigned char *pal, int transparent);
+static void clearrect(unsigned char *canvas, int swidth, int sheight, LOCAL *local);
+static void dirtyrect(const unsigned char *last, const unsigned char *canvas, int swidth, int sheight, const LOCAL *local, const LOCAL *disposed, int *x, int *y, int *w, int *h);
 static int loadraster(unsigned char *out, FILE *fp, int width, int height);
 static int saveraster(unsigned char *data, FILE *fp, int width, int height, int codesize);
 static int lzwcompress(void *data, int len, void *out, int outlen, int codesize);
@@ -166,6 +172,206 @@ unsigned char *loadgif(char *fname, int *width, int *height, unsigned char *pal,
   return answer;
 }
 
+/*
+  load an animated gif file, as the first frame plus the rectangle of
+  each later frame which changes.
+  Params: fname - name of file to load
+          width - return pointer for the logical screen width
+          height - return pointer for the logical screen height
+          frames - return pointer for the frame table
+          Nframes - return pointer for number of frames
+          Nbytes - return pointer for number of bytes of pixel data
+  Returns: the rgba pixel data, the whole of the first frame followed by
+    the changed rectangle of each later frame (0 on fail).
+  Notes: graphic control extension disposal methods are honoured,
+    "restore to background" clears to transparent, as browsers do.
+    Local palettes override the global palette for one frame only.
+    A frame with no pixels is an empty frame, shown for its delay.
+    Only the frame being built and the last frame are held, plus a
+    save for "restore to previous". The changed rectangle is searched
+    for only where the new image and the last disposal touched.
+ */
+unsigned char *loadgifanimation(char *fname, int *width, int *height, GIFFRAME **frames, int *Nframes, unsigned long *Nbytes)
+{
+  FILE *fp;
+  SCREEN screen;
+  LOCAL header;
+  LOCAL disposed;
+  unsigned char globalpal[256 * 3];
+  unsigned char localpal[256 * 3];
+  unsigned char *canvas = 0;
+  unsigned char *last = 0;
+  unsigned char *previous = 0;
+  unsigned char *index = 0;
+  unsigned char *rgba = 0;
+  unsigned long rgbalen = 0;
+  unsigned long rgbacapacity = 0;
+  GIFFRAME *table = 0;
+  int capacity = 0;
+  void *temp;
+  int N = 0;
+  int disposal = 0;
+  int delay = 0;
+  int transparent = -1;
+  size_t framesize;
+  int x, y, w, h;
+  int i;
+  int ch;
+
+  fp = fopen(fname, "rb");
+  if(!fp)
+    return 0;
+
+  if(loadheader(&screen, fp) == -1)
+    goto error_exit;
+  memset(globalpal, 0, sizeof(globalpal));
+  if(screen.global_colourmap)
+    loadpalette(fp, globalpal, 1 << screen.bits_per_pixel);
+
+  if(screen.screenwidth <= 0 || screen.screenheight <= 0)
+    goto error_exit;
+  framesize = (size_t) screen.screenwidth * screen.screenheight * 4;
+  canvas = calloc(framesize, 1);
+  last = malloc(framesize);
+  previous = malloc(framesize);
+  if(!canvas || !last || !previous)
+    goto error_exit;
+  disposed.left = 0;
+  disposed.top = 0;
+  disposed.width = 0;
+  disposed.height = 0;
+
+  while( (ch = fgetc(fp)) != EOF && ch != ';')
+  {
+    if(ch == '!')
+    {
+      ch = fgetc(fp);
+      if(ch == 0xF9)
+      {
+        if(loadgraphiccontrol(fp, &disposal, &delay, &transparent) == -1)
+          goto error_exit;
+      }
+      else if(skipextension(fp) == -1)
+        goto error_exit;
+    }
+    else if(ch == ',')
+    {
+      ungetc(ch, fp);
+      if(loadimageheader(&header, fp) == -1)
+        goto error_exit;
+      if(header.use_local)
+      {
+        memset(localpal, 0, sizeof(localpal));
+        loadpalette(fp, localpal, 1 << header.bits_per_pixel);
+      }
+      if(header.width == 0 || header.height == 0)
+      {
+        /* an empty image, skip its code size and data sub-blocks */
+        if(fgetc(fp) == EOF || skipextension(fp) == -1)
+          goto error_exit;
+      }
+      else
+      {
+        index = malloc(header.width * header.height);
+        if(!index)
+          goto error_exit;
+        if(loadraster(index, fp, header.width, header.height) == -1)
+          goto error_exit;
+        if(header.interlaced && uninterlace(index, header.width, header.height) == -1)
+          goto error_exit;
+      }
+
+      if(disposal == 3)
+        memcpy(previous, canvas, framesize);
+      pasteframe(canvas, screen.screenwidth, screen.screenheight, index, &header,
+                 header.use_local ? localpal : globalpal, transparent);
+      free(index);
+      index = 0;
+
+      if(N == 0)
+      {
+        x = 0;
+        y = 0;
+        w = screen.screenwidth;
+        h = screen.screenheight;
+      }
+      else
+        dirtyrect(last, canvas, screen.screenwidth, screen.screenheight,
+                  &header, &disposed, &x, &y, &w, &h);
+
+      if(N == capacity)
+      {
+        temp = realloc(table, (capacity * 2 + 16) * sizeof(GIFFRAME));
+        if(!temp)
+          goto error_exit;
+        table = temp;
+        capacity = capacity * 2 + 16;
+      }
+      if(rgbalen + (unsigned long) w * h * 4 > rgbacapacity)
+      {
+        while(rgbalen + (unsigned long) w * h * 4 > rgbacapacity)
+          rgbacapacity = rgbacapacity * 2 + framesize;
+        temp = realloc(rgba, rgbacapacity);
+        if(!temp)
+          goto error_exit;
+        rgba = temp;
+      }
+      table[N].x = x;
+      table[N].y = y;
+      table[N].width = w;
+      table[N].height = h;
+      table[N].delay = delay;
+      table[N].offset = rgbalen;
+      for(i = 0; i < h; i++)
+      {
+        memcpy(rgba + rgbalen, canvas + ((size_t) (y + i) * screen.screenwidth + x) * 4, w * 4);
+        rgbalen += w * 4;
+      }
+      N++;
+      memcpy(last, canvas, framesize);
+
+      if(disposal == 2)
+        clearrect(canvas, screen.screenwidth, screen.screenheight, &header);
+      else if(disposal == 3)
+        memcpy(canvas, previous, framesize);
+      if(disposal == 2 || disposal == 3)
+        disposed = header;
+      else
+        disposed.width = 0;
+      disposal = 0;
+      delay = 0;
+      transparent = -1;
+    }
+    else
+      goto error_exit;
+  }
+  if(N == 0)
+    goto error_exit;
+
+  fclose(fp);
+  free(canvas);
+  free(last);
+  free(previous);
+
+  *width = screen.screenwidth;
+  *height = screen.screenheight;
+  *frames = table;
+  *Nframes = N;
+  *Nbytes = rgbalen;
+
+  return rgba;
+
+error_exit:
+  fclose(fp);
+  free(canvas);
+  free(last);
+  free(previous);
+  free(index);
+  free(rgba);
+  free(table);
+  return 0;
+}
+
 /*
   save an image in gif format.
   Params: fname - name of file to save.
@@ -348,6 +554,57 @@ static int loadtransparency(FILE *fp)
     return -1;
 } 
 
+/*
+  load a graphic control extension (introducer already read)
+  Params: fp - pointer to an open file
+          disposal - return for disposal method
+          delay - return for frame delay, hundredths of a second
+          transparent - return for transparent index (-1 if none)
+  Returns: 0 on success, -1 on fail.
+ */
+static int loadgraphiccontrol(FILE *fp, int *disposal, int *delay, int *transparent)
+{
+  int len;
+  int pack;
+  int transparentindex;
+
+  len = fgetc(fp);
+  if(len != 4)
+  {
+    ungetc(len, fp);
+    return skipextension(fp);
+  }
+  pack = fgetc(fp);
+  *delay = fgetu16le(fp);
+  transparentindex = fgetc(fp);
+  if(fgetc(fp) != 0)
+    return -1;
+  *disposal = (pack >> 2) & 0x07;
+  *transparent = (pack & 0x01) ? transparentindex : -1;
+
+  return 0;
+}
+
+/*
+  skip the sub-blocks of an extension we don't understand
+  Params: fp - pointer to an open file (positioned after the label)
+  Returns: 0 on success, -1 on fail.
+ */
+static int skipextension(FILE *fp)
+{
+  int len;
+
+  while( (len = fgetc(fp)) != 0)
+  {
+    if(len == EOF)
+      return -1;
+    if(fseek(fp, len, SEEK_CUR) != 0)
+      return -1;
+  }
+
+  return 0;
+}
+
 /*
   load the image header data
   Params: local - return pointer to local image structure
@@ -545,6 +802,139 @@ int loadraster(unsigned char *out, FILE *fp, int width, int height)
   return 0;
 }
 
+/*
+  draw a decoded frame onto the rgba canvas
+  Params: canvas - the logical screen, rgba
+          swidth - screen width
+          sheight - screen height
+          index - the frame's pixel indices
+          local - the frame's image header
+          pal - palette to use
+          transparent - transparent index (-1 if none)
+  Notes: transparent pixels leave the canvas untouched, frames are
+    clipped to the logical screen.
+ */
+static void pasteframe(unsigned char *canvas, int swidth, int sheight, const unsigned char *index, LOCAL *local, const unsigned char *pal, int transparent)
+{
+  int x, y;
+  int sx, sy;
+  int ix;
+  unsigned char *pixel;
+
+  for(y=0;y<local->height;y++)
+  {
+    sy = local->top + y;
+    if(sy >= sheight)
+      break;
+    for(x=0;x<local->width;x++)
+    {
+      sx = local->left + x;
+      if(sx >= swidth)
+        break;
+      ix = index[y * local->width + x];
+      if(ix == transparent)
+        continue;
+      pixel = canvas + (sy * swidth + sx) * 4;
+      pixel[0] = pal[ix*3];
+      pixel[1] = pal[ix*3+1];
+      pixel[2] = pal[ix*3+2];
+      pixel[3] = 0xFF;
+    }
+  }
+}
+
+/*
+  clear a frame's rectangle to transparent (disposal method 2)
+  Params: canvas - the logical screen, rgba
+          swidth - screen width
+          sheight - screen height
+          local - header of the frame to dispose
+ */
+static void clearrect(unsigned char *canvas, int swidth, int sheight, LOCAL *local)
+{
+  int y;
+  int width;
+
+  if(local->left >= swidth)
+    return;
+  width = local->width;
+  if(local->left + width > swidth)
+    width = swidth - local->left;
+  for(y=local->top;y<local->top + local->height && y < sheight;y++)
+    memset(canvas + (y * swidth + local->left) * 4, 0, width * 4);
+}
+
+/*
+  find the rectangle that changed between the last frame and the canvas
+  Params: last - the last frame
+          canvas - the new frame
+          swidth - screen width
+          sheight - screen height
+          local - the image just pasted
+          disposed - the image disposed of after the last frame (width 0 if none)
+          x, y, w, h - return for the rectangle, all 0 if nothing changed
+  Notes: nothing outside the image and the disposed image can change, so
+    only the box around them is searched.
+ */
+static void dirtyrect(const unsigned char *last, const unsigned char *canvas, int swidth, int sheight, const LOCAL *local, const LOCAL *disposed, int *x, int *y, int *w, int *h)
+{
+  int left = local->left;
+  int top = local->top;
+  int right = local->left + local->width;
+  int bottom = local->top + local->height;
+  int minx, miny, maxx = -1, maxy = -1;
+  int ix, iy;
+  const unsigned char *a, *b;
+
+  if(disposed->width > 0 && disposed->height > 0)
+  {
+    if(disposed->left < left)
+      left = disposed->left;
+    if(disposed->top < top)
+      top = disposed->top;
+    if(disposed->left + disposed->width > right)
+      right = disposed->left + disposed->width;
+    if(disposed->top + disposed->height > bottom)
+      bottom = disposed->top + disposed->height;
+  }
+  if(right > swidth)
+    right = swidth;
+  if(bottom > sheight)
+    bottom = sheight;
+
+  minx = right;
+  miny = bottom;
+  for(iy = top; iy < bottom; iy++)
+  {
+    a = last + ((size_t) iy * swidth + left) * 4;
+    b = canvas + ((size_t) iy * swidth + left) * 4;
+    if(left >= right || !memcmp(a, b, (right - left) * 4))
+      continue;
+    if(iy < miny)
+      miny = iy;
+    maxy = iy;
+    for(ix = 0; ix < right - left; ix++)
+    {
+      if(memcmp(a + ix * 4, b + ix * 4, 4))
+      {
+        if(ix + left < minx)
+          minx = ix + left;
+        if(ix + left > maxx)
+          maxx = ix + left;
+      }
+    }
+  }
+  if(maxy < 0)
+  {
+    *x = *y = *w = *h = 0;
+    return;
+  }
+  *x = minx;
+  *y = miny;
+  *w = maxx - minx + 1;
+  *h = maxy - miny + 1;
+}
+
 /*
   save raster data
   Params: data - the data to save
@@ -2,6 +2,17 @@
 #define gif_h
 
 unsigned char *loadgif(char *fname, int *width, int *height, unsigned char *pal, int *transparent);
+typedef struct
+{
+  int x;                  /* left of changed rectangle */
+  int y;                  /* top of changed rectangle */
+  int width;              /* width of changed rectangle, 0 if no change */
+  int height;             /* height of changed rectangle */
+  int delay;              /* display time in hundredths of a second */
+  unsigned long offset;   /* offset of the rectangle's pixels */
+} GIFFRAME;
+
+unsigned char *loadgifanimation(char *fname, int *width, int *height, GIFFRAME **frames, int *Nframes, unsigned long *Nbytes);
 int savegif(char *fname, unsigned char *data, int width, int height, unsigned char *pal, int palsize, int transparent, int important, int interlaced);
 
 #endif
@@ -4,13 +4,15 @@
 #include <limits.h>
 
 #include "text_encoding_detect.h"
+#include "utftranscode.h"
 #include "loadasutf8.h"
 
+#define SLURPBLOCK (64 * 1024)
+
 static char *loadascii(const char *fname);
 static char *loadutf8(const char *fname, int bom);
 static char *loadUTF16(const char *fname, int bigendian, int bom);
-static int bbx_utf8_putch(char *out, int ch);
-static char *fslurp(FILE *fp);
+static char *fslurp(FILE *fp, long *len);
 
 char *loadasutf8(const char *filename, int *err)
 {
@@ -53,6 +55,13 @@ char *loadasutf8(const char *filename, int *err)
    }
    if (!answer)
      goto error_exit;
+   /* the detector only looks at the start of a long file */
+   if (encoding == TEXTENC_ASCII || encoding == TEXTENC_UTF8_NOBOM)
+   {
+      if (GetTextEncodingScanLimit() > 0 && (long) strlen(answer) > GetTextEncodingScanLimit()
+          && !utf8_valid(answer, (long) strlen(answer)))
+        goto error_exit;
+   }
 
    return answer;
 
@@ -71,13 +80,15 @@ static char *loadascii(const char *fname)
    fp = fopen(fname, "r");
    if (!fp)
       goto error_exit;
-   answer = fslurp(fp);
+   answer = fslurp(fp, 0);
    if (!answer)
       goto error_exit;
    fclose(fp);
    return answer;
 error_exit:
    free(answer);
+   if (fp)
+      fclose(fp);
    return 0;
 }
 
@@ -90,7 +101,7 @@ static char *loadutf8(const char *fname, int bom)
    fp = fopen(fname, "r");
    if (!fp)
       goto error_exit;
-   answer = fslurp(fp);
+   answer = fslurp(fp, 0);
    if (!answer)
       goto error_exit;
    len = strlen(answer);
@@ -111,167 +122,81 @@ error_exit:
     return 0;
 }
 
+/*
+  load a UTF-16 file, reading it in one go and converting it to 
+  UTF-8 in memory
+ */
 static char *loadUTF16(const char *fname, int bigendian, int bom)
 {
    FILE *fp;
-   char *answer;
-   int capacity = 1024;
-   int pos = 0;
-   int ch1, ch2;
-   int codepoint;
-   char *temp;
+   unsigned char *utf16 = 0;
+   char *answer = 0;
+   long len;
+   int skip = 0;
+   int error;
 
    fp = fopen(fname, "rb");
    if (!fp)
      return 0;
-   answer = malloc(capacity);
+   utf16 = (unsigned char *) fslurp(fp, &len);
+   fclose(fp);
+   if (!utf16)
+     return 0;
    if (bom)
-   {
-      fgetc(fp);
-      fgetc(fp);
-   }
-   do
-   {
-      ch1 = fgetc(fp);
-      if (ch1 == EOF)
-        break;
-      ch2 = fgetc(fp);
-      if (ch2 == EOF)
-        goto error_exit;
-      if (bigendian)
-      {
-         int tempch = ch1;
-         ch1 = ch2;
-         ch2 = tempch;
-      }
-      if ((ch2 & 0xFC) == 0xD8)
-      {
-          int ch3 = getc(fp);
-          int ch4 = getc(fp);
-          int highsurrogate, lowsurrogate;
-          
-          if (ch3 == EOF || ch4 == EOF)
-              goto error_exit;
-          if (bigendian)
-          {
-              int tempch = ch3;
-              ch3 = ch4;
-              ch4 = tempch;
-          }
-          if ((ch4 & 0xFC) == 0xDC)
-          {
-              highsurrogate = ((ch2 * 256) + ch1) & 0x03FF;
-              lowsurrogate = ((ch4 * 256) + ch3) & 0x03FF;
-              codepoint = 0x10000 + highsurrogate * 1024 + lowsurrogate;
-          }
-          else
-          {
-              goto error_exit;
-          }
-      }
-      else  if ((ch2 & 0xFC) == 0xDC)
-      {
-          goto error_exit;
-      }
-      else
-      {
-          codepoint = ch2 * 256 + ch1;
-      }
-      if (pos > capacity - 8)
-      {
-         temp = realloc(answer, capacity + capacity / 2);
-         if (!temp)
-            goto error_exit;
-         answer = temp;
-         capacity = capacity + capacity / 2;
-      }
-      pos += bbx_utf8_putch(answer + pos, codepoint);
-   } while(1);
-   
-   pos += bbx_utf8_putch(answer + pos, 0);
+     skip = len >= 2 ? 2 : (int) len;
+   answer = utf16toutf8(utf16 + skip, len - skip, bigendian, &error);
+   free(utf16);
 
-   temp = realloc(answer, pos);
-   if (!temp)
-      goto error_exit;
-   answer = temp;
-   fclose(fp);
    return answer;
-
-error_exit:
-    free(answer);
-    return 0;      
-}
-
-
-
-static int bbx_utf8_putch(char *out, int ch)
-{
-  char *dest = out;
-  if (ch < 0x80) 
-  {
-     *dest++ = (char)ch;
-  }
-  else if (ch < 0x800) 
-  {
-    *dest++ = (ch>>6) | 0xC0;
-    *dest++ = (ch & 0x3F) | 0x80;
-  }
-  else if (ch < 0x10000) 
-  {
-     *dest++ = (ch>>12) | 0xE0;
-     *dest++ = ((ch>>6) & 0x3F) | 0x80;
-     *dest++ = (ch & 0x3F) | 0x80;
-  }
-  else if (ch < 0x110000) 
-  {
-     *dest++ = (ch>>18) | 0xF0;
-     *dest++ = ((ch>>12) & 0x3F) | 0x80;
-     *dest++ = ((ch>>6) & 0x3F) | 0x80;
-     *dest++ = (ch & 0x3F) | 0x80;
-  }
-  else
-    return 0;
-  return dest - out;
 }
 
 /*
-  load a text file into memory
-
+  load a file into memory, in large blocks
+  Params: fp - the open file
+          len - return for number of bytes (may be null)
+  Returns: the contents, with a nul appended, 0 on fail
 */
-static char *fslurp(FILE *fp)
+static char *fslurp(FILE *fp, long *len)
 {
   char *answer;
   char *temp;
-  int buffsize = 1024;
-  int i = 0;
-  int ch;
+  size_t capacity = SLURPBLOCK;
+  size_t N = 0;
+  size_t Nread;
 
-  answer = malloc(1024);
+  answer = malloc(capacity + 1);
   if(!answer)
     return 0;
-  while( (ch = fgetc(fp)) != EOF )
+  while ((Nread = fread(answer + N, 1, capacity - N, fp)) > 0)
   {
-    if(i == buffsize-2)
+    N += Nread;
+    if (N == capacity)
     {
-      if(buffsize > INT_MAX - 100 - buffsize/10)
+      if (capacity > LONG_MAX / 2 - 1)
       {
-	free(answer);
+        free(answer);
         return 0;
       }
-      buffsize = buffsize + 100 * buffsize/10;
-      temp = realloc(answer, buffsize);
-      if(temp == 0)
+      temp = realloc(answer, capacity * 2 + 1);
+      if (!temp)
       {
         free(answer);
         return 0;
       }
       answer = temp;
+      capacity *= 2;
     }
-    answer[i++] = (char) ch;
   }
-  answer[i++] = 0;
+  if (ferror(fp))
+  {
+    free(answer);
+    return 0;
+  }
+  answer[N] = 0;
+  if (len)
+    *len = (long) N;
 
-  temp = realloc(answer, i);
+  temp = realloc(answer, N + 1);
   if(temp)
     return temp;
   else
@@ -7,6 +7,18 @@
 
 #define BUFFER_COUNT 2
 
+typedef struct
+{
+   short *pcm;
+   size_t N;         /* shorts written */
+   size_t capacity;  /* shorts allocated */
+   long samplerate;
+   int Nchannels;
+} PCMBUFFER;
+
+static int appendpcm(void *ptr, const short *pcm, long samplerate, int Nchannels, long Nsamples);
+static long xingNsamples(const unsigned char *mp3_stream, int stream_size);
+static void getaudiorange(const unsigned char *mp3_stream, int stream_size, int *start, int *end);
 static unsigned char *slurpb(const char *fname, int *len);
 
 short *loadmp3(const char *fname, long *samplerate, int 
@@ -40,91 +52,240 @@ error_exit:
    return 0;
 }
 
+/*
+  decode an mp3 file, passing each frame to a callback as it is decoded.
+  Params: fname - the file name
+          callback - called with each frame of interleaved pcm, return
+                     non-zero to abandon decoding
+          ptr - context pointer passed to the callback
+  Returns: the number of frames decoded, -1 on error.
+  Only the compressed file is held in memory, so long tracks can be
+    processed without buffering all of the audio.
+*/
+int loadmp3stream(const char *fname, int (*callback)(void *ptr, const short *pcm, long samplerate, int Nchannels, long Nsamples), void *ptr)
+{
+   unsigned char *bytes;
+   int N = 0;
+   int answer;
+
+   bytes = slurpb(fname, &N);
+   if (!bytes)
+     return -1;
+   answer = mp3streamdecode(bytes, N, callback, ptr);
+   free(bytes);
+
+   return answer;
+}
+
 short *mp3streamdecompress(unsigned char *mp3_stream, int stream_size,
    long *samplerate, int *Nchannels, long *Nsamples)
 {
-   int i;
-   unsigned char *inptr;
+   PCMBUFFER buff;
+   long expected;
+
+   buff.pcm = 0;
+   buff.N = 0;
+   buff.capacity = 0;
+   buff.samplerate = 0;
+   buff.Nchannels = 0;
+
+   /* pre-size from the VBR header if the encoder wrote one */
+   expected = xingNsamples(mp3_stream, stream_size);
+   if (expected > 0)
+   {
+     buff.pcm = malloc(expected * sizeof(short));
+     if (buff.pcm)
+        buff.capacity = expected;
+   }
+
+   if (mp3streamdecode(mp3_stream, stream_size, appendpcm, &buff) <= 0)
+     goto error_exit;
+   if (buff.N == 0)
+     goto error_exit;
+
+   if (samplerate)
+      *samplerate = buff.samplerate;
+   if (Nchannels)
+     *Nchannels = buff.Nchannels;
+   if (Nsamples)
+     *Nsamples = (long) (buff.N / buff.Nchannels);
+
+   return buff.pcm;
+
+error_exit:
+   if (samplerate)
+      *samplerate = 0;
+   if (Nchannels)
+     *Nchannels = 0;
+   if (Nsamples)
+     *Nsamples = 0;
+   free(buff.pcm);
+   return 0;
+}
+
+/*
+  decode an mp3 held in memory, frame by frame.
+  Params: mp3_stream - the mp3 file data
+          stream_size - number of bytes in the stream
+          callback - called with each decoded frame, return non-zero to stop
+          ptr - context pointer passed to the callback
+  Returns: the number of frames decoded, -1 on error or if the callback
+    stopped decoding.
+*/
+int mp3streamdecode(unsigned char *mp3_stream, int stream_size, int (*callback)(void *ptr, const short *pcm, long samplerate, int Nchannels, long Nsamples), void *ptr)
+{
    unsigned char *stream_pos;
    signed short sample_buffer[MP3_MAX_SAMPLES_PER_FRAME * BUFFER_COUNT];
+   int start, end;
    int bytes_left;
    int byte_count;
    mp3_info_t info;
-   mp3_decoder_t mp3 = 0;;
-   size_t Nout = 0;
-   short *answer = 0;
+   mp3_decoder_t mp3 = 0;
+   int Nframes = 0;
+
+   getaudiorange(mp3_stream, stream_size, &start, &end);
+   stream_pos = mp3_stream + start;
+   bytes_left = end - start;
 
-   stream_pos = mp3_stream;
-   bytes_left = stream_size - 128;
-  
    mp3 = mp3_create();
    if (!mp3)
-     goto error_exit;
-   do
+     return -1;
+   while (bytes_left > 0)
    {
+     info.audio_bytes = 0;
      byte_count = mp3_decode(mp3, stream_pos, bytes_left, sample_buffer,
-       &info); 
+       &info);
+     if (byte_count <= 0)
+       break;
      bytes_left -= byte_count;
      stream_pos += byte_count;
-     Nout += info.audio_bytes;
-   } while(bytes_left > 0 && byte_count);
-     
+     /* a frame that fails to decode reports a negative size */
+     if (info.audio_bytes > 0 && info.channels > 0)
+     {
+       if ((*callback)(ptr, sample_buffer, info.sample_rate, info.channels,
+             info.audio_bytes / (info.channels * sizeof(short))))
+         goto error_exit;
+       Nframes++;
+     }
+   }
    mp3_free(mp3);
 
-   mp3 = mp3_create();
-   if (!mp3)
-     goto error_exit;
-   answer = malloc(Nout);
-   if (!answer)
-     goto error_exit;
+   return Nframes;
 
-   Nout = 0;
-   stream_pos = mp3_stream;
-   bytes_left = stream_size - 128;
+error_exit:
+   mp3_free(mp3);
+   return -1;
+}
 
-   do
+static int appendpcm(void *ptr, const short *pcm, long samplerate, int Nchannels, long Nsamples)
+{
+   PCMBUFFER *buff = ptr;
+   size_t N = Nsamples * Nchannels;
+   size_t newcapacity;
+   short *temp;
+
+   if (buff->N + N > buff->capacity)
    {
-     byte_count = mp3_decode(mp3, stream_pos, bytes_left, sample_buffer,
-       &info);
-     bytes_left -= byte_count;
-     stream_pos += byte_count;
-     memcpy(answer + Nout/(sizeof(short)), sample_buffer, info.audio_bytes);
-     Nout += info.audio_bytes;
-   } while(bytes_left > 0 && byte_count);
+     newcapacity = buff->capacity * 2;
+     if (newcapacity < buff->N + N)
+       newcapacity = buff->N + N + MP3_MAX_SAMPLES_PER_FRAME * 64;
+     temp = realloc(buff->pcm, newcapacity * sizeof(short));
+     if (!temp)
+       return -1;
+     buff->pcm = temp;
+     buff->capacity = newcapacity;
+   }
+   memcpy(buff->pcm + buff->N, pcm, N * sizeof(short));
+   buff->N += N;
+   buff->samplerate = samplerate;
+   buff->Nchannels = Nchannels;
 
-   mp3_free(mp3);
+   return 0;
+}
 
-   if (samplerate)
-      *samplerate = info.sample_rate;
-   if (Nchannels)
-     *Nchannels = info.channels;
-   if (Nsamples)
-     *Nsamples = Nout / (info.channels * sizeof(short));;
+/*
+  get the total number of samples (all channels) from a Xing or Info
+    VBR header in the first frame, -1 if there isn't one.
+*/
+static long xingNsamples(const unsigned char *mp3_stream, int stream_size)
+{
+   int start, end;
+   int i;
+   unsigned long header;
+   int lsf, mono;
+   int offset;
+   const unsigned char *tag;
+   unsigned long flags;
+   unsigned long Nframes;
 
-   return answer;
+   getaudiorange(mp3_stream, stream_size, &start, &end);
+   for (i = start; i + 4 <= end; i++)
+   {
+     header = ((unsigned long) mp3_stream[i] << 24) | (mp3_stream[i+1] << 16) |
+        (mp3_stream[i+2] << 8) | mp3_stream[i+3];
+     if ((header & 0xffe60000UL) == 0xffe20000UL)
+       break;
+   }
+   if (i + 4 > end)
+     return -1;
 
-error_exit:
-   if (samplerate)
-      *samplerate = 0;
-   if (Nchannels)
-     *Nchannels = 0;
-   if (Nsamples)
-     *Nsamples = 0;
-   if (mp3)
-   	mp3_free(mp3);
-   free(answer);
-   return 0;
+   lsf = (header & (1 << 19)) ? 0 : 1;
+   mono = ((header >> 6) & 3) == 3;
+   if (lsf)
+     offset = mono ? 9 : 17;
+   else
+     offset = mono ? 17 : 32;
+   offset += i + 4;
+   if (offset + 12 > end)
+     return -1;
+   tag = mp3_stream + offset;
+   if (memcmp(tag, "Xing", 4) && memcmp(tag, "Info", 4))
+     return -1;
+   flags = ((unsigned long) tag[4] << 24) | (tag[5] << 16) | (tag[6] << 8) | tag[7];
+   if (!(flags & 1))
+     return -1;
+   Nframes = ((unsigned long) tag[8] << 24) | (tag[9] << 16) | (tag[10] << 8) | tag[11];
+   if (Nframes == 0 || Nframes > 0xFFFFFF)
+     return -1;
+
+   /* the header frame itself decodes as a frame of silence */
+   return (long) (Nframes + 1) * (lsf ? 576 : 1152) * (mono ? 1 : 2);
 }
 
-static unsigned char *slurpb(const char *fname, int *len)
+/*
+  get the range of the stream holding mp3 frames, skipping an ID3v2 tag
+    at the start and an ID3v1 tag at the end.
+*/
+static void getaudiorange(const unsigned char *mp3_stream, int stream_size, int *start, int *end)
+{
+   long tagsize;
+
+   *start = 0;
+   *end = stream_size;
+   if (stream_size >= 10 && !memcmp(mp3_stream, "ID3", 3))
+   {
+     tagsize = ((long) (mp3_stream[6] & 0x7F) << 21) |
+        ((mp3_stream[7] & 0x7F) << 14) |
+        ((mp3_stream[8] & 0x7F) << 7) |
+        (mp3_stream[9] & 0x7F);
+     tagsize += 10;
+     if (mp3_stream[5] & 0x10)
+       tagsize += 10;
+     if (tagsize < stream_size)
+       *start = (int) tagsize;
+   }
+   if (*end - *start >= 128 && !memcmp(mp3_stream + *end - 128, "TAG", 3))
+     *end -= 128;
+}
 
+static unsigned char *slurpb(const char *fname, int *len)
 {
 	FILE *fp;
 	unsigned char *answer = 0;
 	unsigned char *temp;
-	int capacity = 1024;
+	int capacity = 64 * 1024;
 	int N = 0;
-	int ch;
+	size_t got;
 
 	fp = fopen(fname, "rb");
 	if (!fp)
@@ -132,9 +293,9 @@ static unsigned char *slurpb(const char *fname, int *len)
 	answer = malloc(capacity);
 	if (!answer)
 		goto out_of_memory;
-	while ( (ch = fgetc(fp)) != EOF)
+	while ( (got = fread(answer + N, 1, capacity - N, fp)) > 0)
 	{
-		answer[N++] = ch;
+		N += (int) got;
 		if (N >= capacity)
 		{
 			temp = realloc(answer, capacity + capacity / 2);
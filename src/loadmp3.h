@@ -12,6 +12,8 @@ short *loadmp3(const char *fname, long *samplerate, int
                *Nchannels, long *Nsamples);
 short *mp3streamdecompress(unsigned char *mp3_stream, int stream_size,
    long *samplerate, int *Nchannels, long *Nsamples);
+int loadmp3stream(const char *fname, int (*callback)(void *ptr, const short *pcm, long samplerate, int Nchannels, long Nsamples), void *ptr);
+int mp3streamdecode(unsigned char *mp3_stream, int stream_size, int (*callback)(void *ptr, const short *pcm, long samplerate, int Nchannels, long Nsamples), void *ptr);
 
 
 #endif /* loadmp3_h */
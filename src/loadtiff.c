@@ -17,6 +17,9 @@
 #include <limits.h>
 #include <math.h>
 
+#include "threadpool.h"
+#include "ccitt.h"
+
 #define TAG_BYTE 1
 #define TAG_ASCII 2
 #define TAG_SHORT 3
@@ -409,7 +412,7 @@ static int header_fixupsections(BASICHEADER *header);
 static int header_not_ok(BASICHEADER *header);
 static int fillheader(BASICHEADER *header, TAG *tags, int Ntags);
 
-static unsigned char *decompress(FILE *fp, unsigned long count, int compression, unsigned long *Nret, int width, int height, unsigned long T4options );
+static unsigned char *decompress(unsigned char *in, unsigned long count, int compression, unsigned long *Nret, int width, int height, unsigned long T4options );
 static void header_defaults(BASICHEADER *header);
 static TAG *floadheader(int type, FILE *fp, int *Ntags);
 static void killtags(TAG *tags, int N);
@@ -417,16 +420,19 @@ static int floadtag(TAG *tag, int type, FILE *fp);
 static double tag_getentry(TAG *tag, int index);
 
 static unsigned char *loadraster(BASICHEADER *header, FILE *fp);
+static int loadrasterparallel(unsigned char *rgba, BASICHEADER *header, int tilesacross, FILE *fp, int Nthreads);
+static unsigned char *readsegment(FILE *fp, unsigned long offset, unsigned long count);
 static unsigned char *readstrip(BASICHEADER *header, int index, int *strip_width, int *strip_height, FILE *fp);
 static unsigned char *readtile(BASICHEADER *header, int index, int *tile_width, int *tile_height, FILE *fp);
 static unsigned char *readchannel(BASICHEADER *header, int index, int *channel_width, int *channel_height, FILE *fp);
+static unsigned char *decodestrip(BASICHEADER *header, int index, unsigned char *in, unsigned long count, int *strip_width, int *strip_height);
+static unsigned char *decodetile(BASICHEADER *header, int index, unsigned char *in, unsigned long count, int *tile_width, int *tile_height);
 
 static BSTREAM *bstream(unsigned char *data, int N, int endinaness);
 static void killbstream(BSTREAM *bs);
 static int getbit(BSTREAM *bs);
 static int getbits(BSTREAM *bs, int nbits);
 static int synchtobyte(BSTREAM *bs);
-static int writebit(BSTREAM *bs, int bit);
 
 static void rgbapaste(unsigned char *rgba, int width, int height, unsigned char *tile, int twidth, int theight, int x, int y);
 
@@ -946,18 +952,6 @@ static unsigned char *loadraster(BASICHEADER *header, FILE *fp)
 		}
 	}
 
-	if (header->Nstripoffsets > 0 && tilesacross == 0)
-	{
-		for (i = 0; i < header->Nstripoffsets; i++)
-		{
-			strip = readstrip(header, i, &swidth, &sheight, fp);
-			if (!strip)
-				goto out_of_memory;
-			memcpy(rgba + row * header->imagewidth * 4, strip, swidth *sheight * 4);
-			row += sheight;
-			free(strip);
-		}
-	}
 	if (header->Nstripoffsets > 0 && tilesacross != 0)
 	{
 		header->Ntileoffsets = header->Nstripoffsets;
@@ -967,12 +961,32 @@ static unsigned char *loadraster(BASICHEADER *header, FILE *fp)
 	}
 	if (header->Ntilebytecounts == 0 && tilesacross != 0)
 	{
-		header->Ntilebytecounts = header->Nstripoffsets;
+		header->Ntilebytecounts = header->Nstripbytecounts;
 		header->tilebytecounts = header->stripbytecounts;
 		header->stripbytecounts = 0;
 		header->Nstripbytecounts = 0;
 	}
-    if (header->Ntileoffsets > 0)
+
+	if (threadpool_Nthreads() > 1 && (header->Nstripoffsets > 1 || header->Ntileoffsets > 1))
+	{
+		if (loadrasterparallel(rgba, header, tilesacross, fp, threadpool_Nthreads()) == -1)
+			goto out_of_memory;
+		return rgba;
+	}
+
+	if (header->Nstripoffsets > 0 && tilesacross == 0)
+	{
+		for (i = 0; i < header->Nstripoffsets; i++)
+		{
+			strip = readstrip(header, i, &swidth, &sheight, fp);
+			if (!strip)
+				goto out_of_memory;
+			memcpy(rgba + row * header->imagewidth * 4, strip, swidth *sheight * 4);
+			row += sheight;
+			free(strip);
+		}
+	}
+	if (header->Ntileoffsets > 0)
 	{
 		
 		for (i = 0; i < header->Ntileoffsets; i++)
@@ -993,6 +1007,104 @@ out_of_memory:
 	return 0;
 }
 
+typedef struct
+{
+	BASICHEADER *header;
+	unsigned char *rgba;
+	unsigned char **segments;
+	int tilesacross;
+	int *errors;
+} PARALLELRASTER;
+
+/*
+  worker job, decode one strip or tile and write it into its
+  destination rectangle. Strips and tiles never overlap, so no locking.
+*/
+static void decodesegmentjob(void *ptr, int index)
+{
+	PARALLELRASTER *job = ptr;
+	BASICHEADER *header = job->header;
+	unsigned char *decoded;
+	int swidth, sheight;
+
+	if (job->tilesacross == 0)
+	{
+		decoded = decodestrip(header, index, job->segments[index], header->stripbytecounts[index], &swidth, &sheight);
+		if (decoded)
+			memcpy(job->rgba + (unsigned long) index * header->rowsperstrip * header->imagewidth * 4, decoded, swidth * sheight * 4);
+	}
+	else
+	{
+		decoded = decodetile(header, index, job->segments[index], header->tilebytecounts[index], &swidth, &sheight);
+		if (decoded)
+			rgbapaste(job->rgba, header->imagewidth, header->imageheight, decoded, swidth, sheight,
+				(index % job->tilesacross) * header->tilewidth, (index / job->tilesacross) * header->tileheight);
+	}
+	if (!decoded)
+		job->errors[index] = 1;
+	free(decoded);
+	free(job->segments[index]);
+	job->segments[index] = 0;
+}
+
+/*
+  load chunky strips or tiles using several threads.
+  Params: rgba - the output image
+          header - the image header
+          tilesacross - tiles per row, 0 for a stripped image
+          fp - the input file
+          Nthreads - number of worker threads
+  Returns: 0 on success, -1 on fail
+  Notes: all the compressed segments are read up front (file access
+    is sequential and single-threaded), then decompression and colour
+    conversion run on the workers.
+*/
+static int loadrasterparallel(unsigned char *rgba, BASICHEADER *header, int tilesacross, FILE *fp, int Nthreads)
+{
+	PARALLELRASTER job;
+	int N;
+	int i;
+	int answer = 0;
+
+	N = tilesacross ? header->Ntileoffsets : header->Nstripoffsets;
+	job.header = header;
+	job.rgba = rgba;
+	job.tilesacross = tilesacross;
+	job.segments = calloc(N, sizeof(unsigned char *));
+	job.errors = calloc(N, sizeof(int));
+	if (!job.segments || !job.errors)
+		goto out_of_memory;
+
+	for (i = 0; i < N; i++)
+	{
+		if (tilesacross)
+			job.segments[i] = readsegment(fp, header->tileoffsets[i], header->tilebytecounts[i]);
+		else
+			job.segments[i] = readsegment(fp, header->stripoffsets[i], header->stripbytecounts[i]);
+		if (!job.segments[i])
+			goto out_of_memory;
+	}
+
+	parallelfor(N, Nthreads, decodesegmentjob, &job);
+
+	for (i = 0; i < N; i++)
+		if (job.errors[i])
+			answer = -1;
+	free(job.segments);
+	free(job.errors);
+	return answer;
+
+out_of_memory:
+	if (job.segments)
+	{
+		for (i = 0; i < N; i++)
+			free(job.segments[i]);
+	}
+	free(job.segments);
+	free(job.errors);
+	return -1;
+}
+
 /*//////////////////////////////////////////////////////////////////////////////////////////////////*/
 /* stip tile and plane loading section*/
 /*//////////////////////////////////////////////////////////////////////////////////////////////////*/
@@ -1010,14 +1122,77 @@ static void unpredictsamples(unsigned char *rgba, int width, int height, BASICHE
 static int readbytesample(unsigned char *bytes, BASICHEADER *header, int sample_index);
 static int readintsample(unsigned char *bytes, BASICHEADER *header, int sample_index);
 
+/*
+  read the raw (compressed) bytes of a strip or tile
+  Params: fp - the input file
+          offset - file offset of the segment
+          count - number of bytes in the segment
+  Returns: pointer to the raw bytes, 0 on fail
+*/
+static unsigned char *readsegment(FILE *fp, unsigned long offset, unsigned long count)
+{
+	unsigned char *answer;
+
+	answer = calloc(count ? count : 1, 1);
+	if (!answer)
+		return 0;
+	if (fseek(fp, offset, SEEK_SET) != 0)
+	{
+		free(answer);
+		return 0;
+	}
+	/* a truncated segment is decoded as far as it goes, padded with zeroes */
+	fread(answer, 1, count, fp);
+
+	return answer;
+}
+
 static unsigned char *readtile(BASICHEADER *header, int index, int *tile_width, int *tile_height, FILE *fp)
+{
+	unsigned char *in;
+	unsigned char *rgba;
+
+	in = readsegment(fp, header->tileoffsets[index], header->tilebytecounts[index]);
+	if (!in)
+		return 0;
+	rgba = decodetile(header, index, in, header->tilebytecounts[index], tile_width, tile_height);
+	free(in);
+
+	return rgba;
+}
+
+static unsigned char *readstrip(BASICHEADER *header, int index, int *strip_width, int *strip_height, FILE *fp)
+{
+	unsigned char *in;
+	unsigned char *rgba;
+
+	in = readsegment(fp, header->stripoffsets[index], header->stripbytecounts[index]);
+	if (!in)
+		return 0;
+	rgba = decodestrip(header, index, in, header->stripbytecounts[index], strip_width, strip_height);
+	free(in);
+
+	return rgba;
+}
+
+/*
+  decompress a tile and convert it to rgba
+  Params: header - the image header
+          index - index of the tile
+          in - the raw tile bytes
+          count - number of raw bytes
+          tile_width, tile_height - return for tile dimensions
+  Returns: the tile as rgba, 0 on fail
+  Notes: touches nothing but its arguments, so tiles can be decoded
+    on several threads at once.
+*/
+static unsigned char *decodetile(BASICHEADER *header, int index, unsigned char *in, unsigned long count, int *tile_width, int *tile_height)
 {
 	unsigned char *data = 0;
 	unsigned char *rgba = 0;
 	unsigned long N;
 
-	fseek(fp, header->tileoffsets[index], SEEK_SET);
-	data = decompress(fp, header->tilebytecounts[index], header->compression, &N, header->tilewidth, header->tileheight, header->T4options);
+	data = decompress(in, count, header->compression, &N, header->tilewidth, header->tileheight, header->T4options);
 	if (!data)
 		goto out_of_memory;
 	rgba = malloc(4 * header->tilewidth * header->tileheight);
@@ -1064,21 +1239,29 @@ out_of_memory:
 
 }
 
-static unsigned char *readstrip(BASICHEADER *header, int index, int *strip_width, int *strip_height, FILE *fp)
+/*
+  decompress a strip and convert it to rgba
+  Params: header - the image header
+          index - index of the strip
+          in - the raw strip bytes
+          count - number of raw bytes
+          strip_width, strip_height - return for strip dimensions
+  Returns: the strip as rgba, 0 on fail
+*/
+static unsigned char *decodestrip(BASICHEADER *header, int index, unsigned char *in, unsigned long count, int *strip_width, int *strip_height)
 {
 	unsigned char *data = 0;
 	unsigned char *rgba = 0;
 	unsigned long N;
 	int stripheight;
 
-	fseek(fp, header->stripoffsets[index], SEEK_SET);
 	if (index == header->Nstripoffsets - 1)
 	{
 		stripheight = header->imageheight - header->rowsperstrip *index;
 	}
 	else
 		stripheight = header->rowsperstrip;
-	data = decompress(fp, header->stripbytecounts[index], header->compression, &N, header->imagewidth, stripheight, header->T4options);
+	data = decompress(in, count, header->compression, &N, header->imagewidth, stripheight, header->T4options);
 	if (!data)
 		goto out_of_memory;
 	
@@ -1125,6 +1308,7 @@ out_of_memory:
 
 static unsigned char *readchannel(BASICHEADER *header, int index, int *channel_width, int *channel_height, FILE *fp)
 {
+	unsigned char *in = 0;
 	unsigned char *data = 0;
 	unsigned char *out = 0;
 	unsigned long N;
@@ -1136,14 +1320,18 @@ static unsigned char *readchannel(BASICHEADER *header, int index, int *channel_w
 	if (sample_index < 0 || sample_index >= header->samplesperpixel)
 		return 0;
 
-	fseek(fp, header->stripoffsets[index], SEEK_SET);
 	if ((index % stripsperimage) == stripsperimage - 1)
 	{
 		stripheight = header->imageheight - header->rowsperstrip *(index%stripsperimage);
 	}
 	else
 		stripheight = header->rowsperstrip;
-	data = decompress(fp, header->stripbytecounts[index], header->compression, &N, header->imagewidth, stripheight, header->T4options);
+	in = readsegment(fp, header->stripoffsets[index], header->stripbytecounts[index]);
+	if (!in)
+		goto out_of_memory;
+	data = decompress(in, header->stripbytecounts[index], header->compression, &N, header->imagewidth, stripheight, header->T4options);
+	free(in);
+	in = 0;
 	if (!data)
 		goto out_of_memory;
 	
@@ -1157,6 +1345,7 @@ static unsigned char *readchannel(BASICHEADER *header, int index, int *channel_w
 	free(data);
 	return out;
 out_of_memory:
+	free(in);
 	free(data);
 	free(out);
 	return 0;
@@ -1652,7 +1841,6 @@ static int readbytesample(unsigned char *bytes, BASICHEADER *header, int sample_
 	int answer = -1;
 	double real;
 	double low, high;
-	static double highest = 0.0;
 
 	if (header->sampleformat[sample_index] == SAMPLEFORMAT_UINT)
 	{
@@ -1680,10 +1868,6 @@ static int readbytesample(unsigned char *bytes, BASICHEADER *header, int sample_
 			high = header->smaxsamplevalue[sample_index];
 		else
 			high = 512.0;
-		if (highest < real)
-		{
-			highest = real;
-		}
 		return (int)((real - low) * 255.0 / (high - low));
 	}
 
@@ -1715,17 +1899,15 @@ typedef struct LodePNGDecompressSettings
 } LodePNGDecompressSettings;
 
 static void invert(unsigned char *bits, unsigned long N);
-static unsigned char *unpackbits(FILE *fp, unsigned long count, unsigned long *Nret);
-static unsigned char *ccittdecompress(unsigned char *in, unsigned long count, unsigned long *Nret, int width, int height, int eol);
-static unsigned char *ccittgroup4decompress(unsigned char *in, unsigned long count, unsigned long *Nret, int width, int height, int eol);
-static int loadlzw(unsigned char *out, FILE *fp, unsigned long count, unsigned long *Nret);
+static unsigned char *unpackbits(unsigned char *in, unsigned long count, unsigned long *Nret);
+static int loadlzw(unsigned char *out, unsigned char *in, unsigned long count, unsigned long *Nret);
 static unsigned lodepng_zlib_decompress(unsigned char** out, size_t* outsize, const unsigned char* in,
 	size_t insize, const LodePNGDecompressSettings* settings);
 
 /*
   Master decompression function
   Params:
-    fp - input file, pointing to start of data section
+    in - the compressed strip or tile
 	count - number of bytes in stream to decompress
 	Nret - return for number of decompressed bytes
 	width, height - width and height of strip or tile
@@ -1733,7 +1915,7 @@ static unsigned lodepng_zlib_decompress(unsigned char** out, size_t* outsize, co
   Returns: pointer to decompressed dta, 0 on fail
 
 */
-static unsigned char *decompress(FILE *fp, unsigned long count, int compression, unsigned long *Nret, int width, int height, unsigned long T4options)
+static unsigned char *decompress(unsigned char *in, unsigned long count, int compression, unsigned long *Nret, int width, int height, unsigned long T4options)
 {
 	unsigned char *answer = 0;
 	if (compression == 1)
@@ -1741,65 +1923,47 @@ static unsigned char *decompress(FILE *fp, unsigned long count, int compression,
 		answer = malloc(count);
 		if (!answer)
 			goto out_of_memory;
-		fread(answer, 1, count, fp);
+		memcpy(answer, in, count);
 		*Nret = count;
 		return answer;
 	}
 	else if (compression == COMPRESSION_CCITTRLE)
 	{
-		unsigned char *buff = malloc(count);
-		unsigned long i;
-		if (!buff)
-			goto out_of_memory;
-		fread(buff, 1, count, fp);
-		answer = ccittdecompress(buff, count, Nret, width, height, 0);
+		answer = ccittdecompress(in, count, Nret, width, height, 0);
 		if (answer)
 			invert(answer, *Nret);
-		free(buff);
 		return answer;
 	}
 	else if (compression == COMPRESSION_CCITTFAX3)
 	{
-		unsigned char *buff = malloc(count);
-		if (!buff)
-			goto out_of_memory;
-		fread(buff, 1, count, fp);
 		if ((T4options & 0x04) == 0)
-			answer = ccittdecompress(buff, count, Nret, width, height, 1);
+			answer = ccittdecompress(in, count, Nret, width, height, 1);
 		else
 			answer = 0; /* not handling for now */
 		if (answer)
 			invert(answer, *Nret);
-		free(buff);
 		return answer;
 	}
 	else if (compression == COMPRESSION_CCITTFAX4)
 	{
-		unsigned char *buff = malloc(count);
-		if (!buff)
-			goto out_of_memory;
-		fread(buff, 1, count, fp);
-		answer = ccittgroup4decompress(buff, count, Nret, width, height, 0);
+		answer = ccittgroup4decompress(in, count, Nret, width, height, 0);
 		if (answer)
 			invert(answer, *Nret);
-		free(buff);
 		return answer;
 	}
 	else if (compression == COMPRESSION_PACKBITS)
 	{
-		answer = unpackbits(fp, count, Nret);
+		answer = unpackbits(in, count, Nret);
 		return answer;
 	}
 	else if (compression == COMPRESSION_LZW)
 	{
-		unsigned long pos = ftell(fp);
-		int err;
-		err = loadlzw(0, fp, count, Nret);
+		if (loadlzw(0, in, count, Nret) == -1)
+			goto out_of_memory;
 		answer = malloc(*Nret);
 		if (!answer)
 			goto out_of_memory;
-		fseek(fp, pos, SEEK_SET);
-		loadlzw(answer, fp, count, Nret);
+		loadlzw(answer, in, count, Nret);
 		return answer;
 	}
 	else if (compression == COMPRESSION_ADOBE_DEFLATE || compression == COMPRESSION_DEFLATE)
@@ -1808,15 +1972,10 @@ static unsigned char *decompress(FILE *fp, unsigned long count, int compression,
 		size_t Nout = 0;
 		settings.custom_decoder = 0;
 		settings.ignore_adler32 = 0;
-		unsigned char *buff = malloc(count);
-		if (!buff)
-			goto out_of_memory;
-		fread(buff, 1, count, fp);
 		*Nret = 0;
 		answer = 0;
-		lodepng_zlib_decompress(&answer, &Nout, buff, count, &settings);
+		lodepng_zlib_decompress(&answer, &Nout, in, count, &settings);
 		*Nret = Nout;
-		free(buff);
 		return answer;
 	}
 	return 0;
@@ -1837,80 +1996,52 @@ static void invert(unsigned char *bits, unsigned long N)
   unpackbits decompressor. 
   Nice and easy compression scheme
 */
-static unsigned char *unpackbits(FILE *fp, unsigned long count, unsigned long *Nret)
+static unsigned char *unpackbits(unsigned char *in, unsigned long count, unsigned long *Nret)
 {
-	unsigned long pos = ftell(fp);
+	unsigned long pos = 0;
 	unsigned long N = 0;
 	unsigned long i, j;
-	long Nleft;
 	signed char header;
-	int ch;
 	unsigned char *answer = 0;
 
-	Nleft = count;
-	while (Nleft > 0)
+	while (pos < count)
 	{
-		if ((ch = fgetc(fp)) == EOF)
-			goto parse_error;
-		Nleft--;
-		header = (signed char) ch;
-		if (header > 0)
+		header = (signed char) in[pos++];
+		if (header >= 0)
 		{
 			N += header + 1;
-			for (i = 0; i < header +1; i++)
-			{
-				fgetc(fp);
-				Nleft--;
-			}
+			pos += header + 1;
 		}
 		else if (header > -128)
 		{
 			N += 1 - header;
-			fgetc(fp);
-			Nleft--;
-		}
-		else
-		{
+			pos++;
 		}
 	}
-	fseek(fp, pos, SEEK_SET);
-	Nleft = count;
-	answer = malloc(N);
+	answer = malloc(N ? N : 1);
 	if (!answer)
 		goto out_of_memory;
+	pos = 0;
 	j = 0;
-	while (Nleft > 0)
+	while (pos < count)
 	{
-		if ((ch = fgetc(fp)) == EOF)
-			goto parse_error;
-		Nleft--;
-		header = (signed char) ch;
-		if (header > 0)
+		header = (signed char) in[pos++];
+		if (header >= 0)
 		{
-			for (i = 0; i < header +1; i++)
-			{
-				answer[j++] = fgetc(fp);
-				Nleft--;
-			}
+			for (i = 0; i < (unsigned long) header + 1; i++)
+				answer[j++] = pos < count ? in[pos++] : 0;
 		}
 		else if (header > -128)
 		{
-			ch  = fgetc(fp);
-			Nleft--;
-			for (i = 0; i < 1 - header; i++)
-				answer[j++] = ch;
+			memset(answer + j, pos < count ? in[pos] : 0, 1 - header);
+			j += 1 - header;
+			pos++;
 		}
-		else
-		{
-		}
-
 	}
 
 	*Nret = N;
 	return answer;
-parse_error:
 out_of_memory:
-	free(answer);
     *Nret = 0;
 	return 0;
 }
@@ -2006,43 +2137,11 @@ static void debughufftree(HUFFNODE *root, int N)
 }
 */
 
-static int gethuffmansymbol(HUFFNODE *root, BSTREAM *bs)
-{
-	int bit;
-
-	if (root->zero == 0 && root->one == 0)
-	{
-		//printf("\n");
-		return root->symbol;
-	}
-	bit = getbit(bs);
-	//printf("%d", bit);
-	if (bit == 0 && root->zero)
-		return gethuffmansymbol(root->zero, bs);
-	else if (bit == 1 && root->one)
-		return gethuffmansymbol(root->one, bs);
-	else
-		return root->symbol;
-}
-
 /*///////////////////////////////////////////////////////////////////////////////////////////////////*/
 /*   CCITT decoding section*/
 /*///////////////////////////////////////////////////////////////////////////////////////////////////*/
-#define CCITT_PASS 101
-#define CCITT_HORIZONTAL 102
-#define CCITT_VERTICAL_0 103
-#define CCITT_VERTICAL_R1 104
-#define CCITT_VERTICAL_R2 105
-#define CCITT_VERTICAL_R3 106
-#define CCITT_VERTICAL_L1 107
-#define CCITT_VERTICAL_L2 108
-#define CCITT_VERTICAL_L3 109
-#define CCITT_EXTENSION 110
-#define CCITT_ENDOFFAXBLOCK 110
-
-struct ccitt2dcode { int symbol; const char *code; };
-
-static struct ccitt2dcode ccitt2dtable[11] =
+
+const struct ccitt2dcode ccitt2dtable[11] =
 {
 	{ CCITT_PASS, "0001" },
 	{ CCITT_HORIZONTAL, "001" },
@@ -2057,9 +2156,7 @@ static struct ccitt2dcode ccitt2dtable[11] =
     { CCITT_ENDOFFAXBLOCK, "000000000001"}
 };
 
-struct ccittcode { int whitelen; const char *whitecode; int blacklen; const char *blackcode; };
-#define EOL -2
-static struct ccittcode ccitttable[105] =
+const struct ccittcode ccitttable[105] =
 {
 	{ 0, "00110101", 0, "0000110111" },
 	{ 1, "000111", 1, "010" },
@@ -2152,7 +2249,7 @@ static struct ccittcode ccitttable[105] =
 	{ 1600, "010011010", 1600, "0000001011011" },
 	{ 1664, "011000", 1664, "0000001100100" },
 	{ 1728, "010011011", 1728, "0000001100101" },
-	{ EOL, "000000000001", EOL, "00000000000" },
+	{ CCITT_EOL, "000000000001", CCITT_EOL, "00000000000" },
 	{ 1792, "00000001000", 1792, "00000001000" },
 	{ 1856, "00000001100", 1856, "00000001100" },
 	{ 1920, "00000001101", 1920, "00000001101" },
@@ -2160,7 +2257,7 @@ static struct ccittcode ccitttable[105] =
 	{ 2048, "000000010011", 2048, "000000010011" },
 	{ 2112, "000000010100", 2112, "000000010100" },
 	{ 2176, "000000010101", 2176, "000000010101" },
-	{ 2240, "00000001011", 2240, "000000010110" },
+	{ 2240, "000000010110", 2240, "000000010110" },
 	{ 2304, "000000010111", 2304, "000000010111" },
 	{ 2368, "000000011100", 2368, "000000011100" },
 	{ 2432, "000000011101", 2432, "000000011101" },
@@ -2168,14 +2265,249 @@ static struct ccittcode ccitttable[105] =
 	{ 2560, "000000011111", 2560, "000000011111" },
 };
 
-static unsigned char *ccittdecompress(unsigned char *in, unsigned long count, unsigned long *Nret, int width, int height, int eol)
+/*
+  The CCITT decoders look codes up in tables indexed by the next
+  CCITT_PEEKBITS bits of the stream, giving the symbol and the number of
+  bits it occupies. The tables are filled by walking the Huffman trees,
+  so invalid codes consume exactly the bits the tree walk would.
+*/
+#define CCITT_PEEKBITS 13
+
+typedef struct
 {
-	HUFFNODE * whitetree = 0;
-	HUFFNODE * blacktree = 0;
-	BSTREAM *bs = 0;
-	BSTREAM *bout = 0;
-	int i, ii;
+	short symbol[1 << CCITT_PEEKBITS];
+	unsigned char len[1 << CCITT_PEEKBITS];
+	HUFFNODE *tree;
+} CCITTTABLE;
+
+typedef struct
+{
+	const unsigned char *data;
+	unsigned long N;
+	unsigned long pos;
+	unsigned long buffer;
+	int Nbuffered;
+	unsigned long remaining;
+	int lsbfirst;
+} CCITTREADER;
+
+static const unsigned char ccittreverse[16] =
+{
+	0x0, 0x8, 0x4, 0xC, 0x2, 0xA, 0x6, 0xE, 0x1, 0x9, 0x5, 0xD, 0x3, 0xB, 0x7, 0xF
+};
+
+/*
+  build a lookup table from a Huffman tree
+  Params: table - the table to fill
+          tree - the tree (table takes ownership)
+  Returns: 0 on success, -1 on fail
+*/
+static int buildccitttable(CCITTTABLE *table, HUFFNODE *tree)
+{
+	HUFFNODE *node;
+	int i;
+	int len;
+	int bit;
+
+	table->tree = tree;
+	if (!tree)
+		return -1;
+	for (i = 0; i < (1 << CCITT_PEEKBITS); i++)
+	{
+		node = tree;
+		len = 0;
+		while (node->zero || node->one)
+		{
+			bit = (i >> (CCITT_PEEKBITS - 1 - len)) & 1;
+			len++;
+			if (bit == 0 && node->zero)
+				node = node->zero;
+			else if (bit == 1 && node->one)
+				node = node->one;
+			else
+				break;
+		}
+		table->symbol[i] = (short) node->symbol;
+		table->len[i] = (unsigned char) len;
+	}
+
+	return 0;
+}
+
+static void ccittreader(CCITTREADER *br, const unsigned char *data, unsigned long N, int lsbfirst)
+{
+	br->data = data;
+	br->N = N;
+	br->pos = 0;
+	br->buffer = 0;
+	br->Nbuffered = 0;
+	br->remaining = N * 8;
+	br->lsbfirst = lsbfirst;
+}
+
+/*
+  look at the next CCITT_PEEKBITS bits, padding with zeroes past the end
+*/
+static unsigned int ccittpeek(CCITTREADER *br)
+{
+	unsigned int byte;
+
+	while (br->Nbuffered <= 24)
+	{
+		byte = br->pos < br->N ? br->data[br->pos] : 0;
+		if (br->lsbfirst)
+			byte = (ccittreverse[byte & 0x0F] << 4) | ccittreverse[byte >> 4];
+		br->buffer = (br->buffer << 8) | byte;
+		br->Nbuffered += 8;
+		br->pos++;
+	}
+	return (unsigned int) (br->buffer >> (br->Nbuffered - CCITT_PEEKBITS)) & ((1 << CCITT_PEEKBITS) - 1);
+}
+
+static void ccittskip(CCITTREADER *br, int nbits)
+{
+	br->Nbuffered -= nbits;
+	br->remaining -= nbits;
+}
+
+/*
+  read a single bit
+  Returns: the bit, or -1 at the end of the stream
+*/
+static int ccittgetbit(CCITTREADER *br)
+{
+	int answer;
+
+	if (br->remaining == 0)
+		return -1;
+	answer = (ccittpeek(br) >> (CCITT_PEEKBITS - 1)) & 1;
+	ccittskip(br, 1);
+
+	return answer;
+}
+
+/*
+  decode one symbol
+  Returns: the symbol, -1 for an invalid code
+  Notes: a code running off the end of the stream is finished by walking
+    the tree, exactly as bit-by-bit decoding would.
+*/
+static int ccittgetsymbol(CCITTREADER *br, const CCITTTABLE *table)
+{
+	unsigned int index;
+	HUFFNODE *node;
+	int bit;
+
+	index = ccittpeek(br);
+	if (table->len[index] <= br->remaining)
+	{
+		ccittskip(br, table->len[index]);
+		return table->symbol[index];
+	}
+
+	node = table->tree;
+	while (node->zero || node->one)
+	{
+		bit = ccittgetbit(br);
+		if (bit == 0 && node->zero)
+			node = node->zero;
+		else if (bit == 1 && node->one)
+			node = node->one;
+		else
+			break;
+	}
+	return node->symbol;
+}
+
+/*
+  write a run of pixels to a packed, msb first, bitmap
+  Params: out - the bitmap
+          Nout - size of the bitmap in bytes
+          bitpos - position of the next bit, updated
+          len - run length
+          colour - 0 or 1
+  Notes: bits past the end of the bitmap are dropped.
+*/
+static void ccittwriterun(unsigned char *out, unsigned long Nout, unsigned long *bitpos, long len, int colour)
+{
+	unsigned long pos = *bitpos;
+	unsigned long end;
+	unsigned char mask;
+
+	if (len <= 0)
+		return;
+	end = pos + len;
+	*bitpos = end;
+	if (end > Nout * 8)
+		end = Nout * 8;
+	if (pos >= end)
+		return;
+	while (pos < end && (pos & 7))
+	{
+		mask = (unsigned char) (0x80 >> (pos & 7));
+		if (colour)
+			out[pos >> 3] |= mask;
+		else
+			out[pos >> 3] &= (unsigned char) ~mask;
+		pos++;
+	}
+	if (end - pos >= 8)
+	{
+		memset(out + (pos >> 3), colour ? 0xFF : 0x00, (end - pos) >> 3);
+		pos += (end - pos) & ~7UL;
+	}
+	while (pos < end)
+	{
+		mask = (unsigned char) (0x80 >> (pos & 7));
+		if (colour)
+			out[pos >> 3] |= mask;
+		else
+			out[pos >> 3] &= (unsigned char) ~mask;
+		pos++;
+	}
+}
+
+/*
+  build the white and black run length tables, and optionally 2D mode table
+  Returns: 0 on success, -1 on out of memory
+*/
+static int buildccitttables(CCITTTABLE *white, CCITTTABLE *black, CCITTTABLE *twod)
+{
+	HUFFNODE *whitetree = 0;
+	HUFFNODE *blacktree = 0;
+	HUFFNODE *twodtree = 0;
+	int i;
 	int err = 0;
+
+	white->tree = 0;
+	black->tree = 0;
+	if (twod)
+		twod->tree = 0;
+	for (i = 0; i < 105; i++)
+		whitetree = addhuffmansymbol(whitetree, ccitttable[i].whitecode, ccitttable[i].whitelen, &err);
+	for (i = 0; i < 105; i++)
+		blacktree = addhuffmansymbol(blacktree, ccitttable[i].blackcode, ccitttable[i].blacklen, &err);
+	if (twod)
+	{
+		for (i = 0; i < 11; i++)
+			twodtree = addhuffmansymbol(twodtree, ccitt2dtable[i].code, ccitt2dtable[i].symbol, &err);
+	}
+	buildccitttable(white, whitetree);
+	buildccitttable(black, blacktree);
+	if (twod)
+		buildccitttable(twod, twodtree);
+	if (err || !whitetree || !blacktree || (twod && !twodtree))
+		return -1;
+
+	return 0;
+}
+
+unsigned char *ccittdecompress(unsigned char *in, unsigned long count, unsigned long *Nret, int width, int height, int eol)
+{
+	CCITTTABLE *tables = 0;
+	CCITTREADER bs;
+	unsigned long bitpos = 0;
+	int i;
 	int totlen;
 	int len;
 	int whitelen, blacklen;
@@ -2186,28 +2518,21 @@ static unsigned char *ccittdecompress(unsigned char *in, unsigned long count, un
 	answer = malloc(Nout);
 	if (!answer)
 		goto out_of_memory;
-	bout = bstream(answer, Nout, BIG_ENDIAN);
-	if (!bout)
+	tables = malloc(2 * sizeof(CCITTTABLE));
+	if (!tables)
 		goto out_of_memory;
-	bs = bstream(in, count, LITTLE_ENDIAN);
-	if (!bs)
+	if (buildccitttables(&tables[0], &tables[1], 0) == -1)
 		goto out_of_memory;
-	for (i = 0; i < 105; i++)
-		whitetree = addhuffmansymbol(whitetree, ccitttable[i].whitecode, ccitttable[i].whitelen, &err);
-	for (i = 0; i < 105; i++)
-		blacktree = addhuffmansymbol(blacktree, ccitttable[i].blackcode, ccitttable[i].blacklen, &err);
-	if (err)
-		goto out_of_memory;
-	
-	//debug(whitetree, 0);
+	ccittreader(&bs, in, count, 1);
+
 	if(eol)
-		len = gethuffmansymbol(whitetree, bs);
+		len = ccittgetsymbol(&bs, &tables[0]);
 	for (i = 0; i < height; i++)
 	{
 		totlen = 0;
 		while (totlen < width)
 		{ 
-			len = gethuffmansymbol(whitetree, bs);
+			len = ccittgetsymbol(&bs, &tables[0]);
 			if (len == -1)
 				goto parse_error;
 			if (len == -2)
@@ -2216,62 +2541,56 @@ static unsigned char *ccittdecompress(unsigned char *in, unsigned long count, un
 			  whitelen = len;
 			while (len >= 64)
 			{
-				len = gethuffmansymbol(whitetree, bs);
-				if (len == EOL || len == -1 || totlen + len + whitelen > width)
+				len = ccittgetsymbol(&bs, &tables[0]);
+				if (len == CCITT_EOL || len == -1 || totlen + len + whitelen > width)
 					goto parse_error;
 				whitelen += len;
 			}
-			for (ii = 0; ii < whitelen; ii++)
-				writebit(bout, 0);
+			ccittwriterun(answer, Nout, &bitpos, whitelen, 0);
 			totlen += whitelen;
 			if (totlen >= width)
 				break;
-			len = gethuffmansymbol(blacktree, bs);
+			len = ccittgetsymbol(&bs, &tables[1]);
 			if (len < 0)
 				goto parse_error;
 			blacklen = len;
 			while (len >= 64)
 			{
-				len = gethuffmansymbol(blacktree, bs);
-				if (len == EOL || len == -1 || totlen + len + blacklen > width)
+				len = ccittgetsymbol(&bs, &tables[1]);
+				if (len == CCITT_EOL || len == -1 || totlen + len + blacklen > width)
 					goto parse_error;
 				blacklen += len;
 			}
-			for (ii = 0; ii < blacklen; ii++)
-				writebit(bout, 1);
+			ccittwriterun(answer, Nout, &bitpos, blacklen, 1);
 			totlen += blacklen;
 
 		}
-		//synchtobyte(bs);
 		if (width & 0x07)
-		{
-			for (ii = 0; ii < 8 - (width & 0x07); ii++)
-				writebit(bout, 0);
-		}
+			ccittwriterun(answer, Nout, &bitpos, 8 - (width & 0x07), 0);
 		if(eol)
-			gethuffmansymbol(whitetree, bs);
-		///synchtobyte(bs);
+			ccittgetsymbol(&bs, &tables[0]);
 	}
 	*Nret = Nout;
-	killhuffmantree(whitetree);
-	killhuffmantree(blacktree);
-	free(bs);
-	free(bout);
+	killhuffmantree(tables[0].tree);
+	killhuffmantree(tables[1].tree);
+	free(tables);
 	return answer;
 parse_error:
 out_of_memory:
-	killhuffmantree(whitetree);
-	killhuffmantree(blacktree);
-	free(bs);
-	free(bout);
+	if (tables)
+	{
+		killhuffmantree(tables[0].tree);
+		killhuffmantree(tables[1].tree);
+	}
+	free(tables);
 	free(answer);
 	return 0;
 }
 
-static unsigned char *ccittgroup4decompress(unsigned char *in, unsigned long count, unsigned long *Nret, int width, int height, int eol)
+unsigned char *ccittgroup4decompress(unsigned char *in, unsigned long count, unsigned long *Nret, int width, int height, int eol)
 {
-	unsigned char *reference;
-	unsigned char *current;
+	unsigned char *reference = 0;
+	unsigned char *current = 0;
 	unsigned char *temp;
 	int i;
 	int a0;
@@ -2280,53 +2599,34 @@ static unsigned char *ccittgroup4decompress(unsigned char *in, unsigned long cou
 	int a1span, a2span;
 	int seg;
 	int b1, b2;
-	HUFFNODE * twodtree = 0;
-	HUFFNODE * whitetree = 0;
-	HUFFNODE * blacktree = 0;
-	BSTREAM *bs = 0;
-	BSTREAM *bout = 0;
+	int end;
+	CCITTTABLE *tables = 0;
+	CCITTREADER bs;
+	unsigned long bitpos = 0;
 	unsigned long Nout;
 	unsigned char *answer;
-	int err =0;
 	int mode;
 	int colour;
 
 	Nout = (width + 7) / 8 * height;
-	answer = malloc(Nout);
+	answer = calloc(Nout ? Nout : 1, 1);
 	if (!answer)
 		goto out_of_memory;
-	//debug memset
-	memset(answer, 0, Nout);
-	bout = bstream(answer, Nout, BIG_ENDIAN);
-	if (!bout)
+	tables = malloc(3 * sizeof(CCITTTABLE));
+	if (!tables)
 		goto out_of_memory;
-	bs = bstream(in, count, eol ? LITTLE_ENDIAN : BIG_ENDIAN);
-	if (!bs)
+	if (buildccitttables(&tables[0], &tables[1], &tables[2]) == -1)
 		goto out_of_memory;
-	for (i = 0; i < 105; i++)
-		whitetree = addhuffmansymbol(whitetree, ccitttable[i].whitecode, ccitttable[i].whitelen, &err);
-	for (i = 0; i < 105; i++)
-		blacktree = addhuffmansymbol(blacktree, ccitttable[i].blackcode, ccitttable[i].blacklen, &err);
-	for (i = 0; i < 11; i++)
-		twodtree = addhuffmansymbol(twodtree, ccitt2dtable[i].code, ccitt2dtable[i].symbol, &err);
-	if (err)
-		goto out_of_memory;
-
+	ccittreader(&bs, in, count, eol ? 1 : 0);
 
-
-	reference = malloc(width);
-	for (i = 0; i < width; i++)
-		reference[i] = 0;
-	current = malloc(width);
+	reference = calloc(width, 1);
+	current = calloc(width, 1);
 	if (!current || !reference)
 		goto out_of_memory;
 
-
 	if (eol)
 	{
-		int len;
-
-		while (getbit(bs) == 0)
+		while (ccittgetbit(&bs) == 0)
 			continue;
 	}
 	for (i = 0; i < height; i++)
@@ -2348,7 +2648,7 @@ static unsigned char *ccittgroup4decompress(unsigned char *in, unsigned long cou
 			if (a0 == -1)
 				a0 = 0;
 			
-			mode = gethuffmansymbol(twodtree, bs);
+			mode = ccittgetsymbol(&bs, &tables[2]);
 			a2 = -1;
 			switch (mode)
 			{
@@ -2362,13 +2662,13 @@ static unsigned char *ccittgroup4decompress(unsigned char *in, unsigned long cou
 				{
 					do
 					{
-						seg = gethuffmansymbol(whitetree, bs);
+						seg = ccittgetsymbol(&bs, &tables[0]);
 						a1span += seg;
 					} while (seg >= 64 && a0 + a1span <= width);
 
 					do
 					{
-						seg = gethuffmansymbol(blacktree, bs);
+						seg = ccittgetsymbol(&bs, &tables[1]);
 						a2span += seg;
 					} while (seg >= 64 && a0 + a1span <= width);
 				}
@@ -2376,23 +2676,20 @@ static unsigned char *ccittgroup4decompress(unsigned char *in, unsigned long cou
 				{
 					do
 					{
-						seg = gethuffmansymbol(blacktree, bs);
+						seg = ccittgetsymbol(&bs, &tables[1]);
 						a1span += seg;
 					} while (seg >= 64 && a0 + a1span  <= width);
 
 					do
 					{
-						seg = gethuffmansymbol(whitetree, bs);
+						seg = ccittgetsymbol(&bs, &tables[0]);
 						a2span += seg;
 					} while (seg >= 64 && a0 + a1span + a2span <= width);
 				}
 				a1 = a0 + a1span;
 				a2 = a1 + a2span;
 				if (a1 > width)
-				{
-					//printf("Bad span1 %d span2 %d here\n", a1span, a2span);
 					goto parse_error;
-				}
 				break;
 			case CCITT_VERTICAL_0:
 				a1 = b1;
@@ -2419,29 +2716,19 @@ static unsigned char *ccittgroup4decompress(unsigned char *in, unsigned long cou
 				goto endofblock;
 				break;
 			default:
-				//printf("bad %d\n", mode);
-				//for (i = 0; i < 32; i++)
-					//printf("%d", getbit(bs));
-				//printf("\n");
-				//getchar();
 				goto parse_error;
 				break;
 			}
 			if (a1 <= a0 && a0 != 0 )
-			{
-				//printf("bad here a0 %d a1 %d\n", a0, a1);
-				//getchar();
 				goto parse_error;
-			}
-			//printf("a0 %d a1 %d a2 %d\n", a0, a1, a2);
 			if (a0 < 0 || a1 < 0)
-			{
 				goto parse_error;
-			}
-			while (a0 < a1 && a0 < width)
+			end = a1 < width ? a1 : width;
+			if (a0 < end)
 			{
-				current[a0++] = colour;
-				writebit(bout, colour);
+				memset(current + a0, colour, end - a0);
+				ccittwriterun(answer, Nout, &bitpos, end - a0, colour);
+				a0 = end;
 			}
 			if (mode != CCITT_PASS)
 				colour ^= 1;
@@ -2449,62 +2736,70 @@ static unsigned char *ccittgroup4decompress(unsigned char *in, unsigned long cou
 				a0 = a1;
 			if (a2 != -1)
 			{
-				while (a0 < a2 && a0 < width)
+				end = a2 < width ? a2 : width;
+				if (a0 < end)
 				{
-					current[a0++] = colour;
-					writebit(bout, colour);
+					memset(current + a0, colour, end - a0);
+					ccittwriterun(answer, Nout, &bitpos, end - a0, colour);
+					a0 = end;
 				}
 				colour ^= 1;
 			}
 		}
-		//printf("here a0 %d\n", a0);
 		if (eol)
 		{
-			while (getbit(bs) == 0)
+			while (ccittgetbit(&bs) == 0)
 				continue;
-			//printf("mode %d\n", getbit(bs));
-			//int endline = gethuffmansymbol(whitetree, bs);
-			//printf("end %d\n", endline);
 		}
 		temp = reference;
 		reference = current;
 		current = temp;
-		if (width % 8)
-		{
-			while (a0 % 8)
-			{
-				writebit(bout, 0);
-				a0++;
-			}
-		}
-
+		if ((width % 8) && (a0 % 8))
+			ccittwriterun(answer, Nout, &bitpos, 8 - (a0 % 8), 0);
 	}
 endofblock:
 	*Nret = Nout;
-	killhuffmantree(twodtree);
-	killhuffmantree(whitetree);
-	killhuffmantree(blacktree);
+	killhuffmantree(tables[0].tree);
+	killhuffmantree(tables[1].tree);
+	killhuffmantree(tables[2].tree);
+	free(tables);
 	free(reference);
 	free(current);
 	return answer;
 
 parse_error:
-	//printf("parse error\n");
-	//getchar();
+	/* return what we have decoded so far */
 	*Nret = Nout;
+	killhuffmantree(tables[0].tree);
+	killhuffmantree(tables[1].tree);
+	killhuffmantree(tables[2].tree);
+	free(tables);
+	free(reference);
+	free(current);
 	return answer;
 out_of_memory:
+	if (tables)
+	{
+		killhuffmantree(tables[0].tree);
+		killhuffmantree(tables[1].tree);
+		killhuffmantree(tables[2].tree);
+	}
+	free(tables);
+	free(reference);
+	free(current);
+	free(answer);
 	return 0;
 }
 
 /*
 load the raster data
 Params: out - return pointer for raster data, 0 for size run
-fp - pointer to an open file
+in - the compressed data
+count - number of compressed bytes
 Nret - number of bytes read
 Returns: 0 on success, -1 on fail.
 */
-static int loadlzw(unsigned char *out, FILE *fp, unsigned long count, unsigned long *Nret)
+static int loadlzw(unsigned char *out, unsigned char *in, unsigned long count, unsigned long *Nret)
 {
 	int codesize;
 	//int block;
@@ -2531,12 +2826,11 @@ static int loadlzw(unsigned char *out, FILE *fp, unsigned long count, unsigned l
 	nextcode = end + 1;
 	codelen = codesize + 1;
 
-	stream = malloc(count);
-	if (!stream)
-		return -1;
-	fread(stream, count, 1, fp);
+	stream = in;
 
 	table = malloc(sizeof(ENTRY) * (1 << 12));
+	if (!table)
+		return -1;
 
 	for (ii = 0; ii<nextcode; ii++)
 	{
@@ -2646,14 +2940,14 @@ static int loadlzw(unsigned char *out, FILE *fp, unsigned long count, unsigned l
 
 
 	free(table);
-	free(stream);
+	killbstream(bs);
 
 	*Nret = pos;
 
 	return 0;
 parse_error:
 	free(table);
-	free(stream);
+	killbstream(bs);
 	return -1;
 }
 
@@ -2769,18 +3063,6 @@ static int synchtobyte(BSTREAM *bs)
 	return 0;
 }
 
-static int writebit(BSTREAM *bs, int bit)
-{
-	if (bs->pos >= bs->N)
-		return -1;
-	if (bit)
-		bs->data[bs->pos] |= bs->bit;
-	else
-		bs->data[bs->pos] &= (unsigned char)~bs->bit;
-	getbit(bs);
-	return 0;
-}
-
 /*
   sizeof() for a TIFF data type
   we default to 1
@@ -0,0 +1,228 @@
+/*
+  Reading the sample data of uncompressed audio files.
+
+  Wav and aiff files store samples as 8, 16, 24 or 32 bit integers,
+  or as 32 or 64 bit IEEE floats, in either byte order. We read the
+  data in large blocks with fread and convert the block in one go,
+  which is very much faster than calling fgetc for every byte of a
+  long recording.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pcmsamples.h"
+
+#define PCMBLOCKSIZE (64 * 1024)
+
+static void convertpcm(const unsigned char *buff, short *out, long N, int format, int bytes, int bigendian);
+static short floattopcm(double x);
+
+/*
+  Read a run of samples and convert them to 16 bit.
+  Params:
+    fp - the file, positioned at the first sample
+    out - return for the samples
+    N - the number of samples (not frames)
+    format - PCM_UNSIGNED, PCM_SIGNED or PCM_FLOAT
+    bytes - bytes per sample (1 - 4 for integers, 4 or 8 for floats)
+    bigendian - set if the samples are stored most significant byte first
+  Returns: 0 on success, -1 on a read error, short file or
+    unsupported format.
+  Notes: wider integers are rounded to 16 bits, floats are scaled from
+    -1.0 to 1.0, and both are clipped.
+ */
+int freadpcmsamples(FILE *fp, short *out, long N, int format, int bytes, int bigendian)
+{
+   unsigned char buff[PCMBLOCKSIZE];
+   long chunk = PCMBLOCKSIZE / bytes;
+   long Nread;
+
+   if (format == PCM_FLOAT)
+   {
+      if (bytes != 4 && bytes != 8)
+         return -1;
+   }
+   else if (format == PCM_SIGNED || format == PCM_UNSIGNED)
+   {
+      if (bytes < 1 || bytes > 4)
+         return -1;
+   }
+   else
+      return -1;
+
+   while (N > 0)
+   {
+      if (chunk > N)
+         chunk = N;
+      Nread = (long) fread(buff, bytes, chunk, fp);
+      if (Nread != chunk)
+         return -1;
+      convertpcm(buff, out, chunk, format, bytes, bigendian);
+      out += chunk;
+      N -= chunk;
+   }
+
+   return 0;
+}
+
+/*
+  Read a run of frames and pass them to a callback a block at a time,
+  so a long recording is never all in memory.
+  Params:
+    fp - the file, positioned at the first sample
+    Nframes - the number of frames
+    Nchannels - samples per frame
+    format, bytes, bigendian - as freadpcmsamples()
+    samplerate - passed on to the callback
+    callback - called with each block of interleaved samples, returns
+      non-zero to stop
+    ptr - context pointer for the callback
+  Returns: 0 on success, -1 on a read error, short file, unsupported
+    format, out of memory, or if the callback stops.
+  Notes: an empty file gives one call with no samples.
+ */
+int streampcmsamples(FILE *fp, long Nframes, int Nchannels, int format, int bytes, int bigendian, long samplerate,
+   int (*callback)(void *ptr, const short *pcm, long samplerate, int Nchannels, long Nsamples), void *ptr)
+{
+   short *pcm;
+   long chunk;
+
+   if (bytes < 1 || Nchannels < 1)
+      return -1;
+   chunk = PCMBLOCKSIZE / (bytes * Nchannels);
+   if (chunk < 1)
+      chunk = 1;
+   pcm = malloc(chunk * Nchannels * sizeof(short));
+   if (!pcm)
+      return -1;
+
+   if (freadpcmsamples(fp, pcm, 0, format, bytes, bigendian))
+      goto error_exit;
+   if (Nframes == 0 && (*callback)(ptr, pcm, samplerate, Nchannels, 0))
+      goto error_exit;
+   while (Nframes > 0)
+   {
+      if (chunk > Nframes)
+         chunk = Nframes;
+      if (freadpcmsamples(fp, pcm, chunk * Nchannels, format, bytes, bigendian))
+         goto error_exit;
+      if ((*callback)(ptr, pcm, samplerate, Nchannels, chunk))
+         goto error_exit;
+      Nframes -= chunk;
+   }
+   free(pcm);
+
+   return 0;
+
+error_exit:
+   free(pcm);
+   return -1;
+}
+
+/*
+  Convert a block of raw samples to 16 bit. Integers are handled in
+  offset binary so that the rounding shifts never see a negative number.
+ */
+static void convertpcm(const unsigned char *buff, short *out, long N, int format, int bytes, int bigendian)
+{
+   long i;
+   int j;
+   unsigned long u;
+   unsigned char native[8];
+   unsigned int one = 1;
+   int swap;
+   float f;
+   double d;
+
+   if (format == PCM_UNSIGNED && bytes == 1)
+   {
+      for (i = 0; i < N; i++)
+         out[i] = (short) ((buff[i] - 128) * 256);
+   }
+   else if (format == PCM_SIGNED && bytes == 1)
+   {
+      for (i = 0; i < N; i++)
+         out[i] = (short) (((buff[i] ^ 128) - 128) * 256);
+   }
+   else if (format != PCM_FLOAT && bytes == 2)
+   {
+      if (bigendian)
+      {
+         for (i = 0; i < N; i++, buff += 2)
+            out[i] = (short) (((buff[0] ^ 128) - 128) * 256 + buff[1]);
+      }
+      else
+      {
+         for (i = 0; i < N; i++, buff += 2)
+            out[i] = (short) (((buff[1] ^ 128) - 128) * 256 + buff[0]);
+      }
+   }
+   else if (format != PCM_FLOAT && bytes == 3)
+   {
+      for (i = 0; i < N; i++, buff += 3)
+      {
+         if (bigendian)
+            u = ((unsigned long) (buff[0] ^ 0x80) << 16) | (buff[1] << 8) | buff[2];
+         else
+            u = ((unsigned long) (buff[2] ^ 0x80) << 16) | (buff[1] << 8) | buff[0];
+         u = (u + 0x80) >> 8;
+         if (u > 0xFFFF)
+            u = 0xFFFF;
+         out[i] = (short) ((long) u - 32768);
+      }
+   }
+   else if (format != PCM_FLOAT && bytes == 4)
+   {
+      for (i = 0; i < N; i++, buff += 4)
+      {
+         if (bigendian)
+            u = ((unsigned long) (buff[0] ^ 0x80) << 24) | ((unsigned long) buff[1] << 16) | (buff[2] << 8) | buff[3];
+         else
+            u = ((unsigned long) (buff[3] ^ 0x80) << 24) | ((unsigned long) buff[2] << 16) | (buff[1] << 8) | buff[0];
+         u = (u >> 16) + ((u >> 15) & 1);
+         if (u > 0xFFFF)
+            u = 0xFFFF;
+         out[i] = (short) ((long) u - 32768);
+      }
+   }
+   else if (format == PCM_FLOAT)
+   {
+      /* floats are assumed to be IEEE 754 on the host too, so we only
+         need to get the bytes into the host's order */
+      swap = (*(unsigned char *) &one == 1) == (bigendian != 0);
+      for (i = 0; i < N; i++, buff += bytes)
+      {
+         for (j = 0; j < bytes; j++)
+            native[j] = swap ? buff[bytes - j - 1] : buff[j];
+         if (bytes == 4)
+         {
+            memcpy(&f, native, 4);
+            out[i] = floattopcm(f);
+         }
+         else
+         {
+            memcpy(&d, native, 8);
+            out[i] = floattopcm(d);
+         }
+      }
+   }
+}
+
+/*
+  Scale a float sample from the range -1.0 to 1.0 to 16 bits, with
+  rounding and clipping. NaNs fail both comparisons and go to silence.
+ */
+static short floattopcm(double x)
+{
+   x = x * 32768.0;
+   if (x >= 32767.0)
+      return 32767;
+   if (x <= -32768.0)
+      return -32768;
+   if (x > 0)
+      return (short) (x + 0.5);
+   if (x < 0)
+      return (short) -(long) (-x + 0.5);
+   return 0;
+}
@@ -0,0 +1,14 @@
+#ifndef pcmsamples_h
+#define pcmsamples_h
+
+#include <stdio.h>
+
+#define PCM_UNSIGNED 0
+#define PCM_SIGNED 1
+#define PCM_FLOAT 2
+
+int freadpcmsamples(FILE *fp, short *out, long N, int format, int bytes, int bigendian);
+int streampcmsamples(FILE *fp, long Nframes, int Nchannels, int format, int bytes, int bigendian, long samplerate,
+   int (*callback)(void *ptr, const short *pcm, long samplerate, int Nchannels, long Nsamples), void *ptr);
+
+#endif
@@ -175,6 +175,14 @@ enum
 	SRC_SINC_FASTEST			= 2,
 	SRC_ZERO_ORDER_HOLD			= 3,
 	SRC_LINEAR					= 4,
+
+	/*
+	** The best quality filter, run from a precomputed polyphase bank when
+	** the ratio is a fixed fraction with a small denominator, as most
+	** conversions between standard rates are. Other ratios use
+	** SRC_SINC_BEST_QUALITY.
+	*/
+	SRC_SINC_POLYPHASE			= 5,
 } ;
 
 /*
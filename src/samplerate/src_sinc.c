@@ -31,6 +31,40 @@
 #include "float_cast.h"
 #include "common.h"
 
+/*
+** Four float vectors for the filter dot products. VEC_MADD (a, b, c) is
+** a + b * c, VEC_DUPLO and VEC_DUPHI spread the low and high pairs as
+** x0 x0 x1 x1 and x2 x2 x3 x3, VEC_SET2 (x, y) is x x y y.
+** Define SINC_SCALAR to build the plain float loops instead.
+*/
+#if !defined (SINC_SCALAR) && (defined (__SSE2__) || defined (_M_X64) || (defined (_M_IX86_FP) && _M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define	SINC_VECTOR
+typedef __m128 VEC4 ;
+#define	VEC_ZERO()			_mm_setzero_ps ()
+#define	VEC_LOAD(p)			_mm_loadu_ps (p)
+#define	VEC_STORE(p, v)		_mm_storeu_ps ((p), (v))
+#define	VEC_SPLAT(x)		_mm_set1_ps (x)
+#define	VEC_SET2(x, y)		_mm_setr_ps ((x), (x), (y), (y))
+#define	VEC_ADD(a, b)		_mm_add_ps ((a), (b))
+#define	VEC_MADD(a, b, c)	_mm_add_ps ((a), _mm_mul_ps ((b), (c)))
+#define	VEC_DUPLO(v)		_mm_unpacklo_ps ((v), (v))
+#define	VEC_DUPHI(v)		_mm_unpackhi_ps ((v), (v))
+#elif !defined (SINC_SCALAR) && (defined (__ARM_NEON) || defined (__ARM_NEON__))
+#include <arm_neon.h>
+#define	SINC_VECTOR
+typedef float32x4_t VEC4 ;
+#define	VEC_ZERO()			vdupq_n_f32 (0.0f)
+#define	VEC_LOAD(p)			vld1q_f32 (p)
+#define	VEC_STORE(p, v)		vst1q_f32 ((p), (v))
+#define	VEC_SPLAT(x)		vdupq_n_f32 (x)
+#define	VEC_SET2(x, y)		vcombine_f32 (vdup_n_f32 (x), vdup_n_f32 (y))
+#define	VEC_ADD(a, b)		vaddq_f32 ((a), (b))
+#define	VEC_MADD(a, b, c)	vmlaq_f32 ((a), (b), (c))
+#define	VEC_DUPLO(v)		vzipq_f32 ((v), (v)).val [0]
+#define	VEC_DUPHI(v)		vzipq_f32 ((v), (v)).val [1]
+#endif
+
 #define	SINC_MAGIC_MARKER	MAKE_MAGIC (' ', 's', 'i', 'n', 'c', ' ')
 
 /*========================================================================================
@@ -52,6 +86,11 @@ typedef float	coeff_t ;
 #include "mid_qual_coeffs.h"
 #include "high_qual_coeffs.h"
 
+/* One phase of a polyphase filter bank. */
+typedef struct
+{	int		first, Ntaps, offset ;
+} SINC_PHASE ;
+
 typedef struct
 {	int		sinc_magic_marker ;
 
@@ -68,7 +107,19 @@ typedef struct
 	int		b_current, b_end, b_real_end, b_len ;
 
 	/* Sure hope noone does more than 128 channels at once. */
-	double left_calc [128], right_calc [128] ;
+	double	multi_sum [128] ;
+
+	/* Interpolated filter taps for the current output, in frame order. */
+	float	*taps ;
+
+	/*
+	** Polyphase bank for a ratio of L / M, L phases of taps scaled for
+	** output. poly_L is 0 if the ratio has no bank.
+	*/
+	double	poly_ratio ;
+	int		poly_L, poly_M ;
+	SINC_PHASE	*phases ;
+	float	*bank ;
 
 	/* C99 struct flexible array. */
 	float	buffer [] ;
@@ -79,6 +130,7 @@ static int sinc_hex_vari_process (SRC_PRIVATE *psrc, SRC_DATA *data) ;
 static int sinc_quad_vari_process (SRC_PRIVATE *psrc, SRC_DATA *data) ;
 static int sinc_stereo_vari_process (SRC_PRIVATE *psrc, SRC_DATA *data) ;
 static int sinc_mono_vari_process (SRC_PRIVATE *psrc, SRC_DATA *data) ;
+static int sinc_poly_process (SRC_PRIVATE *psrc, SRC_DATA *data) ;
 
 static int prepare_data (SINC_FILTER *filter, SRC_DATA *data, int half_filter_chan_len) WARN_UNUSED ;
 
@@ -104,11 +156,6 @@ fp_fraction_part (increment_t x)
 {	return ((x) & ((((increment_t) 1) << SHIFT_BITS) - 1)) ;
 } /* fp_fraction_part */
 
-static double
-fp_to_double (increment_t x)
-{	return fp_fraction_part (x) * INV_FP_ONE ;
-} /* fp_to_double */
-
 
 /*----------------------------------------------------------------------------------------
 */
@@ -126,6 +173,9 @@ sinc_get_name (int src_enum)
 		case SRC_SINC_FASTEST :
 			return "Fastest Sinc Interpolator" ;
 
+		case SRC_SINC_POLYPHASE :
+			return "Polyphase Sinc Interpolator" ;
+
 		default: break ;
 		} ;
 
@@ -145,6 +195,9 @@ sinc_get_description (int src_enum)
 		case SRC_SINC_BEST_QUALITY :
 			return "Band limited sinc interpolation, best quality, 145dB SNR, 96% BW." ;
 
+		case SRC_SINC_POLYPHASE :
+			return "Band limited sinc interpolation, best quality, polyphase for fixed rational ratios." ;
+
 		default :
 			break ;
 		} ;
@@ -156,7 +209,7 @@ int
 sinc_set_converter (SRC_PRIVATE *psrc, int src_enum)
 {	SINC_FILTER *filter, temp_filter ;
 	increment_t count ;
-	int bits ;
+	int bits, taps_len ;
 
 	/* Quick sanity check. */
 	if (SHIFT_BITS >= sizeof (increment_t) * 8 - 1)
@@ -172,7 +225,7 @@ sinc_set_converter (SRC_PRIVATE *psrc, int src_enum)
 	temp_filter.sinc_magic_marker = SINC_MAGIC_MARKER ;
 	temp_filter.channels = psrc->channels ;
 
-	if (psrc->channels > ARRAY_LEN (temp_filter.left_calc))
+	if (psrc->channels > ARRAY_LEN (temp_filter.multi_sum))
 		return SRC_ERR_BAD_CHANNEL_COUNT ;
 	else if (psrc->channels == 1)
 	{	psrc->const_process = sinc_mono_vari_process ;
@@ -199,6 +252,10 @@ sinc_set_converter (SRC_PRIVATE *psrc, int src_enum)
 		} ;
 	psrc->reset = sinc_reset ;
 
+	/* The bank is built on the first call, when the ratio is known. */
+	if (src_enum == SRC_SINC_POLYPHASE)
+		psrc->const_process = sinc_poly_process ;
+
 	switch (src_enum)
 	{	case SRC_SINC_FASTEST :
 				temp_filter.coeffs = fastest_coeffs.coeffs ;
@@ -213,6 +270,7 @@ sinc_set_converter (SRC_PRIVATE *psrc, int src_enum)
 				break ;
 
 		case SRC_SINC_BEST_QUALITY :
+		case SRC_SINC_POLYPHASE :
 				temp_filter.coeffs = slow_high_qual_coeffs.coeffs ;
 				temp_filter.coeff_half_len = ARRAY_LEN (slow_high_qual_coeffs.coeffs) - 1 ;
 				temp_filter.index_inc = slow_high_qual_coeffs.increment ;
@@ -229,12 +287,15 @@ sinc_set_converter (SRC_PRIVATE *psrc, int src_enum)
 
 	temp_filter.b_len = lrint (2.5 * temp_filter.coeff_half_len / (temp_filter.index_inc * 1.0) * SRC_MAX_RATIO) ;
 	temp_filter.b_len = MAX (temp_filter.b_len, 4096) ;
+	taps_len = temp_filter.b_len + 4 ;
 	temp_filter.b_len *= temp_filter.channels ;
 
-	if ((filter = calloc (1, sizeof (SINC_FILTER) + sizeof (filter->buffer [0]) * (temp_filter.b_len + temp_filter.channels))) == NULL)
+	/* The taps go after the buffer. There are never more than a buffer of frames. */
+	if ((filter = calloc (1, sizeof (SINC_FILTER) + sizeof (filter->buffer [0]) * (temp_filter.b_len + temp_filter.channels + taps_len))) == NULL)
 		return SRC_ERR_MALLOC_FAILED ;
 
 	*filter = temp_filter ;
+	filter->taps = filter->buffer + filter->b_len + filter->channels ;
 	memset (&temp_filter, 0xEE, sizeof (temp_filter)) ;
 
 	psrc->private_data = filter ;
@@ -274,56 +335,278 @@ sinc_reset (SRC_PRIVATE *psrc)
 **	Beware all ye who dare pass this point. There be dragons here.
 */
 
-static double
-calc_output_single (SINC_FILTER *filter, increment_t increment, increment_t start_filter_index)
-{	double		fraction, left, right, icoeff ;
+/*
+** Each output is a dot product of the interpolated filter taps with
+** the frames round b_current. The taps are worked out once, in float,
+** then the dot products for every channel run as vector code, four
+** floats at a time, with SSE2 on x86 and NEON on ARM. Anything else
+** gets plain float loops, which a compiler is free to vectorise itself.
+*/
+
+static int
+calc_taps (SINC_FILTER *filter, increment_t increment, increment_t start_filter_index, int *first)
+{	const coeff_t	*coeffs ;
+	float		*taps ;
 	increment_t	filter_index, max_filter_index ;
-	int			data_index, coeff_count, indx ;
+	int			coeff_count, indx, k, Nleft ;
+	float		fraction ;
+
+	coeffs = filter->coeffs ;
+	taps = filter->taps ;
 
 	/* Convert input parameters into fixed point. */
 	max_filter_index = int_to_fp (filter->coeff_half_len) ;
 
-	/* First apply the left half of the filter. */
+	/* The left half of the filter, ending on the current frame. */
 	filter_index = start_filter_index ;
 	coeff_count = (max_filter_index - filter_index) / increment ;
 	filter_index = filter_index + coeff_count * increment ;
-	data_index = filter->b_current - coeff_count ;
+	*first = -coeff_count ;
+	Nleft = coeff_count + 1 ;
 
-	left = 0.0 ;
-	do
-	{	fraction = fp_to_double (filter_index) ;
+	for (k = 0 ; k < Nleft ; k++)
+	{	fraction = fp_fraction_part (filter_index) * (float) INV_FP_ONE ;
 		indx = fp_to_int (filter_index) ;
 
-		icoeff = filter->coeffs [indx] + fraction * (filter->coeffs [indx + 1] - filter->coeffs [indx]) ;
-
-		left += icoeff * filter->buffer [data_index] ;
+		taps [k] = coeffs [indx] + fraction * (coeffs [indx + 1] - coeffs [indx]) ;
 
 		filter_index -= increment ;
-		data_index = data_index + 1 ;
-		}
-	while (filter_index >= MAKE_INCREMENT_T (0)) ;
+		} ;
 
-	/* Now apply the right half of the filter. */
+	/* The right half, from the next frame on. */
 	filter_index = increment - start_filter_index ;
 	coeff_count = (max_filter_index - filter_index) / increment ;
-	filter_index = filter_index + coeff_count * increment ;
-	data_index = filter->b_current + 1 + coeff_count ;
 
-	right = 0.0 ;
-	do
-	{	fraction = fp_to_double (filter_index) ;
+	for (k = 0 ; k <= coeff_count ; k++)
+	{	fraction = fp_fraction_part (filter_index) * (float) INV_FP_ONE ;
 		indx = fp_to_int (filter_index) ;
 
-		icoeff = filter->coeffs [indx] + fraction * (filter->coeffs [indx + 1] - filter->coeffs [indx]) ;
+		taps [Nleft + k] = coeffs [indx] + fraction * (coeffs [indx + 1] - coeffs [indx]) ;
 
-		right += icoeff * filter->buffer [data_index] ;
+		filter_index += increment ;
+		} ;
 
-		filter_index -= increment ;
-		data_index = data_index - 1 ;
-		}
-	while (filter_index > MAKE_INCREMENT_T (0)) ;
+	/* The centre goes to the left half when it falls exactly on a frame. */
+	if (increment == start_filter_index && coeff_count > 0)
+		taps [Nleft] = 0.0f ;
+
+	return Nleft + coeff_count + 1 ;
+} /* calc_taps */
+
+#ifdef SINC_VECTOR
+
+static float
+sinc_dot_mono (const float *taps, const float *data, int Ntaps)
+{	VEC4	sum0, sum1 ;
+	float	sum [4] ;
+	int		k ;
+
+	sum0 = sum1 = VEC_ZERO () ;
+	for (k = 0 ; k + 8 <= Ntaps ; k += 8)
+	{	sum0 = VEC_MADD (sum0, VEC_LOAD (taps + k), VEC_LOAD (data + k)) ;
+		sum1 = VEC_MADD (sum1, VEC_LOAD (taps + k + 4), VEC_LOAD (data + k + 4)) ;
+		} ;
+	VEC_STORE (sum, VEC_ADD (sum0, sum1)) ;
+
+	sum [0] += sum [2] ;
+	sum [1] += sum [3] ;
+	for ( ; k < Ntaps ; k++)
+		sum [0] += taps [k] * data [k] ;
+
+	return sum [0] + sum [1] ;
+} /* sinc_dot_mono */
+
+static void
+sinc_dot_stereo (const float *taps, const float *data, int Ntaps, float *out)
+{	VEC4	sum0, sum1, t ;
+	float	sum [4] ;
+	int		k ;
+
+	/* Two frames a vector, so each tap goes in twice. */
+	sum0 = sum1 = VEC_ZERO () ;
+	for (k = 0 ; k + 4 <= Ntaps ; k += 4)
+	{	t = VEC_LOAD (taps + k) ;
+		sum0 = VEC_MADD (sum0, VEC_DUPLO (t), VEC_LOAD (data + 2 * k)) ;
+		sum1 = VEC_MADD (sum1, VEC_DUPHI (t), VEC_LOAD (data + 2 * k + 4)) ;
+		} ;
+	VEC_STORE (sum, VEC_ADD (sum0, sum1)) ;
+
+	out [0] = sum [0] + sum [2] ;
+	out [1] = sum [1] + sum [3] ;
+	for ( ; k < Ntaps ; k++)
+	{	out [0] += taps [k] * data [2 * k] ;
+		out [1] += taps [k] * data [2 * k + 1] ;
+		} ;
+} /* sinc_dot_stereo */
+
+static void
+sinc_dot_quad (const float *taps, const float *data, int Ntaps, float *out)
+{	VEC4	sum0, sum1 ;
+	int		k ;
+
+	sum0 = sum1 = VEC_ZERO () ;
+	for (k = 0 ; k + 2 <= Ntaps ; k += 2)
+	{	sum0 = VEC_MADD (sum0, VEC_SPLAT (taps [k]), VEC_LOAD (data + 4 * k)) ;
+		sum1 = VEC_MADD (sum1, VEC_SPLAT (taps [k + 1]), VEC_LOAD (data + 4 * k + 4)) ;
+		} ;
+	if (k < Ntaps)
+		sum0 = VEC_MADD (sum0, VEC_SPLAT (taps [k]), VEC_LOAD (data + 4 * k)) ;
+
+	VEC_STORE (out, VEC_ADD (sum0, sum1)) ;
+} /* sinc_dot_quad */
+
+static void
+sinc_dot_hex (const float *taps, const float *data, int Ntaps, float *out)
+{	VEC4	sum0, sum1, sum2 ;
+	float	a [4], b [4], c [4] ;
+	int		k, ch ;
+
+	/*
+	** Two frames are twelve floats, three vectors. The middle one has
+	** the last two channels of the first frame and the first two of
+	** the second.
+	*/
+	sum0 = sum1 = sum2 = VEC_ZERO () ;
+	for (k = 0 ; k + 2 <= Ntaps ; k += 2)
+	{	sum0 = VEC_MADD (sum0, VEC_SPLAT (taps [k]), VEC_LOAD (data + 6 * k)) ;
+		sum1 = VEC_MADD (sum1, VEC_SET2 (taps [k], taps [k + 1]), VEC_LOAD (data + 6 * k + 4)) ;
+		sum2 = VEC_MADD (sum2, VEC_SPLAT (taps [k + 1]), VEC_LOAD (data + 6 * k + 8)) ;
+		} ;
+	VEC_STORE (a, sum0) ;
+	VEC_STORE (b, sum1) ;
+	VEC_STORE (c, sum2) ;
+
+	out [0] = a [0] + b [2] ;
+	out [1] = a [1] + b [3] ;
+	out [2] = a [2] + c [0] ;
+	out [3] = a [3] + c [1] ;
+	out [4] = b [0] + c [2] ;
+	out [5] = b [1] + c [3] ;
+	if (k < Ntaps)
+		for (ch = 0 ; ch < 6 ; ch++)
+			out [ch] += taps [k] * data [6 * k + ch] ;
+} /* sinc_dot_hex */
+
+static void
+sinc_dot_multi (const float *taps, const float *data, int Ntaps, int channels, float *out)
+{	VEC4	sum ;
+	int		k, ch ;
+
+	/* Four channels at a time down the frames, then the odd ones over. */
+	for (ch = 0 ; ch + 4 <= channels ; ch += 4)
+	{	sum = VEC_ZERO () ;
+		for (k = 0 ; k < Ntaps ; k++)
+			sum = VEC_MADD (sum, VEC_SPLAT (taps [k]), VEC_LOAD (data + channels * k + ch)) ;
+		VEC_STORE (out + ch, sum) ;
+		} ;
+
+	for ( ; ch < channels ; ch++)
+	{	out [ch] = 0.0f ;
+		for (k = 0 ; k < Ntaps ; k++)
+			out [ch] += taps [k] * data [channels * k + ch] ;
+		} ;
+} /* sinc_dot_multi */
+
+#else
+
+static float
+sinc_dot_mono (const float *taps, const float *data, int Ntaps)
+{	float	sum = 0.0f ;
+	int		k ;
+
+	for (k = 0 ; k < Ntaps ; k++)
+		sum += taps [k] * data [k] ;
+
+	return sum ;
+} /* sinc_dot_mono */
+
+static void
+sinc_dot_multi (const float *taps, const float *data, int Ntaps, int channels, float *out)
+{	int		k, ch ;
+
+	for (ch = 0 ; ch < channels ; ch++)
+		out [ch] = 0.0f ;
+
+	for (k = 0 ; k < Ntaps ; k++)
+	{	for (ch = 0 ; ch < channels ; ch++)
+			out [ch] += taps [k] * data [ch] ;
+		data += channels ;
+		} ;
+} /* sinc_dot_multi */
+
+static void
+sinc_dot_stereo (const float *taps, const float *data, int Ntaps, float *out)
+{	sinc_dot_multi (taps, data, Ntaps, 2, out) ;
+} /* sinc_dot_stereo */
+
+static void
+sinc_dot_quad (const float *taps, const float *data, int Ntaps, float *out)
+{	sinc_dot_multi (taps, data, Ntaps, 4, out) ;
+} /* sinc_dot_quad */
+
+static void
+sinc_dot_hex (const float *taps, const float *data, int Ntaps, float *out)
+{	sinc_dot_multi (taps, data, Ntaps, 6, out) ;
+} /* sinc_dot_hex */
+
+#endif
+
+/*
+** The kernels sum in float, which over the thousands of taps of a steep
+** downsampling filter drifts further from the old double code than it
+** should. So they are given SINC_BLOCK taps at a time, and the block
+** sums are added in double.
+*/
+
+#define	SINC_BLOCK			64
+
+static void
+sinc_dot_block (int channels, const float *taps, const float *data, int Ntaps, float *out)
+{
+	switch (channels)
+	{	case 1 :
+			out [0] = sinc_dot_mono (taps, data, Ntaps) ;
+			break ;
+		case 2 :
+			sinc_dot_stereo (taps, data, Ntaps, out) ;
+			break ;
+		case 4 :
+			sinc_dot_quad (taps, data, Ntaps, out) ;
+			break ;
+		case 6 :
+			sinc_dot_hex (taps, data, Ntaps, out) ;
+			break ;
+		default :
+			sinc_dot_multi (taps, data, Ntaps, channels, out) ;
+			break ;
+		} ;
+} /* sinc_dot_block */
+
+static void
+sinc_dot (int channels, const float *taps, const float *data, int Ntaps, double *out)
+{	float	sum [128] ;
+	int		k, ch ;
+
+	for (ch = 0 ; ch < channels ; ch++)
+		out [ch] = 0.0 ;
+
+	for (k = 0 ; k < Ntaps ; k += SINC_BLOCK)
+	{	sinc_dot_block (channels, taps + k, data + channels * k, MIN (SINC_BLOCK, Ntaps - k), sum) ;
+		for (ch = 0 ; ch < channels ; ch++)
+			out [ch] += sum [ch] ;
+		} ;
+} /* sinc_dot */
 
-	return (left + right) ;
+static double
+calc_output_single (SINC_FILTER *filter, increment_t increment, increment_t start_filter_index)
+{	double		sum ;
+	int			first, Ntaps ;
+
+	Ntaps = calc_taps (filter, increment, start_filter_index, &first) ;
+
+	sinc_dot (1, filter->taps, filter->buffer + filter->b_current + first, Ntaps, &sum) ;
+
+	return sum ;
 } /* calc_output_single */
 
 static int
@@ -422,57 +705,15 @@ sinc_mono_vari_process (SRC_PRIVATE *psrc, SRC_DATA *data)
 
 static  void
 calc_output_stereo (SINC_FILTER *filter, increment_t increment, increment_t start_filter_index, double scale, float * output)
-{	double		fraction, left [2], right [2], icoeff ;
-	increment_t	filter_index, max_filter_index ;
-	int			data_index, coeff_count, indx ;
-
-	/* Convert input parameters into fixed point. */
-	max_filter_index = int_to_fp (filter->coeff_half_len) ;
-
-	/* First apply the left half of the filter. */
-	filter_index = start_filter_index ;
-	coeff_count = (max_filter_index - filter_index) / increment ;
-	filter_index = filter_index + coeff_count * increment ;
-	data_index = filter->b_current - filter->channels * coeff_count ;
-
-	left [0] = left [1] = 0.0 ;
-	do
-	{	fraction = fp_to_double (filter_index) ;
-		indx = fp_to_int (filter_index) ;
-
-		icoeff = filter->coeffs [indx] + fraction * (filter->coeffs [indx + 1] - filter->coeffs [indx]) ;
-
-		left [0] += icoeff * filter->buffer [data_index] ;
-		left [1] += icoeff * filter->buffer [data_index + 1] ;
-
-		filter_index -= increment ;
-		data_index = data_index + 2 ;
-		}
-	while (filter_index >= MAKE_INCREMENT_T (0)) ;
-
-	/* Now apply the right half of the filter. */
-	filter_index = increment - start_filter_index ;
-	coeff_count = (max_filter_index - filter_index) / increment ;
-	filter_index = filter_index + coeff_count * increment ;
-	data_index = filter->b_current + filter->channels * (1 + coeff_count) ;
-
-	right [0] = right [1] = 0.0 ;
-	do
-	{	fraction = fp_to_double (filter_index) ;
-		indx = fp_to_int (filter_index) ;
-
-		icoeff = filter->coeffs [indx] + fraction * (filter->coeffs [indx + 1] - filter->coeffs [indx]) ;
+{	double		sum [2] ;
+	int			first, Ntaps ;
 
-		right [0] += icoeff * filter->buffer [data_index] ;
-		right [1] += icoeff * filter->buffer [data_index + 1] ;
+	Ntaps = calc_taps (filter, increment, start_filter_index, &first) ;
 
-		filter_index -= increment ;
-		data_index = data_index - 2 ;
-		}
-	while (filter_index > MAKE_INCREMENT_T (0)) ;
+	sinc_dot (2, filter->taps, filter->buffer + filter->b_current + 2 * first, Ntaps, sum) ;
 
-	output [0] = scale * (left [0] + right [0]) ;
-	output [1] = scale * (left [1] + right [1]) ;
+	output [0] = scale * sum [0] ;
+	output [1] = scale * sum [1] ;
 } /* calc_output_stereo */
 
 static int
@@ -570,63 +811,17 @@ sinc_stereo_vari_process (SRC_PRIVATE *psrc, SRC_DATA *data)
 
 static void
 calc_output_quad (SINC_FILTER *filter, increment_t increment, increment_t start_filter_index, double scale, float * output)
-{	double		fraction, left [4], right [4], icoeff ;
-	increment_t	filter_index, max_filter_index ;
-	int			data_index, coeff_count, indx ;
-
-	/* Convert input parameters into fixed point. */
-	max_filter_index = int_to_fp (filter->coeff_half_len) ;
-
-	/* First apply the left half of the filter. */
-	filter_index = start_filter_index ;
-	coeff_count = (max_filter_index - filter_index) / increment ;
-	filter_index = filter_index + coeff_count * increment ;
-	data_index = filter->b_current - filter->channels * coeff_count ;
-
-	left [0] = left [1] = left [2] = left [3] = 0.0 ;
-	do
-	{	fraction = fp_to_double (filter_index) ;
-		indx = fp_to_int (filter_index) ;
-
-		icoeff = filter->coeffs [indx] + fraction * (filter->coeffs [indx + 1] - filter->coeffs [indx]) ;
-
-		left [0] += icoeff * filter->buffer [data_index] ;
-		left [1] += icoeff * filter->buffer [data_index + 1] ;
-		left [2] += icoeff * filter->buffer [data_index + 2] ;
-		left [3] += icoeff * filter->buffer [data_index + 3] ;
-
-		filter_index -= increment ;
-		data_index = data_index + 4 ;
-		}
-	while (filter_index >= MAKE_INCREMENT_T (0)) ;
-
-	/* Now apply the right half of the filter. */
-	filter_index = increment - start_filter_index ;
-	coeff_count = (max_filter_index - filter_index) / increment ;
-	filter_index = filter_index + coeff_count * increment ;
-	data_index = filter->b_current + filter->channels * (1 + coeff_count) ;
-
-	right [0] = right [1] = right [2] = right [3] = 0.0 ;
-	do
-	{	fraction = fp_to_double (filter_index) ;
-		indx = fp_to_int (filter_index) ;
+{	double		sum [4] ;
+	int			first, Ntaps ;
 
-		icoeff = filter->coeffs [indx] + fraction * (filter->coeffs [indx + 1] - filter->coeffs [indx]) ;
+	Ntaps = calc_taps (filter, increment, start_filter_index, &first) ;
 
-		right [0] += icoeff * filter->buffer [data_index] ;
-		right [1] += icoeff * filter->buffer [data_index + 1] ;
-		right [2] += icoeff * filter->buffer [data_index + 2] ;
-		right [3] += icoeff * filter->buffer [data_index + 3] ;
+	sinc_dot (4, filter->taps, filter->buffer + filter->b_current + 4 * first, Ntaps, sum) ;
 
-		filter_index -= increment ;
-		data_index = data_index - 4 ;
-		}
-	while (filter_index > MAKE_INCREMENT_T (0)) ;
-
-	output [0] = scale * (left [0] + right [0]) ;
-	output [1] = scale * (left [1] + right [1]) ;
-	output [2] = scale * (left [2] + right [2]) ;
-	output [3] = scale * (left [3] + right [3]) ;
+	output [0] = scale * sum [0] ;
+	output [1] = scale * sum [1] ;
+	output [2] = scale * sum [2] ;
+	output [3] = scale * sum [3] ;
 } /* calc_output_quad */
 
 static int
@@ -724,69 +919,19 @@ sinc_quad_vari_process (SRC_PRIVATE *psrc, SRC_DATA *data)
 
 static void
 calc_output_hex (SINC_FILTER *filter, increment_t increment, increment_t start_filter_index, double scale, float * output)
-{	double		fraction, left [6], right [6], icoeff ;
-	increment_t	filter_index, max_filter_index ;
-	int			data_index, coeff_count, indx ;
+{	double		sum [6] ;
+	int			first, Ntaps ;
 
-	/* Convert input parameters into fixed point. */
-	max_filter_index = int_to_fp (filter->coeff_half_len) ;
-
-	/* First apply the left half of the filter. */
-	filter_index = start_filter_index ;
-	coeff_count = (max_filter_index - filter_index) / increment ;
-	filter_index = filter_index + coeff_count * increment ;
-	data_index = filter->b_current - filter->channels * coeff_count ;
-
-	left [0] = left [1] = left [2] = left [3] = left [4] = left [5] = 0.0 ;
-	do
-	{	fraction = fp_to_double (filter_index) ;
-		indx = fp_to_int (filter_index) ;
-
-		icoeff = filter->coeffs [indx] + fraction * (filter->coeffs [indx + 1] - filter->coeffs [indx]) ;
-
-		left [0] += icoeff * filter->buffer [data_index] ;
-		left [1] += icoeff * filter->buffer [data_index + 1] ;
-		left [2] += icoeff * filter->buffer [data_index + 2] ;
-		left [3] += icoeff * filter->buffer [data_index + 3] ;
-		left [4] += icoeff * filter->buffer [data_index + 4] ;
-		left [5] += icoeff * filter->buffer [data_index + 5] ;
-
-		filter_index -= increment ;
-		data_index = data_index + 6 ;
-		}
-	while (filter_index >= MAKE_INCREMENT_T (0)) ;
-
-	/* Now apply the right half of the filter. */
-	filter_index = increment - start_filter_index ;
-	coeff_count = (max_filter_index - filter_index) / increment ;
-	filter_index = filter_index + coeff_count * increment ;
-	data_index = filter->b_current + filter->channels * (1 + coeff_count) ;
-
-	right [0] = right [1] = right [2] = right [3] = right [4] = right [5] = 0.0 ;
-	do
-	{	fraction = fp_to_double (filter_index) ;
-		indx = fp_to_int (filter_index) ;
-
-		icoeff = filter->coeffs [indx] + fraction * (filter->coeffs [indx + 1] - filter->coeffs [indx]) ;
+	Ntaps = calc_taps (filter, increment, start_filter_index, &first) ;
 
-		right [0] += icoeff * filter->buffer [data_index] ;
-		right [1] += icoeff * filter->buffer [data_index + 1] ;
-		right [2] += icoeff * filter->buffer [data_index + 2] ;
-		right [3] += icoeff * filter->buffer [data_index + 3] ;
-		right [4] += icoeff * filter->buffer [data_index + 4] ;
-		right [5] += icoeff * filter->buffer [data_index + 5] ;
+	sinc_dot (6, filter->taps, filter->buffer + filter->b_current + 6 * first, Ntaps, sum) ;
 
-		filter_index -= increment ;
-		data_index = data_index - 6 ;
-		}
-	while (filter_index > MAKE_INCREMENT_T (0)) ;
-
-	output [0] = scale * (left [0] + right [0]) ;
-	output [1] = scale * (left [1] + right [1]) ;
-	output [2] = scale * (left [2] + right [2]) ;
-	output [3] = scale * (left [3] + right [3]) ;
-	output [4] = scale * (left [4] + right [4]) ;
-	output [5] = scale * (left [5] + right [5]) ;
+	output [0] = scale * sum [0] ;
+	output [1] = scale * sum [1] ;
+	output [2] = scale * sum [2] ;
+	output [3] = scale * sum [3] ;
+	output [4] = scale * sum [4] ;
+	output [5] = scale * sum [5] ;
 } /* calc_output_hex */
 
 static int
@@ -884,154 +1029,17 @@ sinc_hex_vari_process (SRC_PRIVATE *psrc, SRC_DATA *data)
 
 static void
 calc_output_multi (SINC_FILTER *filter, increment_t increment, increment_t start_filter_index, int channels, double scale, float * output)
-{	double		fraction, icoeff ;
-	/* The following line is 1999 ISO Standard C. If your compiler complains, get a better compiler. */
-	double		*left, *right ;
-	increment_t	filter_index, max_filter_index ;
-	int			data_index, coeff_count, indx, ch ;
-
-	left = filter->left_calc ;
-	right = filter->right_calc ;
-
-	/* Convert input parameters into fixed point. */
-	max_filter_index = int_to_fp (filter->coeff_half_len) ;
-
-	/* First apply the left half of the filter. */
-	filter_index = start_filter_index ;
-	coeff_count = (max_filter_index - filter_index) / increment ;
-	filter_index = filter_index + coeff_count * increment ;
-	data_index = filter->b_current - channels * coeff_count ;
-
-	memset (left, 0, sizeof (left [0]) * channels) ;
-
-	do
-	{	fraction = fp_to_double (filter_index) ;
-		indx = fp_to_int (filter_index) ;
-
-		icoeff = filter->coeffs [indx] + fraction * (filter->coeffs [indx + 1] - filter->coeffs [indx]) ;
-
-		/*
-		**	Duff's Device.
-		**	See : http://en.wikipedia.org/wiki/Duff's_device
-		*/
-		ch = channels ;
-		do
-		{
-			switch (ch % 8)
-			{	default :
-					ch -- ;
-					left [ch] += icoeff * filter->buffer [data_index + ch] ;
-				case 7 :
-					ch -- ;
-					left [ch] += icoeff * filter->buffer [data_index + ch] ;
-				case 6 :
-					ch -- ;
-					left [ch] += icoeff * filter->buffer [data_index + ch] ;
-				case 5 :
-					ch -- ;
-					left [ch] += icoeff * filter->buffer [data_index + ch] ;
-				case 4 :
-					ch -- ;
-					left [ch] += icoeff * filter->buffer [data_index + ch] ;
-				case 3 :
-					ch -- ;
-					left [ch] += icoeff * filter->buffer [data_index + ch] ;
-				case 2 :
-					ch -- ;
-					left [ch] += icoeff * filter->buffer [data_index + ch] ;
-				case 1 :
-					ch -- ;
-					left [ch] += icoeff * filter->buffer [data_index + ch] ;
-				} ;
-			}
-		while (ch > 0) ;
+{	double		*sum ;
+	int			first, Ntaps, ch ;
 
-		filter_index -= increment ;
-		data_index = data_index + channels ;
-		}
-	while (filter_index >= MAKE_INCREMENT_T (0)) ;
-
-	/* Now apply the right half of the filter. */
-	filter_index = increment - start_filter_index ;
-	coeff_count = (max_filter_index - filter_index) / increment ;
-	filter_index = filter_index + coeff_count * increment ;
-	data_index = filter->b_current + channels * (1 + coeff_count) ;
-
-	memset (right, 0, sizeof (right [0]) * channels) ;
-	do
-	{	fraction = fp_to_double (filter_index) ;
-		indx = fp_to_int (filter_index) ;
+	sum = filter->multi_sum ;
 
-		icoeff = filter->coeffs [indx] + fraction * (filter->coeffs [indx + 1] - filter->coeffs [indx]) ;
-
-		ch = channels ;
-		do
-		{
-			switch (ch % 8)
-			{	default :
-					ch -- ;
-					right [ch] += icoeff * filter->buffer [data_index + ch] ;
-				case 7 :
-					ch -- ;
-					right [ch] += icoeff * filter->buffer [data_index + ch] ;
-				case 6 :
-					ch -- ;
-					right [ch] += icoeff * filter->buffer [data_index + ch] ;
-				case 5 :
-					ch -- ;
-					right [ch] += icoeff * filter->buffer [data_index + ch] ;
-				case 4 :
-					ch -- ;
-					right [ch] += icoeff * filter->buffer [data_index + ch] ;
-				case 3 :
-					ch -- ;
-					right [ch] += icoeff * filter->buffer [data_index + ch] ;
-				case 2 :
-					ch -- ;
-					right [ch] += icoeff * filter->buffer [data_index + ch] ;
-				case 1 :
-					ch -- ;
-					right [ch] += icoeff * filter->buffer [data_index + ch] ;
-				} ;
-			}
-		while (ch > 0) ;
+	Ntaps = calc_taps (filter, increment, start_filter_index, &first) ;
 
-		filter_index -= increment ;
-		data_index = data_index - channels ;
-		}
-	while (filter_index > MAKE_INCREMENT_T (0)) ;
+	sinc_dot (channels, filter->taps, filter->buffer + filter->b_current + channels * first, Ntaps, sum) ;
 
-	ch = channels ;
-	do
-	{
-		switch (ch % 8)
-		{	default :
-				ch -- ;
-				output [ch] = scale * (left [ch] + right [ch]) ;
-			case 7 :
-				ch -- ;
-				output [ch] = scale * (left [ch] + right [ch]) ;
-			case 6 :
-				ch -- ;
-				output [ch] = scale * (left [ch] + right [ch]) ;
-			case 5 :
-				ch -- ;
-				output [ch] = scale * (left [ch] + right [ch]) ;
-			case 4 :
-				ch -- ;
-				output [ch] = scale * (left [ch] + right [ch]) ;
-			case 3 :
-				ch -- ;
-				output [ch] = scale * (left [ch] + right [ch]) ;
-			case 2 :
-				ch -- ;
-				output [ch] = scale * (left [ch] + right [ch]) ;
-			case 1 :
-				ch -- ;
-				output [ch] = scale * (left [ch] + right [ch]) ;
-			} ;
-		}
-	while (ch > 0) ;
+	for (ch = 0 ; ch < channels ; ch++)
+		output [ch] = scale * sum [ch] ;
 
 	return ;
 } /* calc_output_multi */
@@ -1129,6 +1137,205 @@ sinc_multichan_vari_process (SRC_PRIVATE *psrc, SRC_DATA *data)
 	return SRC_ERR_NO_ERROR ;
 } /* sinc_multichan_vari_process */
 
+/*----------------------------------------------------------------------------------------
+**	Polyphase filter bank.
+**
+**	When the ratio is a fixed fraction L / M, output n sits at input
+**	position n * M / L, so its fractional part is one of only L phases.
+**	The taps for each phase are worked out once, and every output is
+**	then a plain multiply-add over the frames.
+*/
+
+#define	POLY_MAX_PHASES		1024
+#define	POLY_MAX_TAPS		(4 * 1024 * 1024)
+
+/*
+** Find L and M with L / M equal to the ratio and L as small as possible.
+** Returns 0 if there is no such fraction with L up to POLY_MAX_PHASES.
+*/
+static int
+poly_fraction (double src_ratio, int *M)
+{	double	m ;
+	int		L ;
+
+	for (L = 1 ; L <= POLY_MAX_PHASES ; L++)
+	{	m = floor (L / src_ratio + 0.5) ;
+		if (m >= 1.0 && m < 1e9 && fabs (L / m - src_ratio) <= 1e-12 * src_ratio)
+		{	*M = (int) m ;
+			return L ;
+			} ;
+		} ;
+
+	return 0 ;
+} /* poly_fraction */
+
+/*
+** Build the bank for a ratio. The filter is reallocated to hold it, so
+** on success psrc->private_data has the new filter. A ratio without a
+** bank just sets poly_L to 0.
+*/
+static int
+poly_make_bank (SRC_PRIVATE *psrc, double src_ratio)
+{	SINC_FILTER	*filter, *temp_filter ;
+	double		float_increment, scale ;
+	increment_t	increment, start_filter_index ;
+	size_t		base_len ;
+	long		total ;
+	int			L, M, p, k, first, Ntaps ;
+
+	filter = (SINC_FILTER*) psrc->private_data ;
+
+	filter->poly_ratio = src_ratio ;
+	filter->poly_L = filter->poly_M = 0 ;
+
+	if ((L = poly_fraction (src_ratio, &M)) == 0)
+		return SRC_ERR_NO_ERROR ;
+
+	float_increment = filter->index_inc * 1.0 ;
+	if (src_ratio < 1.0)
+		float_increment = filter->index_inc * src_ratio ;
+	increment = double_to_fp (float_increment) ;
+	scale = float_increment / filter->index_inc ;
+
+	/* Count the taps first, so the bank can be sized. */
+	total = 0 ;
+	for (p = 0 ; p < L ; p++)
+	{	start_filter_index = double_to_fp (((double) p) / L * float_increment) ;
+		total += calc_taps (filter, increment, start_filter_index, &first) ;
+		} ;
+	if (total > POLY_MAX_TAPS)
+		return SRC_ERR_NO_ERROR ;
+
+	/* The buffer, the taps, then the bank and its phases. */
+	base_len = sizeof (SINC_FILTER) + sizeof (filter->buffer [0]) * (filter->b_len + filter->channels + filter->b_len / filter->channels + 4) ;
+
+	temp_filter = realloc (filter, base_len + total * sizeof (float) + L * sizeof (SINC_PHASE)) ;
+	if (temp_filter == NULL)
+		return SRC_ERR_MALLOC_FAILED ;
+	filter = temp_filter ;
+	psrc->private_data = filter ;
+
+	filter->taps = filter->buffer + filter->b_len + filter->channels ;
+	filter->bank = (float *) (((char *) filter) + base_len) ;
+	filter->phases = (SINC_PHASE *) (filter->bank + total) ;
+
+	total = 0 ;
+	for (p = 0 ; p < L ; p++)
+	{	start_filter_index = double_to_fp (((double) p) / L * float_increment) ;
+		Ntaps = calc_taps (filter, increment, start_filter_index, &first) ;
+
+		for (k = 0 ; k < Ntaps ; k++)
+			filter->bank [total + k] = (float) (scale * filter->taps [k]) ;
+
+		filter->phases [p].first = first ;
+		filter->phases [p].Ntaps = Ntaps ;
+		filter->phases [p].offset = (int) total ;
+		total += Ntaps ;
+		} ;
+
+	filter->poly_L = L ;
+	filter->poly_M = M ;
+
+	return SRC_ERR_NO_ERROR ;
+} /* poly_make_bank */
+
+static int
+sinc_poly_process (SRC_PRIVATE *psrc, SRC_DATA *data)
+{	SINC_FILTER *filter ;
+	SINC_PHASE	*phase ;
+	double		src_ratio, count, terminate, rem ;
+	int			half_filter_chan_len, samples_in_hand, channels, ch, p, L, M ;
+
+	if (psrc->private_data == NULL)
+		return SRC_ERR_NO_PRIVATE ;
+
+	filter = (SINC_FILTER*) psrc->private_data ;
+
+	/* If there is not a problem, this will be optimised out. */
+	if (sizeof (filter->buffer [0]) != sizeof (data->data_in [0]))
+		return SRC_ERR_SIZE_INCOMPATIBILITY ;
+
+	src_ratio = psrc->last_ratio ;
+
+	if (filter->poly_ratio != src_ratio)
+	{	if ((psrc->error = poly_make_bank (psrc, src_ratio)) != 0)
+			return psrc->error ;
+		filter = (SINC_FILTER*) psrc->private_data ;
+		} ;
+
+	/* No bank, so the general converter. */
+	if (filter->poly_L == 0)
+		return psrc->vari_process (psrc, data) ;
+
+	channels = filter->channels ;
+	L = filter->poly_L ;
+	M = filter->poly_M ;
+
+	filter->in_count = data->input_frames * channels ;
+	filter->out_count = data->output_frames * channels ;
+	filter->in_used = filter->out_gen = 0 ;
+
+	/* Check the sample rate ratio wrt the buffer len. */
+	count = (filter->coeff_half_len + 2.0) / filter->index_inc ;
+	if (src_ratio < 1.0)
+		count /= src_ratio ;
+
+	/* Maximum coefficientson either side of center point. */
+	half_filter_chan_len = channels * (lrint (count) + 1) ;
+
+	/* The position is kept as whole frames and a phase, in Lths of a frame. */
+	rem = fmod_one (psrc->last_position) ;
+	filter->b_current = (filter->b_current + channels * lrint (psrc->last_position - rem)) % filter->b_len ;
+	p = (int) floor (rem * L + 0.5) ;
+	if (p >= L)
+	{	filter->b_current = (filter->b_current + channels) % filter->b_len ;
+		p -= L ;
+		} ;
+
+	terminate = 1.0 / src_ratio + 1e-20 ;
+
+	/* Main processing loop. */
+	while (filter->out_gen < filter->out_count)
+	{
+		/* Need to reload buffer? */
+		samples_in_hand = (filter->b_end - filter->b_current + filter->b_len) % filter->b_len ;
+
+		if (samples_in_hand <= half_filter_chan_len)
+		{	if ((psrc->error = prepare_data (filter, data, half_filter_chan_len)) != 0)
+				return psrc->error ;
+
+			samples_in_hand = (filter->b_end - filter->b_current + filter->b_len) % filter->b_len ;
+			if (samples_in_hand <= half_filter_chan_len)
+				break ;
+			} ;
+
+		/* This is the termination condition. */
+		if (filter->b_real_end >= 0)
+		{	if (filter->b_current + ((double) p) / L + terminate >= filter->b_real_end)
+				break ;
+			} ;
+
+		phase = filter->phases + p ;
+		sinc_dot (channels, filter->bank + phase->offset, filter->buffer + filter->b_current + channels * phase->first,
+					phase->Ntaps, filter->multi_sum) ;
+		for (ch = 0 ; ch < channels ; ch++)
+			data->data_out [filter->out_gen + ch] = (float) filter->multi_sum [ch] ;
+		filter->out_gen += channels ;
+
+		/* Figure out the next index. */
+		p += M ;
+		filter->b_current = (filter->b_current + channels * (p / L)) % filter->b_len ;
+		p %= L ;
+		} ;
+
+	psrc->last_position = ((double) p) / L ;
+
+	data->input_frames_used = filter->in_used / channels ;
+	data->output_frames_gen = filter->out_gen / channels ;
+
+	return SRC_ERR_NO_ERROR ;
+} /* sinc_poly_process */
+
 /*----------------------------------------------------------------------------------------
 */
 
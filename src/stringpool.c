@@ -0,0 +1,348 @@
+/*
+  stringpool.c
+  a pool of nul-terminated strings which share storage
+
+  Strings are added with a name, and the pool is then built into one
+  array. Identical strings are stored once, and a string which is the
+  tail of another, like "file" in "Open file", is stored as a pointer
+  into the longer string, which already ends with its nul. Then each
+  name gives the offset of its string in the array.
+
+  To find the tails the strings are sorted on their characters read
+  backwards. Then a string is the tail of another only if it is the
+  tail of the string which follows it in that order. The strings which
+  are not tails are laid out in the order they were added, so strings
+  which appear together in the script sit together in memory.
+
+  Strings are of chars (width 1) or of unsigned shorts (width 2), for
+  UTF-16.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "stringpool.h"
+
+typedef struct
+{
+    char *name;       /* the name of the string */
+    void *str;        /* the string, with its nul */
+    long len;         /* length, not counting the nul */
+    long offset;      /* offset into the pool, once built */
+    long index;       /* order of adding */
+    int owner;        /* index of the string it is a tail of, or -1 */
+} POOLENTRY;
+
+struct stringpool
+{
+    int width;            /* 1 for char, 2 for unsigned short */
+    POOLENTRY *entries;   /* the strings */
+    int N;                /* number of strings */
+    int capacity;         /* space in entries */
+    POOLENTRY **byname;   /* the strings sorted by name, once built */
+    void *data;           /* the pool, once built */
+    long length;          /* number of elements in the pool */
+    int built;            /* set when built */
+};
+
+static unsigned long getelement(const void *str, long index, int width);
+static long getlength(const void *str, int width);
+static int comparetails(const void *e1, const void *e2);
+static int comparenames(const void *e1, const void *e2);
+static int istail(const POOLENTRY *a, const POOLENTRY *b, int width);
+static char *mystrdup(const char *str);
+
+/*
+  the width of the strings being sorted, for comparetails()
+ */
+static int sortwidth;
+
+/*
+  create a string pool
+  Params: width - 1 for strings of char, 2 for unsigned short
+  Returns: an empty pool, 0 on out of memory
+ */
+STRINGPOOL *stringpool(int width)
+{
+    STRINGPOOL *pool;
+
+    if (width != 1 && width != 2)
+        return 0;
+    pool = malloc(sizeof(STRINGPOOL));
+    if (!pool)
+        return 0;
+    pool->width = width;
+    pool->entries = 0;
+    pool->N = 0;
+    pool->capacity = 0;
+    pool->byname = 0;
+    pool->data = 0;
+    pool->length = 0;
+    pool->built = 0;
+
+    return pool;
+}
+
+/*
+  string pool destructor
+ */
+void killstringpool(STRINGPOOL *pool)
+{
+    int i;
+
+    if (pool)
+    {
+        for (i = 0; i < pool->N; i++)
+        {
+            free(pool->entries[i].name);
+            free(pool->entries[i].str);
+        }
+        free(pool->entries);
+        free(pool->byname);
+        free(pool->data);
+        free(pool);
+    }
+}
+
+/*
+  add a string to the pool
+  Params: pool - the pool, not yet built
+          name - the name of the string
+          str - the string, of chars or unsigned shorts, nul-terminated
+  Returns: 0 on success, -1 on out of memory, -2 if the pool
+    has been built.
+  Notes: names should be unique. This is checked by stringpool_build().
+ */
+int stringpool_add(STRINGPOOL *pool, const char *name, const void *str)
+{
+    POOLENTRY *temp;
+    POOLENTRY *entry;
+    long len;
+
+    if (pool->built)
+        return -2;
+    if (pool->N == pool->capacity)
+    {
+        temp = realloc(pool->entries, (pool->capacity * 2 + 16) * sizeof(POOLENTRY));
+        if (!temp)
+            return -1;
+        pool->entries = temp;
+        pool->capacity = pool->capacity * 2 + 16;
+    }
+    len = getlength(str, pool->width);
+    entry = &pool->entries[pool->N];
+    entry->name = mystrdup(name);
+    entry->str = malloc((len + 1) * pool->width);
+    if (!entry->name || !entry->str)
+    {
+        free(entry->name);
+        free(entry->str);
+        return -1;
+    }
+    memcpy(entry->str, str, (len + 1) * pool->width);
+    entry->len = len;
+    entry->offset = -1;
+    entry->index = pool->N;
+    entry->owner = -1;
+    pool->N++;
+
+    return 0;
+}
+
+/*
+  merge the strings into the pool
+  Params: pool - the pool
+  Returns: 0 on success, -1 on out of memory, -2 if two strings
+    have the same name.
+ */
+int stringpool_build(STRINGPOOL *pool)
+{
+    POOLENTRY **sorted = 0;
+    POOLENTRY *entry;
+    int N = pool->N;
+    long length = 0;
+    int i;
+
+    if (pool->built)
+        return 0;
+    sorted = malloc((N + 1) * sizeof(POOLENTRY *));
+    pool->byname = malloc((N + 1) * sizeof(POOLENTRY *));
+    if (!sorted || !pool->byname)
+        goto out_of_memory;
+    for (i = 0; i < N; i++)
+    {
+        sorted[i] = &pool->entries[i];
+        pool->byname[i] = &pool->entries[i];
+    }
+
+    qsort(pool->byname, N, sizeof(POOLENTRY *), comparenames);
+    for (i = 1; i < N; i++)
+        if (!strcmp(pool->byname[i-1]->name, pool->byname[i]->name))
+        {
+            free(sorted);
+            return -2;
+        }
+
+    sortwidth = pool->width;
+    qsort(sorted, N, sizeof(POOLENTRY *), comparetails);
+    /* working down, the string above has its owner already */
+    for (i = N - 2; i >= 0; i--)
+    {
+        if (istail(sorted[i], sorted[i+1], pool->width))
+        {
+            if (sorted[i+1]->owner >= 0)
+                sorted[i]->owner = sorted[i+1]->owner;
+            else
+                sorted[i]->owner = (int) sorted[i+1]->index;
+        }
+    }
+    free(sorted);
+    sorted = 0;
+
+    for (i = 0; i < N; i++)
+    {
+        entry = &pool->entries[i];
+        if (entry->owner < 0)
+        {
+            entry->offset = length;
+            length += entry->len + 1;
+        }
+    }
+    pool->data = malloc((length + 1) * pool->width);
+    if (!pool->data)
+        goto out_of_memory;
+    for (i = 0; i < N; i++)
+    {
+        entry = &pool->entries[i];
+        if (entry->owner < 0)
+        {
+            memcpy((char *) pool->data + entry->offset * pool->width, entry->str,
+                (entry->len + 1) * pool->width);
+        }
+        else
+        {
+            entry->offset = pool->entries[entry->owner].offset +
+                pool->entries[entry->owner].len - entry->len;
+        }
+    }
+    pool->length = length;
+    pool->built = 1;
+
+    return 0;
+
+out_of_memory:
+    free(sorted);
+    free(pool->byname);
+    pool->byname = 0;
+    return -1;
+}
+
+/*
+  get the offset of a string in the built pool
+  Params: pool - the pool
+          name - the name of the string
+  Returns: offset in elements of the string, -1 if not found
+ */
+long stringpool_offset(STRINGPOOL *pool, const char *name)
+{
+    POOLENTRY key;
+    POOLENTRY *keyptr = &key;
+    POOLENTRY **found;
+
+    if (!pool->built)
+        return -1;
+    key.name = (char *) name;
+    found = bsearch(&keyptr, pool->byname, pool->N, sizeof(POOLENTRY *), comparenames);
+    if (!found)
+        return -1;
+
+    return (*found)->offset;
+}
+
+/*
+  get the number of elements in the built pool, counting the nuls
+ */
+long stringpool_length(STRINGPOOL *pool)
+{
+    return pool->length;
+}
+
+/*
+  get an element of the built pool
+ */
+unsigned long stringpool_get(STRINGPOOL *pool, long index)
+{
+    return getelement(pool->data, index, pool->width);
+}
+
+static unsigned long getelement(const void *str, long index, int width)
+{
+    if (width == 2)
+        return ((const unsigned short *) str)[index];
+    return ((const unsigned char *) str)[index];
+}
+
+static long getlength(const void *str, int width)
+{
+    long answer = 0;
+
+    while (getelement(str, answer, width))
+        answer++;
+    return answer;
+}
+
+/*
+  compare strings read from the end
+ */
+static int comparetails(const void *e1, const void *e2)
+{
+    const POOLENTRY *a = *(const POOLENTRY **) e1;
+    const POOLENTRY *b = *(const POOLENTRY **) e2;
+    long i = a->len - 1;
+    long j = b->len - 1;
+    unsigned long cha, chb;
+
+    while (i >= 0 && j >= 0)
+    {
+        cha = getelement(a->str, i--, sortwidth);
+        chb = getelement(b->str, j--, sortwidth);
+        if (cha != chb)
+            return cha < chb ? -1 : 1;
+    }
+    if (i >= 0)
+        return 1;
+    if (j >= 0)
+        return -1;
+    /* identical strings, keep the first added as the owner */
+    if (a->index != b->index)
+        return a->index < b->index ? 1 : -1;
+    return 0;
+}
+
+static int comparenames(const void *e1, const void *e2)
+{
+    const POOLENTRY *a = *(const POOLENTRY **) e1;
+    const POOLENTRY *b = *(const POOLENTRY **) e2;
+
+    return strcmp(a->name, b->name);
+}
+
+/*
+  test if string a is the tail of string b
+ */
+static int istail(const POOLENTRY *a, const POOLENTRY *b, int width)
+{
+    if (a->len > b->len)
+        return 0;
+    return memcmp(a->str, (const char *) b->str + (b->len - a->len) * width,
+        a->len * width) == 0;
+}
+
+static char *mystrdup(const char *str)
+{
+    char *answer;
+
+    answer = malloc(strlen(str) + 1);
+    if (answer)
+        strcpy(answer, str);
+    return answer;
+}
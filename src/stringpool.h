@@ -0,0 +1,14 @@
+#ifndef stringpool_h
+#define stringpool_h
+
+typedef struct stringpool STRINGPOOL;
+
+STRINGPOOL *stringpool(int width);
+void killstringpool(STRINGPOOL *pool);
+int stringpool_add(STRINGPOOL *pool, const char *name, const void *str);
+int stringpool_build(STRINGPOOL *pool);
+long stringpool_offset(STRINGPOOL *pool, const char *name);
+long stringpool_length(STRINGPOOL *pool);
+unsigned long stringpool_get(STRINGPOOL *pool, long index);
+
+#endif
@@ -0,0 +1,820 @@
+/*
+  ccitttest.c
+  regression test for the table-driven CCITT decoders in loadtiff.c
+
+  The decoders are checked against the bit-at-a-time tree walking
+  decoders they replaced, which are kept here as the reference. The
+  corpus is made of images encoded as Modified Huffman (TIFF
+  compression 2), Group 3 1D with EOLs (compression 3) and Group 4
+  (compression 4, and the EOL variant), at a range of widths, plus
+  the same streams with bits flipped, truncated, and random bytes. The
+  new decoders must return exactly what the old ones did, including
+  on corrupt input.
+
+  Usage: ccitttest [Nimages]
+  Returns 0 if all decodes match.
+
+  The decoders are declared in ccitt.h. The test has its own bitstream
+  and Huffman tree, copied from loadtiff.c, for the reference decoders
+  and the encoders.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ccitt.h"
+
+#define STREAM_BIGENDIAN 1
+#define STREAM_LITTLEENDIAN 2
+
+typedef struct
+{
+	unsigned char *data;
+	int N;
+	int pos;
+	int bit;
+	int endianness;
+} BSTREAM;
+
+typedef struct huffnode
+{
+	struct huffnode *zero;
+	struct huffnode *one;
+	int symbol;
+} HUFFNODE;
+
+static BSTREAM *bstream(unsigned char *data, int N, int endianness)
+{
+	BSTREAM *answer = malloc(sizeof(BSTREAM));
+
+	if (!answer)
+		return 0;
+	answer->data = data;
+	answer->pos = 0;
+	answer->N = N;
+	answer->endianness = endianness;
+	answer->bit = endianness == STREAM_BIGENDIAN ? 128 : 1;
+
+	return answer;
+}
+
+static void killbstream(BSTREAM *bs)
+{
+	free(bs);
+}
+
+static int getbit(BSTREAM *bs)
+{
+	int answer;
+
+	if (bs->pos >= bs->N)
+		return -1;
+	answer = (bs->data[bs->pos] & bs->bit) ? 1 : 0;
+
+	if (bs->endianness == STREAM_BIGENDIAN)
+	{
+		bs->bit >>= 1;
+		if (bs->bit == 0)
+		{
+			bs->bit = 128;
+			bs->pos++;
+		}
+	}
+	else
+	{
+		bs->bit <<= 1;
+		if (bs->bit == 0x100)
+		{
+			bs->bit = 1;
+			bs->pos++;
+		}
+	}
+	return answer;
+}
+
+static HUFFNODE *addhuffmansymbol(HUFFNODE *root, const char *str, int symbol, int *err)
+{
+	HUFFNODE *answer;
+
+	if (root)
+	{
+		if (str[0] == '0')
+			root->zero = addhuffmansymbol(root->zero, str + 1, symbol, err);
+		else if (str[0] == '1')
+			root->one = addhuffmansymbol(root->one, str + 1, symbol, err);
+		else if (str[0] == 0)
+			root->symbol = symbol;
+
+		return root;
+	}
+	answer = malloc(sizeof(HUFFNODE));
+	if (!answer)
+	{
+		*err = -1;
+		return 0;
+	}
+	answer->zero = 0;
+	answer->one = 0;
+	answer->symbol = -1;
+
+	return addhuffmansymbol(answer, str, symbol, err);
+}
+
+static void killhuffmantree(HUFFNODE *root)
+{
+	if (root)
+	{
+		killhuffmantree(root->zero);
+		killhuffmantree(root->one);
+		free(root);
+	}
+}
+
+static int reference_writebit(BSTREAM *bs, int bit)
+{
+	if (bs->pos >= bs->N)
+		return -1;
+	if (bit)
+		bs->data[bs->pos] |= bs->bit;
+	else
+		bs->data[bs->pos] &= (unsigned char)~bs->bit;
+	getbit(bs);
+	return 0;
+}
+
+static int reference_gethuffmansymbol(HUFFNODE *root, BSTREAM *bs)
+{
+	int bit;
+
+	if (root->zero == 0 && root->one == 0)
+		return root->symbol;
+	bit = getbit(bs);
+	if (bit == 0 && root->zero)
+		return reference_gethuffmansymbol(root->zero, bs);
+	else if (bit == 1 && root->one)
+		return reference_gethuffmansymbol(root->one, bs);
+	else
+		return root->symbol;
+}
+
+/*
+  The reference decoders, as they were before the lookup tables.
+*/
+static unsigned char *reference_ccittdecompress(unsigned char *in, unsigned long count, unsigned long *Nret, int width, int height, int eol)
+{
+	HUFFNODE * whitetree = 0;
+	HUFFNODE * blacktree = 0;
+	BSTREAM *bs = 0;
+	BSTREAM *bout = 0;
+	int i, ii;
+	int err = 0;
+	int totlen;
+	int len;
+	int whitelen, blacklen;
+	unsigned char *answer = 0;
+	int Nout;
+
+	Nout = (width + 7) / 8 * height;
+	answer = malloc(Nout);
+	if (!answer)
+		goto out_of_memory;
+	bout = bstream(answer, Nout, STREAM_BIGENDIAN);
+	if (!bout)
+		goto out_of_memory;
+	bs = bstream(in, count, STREAM_LITTLEENDIAN);
+	if (!bs)
+		goto out_of_memory;
+	for (i = 0; i < 105; i++)
+		whitetree = addhuffmansymbol(whitetree, ccitttable[i].whitecode, ccitttable[i].whitelen, &err);
+	for (i = 0; i < 105; i++)
+		blacktree = addhuffmansymbol(blacktree, ccitttable[i].blackcode, ccitttable[i].blacklen, &err);
+	if (err)
+		goto out_of_memory;
+	
+	if(eol)
+		len = reference_gethuffmansymbol(whitetree, bs);
+	for (i = 0; i < height; i++)
+	{
+		totlen = 0;
+		while (totlen < width)
+		{ 
+			len = reference_gethuffmansymbol(whitetree, bs);
+			if (len == -1)
+				goto parse_error;
+			if (len == -2)
+				whitelen = width - totlen;
+			else
+			  whitelen = len;
+			while (len >= 64)
+			{
+				len = reference_gethuffmansymbol(whitetree, bs);
+				if (len == CCITT_EOL || len == -1 || totlen + len + whitelen > width)
+					goto parse_error;
+				whitelen += len;
+			}
+			for (ii = 0; ii < whitelen; ii++)
+				reference_writebit(bout, 0);
+			totlen += whitelen;
+			if (totlen >= width)
+				break;
+			len = reference_gethuffmansymbol(blacktree, bs);
+			if (len < 0)
+				goto parse_error;
+			blacklen = len;
+			while (len >= 64)
+			{
+				len = reference_gethuffmansymbol(blacktree, bs);
+				if (len == CCITT_EOL || len == -1 || totlen + len + blacklen > width)
+					goto parse_error;
+				blacklen += len;
+			}
+			for (ii = 0; ii < blacklen; ii++)
+				reference_writebit(bout, 1);
+			totlen += blacklen;
+
+		}
+		if (width & 0x07)
+		{
+			for (ii = 0; ii < 8 - (width & 0x07); ii++)
+				reference_writebit(bout, 0);
+		}
+		if(eol)
+			reference_gethuffmansymbol(whitetree, bs);
+	}
+	*Nret = Nout;
+	killhuffmantree(whitetree);
+	killhuffmantree(blacktree);
+	free(bs);
+	free(bout);
+	return answer;
+parse_error:
+out_of_memory:
+	killhuffmantree(whitetree);
+	killhuffmantree(blacktree);
+	free(bs);
+	free(bout);
+	free(answer);
+	return 0;
+}
+
+static unsigned char *reference_ccittgroup4decompress(unsigned char *in, unsigned long count, unsigned long *Nret, int width, int height, int eol)
+{
+	unsigned char *reference;
+	unsigned char *current;
+	unsigned char *temp;
+	int i;
+	int a0;
+	int a1;
+	int a2;
+	int a1span, a2span;
+	int seg;
+	int b1, b2;
+	HUFFNODE * twodtree = 0;
+	HUFFNODE * whitetree = 0;
+	HUFFNODE * blacktree = 0;
+	BSTREAM *bs = 0;
+	BSTREAM *bout = 0;
+	unsigned long Nout;
+	unsigned char *answer;
+	int err =0;
+	int mode;
+	int colour;
+
+	Nout = (width + 7) / 8 * height;
+	answer = malloc(Nout);
+	if (!answer)
+		goto out_of_memory;
+	memset(answer, 0, Nout);
+	bout = bstream(answer, Nout, STREAM_BIGENDIAN);
+	if (!bout)
+		goto out_of_memory;
+	bs = bstream(in, count, eol ? STREAM_LITTLEENDIAN : STREAM_BIGENDIAN);
+	if (!bs)
+		goto out_of_memory;
+	for (i = 0; i < 105; i++)
+		whitetree = addhuffmansymbol(whitetree, ccitttable[i].whitecode, ccitttable[i].whitelen, &err);
+	for (i = 0; i < 105; i++)
+		blacktree = addhuffmansymbol(blacktree, ccitttable[i].blackcode, ccitttable[i].blacklen, &err);
+	for (i = 0; i < 11; i++)
+		twodtree = addhuffmansymbol(twodtree, ccitt2dtable[i].code, ccitt2dtable[i].symbol, &err);
+	if (err)
+		goto out_of_memory;
+
+
+
+	reference = malloc(width);
+	for (i = 0; i < width; i++)
+		reference[i] = 0;
+	current = malloc(width);
+	if (!current || !reference)
+		goto out_of_memory;
+
+
+	if (eol)
+	{
+		while (getbit(bs) == 0)
+			continue;
+	}
+	for (i = 0; i < height; i++)
+	{
+		a0 = -1;
+		colour = 0;
+		while (a0 < width)
+		{
+			b1 = a0 +1;
+			while (b1 < width)
+			{
+				if (reference[b1] != colour && (b1 ==  0 || reference[b1] != reference[b1 - 1]) )
+					break;
+				b1++;
+			}
+			for (b2 = b1; b2 < width && reference[b2] == reference[b1]; b2++)
+				;
+
+			if (a0 == -1)
+				a0 = 0;
+			
+			mode = reference_gethuffmansymbol(twodtree, bs);
+			a2 = -1;
+			switch (mode)
+			{
+			case CCITT_PASS:
+				a1 = b2;
+				break;
+			case CCITT_HORIZONTAL:
+				a1span = 0;
+				a2span = 0;
+				if (colour == 0)
+				{
+					do
+					{
+						seg = reference_gethuffmansymbol(whitetree, bs);
+						a1span += seg;
+					} while (seg >= 64 && a0 + a1span <= width);
+
+					do
+					{
+						seg = reference_gethuffmansymbol(blacktree, bs);
+						a2span += seg;
+					} while (seg >= 64 && a0 + a1span <= width);
+				}
+				else
+				{
+					do
+					{
+						seg = reference_gethuffmansymbol(blacktree, bs);
+						a1span += seg;
+					} while (seg >= 64 && a0 + a1span  <= width);
+
+					do
+					{
+						seg = reference_gethuffmansymbol(whitetree, bs);
+						a2span += seg;
+					} while (seg >= 64 && a0 + a1span + a2span <= width);
+				}
+				a1 = a0 + a1span;
+				a2 = a1 + a2span;
+				if (a1 > width)
+				{
+					goto parse_error;
+				}
+				break;
+			case CCITT_VERTICAL_0:
+				a1 = b1;
+				break;
+			case CCITT_VERTICAL_R1:
+				a1 = b1 + 1;
+				break;
+			case CCITT_VERTICAL_R2:
+				a1 = b1 + 2;
+				break;
+			case CCITT_VERTICAL_R3:
+				a1 = b1 + 3;
+				break;
+			case CCITT_VERTICAL_L1:
+				a1 = b1 - 1;
+				break;
+			case CCITT_VERTICAL_L2:
+				a1 = b1 - 2;
+				break;
+			case CCITT_VERTICAL_L3:
+				a1 = b1 - 3;
+				break;
+			case CCITT_ENDOFFAXBLOCK:
+				goto endofblock;
+				break;
+			default:
+				goto parse_error;
+				break;
+			}
+			if (a1 <= a0 && a0 != 0 )
+			{
+				goto parse_error;
+			}
+			if (a0 < 0 || a1 < 0)
+			{
+				goto parse_error;
+			}
+			while (a0 < a1 && a0 < width)
+			{
+				current[a0++] = colour;
+				reference_writebit(bout, colour);
+			}
+			if (mode != CCITT_PASS)
+				colour ^= 1;
+			if(a1 >= 0)
+				a0 = a1;
+			if (a2 != -1)
+			{
+				while (a0 < a2 && a0 < width)
+				{
+					current[a0++] = colour;
+					reference_writebit(bout, colour);
+				}
+				colour ^= 1;
+			}
+		}
+		if (eol)
+		{
+			while (getbit(bs) == 0)
+				continue;
+		}
+		temp = reference;
+		reference = current;
+		current = temp;
+		if (width % 8)
+		{
+			while (a0 % 8)
+			{
+				reference_writebit(bout, 0);
+				a0++;
+			}
+		}
+
+	}
+endofblock:
+	*Nret = Nout;
+	killhuffmantree(twodtree);
+	killhuffmantree(whitetree);
+	killhuffmantree(blacktree);
+	free(reference);
+	free(current);
+	return answer;
+
+parse_error:
+	*Nret = Nout;
+	return answer;
+out_of_memory:
+	return 0;
+}
+
+/*/////////////////////////////////////////////////////////////////////*/
+/* encoders, to make the corpus */
+/*/////////////////////////////////////////////////////////////////////*/
+
+typedef struct
+{
+	unsigned char *data;
+	int N;
+	BSTREAM *bs;
+} CODESTREAM;
+
+static unsigned long randstate = 12345;
+
+static unsigned long myrand(void)
+{
+	randstate = randstate * 1103515245UL + 12345UL;
+	return (randstate >> 16) & 0x7FFF;
+}
+
+static int putcode(CODESTREAM *cs, const char *code)
+{
+	while (*code)
+		if (reference_writebit(cs->bs, *code++ == '1') == -1)
+			return -1;
+	return 0;
+}
+
+/*
+  write a run as makeup codes followed by a terminating code
+*/
+static int putrun(CODESTREAM *cs, int len, int colour)
+{
+	int i;
+	int makeup;
+
+	while (len >= 64)
+	{
+		makeup = len >= 2560 ? 2560 : (len / 64) * 64;
+		for (i = 0; i < 105; i++)
+			if (ccitttable[i].whitelen == makeup)
+				break;
+		if (putcode(cs, colour ? ccitttable[i].blackcode : ccitttable[i].whitecode) == -1)
+			return -1;
+		len -= makeup;
+	}
+	return putcode(cs, colour ? ccitttable[len].blackcode : ccitttable[len].whitecode);
+}
+
+static int put2d(CODESTREAM *cs, int symbol)
+{
+	int i;
+
+	for (i = 0; i < 11; i++)
+		if (ccitt2dtable[i].symbol == symbol)
+			return putcode(cs, ccitt2dtable[i].code);
+	return -1;
+}
+
+static const char *eolcode = "000000000001";
+
+/*
+  Modified Huffman, with an EOL before the first row and after each
+  row if eol is set.
+*/
+static int encodemh(CODESTREAM *cs, const unsigned char *image, int width, int height, int eol)
+{
+	const unsigned char *row;
+	int i, x, run;
+	int colour;
+
+	if (eol && putcode(cs, eolcode) == -1)
+		return -1;
+	for (i = 0; i < height; i++)
+	{
+		row = image + i * width;
+		x = 0;
+		colour = 0;
+		while (x < width)
+		{
+			for (run = 0; x + run < width && row[x + run] == colour; run++)
+				;
+			if (putrun(cs, run, colour) == -1)
+				return -1;
+			x += run;
+			colour ^= 1;
+		}
+		if (eol && putcode(cs, eolcode) == -1)
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+  Group 4, finding b1 and b2 exactly as the decoders do.
+*/
+static int encodeg4(CODESTREAM *cs, const unsigned char *image, int width, int height, int eol)
+{
+	const unsigned char *reference;
+	const unsigned char *current;
+	unsigned char *white;
+	int i;
+	int a0, a1, a2, b1, b2;
+	int start;
+	int colour;
+	int err = 0;
+
+	white = calloc(width, 1);
+	if (!white)
+		return -1;
+	if (eol)
+		err |= putcode(cs, eolcode);
+	reference = white;
+	for (i = 0; i < height; i++)
+	{
+		current = image + i * width;
+		a0 = -1;
+		colour = 0;
+		while (a0 < width && !err)
+		{
+			b1 = a0 + 1;
+			while (b1 < width)
+			{
+				if (reference[b1] != colour && (b1 == 0 || reference[b1] != reference[b1 - 1]))
+					break;
+				b1++;
+			}
+			for (b2 = b1; b2 < width && reference[b2] == reference[b1]; b2++)
+				;
+			for (a1 = a0 + 1; a1 < width && current[a1] == colour; a1++)
+				;
+			for (a2 = a1 + 1; a2 < width && current[a2] != colour; a2++)
+				;
+			if (a2 > width)
+				a2 = width;
+			start = a0 < 0 ? 0 : a0;
+
+			if (b2 < a1)
+			{
+				err |= put2d(cs, CCITT_PASS);
+				a0 = b2;
+			}
+			else if (a1 - b1 >= -3 && a1 - b1 <= 3)
+			{
+				err |= put2d(cs, CCITT_VERTICAL_0 + (a1 >= b1 ? a1 - b1 : 3 + b1 - a1));
+				a0 = a1;
+				colour ^= 1;
+			}
+			else
+			{
+				err |= put2d(cs, CCITT_HORIZONTAL);
+				err |= putrun(cs, a1 - start, colour);
+				err |= putrun(cs, a2 - a1, colour ^ 1);
+				a0 = a2;
+			}
+		}
+		if (eol)
+			err |= putcode(cs, eolcode);
+		reference = current;
+	}
+	free(white);
+
+	return err ? -1 : 0;
+}
+
+/*
+  a random image. Rows are usually the row above with the edges moved
+  a little, so all the 2D modes get used, and run lengths go up past
+  the longest makeup codes.
+*/
+static unsigned char *randomimage(int width, int height)
+{
+	unsigned char *image;
+	int i, x, run;
+	int colour;
+	int style;
+
+	image = malloc(width * height);
+	if (!image)
+		return 0;
+	style = (int) (myrand() % 3);
+	for (i = 0; i < height; i++)
+	{
+		unsigned char *row = image + i * width;
+		if (i > 0 && myrand() % 4)
+		{
+			memcpy(row, row - width, width);
+			for (x = 1; x < width; x++)
+				if (row[x] != row[x-1] && myrand() % 3 == 0)
+				{
+					run = (int) (myrand() % 7) - 3;
+					if (x + run > 0 && x + run < width)
+						memset(row + (run < 0 ? x + run : x), row[run < 0 ? x : x - 1], run < 0 ? -run : run);
+				}
+			continue;
+		}
+		x = 0;
+		colour = (int) (myrand() & 1);
+		while (x < width)
+		{
+			if (style == 0)
+				run = 1 + (int) (myrand() % 8);
+			else if (style == 1)
+				run = 1 + (int) (myrand() % 100);
+			else
+				run = 1 + (int) ((myrand() * 8) % (width + 1));
+			if (run > width - x)
+				run = width - x;
+			memset(row + x, colour, run);
+			x += run;
+			colour ^= 1;
+		}
+	}
+
+	return image;
+}
+
+/*
+  decode a stream with both decoders and compare
+  Returns: 0 if they agree, 1 if not
+*/
+static int compare(const char *what, int g4, unsigned char *in, unsigned long count, int width, int height, int eol)
+{
+	unsigned char *expected;
+	unsigned char *got;
+	unsigned long Nexpected = 0;
+	unsigned long Ngot = 0;
+	int answer = 0;
+
+	if (g4)
+	{
+		expected = reference_ccittgroup4decompress(in, count, &Nexpected, width, height, eol);
+		got = ccittgroup4decompress(in, count, &Ngot, width, height, eol);
+	}
+	else
+	{
+		expected = reference_ccittdecompress(in, count, &Nexpected, width, height, eol);
+		got = ccittdecompress(in, count, &Ngot, width, height, eol);
+	}
+	if ((expected == 0) != (got == 0))
+		answer = 1;
+	else if (expected && (Nexpected != Ngot || memcmp(expected, got, Ngot)))
+		answer = 1;
+	if (answer)
+		fprintf(stderr, "%s %s width %d height %d eol %d: decoders differ\n",
+			what, g4 ? "group 4" : "group 3", width, height, eol);
+	free(expected);
+	free(got);
+
+	return answer;
+}
+
+/*
+  check that a valid stream decodes to the image it was made from
+*/
+static int checkimage(const unsigned char *image, int g4, unsigned char *in, unsigned long count, int width, int height, int eol)
+{
+	unsigned char *decoded;
+	unsigned long N = 0;
+	int stride = (width + 7) / 8;
+	int i, x;
+	int answer = 0;
+
+	if (g4)
+		decoded = ccittgroup4decompress(in, count, &N, width, height, eol);
+	else
+		decoded = ccittdecompress(in, count, &N, width, height, eol);
+	if (!decoded)
+		answer = 1;
+	for (i = 0; decoded && i < height && !answer; i++)
+		for (x = 0; x < width; x++)
+			if (((decoded[i * stride + x / 8] >> (7 - (x & 7))) & 1) != image[i * width + x])
+			{
+				answer = 1;
+				break;
+			}
+	if (answer)
+		fprintf(stderr, "%s width %d height %d eol %d: wrong image\n",
+			g4 ? "group 4" : "group 3", width, height, eol);
+	free(decoded);
+
+	return answer;
+}
+
+int main(int argc, char **argv)
+{
+	static const int widths[] = { 1, 7, 8, 13, 64, 100, 1728, 2000, 2623, 3000 };
+	CODESTREAM cs;
+	unsigned char *image;
+	unsigned char *corrupt;
+	int Nimages = 200;
+	int Ncases = 0;
+	int failures = 0;
+	int i, j, k;
+	int width, height;
+	int g4, eol;
+	unsigned long count;
+
+	if (argc > 1)
+		Nimages = atoi(argv[1]);
+
+	for (i = 0; i < Nimages; i++)
+	{
+		width = widths[i % 10];
+		height = 1 + (int) (myrand() % 40);
+		g4 = (i / 10) % 2;
+		eol = (i / 20) % 2;
+		image = randomimage(width, height);
+		cs.N = width * height * 2 + 64;
+		cs.data = calloc(cs.N, 1);
+		if (!image || !cs.data)
+		{
+			fprintf(stderr, "out of memory\n");
+			return 1;
+		}
+		cs.bs = bstream(cs.data, cs.N, g4 && !eol ? STREAM_BIGENDIAN : STREAM_LITTLEENDIAN);
+		if (!cs.bs || (g4 ? encodeg4(&cs, image, width, height, eol) : encodemh(&cs, image, width, height, eol)) == -1)
+		{
+			fprintf(stderr, "can't encode test image\n");
+			return 1;
+		}
+		count = cs.bs->pos + 1;
+
+		failures += checkimage(image, g4, cs.data, count, width, height, eol);
+		failures += compare("valid", g4, cs.data, count, width, height, eol);
+		Ncases += 2;
+
+		corrupt = malloc(count);
+		for (j = 0; corrupt && j < 10; j++)
+		{
+			memcpy(corrupt, cs.data, count);
+			for (k = 0; k < 1 + j / 3; k++)
+				corrupt[myrand() % count] ^= (unsigned char) (1 << (myrand() % 8));
+			failures += compare("flipped", g4, corrupt, count, width, height, eol);
+			failures += compare("truncated", g4, cs.data, myrand() % count, width, height, eol);
+			for (k = 0; k < (int) count; k++)
+				corrupt[k] = (unsigned char) myrand();
+			failures += compare("random", g4, corrupt, count, width, height, eol);
+			Ncases += 3;
+		}
+		free(corrupt);
+		killbstream(cs.bs);
+		free(cs.data);
+		free(image);
+	}
+
+	printf("%d cases, %d failures\n", Ncases, failures);
+
+	return failures ? 1 : 0;
+}
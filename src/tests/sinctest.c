@@ -0,0 +1,313 @@
+/*
+  sinctest.c
+  conformance test and benchmark for the sinc converter in src_sinc.c
+
+  The converter works out the filter taps in float and runs the dot
+  products as vector code (SSE2 or NEON), or as plain float loops when
+  built with SINC_SCALAR. It is checked against the double precision
+  code it replaced, which is kept here as the reference, for 1, 2, 3,
+  4 and 6 channels (the mono, stereo, quad, hex and general kernels),
+  at ratios up and down, with the medium and fastest filters. Every
+  output must be within MAXERROR of the reference.
+
+  Usage: sinctest [-bench]
+  Returns 0 if all outputs are in bounds.
+  -bench also times the converter, in Mframes a second, for each
+  channel count.
+
+  The static functions are reached by including src_sinc.c.
+ */
+#include <math.h>
+#include <time.h>
+#include "../samplerate/src_sinc.c"
+
+/* the worst error of the float code, on signals in -1 to 1 */
+#define MAXERROR 6.9e-7
+
+static const int channelcounts[] = {1, 2, 3, 4, 6};
+static const double ratios[] = {48000.0 / 44100.0, 22050.0 / 48000.0, 44100.0 / 8000.0, 1.0 / 255.0, 255.0};
+static const int converters[] = {SRC_SINC_MEDIUM_QUALITY, SRC_SINC_FASTEST};
+
+/*
+  One output, as the double precision calc_output_multi() did it.
+  data is the frame at the current input position.
+*/
+static void reference_output(const SINC_FILTER *filter, increment_t increment, increment_t start_filter_index,
+	const float *data, int channels, double scale, double *output)
+{
+	double fraction, icoeff;
+	double left[128], right[128];
+	increment_t filter_index, max_filter_index;
+	int coeff_count, indx, ch;
+	long data_index;
+
+	max_filter_index = int_to_fp(filter->coeff_half_len);
+
+	/* the left half of the filter */
+	filter_index = start_filter_index;
+	coeff_count = (max_filter_index - filter_index) / increment;
+	filter_index = filter_index + coeff_count * increment;
+	data_index = -(long) channels * coeff_count;
+
+	for (ch = 0; ch < channels; ch++)
+		left[ch] = 0.0;
+	do
+	{
+		fraction = fp_fraction_part(filter_index) * INV_FP_ONE;
+		indx = fp_to_int(filter_index);
+		icoeff = filter->coeffs[indx] + fraction * (filter->coeffs[indx + 1] - filter->coeffs[indx]);
+		for (ch = 0; ch < channels; ch++)
+			left[ch] += icoeff * data[data_index + ch];
+		filter_index -= increment;
+		data_index += channels;
+	} while (filter_index >= MAKE_INCREMENT_T(0));
+
+	/* the right half */
+	filter_index = increment - start_filter_index;
+	coeff_count = (max_filter_index - filter_index) / increment;
+	filter_index = filter_index + coeff_count * increment;
+	data_index = (long) channels * (1 + coeff_count);
+
+	for (ch = 0; ch < channels; ch++)
+		right[ch] = 0.0;
+	do
+	{
+		fraction = fp_fraction_part(filter_index) * INV_FP_ONE;
+		indx = fp_to_int(filter_index);
+		icoeff = filter->coeffs[indx] + fraction * (filter->coeffs[indx + 1] - filter->coeffs[indx]);
+		for (ch = 0; ch < channels; ch++)
+			right[ch] += icoeff * data[data_index + ch];
+		filter_index -= increment;
+		data_index -= channels;
+	} while (filter_index > MAKE_INCREMENT_T(0));
+
+	for (ch = 0; ch < channels; ch++)
+		output[ch] = scale * (left[ch] + right[ch]);
+}
+
+/*
+  Check the converter's outputs against the reference. The input is
+  padded with zeros either side, as the converter pads its buffer, and
+  the position steps as in the old process loop.
+  Returns the worst error.
+*/
+static double reference_check(SRC_STATE *state, const float *in, long pad, int channels, double ratio,
+	const float *out, long Nout)
+{
+	const SINC_FILTER *filter = ((SRC_PRIVATE *) state)->private_data;
+	double output[128];
+	double input_index = 0.0;
+	double float_increment, rem, err;
+	double worst = 0.0;
+	increment_t increment, start_filter_index;
+	long current = pad;
+	long i;
+	int ch;
+
+	float_increment = filter->index_inc * 1.0;
+	if (ratio < 1.0)
+		float_increment = filter->index_inc * ratio;
+	increment = double_to_fp(float_increment);
+
+	for (i = 0; i < Nout; i++)
+	{
+		start_filter_index = double_to_fp(input_index * float_increment);
+		reference_output(filter, increment, start_filter_index, in + current * channels, channels,
+			float_increment / filter->index_inc, output);
+		for (ch = 0; ch < channels; ch++)
+		{
+			err = fabs(out[i * channels + ch] - output[ch]);
+			if (err > worst)
+				worst = err;
+		}
+
+		input_index += 1.0 / ratio;
+		rem = fmod_one(input_index);
+		current += lrint(input_index - rem);
+		input_index = rem;
+	}
+
+	return worst;
+}
+
+/*
+  A test signal in -1 to 1, a sweep with a little noise, out of phase
+  in each channel.
+*/
+static void makesignal(float *x, long Nframes, int channels)
+{
+	unsigned long seed = 12345;
+	double phase;
+	long i;
+	int ch;
+
+	for (i = 0; i < Nframes; i++)
+	{
+		for (ch = 0; ch < channels; ch++)
+		{
+			seed = (seed * 1103515245 + 12345) & 0x7FFFFFFF;
+			phase = 0.5 * 3.14159265358979 * i * i / Nframes + ch;
+			x[i * channels + ch] = (float) (0.9 * sin(phase) + 0.1 * ((seed >> 8) / (double) 0x7FFFFF - 1.0));
+		}
+	}
+}
+
+/*
+  Convert a block, calling src_process() until it has nothing more to
+  give, as it may return before the input is used up or any output is
+  made.
+  Returns the number of frames out, or -1 on error.
+*/
+static long convert(SRC_STATE *state, float *in, long Nin, int channels, double ratio, float *out, long Nout)
+{
+	SRC_DATA data;
+	long answer = 0;
+
+	memset(&data, 0, sizeof(data));
+	data.src_ratio = ratio;
+	data.end_of_input = 1;
+	do
+	{
+		data.data_in = in;
+		data.input_frames = Nin;
+		data.data_out = out + answer * channels;
+		data.output_frames = Nout - answer;
+		if (src_process(state, &data))
+			return -1;
+		in += data.input_frames_used * channels;
+		Nin -= data.input_frames_used;
+		answer += data.output_frames_gen;
+	} while ((data.input_frames_used > 0 || data.output_frames_gen > 0) && answer < Nout);
+
+	return answer;
+}
+
+/*
+  Run one conversion and compare it with the reference.
+  Returns the worst error, or -1 on failure.
+*/
+static double checkconversion(int converter, int channels, double ratio)
+{
+	SRC_STATE *state = 0;
+	const SINC_FILTER *filter;
+	float *in = 0;
+	float *out = 0;
+	long Nin, Nout, Ngen, pad;
+	int err;
+	double answer = -1.0;
+
+	/* 500 frames in, or enough for about 300 out at small ratios */
+	Nin = 500;
+	if (Nin * ratio < 300)
+		Nin = (long) (300 / ratio);
+	Nout = (long) (Nin * ratio) + 16;
+
+	state = src_new(converter, channels, &err);
+	if (!state)
+		goto error_exit;
+	/* the reach of the filter either side, in frames */
+	filter = ((SRC_PRIVATE *) state)->private_data;
+	pad = 2 + (long) (filter->coeff_half_len / (double) filter->index_inc / (ratio < 1.0 ? ratio : 1.0));
+
+	in = calloc((Nin + 2 * pad) * channels, sizeof(float));
+	out = malloc(Nout * channels * sizeof(float));
+	if (!in || !out)
+		goto error_exit;
+	makesignal(in + pad * channels, Nin, channels);
+
+	Ngen = convert(state, in + pad * channels, Nin, channels, ratio, out, Nout);
+	/* the tail can fall short by the reach of the filter */
+	if (Ngen < (long) ((Nin - pad) * ratio) - 2)
+		goto error_exit;
+
+	answer = reference_check(state, in, pad, channels, ratio, out, Ngen);
+
+error_exit:
+	if (state)
+		src_delete(state);
+	free(in);
+	free(out);
+	return answer;
+}
+
+/*
+  Time the converter on a long block, as Mframes of input a second.
+*/
+static double benchmark(int converter, int channels, double ratio)
+{
+	SRC_STATE *state;
+	float *in, *out;
+	long Nin = 1000000;
+	long Nout = (long) (Nin * ratio) + 16;
+	clock_t start, end;
+	int err;
+	double answer = -1.0;
+
+	in = malloc(Nin * channels * sizeof(float));
+	out = malloc(Nout * channels * sizeof(float));
+	state = src_new(converter, channels, &err);
+	if (!in || !out || !state)
+		goto error_exit;
+	makesignal(in, Nin, channels);
+
+	start = clock();
+	if (convert(state, in, Nin, channels, ratio, out, Nout) < 0)
+		goto error_exit;
+	end = clock();
+	if (end > start)
+		answer = Nin / ((double) (end - start) / CLOCKS_PER_SEC) / 1e6;
+
+error_exit:
+	if (state)
+		src_delete(state);
+	free(in);
+	free(out);
+	return answer;
+}
+
+int main(int argc, char **argv)
+{
+	int i, j, k;
+	int failures = 0;
+	double err;
+
+	printf("sinc converter, %s\n",
+#ifdef SINC_VECTOR
+		"vector code"
+#else
+		"scalar code"
+#endif
+		);
+
+	for (i = 0; i < (int) ARRAY_LEN(converters); i++)
+	{
+		for (j = 0; j < (int) ARRAY_LEN(channelcounts); j++)
+		{
+			for (k = 0; k < (int) ARRAY_LEN(ratios); k++)
+			{
+				err = checkconversion(converters[i], channelcounts[j], ratios[k]);
+				if (err < 0 || err > MAXERROR)
+				{
+					printf("FAIL %s, %d channels, ratio %g, error %g\n", src_get_name(converters[i]),
+						channelcounts[j], ratios[k], err);
+					failures++;
+				}
+			}
+		}
+	}
+	printf("%s\n", failures ? "FAILED" : "all outputs in bounds");
+
+	if (argc == 2 && !strcmp(argv[1], "-bench"))
+	{
+		printf("Mframes/s at 48000/44100\n");
+		for (i = 0; i < (int) ARRAY_LEN(converters); i++)
+		{
+			printf("%s\n", src_get_name(converters[i]));
+			for (j = 0; j < (int) ARRAY_LEN(channelcounts); j++)
+				printf("  %d channels %.2f\n", channelcounts[j],
+					benchmark(converters[i], channelcounts[j], 48000.0 / 44100.0));
+		}
+	}
+
+	return failures ? EXIT_FAILURE : 0;
+}
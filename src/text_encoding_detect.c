@@ -17,9 +17,14 @@
 //
 // Modified by Malcolm McLean
 
+// Modified to gather all the statistics in one pass, over the first
+// megabyte of the file by default, skipping runs of plain ASCII a block 
+// at a time.
+
 // Includes
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
 
 #include "text_encoding_detect.h"
@@ -30,6 +35,26 @@ static const unsigned char TextEncodingDetect_UTF8_BOM[] = { 0xEF, 0xBB, 0xBF };
 
 static int null_suggests_binary_ = true;
 
+// Number of bytes looked at, 0 for the whole file
+static long scan_limit_ = TEXTENC_SCANLIMIT;
+
+#define SCANBLOCK (64 * 1024)
+#define ASCIIBLOCK 16
+
+// Everything the classifier needs, gathered in one pass
+typedef struct
+{
+	size_t size;                // bytes scanned
+	bool utf8_valid;            // valid UTF-8 so far
+	bool only_saw_ascii_range;  // no multibyte sequences so far
+	int more_chars;             // UTF-8 continuation bytes expected
+	int le_control_chars;       // UTF-16 LE newlines
+	int be_control_chars;       // UTF-16 BE newlines
+	size_t num_even_nulls;      // nulls at even offsets
+	size_t num_odd_nulls;       // nulls at odd offsets
+	unsigned char prev;         // the byte before, for UTF-16 pairs
+} TEXTSTATS;
+
 // Set defaults for utf16 detection based the use of odd/even nulls
 static int utf16_expected_null_percent_ = 70;
 static int utf16_unexpected_null_percent_ = 10;
@@ -38,12 +63,10 @@ static const unsigned char* utf16_bom_le_ = TextEncodingDetect_UTF16_BOM_LE;
 static const unsigned char* utf16_bom_be_ = TextEncodingDetect_UTF16_BOM_BE;
 static const unsigned char* utf8_bom_ = TextEncodingDetect_UTF8_BOM;
 
-static TextEncoding DetectEncoding(const unsigned char *pBuffer, size_t size);
-static TextEncoding CheckUTF8(const unsigned char *pBuffer, size_t size);
-static TextEncoding CheckUTF16NewlineChars(const unsigned char *pBuffer, size_t size);
-static TextEncoding CheckUTF16ASCII(const unsigned char *pBuffer, size_t size);
-static bool DoesContainNulls(const unsigned char *pBuffer, size_t size);
-static unsigned char *slurpb(const char *fname, int *len);
+static void InitTextStats(TEXTSTATS *stats);
+static void ScanText(TEXTSTATS *stats, const unsigned char *pBuffer, size_t size);
+static size_t SkipPlainASCII(const unsigned char *pBuffer, size_t size);
+static TextEncoding ClassifyText(const TEXTSTATS *stats);
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -80,6 +103,22 @@ void SetUtf16ExpectedNullPercent(int percent)
 		utf16_expected_null_percent_ = percent;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Set the number of bytes at the start of a file used to detect the
+// encoding, 0 to scan the whole file.
+///////////////////////////////////////////////////////////////////////////////
+
+void SetTextEncodingScanLimit(long limit)
+{
+	if (limit >= 0)
+		scan_limit_ = limit;
+}
+
+long GetTextEncodingScanLimit(void)
+{
+	return scan_limit_;
+}
+
 
 ///////////////////////////////////////////////////////////////////////////////
 // Simple function to return the length of the BOM for a particular encoding
@@ -125,251 +164,259 @@ static TextEncoding CheckBOM(const unsigned char *pBuffer, size_t size)
 	}
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Detect the encoding of a file, reading it in blocks up to the scan limit.
+// error is set to -2 if the file can't be opened, -1 on a read error.
+///////////////////////////////////////////////////////////////////////////////
+
 TextEncoding DetectTextFileEncoding(const char *filename, int *error)
 {
-    int len = 0;
-    unsigned char *rawdata = 0;
-    TextEncoding answer = TEXTENC_None;
-    
-    if (error)
-        *error = 0;
-    rawdata = slurpb(filename, &len);
-    if (!rawdata)
-        goto error_exit;
-    answer = DetectEncoding(rawdata, len);
-    free(rawdata);
-    
-    return answer;
-    
+	FILE *fp;
+	unsigned char *buffer = 0;
+	TEXTSTATS stats;
+	TextEncoding encoding;
+	size_t total = 0;
+	size_t want;
+	size_t got;
+
+	if (error)
+		*error = 0;
+	fp = fopen(filename, "rb");
+	if (!fp)
+	{
+		if (error)
+			*error = -2;
+		return TEXTENC_None;
+	}
+	buffer = malloc(SCANBLOCK);
+	if (!buffer)
+		goto error_exit;
+
+	InitTextStats(&stats);
+	do
+	{
+		want = SCANBLOCK;
+		if (scan_limit_ > 0 && total + want > (size_t) scan_limit_)
+			want = (size_t) scan_limit_ - total;
+		got = fread(buffer, 1, want, fp);
+		if (total == 0)
+		{
+			// First check if we have a BOM and return that if so
+			encoding = CheckBOM(buffer, got);
+			if (encoding != TEXTENC_None)
+				break;
+		}
+		ScanText(&stats, buffer, got);
+		total += got;
+		encoding = TEXTENC_None;
+	} while (got == want && want > 0);
+	if (ferror(fp))
+		goto error_exit;
+	if (encoding == TEXTENC_None)
+		encoding = ClassifyText(&stats);
+
+	free(buffer);
+	fclose(fp);
+	return encoding;
+
 error_exit:
-    if (error)
-    {
-        if (len < 0)
-            *error = len;
-        else
-            *error = -1;
-    }
-    free(rawdata);
-    
-    return TEXTENC_None;
+	if (error)
+		*error = -1;
+	free(buffer);
+	fclose(fp);
+	return TEXTENC_None;
 }
 
-
 ///////////////////////////////////////////////////////////////////////////////
 // Checks if a buffer contains a valid BOM and returns the encoding based on it.
 // If it doesn't contain a BOM it tries to guess what the encoding is or
 // "None" if it just looks like binary data.
 ///////////////////////////////////////////////////////////////////////////////
 
-static TextEncoding DetectEncoding(const unsigned char *pBuffer, size_t size)
+TextEncoding DetectTextEncoding(const unsigned char *pBuffer, size_t size)
 {
-	// First check if we have a BOM and return that if so
-	TextEncoding encoding = CheckBOM(pBuffer, size);
-	if (encoding != TEXTENC_None)
-		return encoding;
-
-	// Now check for valid UTF8
-	encoding = CheckUTF8(pBuffer, size);
-	if (encoding != TEXTENC_None)
-		return encoding;
+	TEXTSTATS stats;
+	TextEncoding encoding;
 
-	// Now try UTF16 
-	encoding = CheckUTF16NewlineChars(pBuffer, size);
+	encoding = CheckBOM(pBuffer, size);
 	if (encoding != TEXTENC_None)
 		return encoding;
 
-	encoding = CheckUTF16ASCII(pBuffer, size);
-	if (encoding != TEXTENC_None)
-		return encoding;
+	InitTextStats(&stats);
+	ScanText(&stats, pBuffer, size);
 
-	// ANSI or None (binary) then
-	if (!DoesContainNulls(pBuffer, size))
-		return TEXTENC_ANSI;
-	else
-	{
-		// Found a null, return based on the preference in null_suggests_binary_
-		if (null_suggests_binary_)
-			return TEXTENC_None;
-		else
-			return TEXTENC_ANSI;
-	}
+	return ClassifyText(&stats);
 }
 
+static void InitTextStats(TEXTSTATS *stats)
+{
+	stats->size = 0;
+	stats->utf8_valid = true;
+	stats->only_saw_ascii_range = true;
+	stats->more_chars = 0;
+	stats->le_control_chars = 0;
+	stats->be_control_chars = 0;
+	stats->num_even_nulls = 0;
+	stats->num_odd_nulls = 0;
+	stats->prev = 0;
+}
 
 ///////////////////////////////////////////////////////////////////////////////
-// Checks if a buffer contains valid utf8. Returns:
-// None - not valid utf8
-// UTF8_NOBOM - valid utf8 encodings and multibyte sequences
-// ASCII - Only data in the 0-127 range. 
+// Add a block of text to the statistics. Blocks may be any length, and
+// carry on where the last left off.
+//
+// UTF8 Valid sequences
+// 0xxxxxxx  ASCII
+// 110xxxxx 10xxxxxx  2-byte
+// 1110xxxx 10xxxxxx 10xxxxxx  3-byte
+// 11110xxx 10xxxxxx 10xxxxxx 10xxxxxx  4-byte
+//
+// Width in UTF8
+// Decimal		Width
+// 0-127		1 byte
+// 194-223		2 bytes
+// 224-239		3 bytes
+// 240-244		4 bytes
+//
+// Subsequent chars are in the range 128-191
+//
+// UTF16 text is recognised by newlines, which are present even in
+// non-english text, or by nulls in the odd or even bytes, which are
+// common in ASCII-like text.
 ///////////////////////////////////////////////////////////////////////////////
 
-static TextEncoding CheckUTF8(const unsigned char *pBuffer, size_t size)
+static void ScanText(TEXTSTATS *stats, const unsigned char *pBuffer, size_t size)
 {
-	// UTF8 Valid sequences
-	// 0xxxxxxx  ASCII
-	// 110xxxxx 10xxxxxx  2-byte
-	// 1110xxxx 10xxxxxx 10xxxxxx  3-byte
-	// 11110xxx 10xxxxxx 10xxxxxx 10xxxxxx  4-byte
-	//
-	// Width in UTF8
-	// Decimal		Width
-	// 0-127		1 byte
-	// 194-223		2 bytes
-	// 224-239		3 bytes
-	// 240-244		4 bytes
-	//
-	// Subsequent chars are in the range 128-191
-
-	bool	only_saw_ascii_range = true;
-	size_t	pos = 0;
-	int		more_chars;
+	size_t pos = 0;
+	size_t skip;
+	unsigned char ch;
+	bool odd;
 
 	while (pos < size)
 	{
-		unsigned char ch = pBuffer[pos++];
-
-		if (ch == 0 && null_suggests_binary_)
-		{
-			return TEXTENC_None;
-		}
-		else if (ch <= 127)
+		// a run of ASCII without nulls changes nothing but the size, if we
+		// are on a character and a pair boundary.
+		if (((stats->size + pos) & 1) == 0 && (stats->more_chars == 0 || !stats->utf8_valid))
 		{
-			// 1 byte
-			more_chars = 0;
+			skip = SkipPlainASCII(pBuffer + pos, size - pos);
+			if (skip > 0)
+			{
+				pos += skip;
+				stats->prev = pBuffer[pos - 1];
+				if (pos == size)
+					break;
+			}
 		}
-		else if (ch >= 194 && ch <= 223)
-		{
-			// 2 Byte
-			more_chars = 1;
-		}
-		else if (ch >= 224 && ch <= 239)
-		{
-			// 3 Byte
-			more_chars = 2;
-		}
-		else if (ch >= 240 && ch <= 244)
+
+		ch = pBuffer[pos];
+		odd = ((stats->size + pos) & 1) != 0;
+		pos++;
+
+		if (ch == 0)
 		{
-			// 4 Byte
-			more_chars = 3;
+			if (odd)
+				stats->num_odd_nulls++;
+			else
+				stats->num_even_nulls++;
 		}
-		else
+
+		if (odd)
 		{
-			return TEXTENC_None;						// Not utf8
+			if (stats->prev == 0)
+			{
+				if (ch == 0x0a || ch == 0x0d)
+					stats->be_control_chars++;
+			}
+			else if (ch == 0)
+			{
+				if (stats->prev == 0x0a || stats->prev == 0x0d)
+					stats->le_control_chars++;
+			}
 		}
+		stats->prev = ch;
 
-		// Check secondary chars are in range if we are expecting any
-		while (more_chars && pos < size)
+		if (!stats->utf8_valid)
+			continue;
+		if (stats->more_chars)
 		{
-			only_saw_ascii_range = false;		// Seen non-ascii chars now
-
-			ch = pBuffer[pos++];
+			// Seen non-ascii chars now
+			stats->only_saw_ascii_range = false;
 			if (ch < 128 || ch > 191)
-				return TEXTENC_None;					// Not utf8
-
-			--more_chars;
+				stats->utf8_valid = false;
+			else
+				stats->more_chars--;
 		}
+		else if (ch == 0 && null_suggests_binary_)
+			stats->utf8_valid = false;
+		else if (ch <= 127)
+			stats->more_chars = 0;
+		else if (ch >= 194 && ch <= 223)
+			stats->more_chars = 1;
+		else if (ch >= 224 && ch <= 239)
+			stats->more_chars = 2;
+		else if (ch >= 240 && ch <= 244)
+			stats->more_chars = 3;
+		else
+			stats->utf8_valid = false;
 	}
-
-	// If we get to here then only valid UTF-8 sequences have been processed
-
-	// If we only saw chars in the range 0-127 then we can't assume UTF8 (the caller will need to decide)
-	if (only_saw_ascii_range)
-		return TEXTENC_ASCII;
-	else
-		return TEXTENC_UTF8_NOBOM;
+	stats->size += size;
 }
 
-
 ///////////////////////////////////////////////////////////////////////////////
-// Checks if a buffer contains text that looks like utf16 by scanning for 
-// newline chars that would be present even in non-english text.
-// Returns:
-// None - not valid utf16
-// UTF16_LE_NOBOM - looks like utf16 le
-// UTF16_BE_NOBOM - looks like utf16 be
+// Get the length of the run of ASCII without nulls at the start of a
+// buffer, in whole blocks. Each block is read as machine words, and a
+// word has a byte which is null or over 127 if the top bit of a byte
+// is set in the word or in (word - 0x0101...) & ~word.
 ///////////////////////////////////////////////////////////////////////////////
 
-static TextEncoding CheckUTF16NewlineChars(const unsigned char *pBuffer, size_t size)
+static size_t SkipPlainASCII(const unsigned char *pBuffer, size_t size)
 {
-	if (size < 2)
-		return TEXTENC_None;
-
-	// Reduce size by 1 so we don't need to worry about bounds checking for pairs of bytes
-	size--;
-
-	int le_control_chars = 0;
-	int be_control_chars = 0;
-	unsigned char ch1, ch2;
-
+	unsigned long words[ASCIIBLOCK / sizeof(unsigned long)];
+	unsigned long ones = (unsigned long) -1 / 0xFF;
+	unsigned long highbits = ones * 0x80;
+	unsigned long bits;
 	size_t pos = 0;
-	while (pos < size)
-	{
-		ch1 = pBuffer[pos++];
-		ch2 = pBuffer[pos++];
+	int i;
 
-		if (ch1 == 0)
-		{
-			if (ch2 == 0x0a || ch2 == 0x0d)
-				++be_control_chars;
-		}
-		else if (ch2 == 0)
-		{
-			if (ch1 == 0x0a || ch1 == 0x0d)
-				++le_control_chars;
-		}
-
-		// If we are getting both LE and BE control chars then this file is not utf16
-		if (le_control_chars && be_control_chars)
-			return TEXTENC_None;
+	while (pos + ASCIIBLOCK <= size)
+	{
+		memcpy(words, pBuffer + pos, ASCIIBLOCK);
+		bits = 0;
+		for (i = 0; i < (int) (ASCIIBLOCK / sizeof(unsigned long)); i++)
+			bits |= words[i] | ((words[i] - ones) & ~words[i]);
+		if (bits & highbits)
+			break;
+		pos += ASCIIBLOCK;
 	}
 
-	if (le_control_chars)
-		return TEXTENC_UTF16_LE_NOBOM;
-	else if (be_control_chars)
-		return TEXTENC_UTF16_BE_NOBOM;
-	else
-		return TEXTENC_None;
+	return pos;
 }
 
-
 ///////////////////////////////////////////////////////////////////////////////
-// Checks if a buffer contains text that looks like utf16. This is done based
-// the use of nulls which in ASCII/script like text can be useful to identify.
-// Returns:
-// None - not valid utf16
-// UTF16_LE_NOBOM - looks like utf16 le
-// UTF16_BE_NOBOM - looks like utf16 be
+// Decide the encoding from the statistics, making the checks in the order
+// valid UTF8 (or ASCII, if only data in the 0-127 range), UTF16 by newlines,
+// UTF16 by nulls, then ANSI or None (binary).
 ///////////////////////////////////////////////////////////////////////////////
 
-static TextEncoding CheckUTF16ASCII(const unsigned char *pBuffer, size_t size)
+static TextEncoding ClassifyText(const TEXTSTATS *stats)
 {
-	int num_odd_nulls = 0;
-	int num_even_nulls = 0;
-
-	// Get even nulls
-	size_t pos = 0;
-	while (pos < size)
-	{
-		if (pBuffer[pos] == 0)
-			num_even_nulls++;
-
-		pos += 2;
-	}
+	double even_null_threshold;
+	double odd_null_threshold;
+	double expected_null_threshold = utf16_expected_null_percent_ / 100.0;
+	double unexpected_null_threshold = utf16_unexpected_null_percent_ / 100.0;
 
-	// Get odd nulls
-	pos = 1;
-	while (pos < size)
-	{
-		if (pBuffer[pos] == 0)
-			num_odd_nulls++;
+	// If we only saw chars in the range 0-127 then we can't assume UTF8 (the caller will need to decide)
+	if (stats->utf8_valid)
+		return stats->only_saw_ascii_range ? TEXTENC_ASCII : TEXTENC_UTF8_NOBOM;
 
-		pos += 2;
-	}
+	// If we are getting both LE and BE control chars then this file is not utf16
+	if (stats->le_control_chars && !stats->be_control_chars)
+		return TEXTENC_UTF16_LE_NOBOM;
+	else if (stats->be_control_chars && !stats->le_control_chars)
+		return TEXTENC_UTF16_BE_NOBOM;
 
-	double even_null_threshold = (num_even_nulls * 2.0) / size;
-	double odd_null_threshold = (num_odd_nulls * 2.0) / size;
-	double expected_null_threshold = utf16_expected_null_percent_ / 100.0;
-	double unexpected_null_threshold = utf16_unexpected_null_percent_ / 100.0;
+	even_null_threshold = (stats->num_even_nulls * 2.0) / stats->size;
+	odd_null_threshold = (stats->num_odd_nulls * 2.0) / stats->size;
 
 	// Lots of odd nulls, low number of even nulls
 	if (even_null_threshold < unexpected_null_threshold	&& odd_null_threshold > expected_null_threshold)
@@ -379,63 +426,15 @@ static TextEncoding CheckUTF16ASCII(const unsigned char *pBuffer, size_t size)
 	if (odd_null_threshold < unexpected_null_threshold && even_null_threshold > expected_null_threshold)
 		return TEXTENC_UTF16_BE_NOBOM;
 
-	// Don't know
-	return TEXTENC_None;
-}
-
-
-///////////////////////////////////////////////////////////////////////////////
-// Checks if a buffer contains any nulls. Used to check for binary vs text data.
-///////////////////////////////////////////////////////////////////////////////
-
-static bool DoesContainNulls(const unsigned char *pBuffer, size_t size)
-{
-	size_t pos = 0;
-	while (pos < size)
+	// ANSI or None (binary) then
+	if (stats->num_even_nulls + stats->num_odd_nulls == 0)
+		return TEXTENC_ANSI;
+	else
 	{
-		if (pBuffer[pos++] == 0)
-			return true;
+		// Found a null, return based on the preference in null_suggests_binary_
+		if (null_suggests_binary_)
+			return TEXTENC_None;
+		else
+			return TEXTENC_ANSI;
 	}
-
-	return false;
-}
-
-static unsigned char *slurpb(const char *fname, int *len)
-{
-    FILE *fp;
-    unsigned char *answer = 0;
-    unsigned char *temp;
-    int capacity = 1024;
-    int N = 0;
-    int ch;
-
-    fp = fopen(fname, "rb");
-    if (!fp)
-    {
-        *len = -2;
-        return 0;
-    }
-    answer = malloc(capacity);
-    if (!answer)
-        goto out_of_memory;
-    while ( (ch = fgetc(fp)) != EOF)
-    {
-        answer[N++] = ch;
-        if (N >= capacity)
-        {
-            temp = realloc(answer, capacity + capacity / 2);
-            if (!temp)
-                goto out_of_memory;
-            answer = temp;
-            capacity = capacity + capacity / 2;
-        }
-    }
-    *len = N;
-    fclose(fp);
-    return answer;
-out_of_memory:
-    fclose(fp);
-    *len = -1;
-    free(answer);
-    return 0;
 }
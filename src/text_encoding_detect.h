@@ -35,7 +35,15 @@ typedef enum
     TEXTENC_UTF16_BE_NOBOM,        // UTF16-BE without BOM
 } TextEncoding;
 
+#include <stddef.h>
+
+// Default number of bytes looked at to detect a file's encoding
+#define TEXTENC_SCANLIMIT (1024 * 1024)
+
 TextEncoding DetectTextFileEncoding(const char *filename, int *error);
+TextEncoding DetectTextEncoding(const unsigned char *pBuffer, size_t size);
+void SetTextEncodingScanLimit(long limit);
+long GetTextEncodingScanLimit(void);
 
 #endif
 
@@ -0,0 +1,186 @@
+/*
+  threadpool.c - run independent jobs on worker threads.
+
+  Uses pthreads if BBX_USE_PTHREADS is defined, Win32 threads on
+  Windows, and otherwise simply runs the jobs one after another, so
+  the program still compiles as plain ANSI C with no dependencies.
+
+  by Malcolm McLean
+ */
+#include <stdlib.h>
+
+#include "threadpool.h"
+
+#if defined(BBX_USE_PTHREADS)
+#include <pthread.h>
+#define HAVE_THREADS
+#elif defined(_WIN32)
+#include <windows.h>
+#define HAVE_THREADS
+#endif
+
+#define MAXTHREADS 64
+
+typedef struct
+{
+  int N;
+  int next;
+  void (*fn)(void *ptr, int index);
+  void *ptr;
+#if defined(BBX_USE_PTHREADS)
+  pthread_mutex_t lock;
+#elif defined(_WIN32)
+  CRITICAL_SECTION lock;
+#endif
+} JOBQUEUE;
+
+static int defaultNthreads = 1;
+
+#ifdef HAVE_THREADS
+static int getjob(JOBQUEUE *queue);
+#endif
+
+/*
+  set the number of threads used when a caller asks for the default
+  Params: Nthreads - number of worker threads (values below 1 mean 1)
+ */
+void threadpool_setNthreads(int Nthreads)
+{
+  if(Nthreads < 1)
+    Nthreads = 1;
+  if(Nthreads > MAXTHREADS)
+    Nthreads = MAXTHREADS;
+  defaultNthreads = Nthreads;
+}
+
+/*
+  get the default number of worker threads
+ */
+int threadpool_Nthreads(void)
+{
+  return defaultNthreads;
+}
+
+#ifdef HAVE_THREADS
+#if defined(BBX_USE_PTHREADS)
+static void *worker(void *ptr)
+#else
+static DWORD WINAPI worker(LPVOID ptr)
+#endif
+{
+  JOBQUEUE *queue = ptr;
+  int index;
+
+  while( (index = getjob(queue)) >= 0)
+    (*queue->fn)(queue->ptr, index);
+
+  return 0;
+}
+#endif
+
+/*
+  call a function once for every index in 0 to N-1, in parallel
+  Params: N - number of jobs
+          Nthreads - number of threads, 0 for the default
+          fn - job function, called with ptr and the job index
+          ptr - context pointer passed to fn
+  Returns: 0 on success, -1 if threads could not be created
+  Notes: jobs are handed out in index order, but may complete in any
+    order. fn must only write to memory belonging to its own index.
+    If no threads can be created the jobs run on the calling thread.
+ */
+int parallelfor(int N, int Nthreads, void (*fn)(void *ptr, int index), void *ptr)
+{
+  JOBQUEUE queue;
+  int i;
+  int answer = 0;
+
+  if(Nthreads <= 0)
+    Nthreads = defaultNthreads;
+  if(Nthreads > N)
+    Nthreads = N;
+  if(Nthreads > MAXTHREADS)
+    Nthreads = MAXTHREADS;
+
+  queue.N = N;
+  queue.next = 0;
+  queue.fn = fn;
+  queue.ptr = ptr;
+
+#if defined(BBX_USE_PTHREADS)
+  if(Nthreads > 1)
+  {
+    pthread_t threads[MAXTHREADS];
+    int Nstarted = 0;
+
+    pthread_mutex_init(&queue.lock, 0);
+    for(i=0;i<Nthreads-1;i++)
+    {
+      if(pthread_create(&threads[i], 0, worker, &queue) != 0)
+      {
+        answer = -1;
+        break;
+      }
+      Nstarted++;
+    }
+    worker(&queue);
+    for(i=0;i<Nstarted;i++)
+      pthread_join(threads[i], 0);
+    pthread_mutex_destroy(&queue.lock);
+    return answer;
+  }
+#elif defined(_WIN32)
+  if(Nthreads > 1)
+  {
+    HANDLE threads[MAXTHREADS];
+    int Nstarted = 0;
+
+    InitializeCriticalSection(&queue.lock);
+    for(i=0;i<Nthreads-1;i++)
+    {
+      threads[Nstarted] = CreateThread(0, 0, worker, &queue, 0, 0);
+      if(!threads[Nstarted])
+      {
+        answer = -1;
+        break;
+      }
+      Nstarted++;
+    }
+    worker(&queue);
+    WaitForMultipleObjects(Nstarted, threads, TRUE, INFINITE);
+    for(i=0;i<Nstarted;i++)
+      CloseHandle(threads[i]);
+    DeleteCriticalSection(&queue.lock);
+    return answer;
+  }
+#endif
+  for(i=0;i<queue.N;i++)
+    (*queue.fn)(queue.ptr, i);
+
+  return answer;
+}
+
+#ifdef HAVE_THREADS
+/*
+  take the next job off the queue
+  Returns: job index, -1 when all jobs have been handed out
+ */
+static int getjob(JOBQUEUE *queue)
+{
+  int answer;
+
+#if defined(BBX_USE_PTHREADS)
+  pthread_mutex_lock(&queue->lock);
+#elif defined(_WIN32)
+  EnterCriticalSection(&queue->lock);
+#endif
+  answer = queue->next < queue->N ? queue->next++ : -1;
+#if defined(BBX_USE_PTHREADS)
+  pthread_mutex_unlock(&queue->lock);
+#elif defined(_WIN32)
+  LeaveCriticalSection(&queue->lock);
+#endif
+
+  return answer;
+}
+#endif
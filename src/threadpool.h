@@ -0,0 +1,8 @@
+#ifndef threadpool_h
+#define threadpool_h
+
+void threadpool_setNthreads(int Nthreads);
+int threadpool_Nthreads(void);
+int parallelfor(int N, int Nthreads, void (*fn)(void *ptr, int index), void *ptr);
+
+#endif
@@ -2,6 +2,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include "freetype/freetype.h"
+#include "bitmapfont.h"
+#include "threadpool.h"
+#include "distancefield.h"
+
+/* distance fields are made from glyphs rendered this many times larger */
+#define SDF_SCALE 8
 
 static TT_Error initrastermap(TT_Raster_Map *map, int width, int height, int gray_render)
 {
@@ -27,57 +33,20 @@ static TT_Error initrastermap(TT_Raster_Map *map, int width, int height, int gra
   return 0;
 }
 
-static void killrastermap(TT_Raster_Map *map)
-{
-  if(map)
-    free(map->bitmap);
-}
-
-static int getascenderanddescender(TT_Instance instance, TT_Glyph glyph, int Nglyphs, int *ascent, int *descent, int *width)
-{
-  int i;
-  TT_Pos ascender = 0;
-  TT_Pos descender = 0;
-  TT_Pos maxwidth = 0;
-  TT_Glyph_Metrics glyphMetrics;
-  TT_UShort glyphIndex;
-  TT_Error err;
-
-  for(i=0;i<Nglyphs;i++)
-  {
-    glyphIndex = (TT_UShort) i;
-    err = TT_Load_Glyph(instance, glyph, glyphIndex, TTLOAD_SCALE_GLYPH | TTLOAD_HINT_GLYPH);
-    if(err == 0)
-    {
-      TT_Get_Glyph_Metrics(glyph, &glyphMetrics);
-      if(ascender < glyphMetrics.bearingY)
-        ascender = glyphMetrics.bearingY;
-      if(descender > glyphMetrics.bbox.yMin)
-        descender = glyphMetrics.bbox.yMin;
-      if(maxwidth < glyphMetrics.bbox.xMax - glyphMetrics.bbox.xMin + glyphMetrics.bearingX)
-         maxwidth =  glyphMetrics.bbox.xMax - glyphMetrics.bbox.xMin + glyphMetrics.bearingX;
-    }
-  }
-  *ascent = (ascender + 31)/64;
-  *descent = (-descender + 31)/64;
-  *width = (maxwidth + 63)/64;
-
-  return 0;
-}
-
+/*
+  get the lowest code which maps to each glyph, -1 if none does.
+ */
 static void getcodes(TT_CharMap charmap, int Nglyphs, int *ret)
 {
   int i, ii;
 
   for(i=0;i<Nglyphs;i++)
+    ret[i] = -1;
+  for(ii=0;ii<0xFFFF;ii++)
   {
-    for(ii=0;ii<0xFFFF;ii++)
-      if(TT_Char_Index(charmap, ii) == i)
-        break;
-    if(ii < 0xFFFF)
+    i = TT_Char_Index(charmap, ii);
+    if(i < Nglyphs && ret[i] == -1)
       ret[i] = ii;
-    else
-      ret[i] = -1;
   }
 }
 
@@ -109,6 +78,41 @@ static int getbestcharmap(TT_Face face)
 
 }
 
+/*
+  get the codes of a subset of characters, and their glyphs. Characters
+  not in the font are dropped.
+  Returns: number of codes, -1 on out of memory.
+ */
+static int getsubsetcodes(TT_CharMap charmap, const int *chars, int Nchars, int **codesret, TT_UShort **glyphsret)
+{
+  int *codes;
+  TT_UShort *glyphs;
+  int i;
+  int N = 0;
+
+  codes = malloc((Nchars ? Nchars : 1) * sizeof(int));
+  glyphs = malloc((Nchars ? Nchars : 1) * sizeof(TT_UShort));
+  if (!codes || !glyphs)
+  {
+    free(codes);
+    free(glyphs);
+    return -1;
+  }
+  for (i = 0; i < Nchars; i++)
+  {
+    if (chars[i] < 0 || chars[i] > 0xFFFF)
+      continue;
+    glyphs[N] = TT_Char_Index(charmap, (TT_UShort) chars[i]);
+    if (glyphs[N] == 0)
+      continue;
+    codes[N++] = chars[i];
+  }
+  *codesret = codes;
+  *glyphsret = glyphs;
+
+  return N;
+}
+
 /*
   sort codes is ascending order (-1 = no code, at start ) 
  */
@@ -117,132 +121,1063 @@ static int compints(const void *e1, const void *e2)
   return *(const int *)e1 - *(const int *) e2;
 }
 
-int dumpttf(char *fname, int header, char *name, int points, FILE *fp)
+/*
+  a glyph rendered by a worker, into a pixmap just big enough to hold it.
+ */
+typedef struct
 {
-  int major, minor;
+  int loaded;           /* glyph loaded and hinted */
+  TT_Glyph_Metrics metrics; /* hinted metrics (26.6) */
+  TT_Pos advance;       /* hinted advance when rendered (26.6) */
+  int hasoutline;       /* outline hinted and waiting to be rendered */
+  TT_Outline outline;   /* the hinted outline */
+  int x;                /* pixmap left relative to the origin, in pixels */
+  int top;              /* pixmap top relative to the baseline, in pixels */
+  int width;            /* pixmap width */
+  int height;           /* pixmap height */
+  int stride;           /* bytes per pixmap row */
+  unsigned char *bitmap; /* grey levels, 0 if not rendered */
+} RENDEREDGLYPH;
+
+/*
+  the glyphs of a font. Hinting is done in order on one instance for
+  each size, because glyph programs may leave state in the cvt, storage
+  area and twilight zone for later glyphs. Every glyph is hinted once,
+  the glyphs with codes first, in code order, keeping their outlines,
+  then the rest for their metrics only. The cell comes from the
+  metrics, then the outlines are placed in their boxes. The sizes are
+  independent so are hinted in parallel, each job opening its own
+  engine, because a FreeType engine may only be used by one thread at
+  a time. The outlines are then rendered in parallel.
+ */
+typedef struct
+{
+  char *fname;
+  const int *points;        /* the sizes */
+  int Npoints;              /* number of sizes */
+  const TT_UShort *glyphs;  /* glyph indices to load, null for all glyphs */
+  const int *order;         /* all the slots, in the order to hint them */
+  int Norder;               /* number of slots to render, at the start */
+  int Nload;                /* number of glyphs to load */
+  int coverage;             /* anti-alias by exact area coverage */
+  int clip;                 /* clip the glyphs to the character cell */
+  int Njobs;
+  RENDEREDGLYPH *slots;     /* Nload for each size */
+  int *errors;              /* one per job */
+} RENDERJOB;
+
+/*
+  a slot to render, by its code.
+ */
+typedef struct
+{
+  int code;
+  int slot;
+} CODESLOT;
+
+/*
+  load and hint one glyph, keeping its metrics and, if wanted, its
+  outline.
+  Params: instance - the size
+          glyph - glyph container
+          glyphIndex - the glyph to load
+          keepoutline - keep the outline to render
+          slot - return for the metrics and outline
+  Returns: 0 on success, -1 on out of memory.
+  Notes: a glyph which fails to load is left unloaded, not an error.
+ */
+static int hintglyph(TT_Instance instance, TT_Glyph glyph, TT_UShort glyphIndex, int keepoutline, RENDEREDGLYPH *slot)
+{
+  TT_Outline outline;
+
+  if (TT_Load_Glyph(instance, glyph, glyphIndex, TTLOAD_SCALE_GLYPH | TTLOAD_HINT_GLYPH))
+    return 0;
+  TT_Get_Glyph_Metrics(glyph, &slot->metrics);
+  slot->advance = slot->metrics.advance;
+  slot->loaded = 1;
+  if (!keepoutline)
+    return 0;
+
+  TT_Get_Glyph_Outline(glyph, &outline);
+  /* nothing to render, e.g. a space */
+  if (outline.n_points == 0 || outline.n_contours == 0)
+    return 0;
+  if (TT_New_Outline(outline.n_points, outline.n_contours, &slot->outline))
+    return -1;
+  TT_Copy_Outline(&outline, &slot->outline);
+  slot->outline.second_pass = outline.second_pass;
+  /* as TT_Get_Glyph_Pixmap() */
+  slot->outline.dropout_mode = 2;
+  slot->hasoutline = 1;
+
+  return 0;
+}
+
+/*
+  work out the box a hinted glyph will be rendered into, and move its
+  outline into it.
+  Params: cell - width, ascent and descent of the cell to clip to,
+            null not to clip
+          slot - the hinted glyph
+  Notes: a glyph with an empty box is not rendered.
+ */
+static void placeglyph(const int *cell, RENDEREDGLYPH *slot)
+{
+  const TT_BBox *bbox = &slot->metrics.bbox;
+  int right, bottom;
+
+  /* the box in whole pixels, with a pixel to spare all round */
+  slot->x = (int) (bbox->xMin >> 6) - 1;
+  right = (int) ((bbox->xMax + 63) >> 6) + 1;
+  slot->top = (int) ((bbox->yMax + 63) >> 6) + 1;
+  bottom = (int) (bbox->yMin >> 6) - 1;
+  /* 
+    a glyph which crosses the cell is rendered into the whole of it, 
+    so the rasteriser clips it at the same place as when every glyph
+    was rendered into a cell 
+  */
+  if (cell && (slot->x < 0 || right > cell[0]))
+  {
+    slot->x = 0;
+    right = cell[0];
+  }
+  if (cell && (slot->top > cell[1] || bottom < -cell[2]))
+  {
+    slot->top = cell[1];
+    bottom = -cell[2];
+  }
+  slot->width = (right - slot->x + 3)/4*4;
+  slot->height = slot->top - bottom;
+  if (slot->width <= 0 || slot->height <= 0)
+  {
+    TT_Done_Outline(&slot->outline);
+    slot->hasoutline = 0;
+    return;
+  }
+  TT_Translate_Outline(&slot->outline, -slot->x * 64, -bottom * 64);
+}
+
+/*
+  render a hinted outline into its pixmap.
+  Returns: 0 on success, -1 on out of memory.
+ */
+static int renderglyph(TT_Engine engine, RENDEREDGLYPH *slot)
+{
+  TT_Raster_Map map;
+
+  if (initrastermap(&map, slot->width, slot->height, 1))
+    return -1;
+  memset(map.bitmap, 0, map.size);
+  TT_Get_Outline_Pixmap(engine, &slot->outline, &map);
+  slot->stride = map.cols;
+  slot->bitmap = map.bitmap;
+  TT_Done_Outline(&slot->outline);
+  slot->hasoutline = 0;
+
+  return 0;
+}
+
+static void killrenderedglyphs(RENDEREDGLYPH *slots, int N)
+{
+  int i;
+
+  if (slots)
+  {
+    for (i = 0; i < N; i++)
+    {
+      if (slots[i].hasoutline)
+        TT_Done_Outline(&slots[i].outline);
+      free(slots[i].bitmap);
+    }
+    free(slots);
+  }
+}
+
+/*
+  get the font metrics from the glyphs we are going to use.
+  scale is the factor the glyphs were rendered larger by.
+ */
+static void getascenderanddescender(const RENDEREDGLYPH *slots, int N, int scale, int *ascent, int *descent, int *width)
+{
+  int i;
+  TT_Pos ascender = 0;
+  TT_Pos descender = 0;
+  TT_Pos maxwidth = 0;
+  const TT_Glyph_Metrics *glyphMetrics;
+
+  for(i=0;i<N;i++)
+  {
+    if(slots[i].loaded)
+    {
+      glyphMetrics = &slots[i].metrics;
+      if(ascender < glyphMetrics->bearingY)
+        ascender = glyphMetrics->bearingY;
+      if(descender > glyphMetrics->bbox.yMin)
+        descender = glyphMetrics->bbox.yMin;
+      if(maxwidth < glyphMetrics->bbox.xMax - glyphMetrics->bbox.xMin + glyphMetrics->bearingX)
+         maxwidth =  glyphMetrics->bbox.xMax - glyphMetrics->bbox.xMin + glyphMetrics->bearingX;
+    }
+  }
+  *ascent = (ascender + 31*scale)/(64*scale);
+  *descent = (-descender + 31*scale)/(64*scale);
+  *width = (maxwidth + 63*scale)/(64*scale);
+}
+
+static void hintglyphsjob(void *ptr, int index)
+{
+  RENDERJOB *job = ptr;
   TT_Engine engine;
-  TT_Byte palette[5] = {0x00, 0x40, 0x80, 0xC0, 0xFF};
   TT_Face face;
-  TT_Face_Properties faceProperties;
   TT_Instance instance;
-  TT_Instance_Metrics instanceMetrics;
   TT_Glyph glyph;
-  TT_Glyph_Metrics glyphMetrics;
-  TT_CharMap charmap;
-  TT_Raster_Map map;
   TT_UShort glyphIndex;
-  TT_Error err;
+  RENDEREDGLYPH *slots;
+  int cell[3];
+  int maxwidth;
+  int i, ii;
+
+  if (TT_Init_FreeType(&engine))
+  {
+    job->errors[index] = 1;
+    return;
+  }
+  if (TT_Open_Face(engine, job->fname, &face))
+  {
+    job->errors[index] = 1;
+    TT_Done_FreeType(engine);
+    return;
+  }
+  if (TT_New_Glyph(face, &glyph))
+    goto error_exit;
+
+  for (i = index; i < job->Npoints; i += job->Njobs)
+  {
+    slots = job->slots + i * job->Nload;
+    if (TT_New_Instance(face, &instance))
+      goto error_exit;
+    if (TT_Set_Instance_CharSize(instance, job->points[i]*64))
+    {
+      TT_Done_Instance(instance);
+      goto error_exit;
+    }
+    for (ii = 0; ii < job->Nload; ii++)
+    {
+      glyphIndex = job->glyphs ? job->glyphs[job->order[ii]] : (TT_UShort) job->order[ii];
+      if (hintglyph(instance, glyph, glyphIndex, ii < job->Norder, &slots[job->order[ii]]))
+      {
+        TT_Done_Instance(instance);
+        goto error_exit;
+      }
+    }
+    TT_Done_Instance(instance);
+    getascenderanddescender(slots, job->Nload, 1, &cell[1], &cell[2], &maxwidth);
+    cell[0] = (maxwidth + 3)/4*4;
+    for (ii = 0; ii < job->Norder; ii++)
+    {
+      if (slots[job->order[ii]].hasoutline)
+        placeglyph(job->clip ? cell : 0, &slots[job->order[ii]]);
+    }
+  }
+
+  TT_Close_Face(face);
+  TT_Done_FreeType(engine);
+  return;
+error_exit:
+  job->errors[index] = 1;
+  TT_Close_Face(face);
+  TT_Done_FreeType(engine);
+}
+
+static void renderglyphsjob(void *ptr, int index)
+{
+  RENDERJOB *job = ptr;
+  TT_Engine engine;
+  TT_Byte palette[5] = {0x00, 0x40, 0x80, 0xC0, 0xFF};
+  int Nslots = job->Nload * job->Npoints;
+  int i;
+
+  if (TT_Init_FreeType(&engine))
+  {
+    job->errors[index] = 1;
+    return;
+  }
+  TT_Set_Raster_Gray_Palette(engine, palette);
+  TT_Set_Raster_Coverage(engine, job->coverage);
+  for (i = index; i < Nslots; i += job->Njobs)
+  {
+    if (job->slots[i].hasoutline && renderglyph(engine, &job->slots[i]))
+    {
+      job->errors[index] = 1;
+      break;
+    }
+  }
+  TT_Done_FreeType(engine);
+}
+
+static int compcodeslots(const void *e1, const void *e2)
+{
+  const CODESLOT *a = e1;
+  const CODESLOT *b = e2;
+
+  return a->code - b->code;
+}
+
+/*
+  run jobs on the worker threads.
+  Returns: 0 on success, -1 if any job failed
+ */
+static int runrenderjobs(RENDERJOB *job, int Nitems, void (*fn)(void *ptr, int index))
+{
+  int i;
+  int error = 0;
+
+  job->Njobs = threadpool_Nthreads();
+  if (job->Njobs > Nitems)
+    job->Njobs = Nitems;
+  if (job->Njobs < 1)
+    job->Njobs = 1;
+  job->errors = calloc(job->Njobs, sizeof(int));
+  if (!job->errors)
+    return -1;
+
+  parallelfor(job->Njobs, job->Njobs, fn, job);
+
+  for (i = 0; i < job->Njobs; i++)
+    if (job->errors[i])
+      error = 1;
+  free(job->errors);
+  job->errors = 0;
+
+  return error ? -1 : 0;
+}
+
+/*
+  load, hint and render glyphs.
+  Params: fname - the font file
+          points - the font sizes
+          Npoints - number of sizes
+          glyphs - glyph indices to load (null means 0 to Nload-1)
+          glyphcodes - codes of the glyphs, -1 means don't render it
+            (null means render all, in order)
+          Nload - number of glyphs to load
+          coverage - anti-alias by exact area coverage, 256 levels,
+            instead of the 5 level palette
+          clip - clip the glyphs to the character cell
+  Returns: Nload slots for each size, 0 on fail.
+ */
+static RENDEREDGLYPH *renderglyphs(char *fname, const int *points, int Npoints, const TT_UShort *glyphs, const int *glyphcodes, int Nload, int coverage, int clip)
+{
+  RENDERJOB job;
+  CODESLOT *codeslots = 0;
+  int *order = 0;
+  int Nslots = Nload * Npoints;
+  int Norder = 0;
+  int n = 0;
   int i;
-  int x, y;
+
+  job.slots = calloc(Nslots > 0 ? Nslots : 1, sizeof(RENDEREDGLYPH));
+  order = malloc((Nload > 0 ? Nload : 1) * sizeof(int));
+  codeslots = malloc((Nload > 0 ? Nload : 1) * sizeof(CODESLOT));
+  if (!job.slots || !order || !codeslots)
+    goto error_exit;
+
+  /* the glyphs with codes are hinted first, in code order, then the rest */
+  for (i = 0; i < Nload; i++)
+  {
+    if (glyphcodes && glyphcodes[i] == -1)
+      continue;
+    codeslots[Norder].code = glyphcodes ? glyphcodes[i] : i;
+    codeslots[Norder].slot = i;
+    Norder++;
+  }
+  qsort(codeslots, Norder, sizeof(CODESLOT), compcodeslots);
+  for (i = 0; i < Norder; i++)
+    order[i] = codeslots[i].slot;
+  for (i = 0; i < Nload; i++)
+    if (glyphcodes && glyphcodes[i] == -1)
+      order[Norder + n++] = i;
+  free(codeslots);
+  codeslots = 0;
+
+  job.fname = fname;
+  job.points = points;
+  job.Npoints = Npoints;
+  job.glyphs = glyphs;
+  job.order = order;
+  job.Norder = Norder;
+  job.Nload = Nload;
+  job.coverage = coverage;
+  job.clip = clip;
+  if (runrenderjobs(&job, Npoints, hintglyphsjob))
+    goto error_exit;
+  if (runrenderjobs(&job, Nslots, renderglyphsjob))
+    goto error_exit;
+  free(order);
+
+  return job.slots;
+error_exit:
+  killrenderedglyphs(job.slots, Nslots);
+  free(order);
+  free(codeslots);
+  return 0;
+}
+
+/*
+  make a bitmap font from the rendered glyphs of one size.
+  Params: slots - the rendered glyphs
+          Nload - number of glyphs loaded
+          codes - the codes, in ascending order
+          Nglyphs - number of codes
+          slotindex - the slot for each code
+  Returns: the font, 0 on out of memory.
+ */
+static BITMAPFONT *buildfont(const RENDEREDGLYPH *slots, int Nload, const int *codes, int Nglyphs, const int *slotindex)
+{
+  BITMAPFONT *font;
+  const RENDEREDGLYPH *slot;
   int ascent, descent, maxwidth;
-  int *codes;
-  int *widths;
+  int width;
+  int i;
+
+  getascenderanddescender(slots, Nload, 1, &ascent, &descent, &maxwidth);
+  font = bitmapfont(Nglyphs, maxwidth, ascent + descent, ascent, descent);
+  if (!font)
+    return 0;
+
+  for(i=0;i<Nglyphs;i++)
+  {
+    slot = &slots[slotindex[i]];
+
+    width = (slot->advance + 31)/64;
+    if(width < 0)
+      width = 0;
+    if(width > maxwidth)
+      width = maxwidth;
+
+    if (slot->bitmap)
+    {
+      if (setglyphbox(font, i, codes[i], width, slot->bitmap, slot->width, slot->height, slot->stride, slot->x, ascent - slot->top))
+      {
+        killbitmapfont(font);
+        return 0;
+      }
+    }
+    else
+    {
+      font->glyphs[i].code = codes[i];
+      font->glyphs[i].advance = width;
+    }
+  }
+
+  return font;
+}
+
+static int floordiv(int a, int b)
+{
+  return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+static int ceildiv(int a, int b)
+{
+  return -floordiv(-a, b);
+}
+
+/*
+  make a signed distance field font from glyphs rendered SDF_SCALE
+  times larger than the font.
+  Params: as buildfont()
+          spread - distance in pixels covered by the field each side of the edge
+  Returns: the font, 0 on out of memory.
+  Notes: the cell has a margin of spread pixels all round.
+ */
+static BITMAPFONT *buildsdffont(const RENDEREDGLYPH *slots, int Nload, const int *codes, int Nglyphs, const int *slotindex, int spread)
+{
+  BITMAPFONT *font;
+  const RENDEREDGLYPH *slot;
+  unsigned char *field;
+  int ascent, descent, maxwidth;
+  int width;
+  int left, right, top, bottom;
+  int i;
+
+  getascenderanddescender(slots, Nload, SDF_SCALE, &ascent, &descent, &maxwidth);
+  font = bitmapfont(Nglyphs, maxwidth + 2 * spread, ascent + descent + 2 * spread, ascent + spread, descent + spread);
+  if (!font)
+    return 0;
+
+  for(i=0;i<Nglyphs;i++)
+  {
+    slot = &slots[slotindex[i]];
+
+    width = (slot->advance + 31*SDF_SCALE)/(64*SDF_SCALE);
+    if(width < 0)
+      width = 0;
+    if(width > maxwidth)
+      width = maxwidth;
+
+    font->glyphs[i].code = codes[i];
+    font->glyphs[i].advance = width;
+    if (!slot->bitmap)
+      continue;
+
+    /* the field covers the glyph and spread pixels round it */
+    left = floordiv(slot->x, SDF_SCALE) - spread;
+    right = ceildiv(slot->x + slot->width, SDF_SCALE) + spread;
+    top = ceildiv(slot->top, SDF_SCALE) + spread;
+    bottom = floordiv(slot->top - slot->height, SDF_SCALE) - spread;
+    field = distancefield(slot->bitmap, slot->width, slot->height, slot->stride,
+                          slot->x - left * SDF_SCALE, top * SDF_SCALE - slot->top,
+                          right - left, top - bottom, SDF_SCALE, spread);
+    if (!field)
+      goto out_of_memory;
+    if (setglyphbox(font, i, codes[i], width, field, right - left, top - bottom, right - left, left + spread, ascent + spread - top))
+    {
+      free(field);
+      goto out_of_memory;
+    }
+    free(field);
+  }
+
+  return font;
+out_of_memory:
+  killbitmapfont(font);
+  return 0;
+}
+
+/*
+  get the name of the font of one size. With several sizes the points
+  are appended to the name.
+ */
+static char *sizename(const char *name, int points, int Npoints)
+{
+  char *answer;
+
+  answer = malloc(strlen(name) + 12);
+  if (!answer)
+    return 0;
+  if (Npoints > 1)
+    sprintf(answer, "%s%d", name, points);
+  else
+    strcpy(answer, name);
+
+  return answer;
+}
+
+/*
+  a kerning pair as read from the kern table, by character index.
+ */
+typedef struct
+{
+  int left;             /* index of the first character */
+  int right;            /* index of the second character */
+  int kern;             /* adjustment in font units */
+  int override;         /* replaces the values of earlier subtables */
+  int seq;              /* position in the table, so later subtables win */
+} RAWKERNPAIR;
+
+static int getu16(const unsigned char *b)
+{
+  return (b[0] << 8) | b[1];
+}
+
+static long getu32(const unsigned char *b)
+{
+  return ((long) b[0] << 24) | ((long) b[1] << 16) | (b[2] << 8) | b[3];
+}
+
+static int compkernpairs(const void *e1, const void *e2)
+{
+  const RAWKERNPAIR *a = e1;
+  const RAWKERNPAIR *b = e2;
+
+  if (a->left != b->left)
+    return a->left - b->left;
+  if (a->right != b->right)
+    return a->right - b->right;
+  return a->seq - b->seq;
+}
+
+/*
+  add the pairs of characters with a kerned pair of glyphs.
+  Returns: 0 on success, -1 on out of memory.
+ */
+static int addkernpair(RAWKERNPAIR **raw, int *Nraw, int *capacity, const int *first, const int *next, int leftglyph, int rightglyph, int kern, int override)
+{
+  RAWKERNPAIR *temp;
+  int left, right;
+
+  for (left = first[leftglyph]; left != -1; left = next[left])
+  {
+    for (right = first[rightglyph]; right != -1; right = next[right])
+    {
+      if (*Nraw == *capacity)
+      {
+        temp = realloc(*raw, (*capacity * 2 + 64) * sizeof(RAWKERNPAIR));
+        if (!temp)
+          return -1;
+        *raw = temp;
+        *capacity = *capacity * 2 + 64;
+      }
+      (*raw)[*Nraw].left = left;
+      (*raw)[*Nraw].right = right;
+      (*raw)[*Nraw].kern = kern;
+      (*raw)[*Nraw].override = override;
+      (*raw)[*Nraw].seq = *Nraw;
+      (*Nraw)++;
+    }
+  }
+
+  return 0;
+}
+
+/*
+  get the kerning pairs of the characters we are ripping.
+  Params: face - the font face
+          glyphids - the glyph of each character
+          Nchars - number of characters
+          Nglyphs - number of glyphs in the face
+          pairsret - return for the pairs, sorted by left then right
+  Returns: number of pairs, -1 on out of memory.
+  Notes: reads the format 0 subtables of the kern table, Microsoft or
+    Apple style, which is all most fonts have. Fonts which kern only
+    in OpenType GPOS have no pairs.
+ */
+static int getkernpairs(TT_Face face, const int *glyphids, int Nchars, int Nglyphs, KERNPAIR **pairsret)
+{
+  TT_Long length = 0;
+  unsigned char *kern = 0;
+  int *first = 0;
+  int *next = 0;
+  RAWKERNPAIR *raw = 0;
+  KERNPAIR *pairs = 0;
+  int Nraw = 0;
+  int capacity = 0;
+  int N = 0;
+  int apple;
+  long Ntables;
+  long table;
+  long pos;
+  long data;
+  long sublength;
+  int headerlength;
+  int coverage;
+  int format;
+  int horizontal;
+  int override;
+  int Nsubpairs;
+  int leftglyph, rightglyph;
+  int value;
+  int i;
+
+  *pairsret = 0;
+  if (TT_Get_Font_Data(face, MAKE_TT_TAG('k', 'e', 'r', 'n'), 0, 0, &length) || length < 4)
+    return 0;
+  kern = malloc(length);
+  first = malloc((Nglyphs ? Nglyphs : 1) * sizeof(int));
+  next = malloc((Nchars ? Nchars : 1) * sizeof(int));
+  if (!kern || !first || !next)
+    goto out_of_memory;
+  if (TT_Get_Font_Data(face, MAKE_TT_TAG('k', 'e', 'r', 'n'), 0, kern, &length))
+    goto done;
+
+  /* the characters using each glyph, as a linked list */
+  for (i = 0; i < Nglyphs; i++)
+    first[i] = -1;
+  for (i = Nchars - 1; i >= 0; i--)
+  {
+    next[i] = -1;
+    if (glyphids[i] >= 0 && glyphids[i] < Nglyphs)
+    {
+      next[i] = first[glyphids[i]];
+      first[glyphids[i]] = i;
+    }
+  }
+
+  if (getu16(kern) == 0)
+  {
+    apple = 0;
+    Ntables = getu16(kern + 2);
+    pos = 4;
+  }
+  else if (getu16(kern) == 1 && length >= 8)
+  {
+    apple = 1;
+    Ntables = getu32(kern + 4);
+    pos = 8;
+  }
+  else
+    goto done;
+
+  for (table = 0; table < Ntables; table++)
+  {
+    if (apple)
+    {
+      if (pos + 8 > length)
+        break;
+      sublength = getu32(kern + pos);
+      coverage = getu16(kern + pos + 4);
+      headerlength = 8;
+      format = coverage & 0xFF;
+      /* not vertical, cross stream or a variation */
+      horizontal = (coverage & 0xE000) == 0;
+      override = 0;
+    }
+    else
+    {
+      if (pos + 6 > length)
+        break;
+      sublength = getu16(kern + pos + 2);
+      coverage = getu16(kern + pos + 4);
+      headerlength = 6;
+      format = coverage >> 8;
+      /* horizontal, and not minimum values or cross stream */
+      horizontal = (coverage & 0x07) == 0x01;
+      override = (coverage & 0x08) != 0;
+    }
+    if (format == 0 && pos + headerlength + 8 <= length)
+    {
+      Nsubpairs = getu16(kern + pos + headerlength);
+      data = pos + headerlength + 8;
+      if (data + Nsubpairs * 6L > length)
+        Nsubpairs = (int) ((length - data) / 6);
+      /* the 16 bit length overflows for big subtables */
+      if (!apple)
+        sublength = headerlength + 8 + Nsubpairs * 6L;
+      for (i = 0; horizontal && i < Nsubpairs; i++)
+      {
+        leftglyph = getu16(kern + data + i * 6);
+        rightglyph = getu16(kern + data + i * 6 + 2);
+        value = getu16(kern + data + i * 6 + 4);
+        if (value >= 0x8000)
+          value -= 0x10000;
+        if (leftglyph >= Nglyphs || rightglyph >= Nglyphs)
+          continue;
+        if (addkernpair(&raw, &Nraw, &capacity, first, next, leftglyph, rightglyph, value, override))
+          goto out_of_memory;
+      }
+    }
+    if (sublength <= 0)
+      break;
+    pos += sublength;
+  }
+
+  if (Nraw)
+  {
+    qsort(raw, Nraw, sizeof(RAWKERNPAIR), compkernpairs);
+    pairs = malloc(Nraw * sizeof(KERNPAIR));
+    if (!pairs)
+      goto out_of_memory;
+    for (i = 0; i < Nraw; i++)
+    {
+      if (N > 0 && pairs[N-1].left == raw[i].left && pairs[N-1].right == raw[i].right)
+        pairs[N-1].kern = raw[i].override ? raw[i].kern : pairs[N-1].kern + raw[i].kern;
+      else
+      {
+        pairs[N].left = raw[i].left;
+        pairs[N].right = raw[i].right;
+        pairs[N].kern = raw[i].kern;
+        N++;
+      }
+    }
+    /* drop the pairs which cancel out */
+    Nraw = N;
+    N = 0;
+    for (i = 0; i < Nraw; i++)
+      if (pairs[i].kern != 0)
+        pairs[N++] = pairs[i];
+  }
+
+done:
+  free(kern);
+  free(first);
+  free(next);
+  free(raw);
+  *pairsret = pairs;
+  return N;
+out_of_memory:
+  free(kern);
+  free(first);
+  free(next);
+  free(raw);
+  free(pairs);
+  return -1;
+}
+
+/*
+  write the fractional advances and the kerning of one size.
+  Params: fp - the output stream
+          face - the font face
+          fontname - name of the font of this size
+          pairsname - name the kerning pairs were written under
+          points - the size
+          widths - advance widths of all the glyphs, font units
+          glyphids - the glyph of each character
+          Nchars - number of characters
+          pairs - the kerning pairs, font units
+          Npairs - number of pairs
+  Returns: 0 on success, -1 on fail.
+ */
+static int dumpkerning(FILE *fp, TT_Face face, const char *fontname, const char *pairsname, int points, const TT_UShort *widths, const int *glyphids, int Nchars, const KERNPAIR *pairs, int Npairs)
+{
+  TT_Instance instance;
+  TT_Instance_Metrics metrics;
+  int *advances = 0;
+  int *kerns = 0;
+  long x;
+  int i;
+
+  if (TT_New_Instance(face, &instance))
+    return -1;
+  if (TT_Set_Instance_CharSize(instance, points * 64) ||
+      TT_Get_Instance_Metrics(instance, &metrics))
+    goto error_exit;
+
+  advances = malloc((Nchars ? Nchars : 1) * sizeof(int));
+  kerns = malloc((Npairs ? Npairs : 1) * sizeof(int));
+  if (!advances || !kerns)
+    goto error_exit;
+  /* the linearly scaled advances, unaffected by hinting */
+  for (i = 0; i < Nchars; i++)
+  {
+    x = TT_MulFix(widths[glyphids[i]], metrics.x_scale);
+    advances[i] = (int) (x < 0 ? 0 : x > 0xFFFF ? 0xFFFF : x);
+  }
+  for (i = 0; i < Npairs; i++)
+  {
+    x = TT_MulFix(pairs[i].kern, metrics.x_scale);
+    kerns[i] = (int) (x < -32768 ? -32768 : x > 32767 ? 32767 : x);
+  }
+  dumpfontkerning(fp, 0, fontname, pairsname, advances, Nchars, kerns, Npairs);
+
+  free(advances);
+  free(kerns);
+  TT_Done_Instance(instance);
+  return 0;
+error_exit:
+  free(advances);
+  free(kerns);
+  TT_Done_Instance(instance);
+  return -1;
+}
+
+/*
+  rip a true type font at several sizes.
+  Params: fname - the font file
+          header - write declarations for a header
+          name - font name
+          points - the sizes
+          Npoints - number of sizes
+          options - layout, subsetting and distance field options (may be null)
+          fp - the output stream
+  Returns: 0 on success, -1 on fail.
+  Notes: with more than one size, the fonts are called name followed by
+    the points, and share the index of codes, name_index. The lookup
+    table, if wanted, is name_lookup and is also shared, as are the
+    kerning pairs, name_kernpairs.
+ */
+int dumpttfsizes(char *fname, int header, char *name, const int *points, int Npoints, const FONTOPTIONS *options, FILE *fp)
+{
+  int major, minor;
+  TT_Engine engine;
+  TT_Face face;
+  TT_Face_Properties faceProperties;
+  TT_CharMap charmap;
+  TT_Error err;
+  int i;
+  int *codes = 0;
+  int *glyphcodes = 0;
+  int *slotindex = 0;
+  TT_UShort *glyphs = 0;
   int Nglyphs;
+  int Nload = 0;
+  int Nslots = 0;
+  int packed = options ? options->packed : 0;
+  int spread = options ? options->spread : 0;
+  int bpp = options && options->bpp ? options->bpp : 8;
+  int lookup = options ? options->lookup : 0;
+  int kerning = options ? options->kerning : 0;
+  int coverage = options ? options->coverage : 0;
+  int *glyphids = 0;
+  TT_UShort *widths = 0;
+  KERNPAIR *pairs = 0;
+  int Npairs = 0;
+  int *renderpoints = 0;
+  BITMAPFONT *font = 0;
+  RENDEREDGLYPH *slots = 0;
+  char *fontname = 0;
     
   if (header)
   {
-      fprintf(fp, "extern struct bitmap_font %s_font;\n", name);
-      return 0;
+    for (i = 0; i < Npoints; i++)
+    {
+      fontname = sizename(name, points[i], Npoints);
+      if (!fontname)
+        return -1;
+      if (spread)
+        dumpsdffont(fp, 1, fontname, 0, 0, 0, 0);
+      else if (bpp < 8)
+        dumpbitsfont(fp, 1, fontname, 0, 0, bpp);
+      else if (packed)
+        dumppackedfont(fp, 1, fontname, 0, 0);
+      else
+        dumpbitmapfont(fp, 1, fontname, 0, 0);
+      if (kerning)
+        dumpfontkerning(fp, 1, fontname, 0, 0, 0, 0, 0);
+      free(fontname);
+    }
+    if (lookup)
+      dumpfontlookup(fp, 1, name, 0, 0);
+    return 0;
+  }
+
+  /* distance fields need the glyphs at a high resolution */
+  renderpoints = malloc(Npoints * sizeof(int));
+  if (!renderpoints)
+  {
+    fprintf(stderr, "Out of memory\n");
+    return -1;
   }
+  for (i = 0; i < Npoints; i++)
+    renderpoints[i] = spread ? points[i] * SDF_SCALE : points[i];
 
   TT_FreeType_Version(&major, &minor);
   err = TT_Init_FreeType(&engine);
   if(err)
   {
     fprintf(stderr, "Can't initialise free type system\n");
+    free(renderpoints);
     return -1;
   }
  
-  TT_Set_Raster_Gray_Palette(engine, palette);
   err = TT_Open_Face(engine, fname, &face);
   if(err)
   {
     fprintf(stderr, "Can't open ttf file %s\n", fname);
+    free(renderpoints);
+    TT_Done_FreeType(engine);
     return -1;
   }
   TT_Get_Face_Properties(face, &faceProperties);
-  TT_New_Instance(face, &instance);
-  TT_Set_Instance_CharSize(instance, points*64);
-  TT_Get_Instance_Metrics(instance, &instanceMetrics);
   TT_Get_CharMap(face, getbestcharmap(face), &charmap);
-  codes = malloc(faceProperties.num_Glyphs * sizeof(int));
-  getcodes(charmap, faceProperties.num_Glyphs, codes);
-  qsort(codes, faceProperties.num_Glyphs, sizeof(int), compints);
-  for(i=0;i<faceProperties.num_Glyphs;i++)
-    if(codes[i] != -1)
-      break;
-  Nglyphs = faceProperties.num_Glyphs - i;
-  memmove(codes, codes+i, Nglyphs * sizeof(int));
-  widths = malloc(Nglyphs * sizeof(int));
-  TT_New_Glyph(face, &glyph);
-
-  getascenderanddescender(instance, glyph, faceProperties.num_Glyphs, &ascent, &descent, &maxwidth);
-  initrastermap(&map, (maxwidth+3)/4*4, ascent + descent, 1);
-
-  fprintf(fp, "\nstatic unsigned char %s_bitmap[%d] =\n", name,  Nglyphs* maxwidth * (ascent + descent) );
-  fprintf(fp, "{\n");
-  for(i=0;i<Nglyphs;i++)
+  if (options && options->chars)
   {
-    memset(map.bitmap, 0, map.size);
-    glyphIndex = TT_Char_Index(charmap, codes[i]);
-
-    TT_Load_Glyph(instance, glyph, glyphIndex, TTLOAD_SCALE_GLYPH | TTLOAD_HINT_GLYPH);
-    TT_Get_Glyph_Metrics(glyph, &glyphMetrics);
-
-    widths[i] = (glyphMetrics.advance + 31)/64;
-    if(widths[i] < 0)
-      widths[i] = 0;
-    if(widths[i] > maxwidth)
-      widths[i] = maxwidth;
-
-    // TT_Get_Glyph_Pixmap(glyph, &map, glyphMetrics.bearingX, descent * 64);
-    TT_Get_Glyph_Pixmap(glyph, &map, 0, descent * 64);
-    fprintf(fp, "/* glyph %d */\n", codes[i]);
-    for(y=0;y<ascent+descent;y++)
-    {
-      for(x=0;x<maxwidth;x++)
-        fprintf(fp, "0x%02x, ", ((unsigned char *)map.bitmap)[y * map.width + x]);
-      fprintf(fp, "\n");
-    }
-    fprintf(fp, "\n"); 
+    /* only load, hint and render the glyphs we need */
+    Nglyphs = getsubsetcodes(charmap, options->chars, options->Nchars, &codes, &glyphs);
+    if (Nglyphs < 0)
+      goto out_of_memory;
+    Nload = Nglyphs;
+    slotindex = malloc((Nglyphs ? Nglyphs : 1) * sizeof(int));
+    if (!slotindex)
+      goto out_of_memory;
+    for (i = 0; i < Nglyphs; i++)
+      slotindex[i] = i;
+    slots = renderglyphs(fname, renderpoints, Npoints, glyphs, 0, Nload, coverage, !spread);
   }
-  fprintf(fp, "};\n");
+  else
+  {
+    /* the metrics come from every glyph, but we only render the ones with codes */
+    Nload = faceProperties.num_Glyphs;
+    glyphcodes = malloc((Nload ? Nload : 1) * sizeof(int));
+    codes = malloc((Nload ? Nload : 1) * sizeof(int));
+    slotindex = malloc((Nload ? Nload : 1) * sizeof(int));
+    if (!glyphcodes || !codes || !slotindex)
+      goto out_of_memory;
+    getcodes(charmap, Nload, glyphcodes);
+    memcpy(codes, glyphcodes, Nload * sizeof(int));
+    qsort(codes, Nload, sizeof(int), compints);
+    for(i=0;i<Nload;i++)
+      if(codes[i] != -1)
+        break;
+    Nglyphs = Nload - i;
+    memmove(codes, codes+i, Nglyphs * sizeof(int));
+    for (i = 0; i < Nglyphs; i++)
+      slotindex[i] = TT_Char_Index(charmap, codes[i]);
+    slots = renderglyphs(fname, renderpoints, Npoints, 0, glyphcodes, Nload, coverage, !spread);
+  }
+  if (!slots)
+    goto out_of_memory;
+  Nslots = Nload * Npoints;
 
-  fprintf(fp, "static unsigned char %s_widths[%d] =\n", name,  Nglyphs);
-  fprintf(fp, "{\n");
-  for(i=0;i<Nglyphs;i++)
-    fprintf(fp, "%d,\n", widths[i]);
-  fprintf(fp, "};\n\n");
+  if (kerning)
+  {
+    glyphids = malloc((Nglyphs ? Nglyphs : 1) * sizeof(int));
+    widths = calloc(faceProperties.num_Glyphs ? faceProperties.num_Glyphs : 1, sizeof(TT_UShort));
+    if (!glyphids || !widths)
+      goto out_of_memory;
+    for (i = 0; i < Nglyphs; i++)
+      glyphids[i] = glyphs ? glyphs[slotindex[i]] : slotindex[i];
+    if (faceProperties.num_Glyphs)
+      TT_Get_Face_Metrics(face, 0, faceProperties.num_Glyphs - 1, 0, widths, 0, 0);
+    Npairs = getkernpairs(face, glyphids, Nglyphs, faceProperties.num_Glyphs, &pairs);
+    if (Npairs < 0)
+      goto out_of_memory;
+    dumpkernpairs(fp, name, pairs, Npairs);
+  }
 
-  fprintf(fp, "static unsigned short %s_index[%d] =\n", name,  Nglyphs);
-  fprintf(fp, "{\n");
-  for(i=0;i<Nglyphs;i++)
-    fprintf(fp, "%d,\n", codes[i]);
-  fprintf(fp, "};\n\n");
-
-  fprintf(fp, "struct bitmap_font %s_font = \n", name);
-  fprintf(fp, "{\n");
-  fprintf(fp, "%d, /* max width */\n", maxwidth);
-  fprintf(fp, "%d, /* height */\n", ascent + descent);
-  fprintf(fp, "%d, /* ascent */\n", ascent);
-  fprintf(fp, "%d, /* descent */\n", descent);
-  fprintf(fp, "%d, /* Nchars */\n", Nglyphs);
-  fprintf(fp, "%s_widths, /* widths */\n", name);
-  fprintf(fp, "%s_index, /* index */\n", name);
-  fprintf(fp, "%s_bitmap /* bitmap */\n", name);
-  fprintf(fp, "};\n");
-  fprintf(fp, "\n"); 
+  for (i = 0; i < Npoints; i++)
+  {
+    if (spread)
+      font = buildsdffont(slots + i * Nload, Nload, codes, Nglyphs, slotindex, spread);
+    else
+      font = buildfont(slots + i * Nload, Nload, codes, Nglyphs, slotindex);
+    fontname = sizename(name, points[i], Npoints);
+    if (!font || !fontname)
+      goto out_of_memory;
+    if (Npoints > 1 && i == 0)
+      dumpfontindex(fp, name, font, spread || bpp < 8 || packed);
+    if (lookup && i == 0 && dumpfontlookup(fp, 0, name, codes, Nglyphs) == -1)
+      goto out_of_memory;
+    if (spread)
+      dumpsdffont(fp, 0, fontname, Npoints > 1 ? name : 0, font, points[i], spread);
+    else if (bpp < 8)
+      dumpbitsfont(fp, 0, fontname, Npoints > 1 ? name : 0, font, bpp);
+    else if (packed)
+      dumppackedfont(fp, 0, fontname, Npoints > 1 ? name : 0, font);
+    else
+      dumpbitmapfont(fp, 0, fontname, Npoints > 1 ? name : 0, font);
+    if (kerning && dumpkerning(fp, face, fontname, name, points[i], widths, glyphids, Nglyphs, pairs, Npairs))
+      goto out_of_memory;
+    killbitmapfont(font);
+    font = 0;
+    free(fontname);
+    fontname = 0;
+  }
 
+  killrenderedglyphs(slots, Nslots);
+  free(renderpoints);
   free(codes);
+  free(glyphcodes);
+  free(slotindex);
+  free(glyphs);
+  free(glyphids);
   free(widths);
-  killrastermap(&map); 
-  TT_Done_Glyph(glyph);
+  free(pairs);
   TT_Close_Face(face);
   TT_Done_FreeType(engine);
 
   return 0;
+out_of_memory:
+  fprintf(stderr, "Out of memory\n");
+  killbitmapfont(font);
+  free(fontname);
+  killrenderedglyphs(slots, Nslots);
+  free(renderpoints);
+  free(codes);
+  free(glyphcodes);
+  free(slotindex);
+  free(glyphs);
+  free(glyphids);
+  free(widths);
+  free(pairs);
+  TT_Close_Face(face);
+  TT_Done_FreeType(engine);
+  return -1;
 }
 
+int dumpttf(char *fname, int header, char *name, int points, const FONTOPTIONS *options, FILE *fp)
+{
+  return dumpttfsizes(fname, header, name, &points, 1, options, fp);
+}
 
 static void usage(void)
 {
@@ -257,7 +1192,7 @@ int ttf2cmain(int argc, char **argv)
   if(argc != 4)
     usage();
   printf("#include \"font.h\"\n");
-  dumpttf(argv[1], 0, argv[2], atoi(argv[3]), stdout);
+  dumpttf(argv[1], 0, argv[2], atoi(argv[3]), 0, stdout);
 
   return 0;
 }
@@ -1,6 +1,9 @@
 #ifndef ttf2c_h
 #define ttf2c_h
 
-int dumpttf(char *fname, int header, char *name, int points, FILE *fp);
+#include "bitmapfont.h"
+
+int dumpttf(char *fname, int header, char *name, int points, const FONTOPTIONS *options, FILE *fp);
+int dumpttfsizes(char *fname, int header, char *name, const int *points, int Npoints, const FONTOPTIONS *options, FILE *fp);
 
 #endif
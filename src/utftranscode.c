@@ -0,0 +1,404 @@
+/*
+  utftranscode.c
+  conversions between UTF-8 and UTF-16
+
+  Most resource text is mostly ASCII, so each conversion first looks
+  for a run of ASCII, 16 bytes at a time by or-ing machine words
+  together and testing the top bits, and copies the run with a simple
+  loop. Only the other characters are decoded one at a time. The
+  decoders validate, so an overlong sequence, a surrogate encoded in
+  UTF-8, a code point over 0x10FFFF or an unpaired UTF-16 surrogate
+  is caught rather than passed on. Each conversion counts its output
+  first, so the result is allocated once at exactly the right size.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "utftranscode.h"
+
+#define ASCIIBLOCK 16
+
+static long asciirun(const unsigned char *str, long N);
+static long asciirun16(const unsigned char *str, long Nunits, int bigendian);
+static int decodeutf8(const unsigned char *str, long len, long *codepoint);
+static int encodeutf8(unsigned char *out, long ch);
+
+/*
+  test if a buffer is valid UTF-8
+  Params: utf8 - the text
+          len - number of bytes
+  Returns: 1 if valid, else 0
+ */
+int utf8_valid(const char *utf8, long len)
+{
+    const unsigned char *str = (const unsigned char *) utf8;
+    long pos = 0;
+    long ch;
+    int nb;
+
+    while (pos < len)
+    {
+        pos += asciirun(str + pos, len - pos);
+        if (pos == len)
+            break;
+        nb = decodeutf8(str + pos, len - pos, &ch);
+        if (ch < 0)
+            return 0;
+        pos += nb;
+    }
+
+    return 1;
+}
+
+/*
+  count the characters in a buffer of UTF-8
+  Params: utf8 - the text
+          len - number of bytes
+  Returns: the number of characters. An invalid byte counts as
+    one character.
+ */
+long utf8_Nchars(const char *utf8, long len)
+{
+    const unsigned char *str = (const unsigned char *) utf8;
+    long pos = 0;
+    long answer = 0;
+    long run;
+    long ch;
+
+    while (pos < len)
+    {
+        run = asciirun(str + pos, len - pos);
+        pos += run;
+        answer += run;
+        if (pos == len)
+            break;
+        pos += decodeutf8(str + pos, len - pos, &ch);
+        answer++;
+    }
+
+    return answer;
+}
+
+/*
+  convert UTF-16 to UTF-8
+  Params: utf16 - the UTF-16, as bytes, without a byte order marker
+          Nbytes - number of bytes
+          bigendian - set if the most significant byte comes first
+          error - return for error, 0 on success, -1 out of memory,
+            -2 bad UTF-16 (odd number of bytes or unpaired surrogate)
+  Returns: the UTF-8, nul-terminated, 0 on error
+ */
+char *utf16toutf8(const unsigned char *utf16, long Nbytes, int bigendian, int *error)
+{
+    long Nunits = Nbytes / 2;
+    long i;
+    long run;
+    long j;
+    long len = 0;
+    long unit, low;
+    long ch;
+    int pass;
+    int hi = bigendian ? 0 : 1;
+    int lo = bigendian ? 1 : 0;
+    unsigned char *answer = 0;
+
+    if (error)
+        *error = 0;
+    if (Nbytes & 1)
+        goto bad_utf16;
+
+    /* first pass counts the bytes, second writes them */
+    for (pass = 0; pass < 2; pass++)
+    {
+        if (pass == 1)
+        {
+            answer = malloc(len + 1);
+            if (!answer)
+            {
+                if (error)
+                    *error = -1;
+                return 0;
+            }
+            len = 0;
+        }
+        i = 0;
+        while (i < Nunits)
+        {
+            run = asciirun16(utf16 + i * 2, Nunits - i, bigendian);
+            if (answer)
+            {
+                for (j = 0; j < run; j++)
+                    answer[len + j] = utf16[(i + j) * 2 + lo];
+            }
+            len += run;
+            i += run;
+            if (i == Nunits)
+                break;
+            unit = utf16[i * 2 + hi] * 256 + utf16[i * 2 + lo];
+            i++;
+            if (unit >= 0xD800 && unit < 0xDC00)
+            {
+                if (i == Nunits)
+                    goto bad_utf16;
+                low = utf16[i * 2 + hi] * 256 + utf16[i * 2 + lo];
+                if (low < 0xDC00 || low >= 0xE000)
+                    goto bad_utf16;
+                i++;
+                ch = 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00);
+            }
+            else if (unit >= 0xDC00 && unit < 0xE000)
+                goto bad_utf16;
+            else
+                ch = unit;
+            if (answer)
+                len += encodeutf8(answer + len, ch);
+            else
+                len += ch < 0x800 ? 2 : ch < 0x10000 ? 3 : 4;
+        }
+    }
+    answer[len] = 0;
+
+    return (char *) answer;
+
+bad_utf16:
+    free(answer);
+    if (error)
+        *error = -2;
+    return 0;
+}
+
+/*
+  convert UTF-8 to UTF-16
+  Params: utf8 - the UTF-8, nul-terminated
+          allowsurrogatepairs - set to write code points over 0xFFFF
+            as surrogate pairs
+          error - return for error, 0 on success, -1 out of memory,
+            -2 if some characters couldn't be represented
+  Returns: the UTF-16, terminated by a 0, 0 on out of memory
+  Notes: code points over 0xFFFF without surrogate pairs, and
+    invalid UTF-8, are written as U+FFFD, the replacement character.
+ */
+unsigned short *utf8toutf16(const char *utf8, int allowsurrogatepairs, int *error)
+{
+    const unsigned char *str = (const unsigned char *) utf8;
+    long len = (long) strlen(utf8);
+    long pos;
+    long run;
+    long j;
+    long Nout = 0;
+    long ch;
+    int pass;
+    unsigned short *answer = 0;
+
+    if (error)
+        *error = 0;
+
+    for (pass = 0; pass < 2; pass++)
+    {
+        if (pass == 1)
+        {
+            answer = malloc((Nout + 1) * sizeof(unsigned short));
+            if (!answer)
+            {
+                if (error)
+                    *error = -1;
+                return 0;
+            }
+            Nout = 0;
+        }
+        pos = 0;
+        while (pos < len)
+        {
+            run = asciirun(str + pos, len - pos);
+            if (answer)
+            {
+                for (j = 0; j < run; j++)
+                    answer[Nout + j] = str[pos + j];
+            }
+            Nout += run;
+            pos += run;
+            if (pos == len)
+                break;
+            pos += decodeutf8(str + pos, len - pos, &ch);
+            if (ch > 0xFFFF && allowsurrogatepairs)
+            {
+                if (answer)
+                {
+                    answer[Nout] = (unsigned short) (0xD800 | ((ch - 0x10000) >> 10));
+                    answer[Nout+1] = (unsigned short) (0xDC00 | (ch & 0x03FF));
+                }
+                Nout += 2;
+            }
+            else
+            {
+                if (ch < 0 || ch > 0xFFFF)
+                {
+                    if (error)
+                        *error = -2;
+                    ch = 0xFFFD;
+                }
+                if (answer)
+                    answer[Nout] = (unsigned short) ch;
+                Nout++;
+            }
+        }
+    }
+    answer[Nout] = 0;
+
+    return answer;
+}
+
+/*
+  the length of the run of ASCII at the start of a buffer
+ */
+static long asciirun(const unsigned char *str, long N)
+{
+    unsigned long words[ASCIIBLOCK / sizeof(unsigned long)];
+    unsigned long highbits = ((unsigned long) -1 / 0xFF) * 0x80;
+    unsigned long bits;
+    long i = 0;
+    int j;
+
+    while (i + ASCIIBLOCK <= N)
+    {
+        memcpy(words, str + i, ASCIIBLOCK);
+        bits = 0;
+        for (j = 0; j < (int) (ASCIIBLOCK / sizeof(unsigned long)); j++)
+            bits |= words[j];
+        if (bits & highbits)
+            break;
+        i += ASCIIBLOCK;
+    }
+    while (i < N && str[i] < 0x80)
+        i++;
+
+    return i;
+}
+
+/*
+  the length of the run of ASCII at the start of a buffer of UTF-16,
+  in units. The high bytes must be zero and the low bytes below 0x80,
+  so we test a block against a mask of the bits which must be clear.
+ */
+static long asciirun16(const unsigned char *str, long Nunits, int bigendian)
+{
+    unsigned long words[ASCIIBLOCK / sizeof(unsigned long)];
+    unsigned long mask[ASCIIBLOCK / sizeof(unsigned long)];
+    unsigned char maskbytes[ASCIIBLOCK];
+    unsigned long bits;
+    long i = 0;
+    int j;
+
+    for (j = 0; j < ASCIIBLOCK; j += 2)
+    {
+        maskbytes[j] = bigendian ? 0xFF : 0x80;
+        maskbytes[j+1] = bigendian ? 0x80 : 0xFF;
+    }
+    memcpy(mask, maskbytes, ASCIIBLOCK);
+
+    while ((i + ASCIIBLOCK / 2) <= Nunits)
+    {
+        memcpy(words, str + i * 2, ASCIIBLOCK);
+        bits = 0;
+        for (j = 0; j < (int) (ASCIIBLOCK / sizeof(unsigned long)); j++)
+            bits |= words[j] & mask[j];
+        if (bits)
+            break;
+        i += ASCIIBLOCK / 2;
+    }
+    if (bigendian)
+    {
+        while (i < Nunits && str[i*2] == 0 && str[i*2+1] < 0x80)
+            i++;
+    }
+    else
+    {
+        while (i < Nunits && str[i*2+1] == 0 && str[i*2] < 0x80)
+            i++;
+    }
+
+    return i;
+}
+
+/*
+  decode one UTF-8 character, validating it
+  Params: str - the text
+          len - bytes available
+          codepoint - return for the code point, -1 if invalid
+  Returns: the number of bytes used, 1 for an invalid byte
+ */
+static int decodeutf8(const unsigned char *str, long len, long *codepoint)
+{
+    long ch;
+    long min;
+    int nb;
+    int i;
+
+    *codepoint = -1;
+    if (str[0] < 0x80)
+    {
+        *codepoint = str[0];
+        return 1;
+    }
+    else if ((str[0] & 0xE0) == 0xC0)
+    {
+        nb = 2;
+        ch = str[0] & 0x1F;
+        min = 0x80;
+    }
+    else if ((str[0] & 0xF0) == 0xE0)
+    {
+        nb = 3;
+        ch = str[0] & 0x0F;
+        min = 0x800;
+    }
+    else if ((str[0] & 0xF8) == 0xF0)
+    {
+        nb = 4;
+        ch = str[0] & 0x07;
+        min = 0x10000;
+    }
+    else
+        return 1;
+
+    if (nb > len)
+        return 1;
+    for (i = 1; i < nb; i++)
+    {
+        if ((str[i] & 0xC0) != 0x80)
+            return 1;
+        ch = (ch << 6) | (str[i] & 0x3F);
+    }
+    if (ch < min || ch > 0x10FFFF || (ch >= 0xD800 && ch < 0xE000))
+        return 1;
+    *codepoint = ch;
+
+    return nb;
+}
+
+static int encodeutf8(unsigned char *out, long ch)
+{
+    if (ch < 0x80)
+    {
+        out[0] = (unsigned char) ch;
+        return 1;
+    }
+    else if (ch < 0x800)
+    {
+        out[0] = (unsigned char) ((ch >> 6) | 0xC0);
+        out[1] = (unsigned char) ((ch & 0x3F) | 0x80);
+        return 2;
+    }
+    else if (ch < 0x10000)
+    {
+        out[0] = (unsigned char) ((ch >> 12) | 0xE0);
+        out[1] = (unsigned char) (((ch >> 6) & 0x3F) | 0x80);
+        out[2] = (unsigned char) ((ch & 0x3F) | 0x80);
+        return 3;
+    }
+    out[0] = (unsigned char) ((ch >> 18) | 0xF0);
+    out[1] = (unsigned char) (((ch >> 12) & 0x3F) | 0x80);
+    out[2] = (unsigned char) (((ch >> 6) & 0x3F) | 0x80);
+    out[3] = (unsigned char) ((ch & 0x3F) | 0x80);
+    return 4;
+}
@@ -0,0 +1,9 @@
+#ifndef utftranscode_h
+#define utftranscode_h
+
+int utf8_valid(const char *utf8, long len);
+long utf8_Nchars(const char *utf8, long len);
+char *utf16toutf8(const unsigned char *utf16, long Nbytes, int bigendian, int *error);
+unsigned short *utf8toutf16(const char *utf8, int allowsurrogatepairs, int *error);
+
+#endif
@@ -3,24 +3,32 @@
 #include <stdlib.h>
 
 #include "wavfile.h"
+#include "pcmsamples.h"
+
+#define WAVE_FORMAT_PCM 1
+#define WAVE_FORMAT_IEEE_FLOAT 3
+#define WAVE_FORMAT_EXTENSIBLE 0xFFFE
 
 typedef struct
 {
    int formattype;
    int numchannels;
    long samplerate;
+   int blockalign;
    int bitspersample;
-   long datasize;
+   unsigned long datasize;
 } WAVHEADER;
 
 static int loadheader(FILE *fp, WAVHEADER *header);
 static int saveheader(FILE *fp, long samplerate, int Nchannels, long 
 Nsamples);
-static short *load8bitpcm(FILE *fp, long N);
-static short *load16bitpcm(FILE *fp, long N);
+static int loadformat(FILE *fp, WAVHEADER *header, unsigned long fmtsize);
+static int getsampleformat(WAVHEADER *header, int *format, int *bytes);
+static int skipbytes(FILE *fp, unsigned long N);
 static void fput32le(long x, FILE *fp);
 static void fput16le(int x, FILE *fp);
 static long fget32le(FILE *fp);
+static unsigned long fgetu32le(FILE *fp);
 static int fget16le(FILE *fp);
 
 short *loadwav(const char *fname, long *samplerate, int *Nchannels, long 
@@ -61,30 +69,22 @@ short *floadwav(FILE *fp, long *samplerate, int *Nchannels, long
    WAVHEADER header;
    short *answer = 0;
    long N;
+   int bytes;
+   int format;
    int err;
 
    err = loadheader(fp, &header);
    if (err == -1)
      goto error_exit;
+   if (getsampleformat(&header, &format, &bytes))
+     goto error_exit;
 
-   if (header.bitspersample == 8)
-   {
-      N = header.datasize;
-      answer =load8bitpcm(fp, N);
-      if (!answer)
-        goto error_exit;
-   }
-   else if (header.bitspersample == 16)
-   {
-     N = header.datasize / 2;
-     answer = load16bitpcm(fp, N);
-     if (!answer)
-       goto error_exit;
-   }
-   else
+   N = (long) (header.datasize / (header.numchannels * bytes)) * header.numchannels;
+   answer = malloc((N ? N : 1) * sizeof(short));
+   if (!answer)
      goto error_exit;
-   
-   if (header.numchannels <= 0)
+   err = freadpcmsamples(fp, answer, N, format, bytes, 0);
+   if (err)
      goto error_exit;
 
    if (samplerate)
@@ -110,6 +110,36 @@ short *floadwav(FILE *fp, long *samplerate, int *Nchannels, long
    
 }
 
+/*
+  Load a wav file, passing the samples to a callback a block at a time.
+  Params: fname - the file name
+          callback - called with each block of interleaved pcm, return
+                     non-zero to abandon loading
+          ptr - context pointer passed to the callback
+  Returns: 0 on success, -1 on error.
+  Notes: only a block of the file is held in memory at once.
+ */
+int loadwavstream(const char *fname, int (*callback)(void *ptr, const short *pcm, long samplerate, int Nchannels, long Nsamples), void *ptr)
+{
+   FILE *fp;
+   WAVHEADER header;
+   int bytes;
+   int format;
+   int answer = -1;
+
+   fp = fopen(fname, "rb");
+   if (!fp)
+     return -1;
+   if (loadheader(fp, &header) == 0 && getsampleformat(&header, &format, &bytes) == 0)
+   {
+     answer = streampcmsamples(fp, (long) (header.datasize / (header.numchannels * bytes)),
+        header.numchannels, format, bytes, 0, header.samplerate, callback, ptr);
+   }
+   fclose(fp);
+
+   return answer;
+}
+
 int savewav(const char *fname, const short *pcm, long 
 samplerate, int Nchannels, 
 long Nsamples)
@@ -147,35 +177,120 @@ Nchannels, long Nsamples)
    return 0;
 }
 
+/*
+  Walk the chunks up to the sample data, picking up the format on the
+  way. Anything else, such as LIST or fact chunks, is skipped.
+ */
 static int loadheader(FILE *fp, WAVHEADER *header)
 {
    char chunk[4];
-   long size;
-   long fmtsize;
+   unsigned long size;
+   int hasformat = 0;
 
-   fread(chunk, 4, 1, fp);
+   memset(header, 0, sizeof(WAVHEADER));
+   if (fread(chunk, 4, 1, fp) != 1)
+     return -1;
    if (strncmp(chunk, "RIFF", 4) != 0)
      return -1;
-   size = fget32le(fp);
-   fread(chunk, 4, 1, fp);
+   fget32le(fp);
+   if (fread(chunk, 4, 1, fp) != 1)
+     return -1;
    if (strncmp(chunk, "WAVE", 4) != 0)
      return -1;
-    fread(chunk, 4, 1, fp);
-    if (strncmp(chunk, "fmt", 3) != 0)
-      return -1;
-    fmtsize = fget32le(fp);;
-    header->formattype = fget16le(fp);
-    header->numchannels = fget16le(fp);
-    header->samplerate = fget32le(fp);
-    fget32le(fp);
-    fget16le(fp);
-    header->bitspersample = fget16le(fp);
-    fread(chunk, 4, 1, fp);
-    if (strncmp(chunk, "data", 4) != 0)
+
+   while (1)
+   {
+      if (fread(chunk, 4, 1, fp) != 1)
+        return -1;
+      size = fgetu32le(fp);
+      if (feof(fp))
+        return -1;
+      if (strncmp(chunk, "fmt ", 4) == 0)
+      {
+         if (loadformat(fp, header, size))
+           return -1;
+         hasformat = 1;
+      }
+      else if (strncmp(chunk, "data", 4) == 0)
+      {
+         if (!hasformat)
+           return -1;
+         header->datasize = size;
+         return 0;
+      }
+      else if (skipbytes(fp, size + (size & 1)))
+        return -1;
+   }
+}
+
+/*
+  Read the fmt chunk. WAVE_FORMAT_EXTENSIBLE, used for more than two
+  channels or more than 16 bits, keeps the real format in the first 
+  two bytes of the sub-format GUID.
+ */
+static int loadformat(FILE *fp, WAVHEADER *header, unsigned long fmtsize)
+{
+   unsigned long Nread = 16;
+
+   if (fmtsize < 16)
+     return -1;
+   header->formattype = fget16le(fp) & 0xFFFF;
+   header->numchannels = fget16le(fp);
+   header->samplerate = fget32le(fp);
+   fget32le(fp);
+   header->blockalign = fget16le(fp);
+   header->bitspersample = fget16le(fp);
+   if (header->formattype == WAVE_FORMAT_EXTENSIBLE)
+   {
+      if (fmtsize < 26)
+        return -1;
+      fget16le(fp);
+      fget16le(fp);
+      fget32le(fp);
+      header->formattype = fget16le(fp) & 0xFFFF;
+      Nread = 26;
+   }
+   if (feof(fp))
+     return -1;
+
+   return skipbytes(fp, fmtsize - Nread + (fmtsize & 1));
+}
+
+/*
+  Get the sample format and bytes per sample from the header.
+  Returns: 0 on success, -1 if the format is not supported.
+ */
+static int getsampleformat(WAVHEADER *header, int *format, int *bytes)
+{
+   if (header->numchannels <= 0)
+     return -1;
+   *bytes = (header->bitspersample + 7) / 8;
+   if (header->formattype == WAVE_FORMAT_PCM)
+     *format = *bytes == 1 ? PCM_UNSIGNED : PCM_SIGNED;
+   else if (header->formattype == WAVE_FORMAT_IEEE_FLOAT)
+     *format = PCM_FLOAT;
+   else
+     return -1;
+   /* samples are padded to the block, e.g. 24 bits in a 32 bit slot */
+   if (header->blockalign >= header->numchannels * *bytes && 
+       header->blockalign % header->numchannels == 0)
+     *bytes = header->blockalign / header->numchannels;
+   if (*bytes <= 0)
+     return -1;
+
+   return 0;
+}
+
+static int skipbytes(FILE *fp, unsigned long N)
+{
+   if (N == 0)
+     return 0;
+   if (N < 0x7FFFFFFF && fseek(fp, (long) N, SEEK_CUR) == 0)
+     return 0;
+   while (N--)
+     if (fgetc(fp) == EOF)
        return -1;
-    header->datasize = fget32le(fp);
-   
-    return 0;
+   return 0;
 }
 
 static int saveheader(FILE *fp, long samplerate, int Nchannels, long 
@@ -204,44 +319,6 @@ Nsamples)
    return 0;   
 }
 
-static short *load8bitpcm(FILE *fp, long N)
-{
-  long i;
-  short *answer;
-
-  answer = malloc(N * sizeof(short));
-  if (!answer)
-    return 0;
-  for (i = 0; i < N; i++)
-    answer[i] = (fgetc(fp) - 128) * 256;
-  if (feof(fp))
-  {
-     free(answer);
-     return 0;
-  } 
-
-  return answer;
-}
-
-static short *load16bitpcm(FILE *fp, long N)
-{
-   long i;
-   short *answer;
-
-   answer = malloc(N * sizeof(short));
-   if (!answer)
-      return 0;
-   for (i = 0;i < N; i++)
-     answer[i] = fget16le(fp);
-   if (feof(fp))
-   {
-      free(answer);
-      return 0;
-   }
-
-   return answer;
-}
-
 static void fput32le(long x, FILE *fp)
 {
   fputc(x & 0xFF, fp);
@@ -268,6 +345,17 @@ static long fget32le(FILE *fp)
 * 256 + c1; 
 }
 
+static unsigned long fgetu32le(FILE *fp)
+{
+   unsigned long c1, c2, c3, c4;
+
+   c1 = fgetc(fp);
+   c2 = fgetc(fp);
+   c3 = fgetc(fp);
+   c4 = fgetc(fp);
+   return ((c4 & 0xFF) << 24) | ((c3 & 0xFF) << 16) | ((c2 & 0xFF) << 8) | (c1 & 0xFF);
+}
+
 static int fget16le(FILE *fp)
 {
 	int c1, c2;
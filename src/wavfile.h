@@ -5,6 +5,7 @@
 
 short *loadwav(const char *fname, long *samplerate, int *Nchannels, long 
 *Nsamples);
+int loadwavstream(const char *fname, int (*callback)(void *ptr, const short *pcm, long samplerate, int Nchannels, long Nsamples), void *ptr);
 int savewav(const char *fname, const short *pcm, long samplerate, int 
 Nchannels, long Nsamples);
 short *floadwav(FILE *fp, long *samplerate, int *Nchannels, long 
@@ -9,6 +9,8 @@
 #include <stdarg.h>
 #include <ctype.h>
 
+#include "utftranscode.h"
+
 #define MAXRECURSIONLIMIT 100
 
 
@@ -41,12 +43,6 @@ struct strbuff
     int pos;
 };
 
-struct utf16buff
-{
-    char rack[8];
-    int pos;
-    FILE *fp;
-};
 
 typedef struct
 {
@@ -92,9 +88,8 @@ typedef struct lexer
 
 static int textencoding(FILE *fp);
 static int fileaccess(void *ptr);
-static int utf16accessbe(void *ptr);
-static int utf16accessle(void *ptr);
-static int bbx_utf8_putch(char *out, int ch);
+static char *readutf16(FILE *fp, int bigendian);
+static int utf8access(void *ptr);
 static int stringaccess(void *ptr);
 
 void killxmlnode(XMLNODE *node);
@@ -147,7 +142,8 @@ XMLDOC *loadxmldoc(const char *filename,char *errormessage, int Nerr)
    LEXER lexer;
    XMLDOC *answer = 0;
     int encoding;
-    struct utf16buff utf16buf = {0};
+    struct strbuff utf8buf;
+    char *utf8 = 0;
     
     initerror(&error);
 
@@ -167,19 +163,23 @@ XMLDOC *loadxmldoc(const char *filename,char *errormessage, int Nerr)
       {
           initlexer(&lexer, &error, fileaccess, fp);
       }
-      else if (encoding == FMT_UTF16BE)
+      else if (encoding == FMT_UTF16BE || encoding == FMT_UTF16LE)
       {
-          utf16buf.fp  = fp;
-          initlexer(&lexer, &error, utf16accessbe, &utf16buf);
+          utf8 = readutf16(fp, encoding == FMT_UTF16BE);
+          if (!utf8)
+          {
+              snprintf(errormessage, Nerr, "Bad UTF-16 in %s", filename);
+              fclose(fp);
+              return 0;
+          }
+          utf8buf.str = utf8;
+          utf8buf.pos = 0;
+          initlexer(&lexer, &error, utf8access, &utf8buf);
       }
-       else if (encoding == FMT_UTF16LE)
-       {
-           utf16buf.fp = fp;
-           initlexer(&lexer, &error, utf16accessle, &utf16buf);
-       }
        else
        {
            snprintf(errormessage, Nerr, "Can't determine text format of %s", filename);
+           fclose(fp);
            return 0;
        }
        
@@ -188,6 +188,8 @@ XMLDOC *loadxmldoc(const char *filename,char *errormessage, int Nerr)
       {
          snprintf(errormessage, Nerr, "%s", error.message);
       }
+      free(utf8);
+      fclose(fp);
       return answer;
    }   
 }
@@ -198,7 +200,8 @@ XMLDOC *floadxmldoc(FILE *fp, char *errormessage, int Nerr)
     LEXER lexer;
     XMLDOC *answer = 0;
     int encoding;
-    struct utf16buff utf16buf = {0};
+    struct strbuff utf8buf;
+    char *utf8 = 0;
 
     initerror(&error);
 
@@ -210,16 +213,18 @@ XMLDOC *floadxmldoc(FILE *fp, char *errormessage, int Nerr)
     {
         initlexer(&lexer, &error, fileaccess, fp);
     }
-    else if (encoding == FMT_UTF16BE)
+    else if (encoding == FMT_UTF16BE || encoding == FMT_UTF16LE)
     {
-        utf16buf.fp  = fp;
-        initlexer(&lexer, &error, utf16accessbe, &utf16buf);
+        utf8 = readutf16(fp, encoding == FMT_UTF16BE);
+        if (!utf8)
+        {
+            snprintf(errormessage, Nerr, "Bad UTF-16 in stream");
+            return 0;
+        }
+        utf8buf.str = utf8;
+        utf8buf.pos = 0;
+        initlexer(&lexer, &error, utf8access, &utf8buf);
     }
-     else if (encoding == FMT_UTF16LE)
-     {
-         utf16buf.fp = fp;
-         initlexer(&lexer, &error, utf16accessle, &utf16buf);
-     }
      else
      {
          snprintf(errormessage, Nerr, "Can't determine text format of stream");
@@ -231,6 +236,7 @@ XMLDOC *floadxmldoc(FILE *fp, char *errormessage, int Nerr)
     {
        snprintf(errormessage, Nerr, "%s", error.message);
     }
+    free(utf8);
        
     return answer;
 }
@@ -265,7 +271,7 @@ static int textencoding(FILE *fp)
             ch1 = fgetc(fp);
             ch2 = fgetc(fp);
         }
-        if (ch1 == '<' && ch2 == '0')
+        if (ch1 == '<' && ch2 == 0)
             return FMT_UTF16LE;
         else
             return FMT_UNKNOWN;
@@ -348,89 +354,56 @@ static int fileaccess(void *ptr)
    return fgetc(fp);
 }
 
-static int utf16accessbe(void *ptr)
-{
-    struct utf16buff *up = ptr;
-    int Nchars;
-    int wch;
-    int ch;
-    
-    if (up->rack[up->pos])
-        return up->rack[up->pos++];
-    else {
-        wch = fgetc(up->fp);
-        if (wch == EOF)
-            return EOF;
-        wch *= 256;
-        ch = fgetc(up->fp);
-        if (ch == EOF)
-            return EOF;
-        wch |= ch;
-        Nchars = bbx_utf8_putch(up->rack, wch);
-        up->rack[Nchars] = 0;
-        up->pos = 0;
-        return up->rack[up->pos++];
-    }
-    
-}
-
-static int utf16accessle(void *ptr)
-{
-    struct utf16buff *up = ptr;
-    int Nchars;
-    int wch;
-    int ch;
-    
-    if (up->rack[up->pos])
-        return up->rack[up->pos++];
-    else {
-        wch = fgetc(up->fp);
-        if (wch == EOF)
-            return EOF;
-        ch = fgetc(up->fp);
-        if (ch == EOF)
-            return EOF;
-        wch |= (ch * 256);
-        Nchars = bbx_utf8_putch(up->rack, wch);
-        up->rack[Nchars] = 0;
-        up->pos = 0;
-        return up->rack[up->pos++];
+/*
+  read the rest of a UTF-16 stream, after the first '<', and
+  convert it to UTF-8 in one go
+ */
+static char *readutf16(FILE *fp, int bigendian)
+{
+    unsigned char *buff;
+    unsigned char *temp;
+    char *answer;
+    size_t capacity = 64 * 1024;
+    size_t N = 0;
+    size_t Nread;
+    int error;
+    
+    buff = malloc(capacity);
+    if (!buff)
+        return 0;
+    while ((Nread = fread(buff + N, 1, capacity - N, fp)) > 0)
+    {
+        N += Nread;
+        if (N == capacity)
+        {
+            temp = realloc(buff, capacity * 2);
+            if (!temp)
+            {
+                free(buff);
+                return 0;
+            }
+            buff = temp;
+            capacity *= 2;
+        }
     }
+    answer = utf16toutf8(buff, (long) N, bigendian, &error);
+    free(buff);
     
+    return answer;
 }
 
-static int bbx_utf8_putch(char *out, int ch)
+/*
+  like stringaccess, but returns bytes 0-255 as fgetc does
+ */
+static int utf8access(void *ptr)
 {
-  char *dest = out;
-  if (ch < 0x80)
-  {
-     *dest++ = (char)ch;
-  }
-  else if (ch < 0x800)
-  {
-    *dest++ = (ch>>6) | 0xC0;
-    *dest++ = (ch & 0x3F) | 0x80;
-  }
-  else if (ch < 0x10000)
-  {
-     *dest++ = (ch>>12) | 0xE0;
-     *dest++ = ((ch>>6) & 0x3F) | 0x80;
-     *dest++ = (ch & 0x3F) | 0x80;
-  }
-  else if (ch < 0x110000)
-  {
-     *dest++ = (ch>>18) | 0xF0;
-     *dest++ = ((ch>>12) & 0x3F) | 0x80;
-     *dest++ = ((ch>>6) & 0x3F) | 0x80;
-     *dest++ = (ch & 0x3F) | 0x80;
-  }
-  else
-    return 0;
-  return dest - out;
+    struct strbuff *s = ptr;
+    if (s->str[s->pos])
+        return (unsigned char) s->str[s->pos++];
+    else
+        return EOF;
 }
 
-
-
 XMLDOC *xmldocfromstring(const char *str,char *errormessage, int Nerr)
 {
    ERROR error;